@@ -0,0 +1,200 @@
+/****************************************************
+ * 2016-2025 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include "bvh.h"
+
+/**
+ * @fn	BVH::BVH()
+ * @brief	Constructs an empty hierarchy.
+ */
+
+BVH::BVH() {
+	rebuildThreshold = 1.5;
+	buildCount = 0;
+	refitCount = 0;
+	builtCost = 0.0;
+	currentCost = 0.0;
+}
+
+/**
+ * @fn	double BVH::surfaceArea(const AABB& box)
+ * @brief	Surface area of a box, the usual measure of how likely a ray is to enter it.
+ * @param	box	The box.
+ * @return	The surface area.
+ */
+
+double BVH::surfaceArea(const AABB& box) {
+	dvec3 e = box.extent();
+	return 2.0 * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+/**
+ * @fn	void BVH::build(const vector<AABB>& objectBounds)
+ * @brief	Builds the tree from scratch. Objects are split recursively at the median
+ * 			centroid along the widest axis of their centroids.
+ * @param	objectBounds	The bounds of each object.
+ */
+
+void BVH::build(const vector<AABB>& objectBounds) {
+	const int N = (int)objectBounds.size();
+	bounds.resize(N);
+	leafOfObject.assign(N, -1);
+	objectOrder.clear();
+	unboundedObjects.clear();
+	dirtyObjects.clear();
+	nodes.clear();
+
+	for (int i = 0; i < N; i++) {
+		if (objectBounds[i].isBounded() && !objectBounds[i].isEmpty()) {
+			dvec3 pad(BVH_BOUNDS_PADDING * (1.0 + glm::length(objectBounds[i].extent())));
+			bounds[i] = AABB(objectBounds[i].lo - pad, objectBounds[i].hi + pad);
+			objectOrder.push_back(i);
+		} else {
+			bounds[i] = AABB::infinite();
+			unboundedObjects.push_back(i);
+		}
+	}
+
+	builtCost = 0.0;
+	if (!objectOrder.empty()) {
+		nodes.reserve(2 * objectOrder.size());
+		buildNode(0, (int)objectOrder.size(), -1);
+		for (const BVHNode& node : nodes) {
+			builtCost += surfaceArea(node.bounds);
+		}
+	}
+	currentCost = builtCost;
+	buildCount++;
+}
+
+/**
+ * @fn	int BVH::buildNode(int first, int last, int parent)
+ * @brief	Builds the subtree holding objectOrder[first, last).
+ * @param	first 	First entry.
+ * @param	last  	One past the last entry.
+ * @param	parent	Index of the parent node.
+ * @return	Index of the new node.
+ */
+
+int BVH::buildNode(int first, int last, int parent) {
+	int index = (int)nodes.size();
+	nodes.push_back(BVHNode());
+	nodes[index].parent = parent;
+
+	AABB box, centroids;
+	for (int k = first; k < last; k++) {
+		box.expand(bounds[objectOrder[k]]);
+		centroids.expand(bounds[objectOrder[k]].center());
+	}
+	nodes[index].bounds = box;
+
+	if (last - first <= BVH_MAX_LEAF_SIZE) {
+		nodes[index].first = first;
+		nodes[index].count = last - first;
+		for (int k = first; k < last; k++) {
+			leafOfObject[objectOrder[k]] = index;
+		}
+		return index;
+	}
+
+	dvec3 spread = centroids.extent();
+	int axis = (spread.x >= spread.y && spread.x >= spread.z) ? 0 : (spread.y >= spread.z ? 1 : 2);
+	int middle = (first + last) / 2;
+	std::nth_element(objectOrder.begin() + first, objectOrder.begin() + middle,
+		objectOrder.begin() + last, [&](int a, int b) {
+			double ca = bounds[a].center()[axis];
+			double cb = bounds[b].center()[axis];
+			return ca < cb || (ca == cb && a < b);
+		});
+
+	int left = buildNode(first, middle, index);
+	int right = buildNode(middle, last, index);
+	nodes[index].left = left;
+	nodes[index].right = right;
+	nodes[index].axis = axis;
+	return index;
+}
+
+/**
+ * @fn	void BVH::markDirty(int object)
+ * @brief	Records that an object has moved. Nothing is updated until refit is called.
+ * @param	object	Index of the object.
+ */
+
+void BVH::markDirty(int object) {
+	dirtyObjects.push_back(object);
+}
+
+/**
+ * @fn	void BVH::refitNode(int node)
+ * @brief	Recomputes the bounds of a node from its children or objects.
+ * @param	node	Index of the node.
+ */
+
+void BVH::refitNode(int node) {
+	BVHNode& N = nodes[node];
+	AABB box;
+	if (N.isLeaf()) {
+		for (int k = N.first; k < N.first + N.count; k++) {
+			box.expand(bounds[objectOrder[k]]);
+		}
+	} else {
+		box.expand(nodes[N.left].bounds);
+		box.expand(nodes[N.right].bounds);
+	}
+	currentCost += surfaceArea(box) - surfaceArea(N.bounds);
+	N.bounds = box;
+}
+
+/**
+ * @fn	bool BVH::refit(const vector<AABB>& objectBounds)
+ * @brief	Brings the tree up to date with the dirty objects. Each moved object's leaf
+ * 			is refit, and then its ancestors, stopping as soon as a node's bounds do
+ * 			not change. Falls back to a full build if an object became unbounded (or
+ * 			bounded), or if the tree has degraded past rebuildThreshold.
+ * @param	objectBounds	The bounds of each object, including the moved ones.
+ * @return	True iff the tree was rebuilt.
+ */
+
+bool BVH::refit(const vector<AABB>& objectBounds) {
+	if (dirtyObjects.empty()) {
+		return false;
+	}
+	for (int i : dirtyObjects) {
+		const AABB& B = objectBounds[i];
+		if ((leafOfObject[i] < 0) != (!B.isBounded() || B.isEmpty())) {
+			build(objectBounds);
+			return true;
+		}
+		if (leafOfObject[i] >= 0) {
+			dvec3 pad(BVH_BOUNDS_PADDING * (1.0 + glm::length(B.extent())));
+			bounds[i] = AABB(B.lo - pad, B.hi + pad);
+		}
+	}
+	for (int i : dirtyObjects) {
+		int node = leafOfObject[i];
+		while (node >= 0) {
+			AABB before = nodes[node].bounds;
+			refitNode(node);
+			if (nodes[node].bounds.lo == before.lo && nodes[node].bounds.hi == before.hi) {
+				break;
+			}
+			node = nodes[node].parent;
+		}
+	}
+	dirtyObjects.clear();
+
+	if (currentCost > rebuildThreshold * builtCost) {
+		build(objectBounds);
+		return true;
+	}
+	refitCount++;
+	return false;
+}
@@ -0,0 +1,187 @@
+/****************************************************
+ * 2016-2025 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <vector>
+#include <climits>
+#include "ishape.h"
+
+const int BVH_MAX_LEAF_SIZE = 2;				//!< Most objects stored in one leaf
+const int BVH_MAX_DEPTH = 64;					//!< Size of the traversal stack
+const double BVH_BOUNDS_PADDING = 1.0E-6;		//!< Grows object bounds so grazing hits are not lost
+
+/**
+ * @struct	BVHNode
+ * @brief	A node of a bounding volume hierarchy. Leaves refer to a contiguous run of
+ * 			BVH::objectOrder; interior nodes have exactly two children.
+ */
+
+struct BVHNode {
+	AABB bounds;		//!< Bounds of everything below this node
+	int parent = -1;	//!< Index of the parent. -1 ==> root
+	int left = -1;		//!< Index of the first child. -1 ==> leaf
+	int right = -1;		//!< Index of the second child
+	int axis = 0;		//!< Axis the children were split along
+	int first = 0;		//!< Leaves: first entry in objectOrder
+	int count = 0;		//!< Leaves: number of objects
+	bool isLeaf() const { return left < 0; }
+};
+
+/**
+ * @class	BVH
+ * @brief	A bounding volume hierarchy over a list of objects, each known only by its
+ * 			index and its bounds. Objects without finite bounds (e.g., planes) are kept
+ * 			aside and tested against every ray. When objects move they are marked dirty
+ * 			and refit updates just the nodes above them, bottom-up. Refitting lets the
+ * 			tree degrade, so its quality (the total surface area of its nodes) is
+ * 			tracked, and the tree is rebuilt from scratch once that exceeds
+ * 			rebuildThreshold times its value when last built.
+ */
+
+class BVH {
+public:
+	BVH();
+	void build(const vector<AABB>& objectBounds);
+	void markDirty(int object);
+	bool refit(const vector<AABB>& objectBounds);
+	bool isDirty() const { return !dirtyObjects.empty(); }
+	int size() const { return (int)bounds.size(); }
+
+	template <class Obj, class Hit>
+	int findIntersection(const Ray& ray, const vector<Obj*>& objects, Hit& closest) const;
+	template <class Obj>
+	bool findAnyIntersection(const Ray& ray, const vector<Obj*>& objects, double maxT) const;
+
+	double rebuildThreshold;	//!< Rebuild when the cost grows by more than this factor.
+	int buildCount;				//!< Number of times the tree was built from scratch
+	int refitCount;				//!< Number of refits that did not need a rebuild
+protected:
+	int buildNode(int first, int last, int parent);
+	void refitNode(int node);
+	static double surfaceArea(const AABB& box);
+	vector<BVHNode> nodes;			//!< The tree. nodes[0] is the root.
+	vector<int> objectOrder;		//!< Bounded objects, ordered so that leaves are contiguous
+	vector<int> leafOfObject;		//!< Leaf holding each object. -1 ==> unbounded
+	vector<int> unboundedObjects;	//!< Objects tested against every ray
+	vector<AABB> bounds;			//!< Padded bounds of each object
+	vector<int> dirtyObjects;		//!< Objects that moved since the last refit
+	double builtCost;				//!< Total surface area of the nodes when built
+	double currentCost;				//!< Total surface area of the nodes now
+};
+
+/**
+ * @fn	template <class Obj, class Hit> int BVH::findIntersection(const Ray& ray, const vector<Obj*>& objects, Hit& closest) const
+ * @brief	Finds the closest intersection, exactly as a linear search through objects
+ * 			would: when two hits are equally far, the one with the lower index wins.
+ * 			Children are visited nearest first, and any node entered farther away than
+ * 			the closest hit so far is skipped. Only distances are found during the
+ * 			traversal; the hit is completed once, for the object that wins.
+ * @param 		  	ray	   	The ray.
+ * @param 		  	objects	The objects the tree was built over.
+ * @param [in,out]	closest	The closest hit. t == FLT_MAX ==> no hit.
+ * @return	The index of the object hit, or -1 if there is none.
+ */
+
+template <class Obj, class Hit>
+int BVH::findIntersection(const Ray& ray, const vector<Obj*>& objects, Hit& closest) const {
+	closest.t = FLT_MAX;
+	int closestIndex = INT_MAX;
+	int closestPart = 0;
+	auto visit = [&](int i) {
+		int part = 0;
+		double t = objects[i]->findClosestT(ray, part);
+		if (t < closest.t || (t == closest.t && t < FLT_MAX && i < closestIndex)) {
+			closest.t = t;
+			closestIndex = i;
+			closestPart = part;
+		}
+	};
+
+	for (int i : unboundedObjects) {
+		visit(i);
+	}
+
+	int stack[BVH_MAX_DEPTH];
+	int top = 0;
+	if (!nodes.empty()) {
+		stack[top++] = 0;
+	}
+	while (top > 0) {
+		const BVHNode& node = nodes[stack[--top]];
+		double tNear;
+		if (!node.bounds.intersects(ray, closest.t, tNear)) {
+			continue;
+		}
+		if (node.isLeaf()) {
+			for (int k = node.first; k < node.first + node.count; k++) {
+				visit(objectOrder[k]);
+			}
+		} else if (ray.dir[node.axis] < 0) {
+			stack[top++] = node.left;
+			stack[top++] = node.right;
+		} else {
+			stack[top++] = node.right;
+			stack[top++] = node.left;
+		}
+	}
+	if (closestIndex == INT_MAX) {
+		return -1;
+	}
+	objects[closestIndex]->completeHit(ray, closest.t, closestPart, closest);
+	return closestIndex;
+}
+
+/**
+ * @fn	template <class Obj> bool BVH::findAnyIntersection(const Ray& ray, const vector<Obj*>& objects, double maxT) const
+ * @brief	Determines if anything at all is hit closer than maxT. Stops at the first
+ * 			such hit, which makes it the cheaper choice for shadow feelers.
+ * @param	ray	   	The ray.
+ * @param	objects	The objects the tree was built over.
+ * @param	maxT   	Hits at or beyond this distance are ignored.
+ * @return	True iff some object is hit at t < maxT.
+ */
+
+template <class Obj>
+bool BVH::findAnyIntersection(const Ray& ray, const vector<Obj*>& objects, double maxT) const {
+	auto hits = [&](int i) {
+		int part = 0;
+		return objects[i]->findClosestT(ray, part) < maxT;
+	};
+
+	for (int i : unboundedObjects) {
+		if (hits(i)) {
+			return true;
+		}
+	}
+	if (nodes.empty()) {
+		return false;
+	}
+
+	int stack[BVH_MAX_DEPTH];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const BVHNode& node = nodes[stack[--top]];
+		double tNear;
+		if (!node.bounds.intersects(ray, maxT, tNear)) {
+			continue;
+		}
+		if (node.isLeaf()) {
+			for (int k = node.first; k < node.first + node.count; k++) {
+				if (hits(objectOrder[k])) {
+					return true;
+				}
+			}
+		} else {
+			stack[top++] = node.right;
+			stack[top++] = node.left;
+		}
+	}
+	return false;
+}
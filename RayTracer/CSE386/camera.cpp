@@ -7,8 +7,70 @@
  * permission is granted.
  ****************************************************/
 
+#include <cstdint>
 #include "camera.h"
 
+/**
+ * @fn	static double radicalInverse2(unsigned int i)
+ * @brief	The van der Corput sequence: the binary digits of i, mirrored about the point.
+ * @param	i	Index into the sequence.
+ * @return	The i-th number, in [0, 1).
+ */
+
+static double radicalInverse2(unsigned int i) {
+	double result = 0.0;
+	for (double digit = 0.5; i != 0; i >>= 1, digit /= 2.0) {
+		if (i & 1) {
+			result += digit;
+		}
+	}
+	return result;
+}
+
+/**
+ * @fn	static double pixelHash(double x, double y, uint64_t stream)
+ * @brief	A number in [0, 1) that looks random, but depends only on the pixel and the
+ * 			stream, so every process tracing the pixel gets the same one.
+ * @param	x	  	The x coordinate of the pixel.
+ * @param	y	  	The y coordinate of the pixel.
+ * @param	stream	Which of the pixel's numbers to get.
+ * @return	The number.
+ */
+
+static double pixelHash(double x, double y, uint64_t stream) {
+	uint64_t h = (uint64_t)(int64_t)std::floor(x) * 0x9E3779B97F4A7C15ull ^
+		(uint64_t)(int64_t)std::floor(y) * 0xC2B2AE3D27D4EB4Full ^ (stream + 1) * 0x165667B19E3779F9ull;
+	h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;		// splitmix64 finalizer
+	h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+	h ^= h >> 31;
+	return (h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * @fn	static dvec2 concentricDisk(const dvec2& u)
+ * @brief	Maps the unit square onto the unit disk, keeping areas in proportion and
+ * 			nearby points nearby, so stratified samples stay stratified (Shirley & Chiu).
+ * @param	u	Point in [0, 1) x [0, 1).
+ * @return	Point in the unit disk.
+ */
+
+static dvec2 concentricDisk(const dvec2& u) {
+	double a = 2.0 * u.x - 1.0;
+	double b = 2.0 * u.y - 1.0;
+	if (a == 0.0 && b == 0.0) {
+		return dvec2(0.0);
+	}
+	double r, phi;
+	if (std::abs(a) > std::abs(b)) {
+		r = a;
+		phi = (PI / 4.0) * (b / a);
+	} else {
+		r = b;
+		phi = PI_2 - (PI / 4.0) * (a / b);
+	}
+	return r * dvec2(std::cos(phi), std::sin(phi));
+}
+
  /**
   * @fn	RaytracingCamera::RaytracingCamera(const dvec3 &viewingPos,
   *											const dvec3 &lookAtPt, const dvec3 &up)
@@ -97,6 +159,20 @@ dvec2 RaytracingCamera::getProjectionPlaneCoordinates(double x, double y) const
 	return s;
 }
 
+/**
+ * @fn	dvec2 RaytracingCamera::getPixelCoordinates(const dvec2& planeCoords) const
+ * @brief	Inverse of getProjectionPlaneCoordinates.
+ * @param	planeCoords	Projection plane coordinates.
+ * @return	The (fractional) pixel coordinates.
+ */
+
+dvec2 RaytracingCamera::getPixelCoordinates(const dvec2& planeCoords) const {
+	dvec2 pixel;
+	pixel.x = map(planeCoords.x, left, right, 0, nx) - 0.5;
+	pixel.y = map(planeCoords.y, bottom, top, 0, ny) - 0.5;
+	return pixel;
+}
+
 /**
  * @fn	void PerspectiveCamera::setupViewingParameters(int W, int H)
  * @brief	Calculates the viewing parameters associated with this camera.
@@ -172,9 +248,86 @@ Ray PerspectiveCamera::getRay(double x, double y) const {
 	return Ray(cameraFrame.origin, rayDirection);
 }
 
+/**
+ * @fn	Ray PerspectiveCamera::getSampleRay(double x, double y, const dvec2& lens, double time) const
+ * @brief	Thin lens: the ray from a point on the lens, a disk of radius aperture around
+ * 			the camera's position, toward the point where the pinhole ray through (x, y)
+ * 			meets the plane in focus, focalDistance in front of the camera. Points on that
+ * 			plane are sharp, and the farther anything is from it the more it is blurred.
+ * @param	x   	The x coordinate.
+ * @param	y   	The y coordinate.
+ * @param	lens	Point on the lens, as a uniform sample of [0, 1) x [0, 1).
+ * @param	time	Uniform sample of [0, 1). Used only if motionBlurEnabled.
+ * @return	The ray.
+ */
+
+Ray PerspectiveCamera::getSampleRay(double x, double y, const dvec2& lens, double time) const {
+	Ray ray = RaytracingCamera::getSampleRay(x, y, lens, time);
+	if (aperture <= 0.0) {
+		return ray;
+	}
+	dvec3 focus = ray.getPoint(focalDistance / glm::dot(ray.dir, -cameraFrame.w));
+	dvec2 disk = aperture * concentricDisk(lens);
+	dvec3 lensPt = cameraFrame.origin + disk.x * cameraFrame.u + disk.y * cameraFrame.v;
+	return Ray(lensPt, focus - lensPt, ray.time);
+}
+
+/**
+ * @fn	bool OrthographicCamera::projectToPixel(const dvec3& worldPt, dvec2& pixel) const
+ * @brief	Finds the pixel whose ray passes through a point. Inverse of getRay.
+ * @param 		  	worldPt	The point.
+ * @param [in,out]	pixel  	The (fractional) pixel coordinates.
+ * @return	True iff the point is in front of the camera.
+ */
+
+bool OrthographicCamera::projectToPixel(const dvec3& worldPt, dvec2& pixel) const {
+	dvec3 local = cameraFrame.globalCoordToFrameCoords(worldPt);
+	pixel = getPixelCoordinates(dvec2(local.x, local.y));
+	return local.z < 0;
+}
+
+/**
+ * @fn	bool PerspectiveCamera::projectToPixel(const dvec3& worldPt, dvec2& pixel) const
+ * @brief	Finds the pixel whose ray passes through a point. Inverse of getRay.
+ * @param 		  	worldPt	The point.
+ * @param [in,out]	pixel  	The (fractional) pixel coordinates.
+ * @return	True iff the point is in front of the camera.
+ */
+
+bool PerspectiveCamera::projectToPixel(const dvec3& worldPt, dvec2& pixel) const {
+	dvec3 local = cameraFrame.globalCoordToFrameCoords(worldPt);
+	if (local.z >= 0) {
+		return false;
+	}
+	pixel = getPixelCoordinates(dvec2(local.x, local.y) * (distToPlane / -local.z));
+	return true;
+}
+
+/**
+ * @fn	Ray RaytracingCamera::getSampleRay(double x, double y, const dvec2& lens, double time) const
+ * @brief	The ray through (x, y) from a point on the lens at a time in the shutter
+ * 			interval. By default a camera has no lens, so only the time is used, and
+ * 			only if motionBlurEnabled.
+ * @param	x   	The x coordinate.
+ * @param	y   	The y coordinate.
+ * @param	lens	Point on the lens, as a uniform sample of [0, 1) x [0, 1).
+ * @param	time	Uniform sample of [0, 1).
+ * @return	The ray.
+ */
+
+Ray RaytracingCamera::getSampleRay(double x, double y, const dvec2& /*lens*/, double time) const {
+	Ray ray = getRay(x, y);
+	ray.time = motionBlurEnabled ? time : 0.0;
+	return ray;
+}
+
 /**
  * @fn	vector<Ray> RaytracingCamera::getRaysAA(double x, double y, int N) const
- * @brief	Generates NN rays through subpixel locations for anti-aliasing.
+ * @brief	Generates NN rays through subpixel locations for anti-aliasing. With a lens
+ * 			or motion blur, each ray also gets its own stratum of the shutter interval
+ * 			and its own point of a Hammersley set on the lens. The strata are permuted
+ * 			so that neither follows the subpixel position, and shifted by random offsets
+ * 			for each pixel, so that neighboring pixels do not repeat the same pattern.
  * @param	x	The x coordinate of the pixel.
  * @param	y	The y coordinate of the pixel.
  * @param	N	The number of rays per dimension (total N^2 rays).
@@ -186,6 +339,10 @@ vector<Ray> RaytracingCamera::getRaysAA(double x, double y, int N) const {
 	vector<Ray> rays;
 
 	double step = 1.0 / N; // Normalize subpixel
+	const int n = N * N;
+	const bool sampled = hasLensOrShutter();
+	const dvec3 shift = sampled ? dvec3(pixelHash(x, y, 0), pixelHash(x, y, 1), pixelHash(x, y, 2))
+								: dvec3(0.0);
 
 	// Loop over subpixel positions in the grid
 	for (int i = 0; i < N; ++i) {
@@ -196,8 +353,19 @@ vector<Ray> RaytracingCamera::getRaysAA(double x, double y, int N) const {
 			double subX = x + (i + 0.5) * step;
 			double subY = y + (j + 0.5) * step;
 
-			// Get the ray from this subpixel position
-			rays.push_back(getRay(subX, subY));
+			if (!sampled) {
+				// Get the ray from this subpixel position
+				rays.push_back(getRay(subX, subY));
+				continue;
+			}
+
+			// N + 1 and 2N + 1 share no factors with N^2, so these are permutations
+			int timeStratum = (i * N + j) * (N + 1) % n;
+			int lensStratum = (i * N + j) * (2 * N + 1) % n;
+			double time = glm::fract((timeStratum + 0.5) / n + shift.x);
+			dvec2 lens(glm::fract((lensStratum + 0.5) / n + shift.y),
+				glm::fract(radicalInverse2(lensStratum) + shift.z));
+			rays.push_back(getSampleRay(subX, subY, lens, time));
 		}
 	}
 
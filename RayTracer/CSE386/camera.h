@@ -13,13 +13,20 @@
 
  /**
   * @struct	RaytracingCamera
-  * @brief	Base class for cameras in raytracing applications.
+  * @brief	Base class for cameras in raytracing applications. getRay gives the ray
+  * 		through a point of the image from the center of the lens at the start of the
+  * 		shutter interval. getSampleRay gives one from a given point on the lens at a
+  * 		given time, which getRaysAA uses to spread each pixel's samples over the lens
+  * 		and the shutter interval, so depth of field and motion blur cost no more rays
+  * 		than anti-aliasing does.
   */
 
 struct RaytracingCamera {
 	RaytracingCamera(const dvec3& pos, const dvec3& lookAtPt, const dvec3& up,
 		int width, int height);
 	virtual Ray getRay(double x, double y) const = 0;
+	virtual bool projectToPixel(const dvec3& worldPt, dvec2& pixel) const = 0;
+	virtual RaytracingCamera* clone() const = 0;
 	Frame getFrame() const { return cameraFrame; }
 	int getNX() const { return nx; }
 	int getNY() const { return ny; }
@@ -27,7 +34,13 @@ struct RaytracingCamera {
 	double getRight() const { return right; }
 	double getBottom() const { return bottom; }
 	double getTop() const { return top; }
+	virtual Ray getSampleRay(double x, double y, const dvec2& lens, double time) const;
 	virtual vector<Ray> getRaysAA(double x, double y, int N) const;
+	bool hasLensOrShutter() const { return aperture > 0.0 || motionBlurEnabled; }
+
+	double aperture = 0.0;			//!< Radius of the lens. 0 ==> a pinhole, with everything in focus
+	double focalDistance = 10.0;	//!< Distance along the view direction to the plane in focus
+	bool motionBlurEnabled = false;	//!< True ==> rays are spread over the shutter interval
 protected:
 	Frame cameraFrame;					//!< The camera's frame
 	int nx, ny;							//!< Window size
@@ -36,6 +49,7 @@ protected:
 	void setupFrame(const dvec3& pos, const dvec3& lookAtPt, const dvec3& up);
 	virtual void setupViewingParameters(int width, int height) = 0;
 	dvec2 getProjectionPlaneCoordinates(double x, double y) const;
+	dvec2 getPixelCoordinates(const dvec2& planeCoords) const;
 public:
 
 	friend ostream& operator << (ostream& os, const RaytracingCamera& camera);
@@ -50,6 +64,9 @@ struct PerspectiveCamera : public RaytracingCamera {
 	PerspectiveCamera(const dvec3& pos, const dvec3& lookAtPt, const dvec3& up, double FOVRads,
 		int width, int height);
 	virtual Ray getRay(double x, double y) const;
+	virtual Ray getSampleRay(double x, double y, const dvec2& lens, double time) const;
+	virtual bool projectToPixel(const dvec3& worldPt, dvec2& pixel) const;
+	virtual RaytracingCamera* clone() const { return new PerspectiveCamera(*this); }
 	double getDistToPlane() const { return distToPlane; }
 private:
 	double fov;						//!< The camera's field of view
@@ -66,6 +83,8 @@ struct OrthographicCamera : public RaytracingCamera {
 	OrthographicCamera(const dvec3& pos, const dvec3& lookAtPt, const dvec3& up,
 		int width, int height, double scaleFactor = 1.0);
 	virtual Ray getRay(double x, double y) const;
+	virtual bool projectToPixel(const dvec3& worldPt, dvec2& pixel) const;
+	virtual RaytracingCamera* clone() const { return new OrthographicCamera(*this); }
 private:
 	double scale;		//!< Controls the size of the image plane.
 	virtual void setupViewingParameters(int width, int height);
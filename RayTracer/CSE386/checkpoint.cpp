@@ -0,0 +1,293 @@
+/****************************************************
+ * 2016-2025 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#ifdef WINDOWS
+#include <windows.h>
+#endif
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include "checkpoint.h"
+#include "raytracer.h"
+
+const char CHECKPOINT_MAGIC[8] = { 'R', 'T', 'C', 'H', 'E', 'C', 'K', '1' };	//!< First bytes of every checkpoint
+
+/**
+ * @fn	vector<RenderTile> makeTiles(int width, int height, int tileSize)
+ * @brief	Divides an image into square tiles, row by row from the bottom. Tiles on the
+ * 			right and top edges may be smaller.
+ * @param	width   	Width of the image.
+ * @param	height  	Height of the image.
+ * @param	tileSize	Width and height of the tiles.
+ * @return	The tiles.
+ */
+
+vector<RenderTile> makeTiles(int width, int height, int tileSize) {
+	vector<RenderTile> tiles;
+	for (int y0 = 0; y0 < height; y0 += tileSize) {
+		for (int x0 = 0; x0 < width; x0 += tileSize) {
+			tiles.push_back({ x0, y0, std::min(x0 + tileSize, width), std::min(y0 + tileSize, height) });
+		}
+	}
+	return tiles;
+}
+
+/**
+ * @fn	void storeTile(FrameBuffer &frameBuffer, const RenderTile &tile, const vector<color> &colors, double weight)
+ * @brief	Writes the colors traced for a tile to the color buffer or, if the framebuffer
+ * 			accumulates samples, adds them to the accumulation buffer.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	tile	   	The tile.
+ * @param 		  	colors	   	Its colors, row by row from the bottom.
+ * @param 		  	weight	   	Weight of each color in the accumulation buffer.
+ */
+
+void storeTile(FrameBuffer& frameBuffer, const RenderTile& tile, const vector<color>& colors, double weight) {
+	const int tileWidth = tile.x1 - tile.x0;
+	if (!frameBuffer.isAccumulationEnabled()) {
+		frameBuffer.writeTile(BoundingBoxi(tile.x0, tileWidth, tile.y0, tile.y1 - tile.y0), colors.data());
+		return;
+	}
+	for (int y = tile.y0; y < tile.y1; ++y) {
+		const color* row = &colors[(size_t)(y - tile.y0) * tileWidth];
+		for (int x = tile.x0; x < tile.x1; ++x) {
+			frameBuffer.accumulate(x, y, row[x - tile.x0], weight);
+		}
+	}
+}
+
+/**
+ * @fn	uint64_t RenderCheckpoint::sceneKey(const IScene &theScene, int width, int height, const vector<double> &settings)
+ * @brief	A hash (FNV-1a) of what determines a rendered image: its size, the lights, the
+ * 			camera and its lens and shutter, the scene's geometryVersion and number of
+ * 			objects, and whatever settings the renderer adds. Materials and textures are not included, so
+ * 			delete the checkpoint after changing them.
+ * @param	theScene	The scene.
+ * @param	width   	Width of the image.
+ * @param	height  	Height of the image.
+ * @param	settings	Anything else that changes the image, such as the recursion depth.
+ * @return	The key.
+ */
+
+uint64_t RenderCheckpoint::sceneKey(const IScene& theScene, int width, int height, const vector<double>& settings) {
+	vector<double> values = { (double)width, (double)height, (double)theScene.geometryVersion,
+		(double)theScene.opaqueObjs.size(), (double)theScene.transparentObjs.size() };
+	values.insert(values.end(), settings.begin(), settings.end());
+	vector<double> lighting = lightingState(theScene);
+	values.insert(values.end(), lighting.begin(), lighting.end());
+	for (const dvec2& corner : { dvec2(0, 0), dvec2(width, 0), dvec2(0, height), dvec2(width, height) }) {
+		Ray ray = theScene.camera->getRay(corner.x, corner.y);
+		values.insert(values.end(), { ray.origin.x, ray.origin.y, ray.origin.z, ray.dir.x, ray.dir.y, ray.dir.z });
+	}
+	values.insert(values.end(), { theScene.camera->aperture, theScene.camera->focalDistance,
+		(double)theScene.camera->motionBlurEnabled });
+
+	uint64_t hash = 14695981039346656037ull;
+	for (double value : values) {
+		unsigned char bytes[sizeof(double)];
+		std::memcpy(bytes, &value, sizeof(double));
+		for (unsigned char b : bytes) {
+			hash = (hash ^ b) * 1099511628211ull;
+		}
+	}
+	return hash;
+}
+
+/**
+ * @fn	bool RenderCheckpoint::begin(FrameBuffer &frameBuffer, uint64_t key, int *samples, int tileSize)
+ * @brief	Starts a render. Divides the image into tiles, none of them done. If resume is
+ * 			set and filename holds a checkpoint of the same render, the finished tiles
+ * 			are marked done and copied into the color buffer, or the accumulation buffer
+ * 			is restored, as they were saved.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	key		   	Identifies the render. See sceneKey.
+ * @param [out]   	samples	   	If not null, the samples per pixel saved, or 0.
+ * @param 		  	tileSize   	Width and height of the tiles.
+ * @return	True iff a checkpoint was restored.
+ */
+
+bool RenderCheckpoint::begin(FrameBuffer& frameBuffer, uint64_t key, int* samples, int tileSize) {
+	this->key = key;
+	this->tileSize = tileSize;
+	width = frameBuffer.getWindowWidth();
+	height = frameBuffer.getWindowHeight();
+	tiles = makeTiles(width, height, tileSize);
+	done.assign(tiles.size(), 0);
+	tilesRestored = 0;
+	lastSave = std::chrono::steady_clock::now();
+	if (samples != nullptr) {
+		*samples = 0;
+	}
+	return isEnabled() && resume && load(frameBuffer, samples);
+}
+
+/**
+ * @fn	bool RenderCheckpoint::load(FrameBuffer &frameBuffer, int *samples)
+ * @brief	Reads filename, if it is a checkpoint of this render. Nothing is changed
+ * 			unless the whole file is read successfully.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param [out]   	samples	   	If not null, the samples per pixel saved.
+ * @return	True iff it was restored.
+ */
+
+bool RenderCheckpoint::load(FrameBuffer& frameBuffer, int* samples) {
+	std::ifstream in(filename, std::ios::binary);
+	char magic[sizeof(CHECKPOINT_MAGIC)];
+	uint64_t fileKey;
+	int32_t header[5];		// width, height, tile size, samples, tile count
+	if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 ||
+		!in.read((char*)&fileKey, sizeof(fileKey)) || !in.read((char*)header, sizeof(header)) ||
+		fileKey != key || header[0] != width || header[1] != height ||
+		header[2] != tileSize || header[4] != (int32_t)tiles.size()) {
+		return false;
+	}
+	vector<char> fileDone(tiles.size());
+	char hasSamples = 0;
+	if (!in.read(fileDone.data(), fileDone.size()) || !in.read(&hasSamples, 1) ||
+		(hasSamples != 0) != frameBuffer.isAccumulationEnabled()) {
+		return false;
+	}
+
+	if (hasSamples) {
+		vector<float> sums((size_t)width * height * 4);
+		if (!in.read((char*)sums.data(), sums.size() * sizeof(float))) {
+			return false;
+		}
+		frameBuffer.setAccumulationBuffer(sums.data());
+	} else {
+		vector<vector<unsigned char>> pixels(tiles.size());
+		for (size_t i = 0; i < tiles.size(); i++) {
+			if (fileDone[i]) {
+				const RenderTile& t = tiles[i];
+				pixels[i].resize((size_t)3 * (t.x1 - t.x0) * (t.y1 - t.y0));
+				if (!in.read((char*)pixels[i].data(), pixels[i].size())) {
+					return false;
+				}
+			}
+		}
+		for (size_t i = 0; i < tiles.size(); i++) {
+			if (fileDone[i]) {
+				// Halfway between levels, so that quantizing gives back the same bytes
+				vector<color> colors(pixels[i].size() / 3);
+				for (size_t p = 0; p < colors.size(); p++) {
+					colors[p] = (color(pixels[i][3 * p], pixels[i][3 * p + 1], pixels[i][3 * p + 2]) + 0.5) / 255.0;
+				}
+				storeTile(frameBuffer, tiles[i], colors);
+			}
+		}
+	}
+	for (size_t i = 0; i < tiles.size(); i++) {
+		done[i] = fileDone[i];
+		tilesRestored += fileDone[i] ? 1 : 0;
+	}
+	if (samples != nullptr) {
+		*samples = header[3];
+	}
+	return true;
+}
+
+/**
+ * @fn	void RenderCheckpoint::tileDone(const FrameBuffer &frameBuffer, int tile)
+ * @brief	Marks a tile finished, once it is in the framebuffer, and saves a checkpoint
+ * 			if one is due.
+ * @param	frameBuffer	Framebuffer.
+ * @param	tile	   	Index of the tile.
+ */
+
+void RenderCheckpoint::tileDone(const FrameBuffer& frameBuffer, int tile) {
+	done[tile] = 1;
+	saveIfDue(frameBuffer);
+}
+
+/**
+ * @fn	bool RenderCheckpoint::saveIfDue(const FrameBuffer &frameBuffer, int samples)
+ * @brief	Saves a checkpoint if interval seconds have passed since the last one.
+ * @param	frameBuffer	Framebuffer.
+ * @param	samples	   	Samples per pixel in the accumulation buffer, for renderers that
+ * 						work in passes.
+ * @return	True iff a checkpoint was saved.
+ */
+
+bool RenderCheckpoint::saveIfDue(const FrameBuffer& frameBuffer, int samples) {
+	auto now = std::chrono::steady_clock::now();
+	if (!isEnabled() || std::chrono::duration<double>(now - lastSave).count() < interval) {
+		return false;
+	}
+	return save(frameBuffer, samples);
+}
+
+/**
+ * @fn	bool RenderCheckpoint::save(const FrameBuffer &frameBuffer, int samples)
+ * @brief	Writes a checkpoint: the finished tiles, 3 bytes per pixel, or the whole
+ * 			accumulation buffer, if it is enabled.
+ * @param	frameBuffer	Framebuffer.
+ * @param	samples	   	Samples per pixel in the accumulation buffer, for renderers that
+ * 						work in passes.
+ * @return	True iff it was written.
+ */
+
+bool RenderCheckpoint::save(const FrameBuffer& frameBuffer, int samples) {
+	lastSave = std::chrono::steady_clock::now();
+	if (!isEnabled()) {
+		return false;
+	}
+	const string temporary = filename + ".tmp";
+	{
+		std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+		const int32_t header[5] = { width, height, tileSize, samples, (int32_t)tiles.size() };
+		const char hasSamples = frameBuffer.isAccumulationEnabled() ? 1 : 0;
+		out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+		out.write((const char*)&key, sizeof(key));
+		out.write((const char*)header, sizeof(header));
+		out.write(done.data(), done.size());
+		out.write(&hasSamples, 1);
+
+		if (hasSamples) {
+			out.write((const char*)frameBuffer.getAccumulationBuffer(), (size_t)width * height * 4 * sizeof(float));
+		} else {
+			vector<unsigned char> pixels;
+			for (size_t i = 0; i < tiles.size(); i++) {
+				if (done[i]) {
+					const RenderTile& t = tiles[i];
+					pixels.clear();
+					for (int y = t.y0; y < t.y1; ++y) {
+						for (int x = t.x0; x < t.x1; ++x) {
+							color C = frameBuffer.getColor(x, y);
+							pixels.insert(pixels.end(), { (unsigned char)(C.r * 255 + 0.5),
+								(unsigned char)(C.g * 255 + 0.5), (unsigned char)(C.b * 255 + 0.5) });
+						}
+					}
+					out.write((const char*)pixels.data(), pixels.size());
+				}
+			}
+		}
+		if (!out) {
+			out.close();
+			std::remove(temporary.c_str());
+			return false;
+		}
+	}
+	// Replace the old checkpoint in one step, so that a crash leaves one or the other
+#ifdef WINDOWS
+	return MoveFileExA(temporary.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return std::rename(temporary.c_str(), filename.c_str()) == 0;
+#endif
+}
+
+/**
+ * @fn	void RenderCheckpoint::finish()
+ * @brief	Deletes the checkpoint, once the render it was for is complete.
+ */
+
+void RenderCheckpoint::finish() {
+	if (isEnabled()) {
+		std::remove(filename.c_str());
+	}
+}
@@ -0,0 +1,76 @@
+/****************************************************
+ * 2016-2025 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include "utilities.h"
+#include "framebuffer.h"
+#include "iscene.h"
+
+const int CHECKPOINT_TILE_SIZE = 32;	//!< Default width and height of the tiles checkpoints track
+
+/**
+ * @struct	RenderTile
+ * @brief	A rectangle of the image: columns [x0, x1) and rows [y0, y1).
+ */
+
+struct RenderTile {
+	int x0, y0, x1, y1;
+};
+
+vector<RenderTile> makeTiles(int width, int height, int tileSize);
+void storeTile(FrameBuffer& frameBuffer, const RenderTile& tile, const vector<color>& colors,
+	double weight = 1.0);
+
+/**
+ * @class	RenderCheckpoint
+ * @brief	Saves a render in progress, so that a process that is killed can pick up
+ * 			where it left off. The image is divided into tiles; as each is finished, it
+ * 			is marked done, and at most every interval seconds the finished tiles are
+ * 			written to filename. If the framebuffer accumulates samples, the whole
+ * 			accumulation buffer is written instead, with a count of samples per pixel
+ * 			for renderers that work in passes.
+ *
+ * 			The file starts with a key identifying the render (see sceneKey); a file
+ * 			with another key, or for another image size, is ignored. Files are written
+ * 			to a temporary name and then renamed, so a crash while saving leaves the
+ * 			previous checkpoint intact. They are in the byte order of the machine that
+ * 			wrote them.
+ */
+
+class RenderCheckpoint {
+public:
+	bool begin(FrameBuffer& frameBuffer, uint64_t key, int* samples = nullptr,
+		int tileSize = CHECKPOINT_TILE_SIZE);
+	void tileDone(const FrameBuffer& frameBuffer, int tile);
+	bool saveIfDue(const FrameBuffer& frameBuffer, int samples = 0);
+	bool save(const FrameBuffer& frameBuffer, int samples = 0);
+	void finish();
+	bool isEnabled() const { return !filename.empty(); }
+	bool isTileDone(int tile) const { return done[tile] != 0; }
+	const vector<RenderTile>& getTiles() const { return tiles; }
+	int getTilesRestored() const { return tilesRestored; }
+	static uint64_t sceneKey(const IScene& theScene, int width, int height, const vector<double>& settings);
+
+	string filename;			//!< Where checkpoints are written. Empty ==> checkpointing is off
+	double interval = 60.0;		//!< Least number of seconds between checkpoints
+	bool resume = true;			//!< True ==> begin picks up from a matching checkpoint
+protected:
+	bool load(FrameBuffer& frameBuffer, int* samples);
+	uint64_t key = 0;			//!< Identifies the render
+	int width = 0;				//!< Width of the image
+	int height = 0;				//!< Height of the image
+	int tileSize = CHECKPOINT_TILE_SIZE;	//!< Width and height of the tiles
+	vector<RenderTile> tiles;	//!< The tiles of the image
+	vector<char> done;			//!< True ==> the tile is finished
+	int tilesRestored = 0;		//!< Tiles found finished by the last begin
+	std::chrono::steady_clock::time_point lastSave;	//!< When the last checkpoint was written, or begin
+};
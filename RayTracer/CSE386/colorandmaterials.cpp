@@ -7,6 +7,7 @@
  * permission is granted.
  ****************************************************/
 
+#include <mutex>
 #include "utilities.h"
 #include "colorandmaterials.h"
 
@@ -110,4 +111,62 @@ Material Material::operator +(const Material& mat) const {
 
 Material operator *(double w, const Material& mat) {
 	return mat * w;
-}
\ No newline at end of file
+}
+
+/**
+ * @fn	bool Material::operator==(const Material &mat) const
+ * @brief	Tests two Materials for equality of all their properties.
+ * @param	mat	The second Material.
+ * @return	True iff the Materials are identical.
+ */
+
+bool Material::operator ==(const Material& mat) const {
+	return ambient == mat.ambient && diffuse == mat.diffuse &&
+		specular == mat.specular && shininess == mat.shininess &&
+		alpha == mat.alpha && isDielectric == mat.isDielectric &&
+		dielectricRefractionIndex == mat.dielectricRefractionIndex;
+}
+
+Material* MaterialTable::chunks[MaterialTable::MAX_CHUNKS];
+std::atomic<int> MaterialTable::count(0);
+
+/**
+ * @fn	static std::mutex &registrationMutex()
+ * @brief	Mutex serializing MaterialTable registration. A function-local static, so that
+ * 			materials can be registered by other files' static initializers.
+ * @return	The mutex.
+ */
+
+static std::mutex& registrationMutex() {
+	static std::mutex mutex;
+	return mutex;
+}
+
+/**
+ * @fn	int MaterialTable::getID(const Material &mat)
+ * @brief	Gets the ID of a material, registering it if it has not been seen before.
+ * 			The most recently registered materials are checked first, since consecutive
+ * 			vertices usually share a material.
+ * @param	mat	The material.
+ * @return	The material's ID.
+ */
+
+int MaterialTable::getID(const Material& mat) {
+	std::lock_guard<std::mutex> lock(registrationMutex());
+	const int N = count;
+	for (int i = N - 1; i >= 0; i--) {
+		if (getMaterial(i) == mat) {
+			return i;
+		}
+	}
+	if (N == MAX_CHUNKS * CHUNK_SIZE) {
+		std::cerr << "MaterialTable is full" << endl;
+		return N - 1;
+	}
+	if ((N & (CHUNK_SIZE - 1)) == 0) {
+		chunks[N >> CHUNK_BITS] = new Material[CHUNK_SIZE];
+	}
+	chunks[N >> CHUNK_BITS][N & (CHUNK_SIZE - 1)] = mat;
+	count = N + 1;
+	return N;
+}
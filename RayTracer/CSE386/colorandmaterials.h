@@ -9,6 +9,7 @@
 
 #pragma once
 #include <vector>
+#include <atomic>
 #include "defs.h"
 
 typedef dvec3 color;
@@ -53,6 +54,31 @@ struct Material {
 	Material operator *(double w) const;
 	Material& operator +=(const Material& mat);
 	Material operator +(const Material& mat) const;
+	bool operator ==(const Material& mat) const;
+	bool operator !=(const Material& mat) const { return !(*this == mat); }
+};
+
+/**
+ * @class	MaterialTable
+ * @brief	Registry of the materials in use, so that a material can be referred to by
+ * 			a small integer ID (e.g., in a vertex or a G-buffer). Identical materials share
+ * 			an ID. Registration is thread-safe, and lookups never lock: materials are kept
+ * 			in fixed-size chunks that are never moved once allocated.
+ */
+
+class MaterialTable {
+public:
+	static int getID(const Material& mat);
+	static const Material& getMaterial(int ID) {
+		return chunks[ID >> CHUNK_BITS][ID & (CHUNK_SIZE - 1)];
+	}
+	static int size() { return count; }
+protected:
+	static const int CHUNK_BITS = 8;
+	static const int CHUNK_SIZE = 1 << CHUNK_BITS;
+	static const int MAX_CHUNKS = 256;
+	static Material* chunks[MAX_CHUNKS];	//!< Constant-initialized, so usable during static initialization
+	static std::atomic<int> count;			//!< Number of registered materials
 };
 
 // http://www.it.hiof.no/~borres/j3d/explain/light/p-materials.html
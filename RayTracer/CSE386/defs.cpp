@@ -117,7 +117,7 @@ Frame Frame::createOrthoNormalBasis(const dvec3& pos, const dvec3& w) {
 	dvec3 wNormed = glm::normalize(w);
 	int minIndex = 0;
 	for (int i = 1; i < 3; i++) {
-		if (w[i] < w[minIndex]) {
+		if (std::abs(w[i]) < std::abs(w[minIndex])) {
 			minIndex = i;
 		}
 	}
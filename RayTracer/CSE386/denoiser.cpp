@@ -0,0 +1,190 @@
+/****************************************************
+ * 2016-2025 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include "denoiser.h"
+
+/**
+ * @fn	static double distanceSquared(const color &A, const color &B)
+ * @brief	Squared distance between two colors.
+ * @param	A	The first color.
+ * @param	B	The second color.
+ * @return	The squared distance.
+ */
+
+static double distanceSquared(const color& A, const color& B) {
+	color D = A - B;
+	return glm::dot(D, D);
+}
+
+/**
+ * @fn	static double luminance(const color &C)
+ * @brief	The luminance of a color (Rec. 709 weights).
+ * @param	C	The color.
+ * @return	The luminance.
+ */
+
+static double luminance(const color& C) {
+	return 0.2126 * C.r + 0.7152 * C.g + 0.0722 * C.b;
+}
+
+/**
+ * @fn	void Denoiser::gatherGuides(const IScene &theScene, int width, int height)
+ * @brief	Traces one ray through the center of each pixel and records the normal, depth
+ * 			and albedo of what it hits. Call once per frame, before denoise, with the
+ * 			camera used for the frame.
+ * @param	theScene	The scene.
+ * @param	width   	Width of the image.
+ * @param	height  	Height of the image.
+ */
+
+void Denoiser::gatherGuides(const IScene& theScene, int width, int height) {
+	this->width = width;
+	this->height = height;
+	guides.assign((size_t)width * height, GuideTexel());
+
+	parallelFor(height, [&](int y) {
+		for (int x = 0; x < width; ++x) {
+			OpaqueHitRecord hit;
+			if (theScene.findIntersection(theScene.camera->getRay(x, y), hit) < 0) {
+				continue;
+			}
+			GuideTexel& guide = guides[(size_t)y * width + x];
+			guide.normal = hit.normal;
+			guide.depth = hit.t;
+			guide.albedo = hit.texture != nullptr ? hit.texture->getPixelUV(hit.u, hit.v)
+												  : hit.material.diffuse;
+		}
+	}, numThreads);
+}
+
+/**
+ * @fn	double Denoiser::guideWeight(const GuideTexel &p, const GuideTexel &q, double distance) const
+ * @brief	How much pixel q may contribute to pixel p, judged by their guides alone.
+ * 			Background pixels are only blended with background pixels.
+ * @param	p			The guide of the pixel being filtered.
+ * @param	q			The guide of its neighbor.
+ * @param	distance	Distance between the two, in pixels.
+ * @return	The weight, in [0, 1].
+ */
+
+double Denoiser::guideWeight(const GuideTexel& p, const GuideTexel& q, double distance) const {
+	const bool pHit = p.depth < FLT_MAX;
+	const bool qHit = q.depth < FLT_MAX;
+	if (!pHit || !qHit) {
+		return pHit == qHit ? 1.0 : 0.0;
+	}
+	double cosine = glm::dot(p.normal, q.normal);
+	if (cosine <= 0.0) {
+		return 0.0;
+	}
+	// The product of the normal, depth and albedo weights, as a single exponential
+	return std::exp(normalPower * std::log(cosine)
+		- std::abs(p.depth - q.depth) / (depthSigma * p.depth * distance)
+		- distanceSquared(p.albedo, q.albedo) / (albedoSigma * albedoSigma));
+}
+
+/**
+ * @fn	void Denoiser::denoise(FrameBuffer &frameBuffer) const
+ * @brief	Filters the color buffer in place. Does nothing unless the guides were
+ * 			gathered at the size of the frame buffer. The variance of each pixel's
+ * 			luminance is first estimated from its 5 x 5 neighborhood, and is filtered
+ * 			along with the color, so that the color weight relaxes where the image is
+ * 			noisy (fireflies included) and tightens as the noise is removed. Rows of
+ * 			each pass are spread over numThreads threads.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ */
+
+void Denoiser::denoise(FrameBuffer& frameBuffer) const {
+	if (frameBuffer.getWindowWidth() != width || frameBuffer.getWindowHeight() != height ||
+		guides.empty()) {
+		return;
+	}
+	static const double KERNEL[5] = { 1.0 / 16, 1.0 / 4, 3.0 / 8, 1.0 / 4, 1.0 / 16 };
+	const color EPSILON(DENOISE_ALBEDO_EPSILON);
+	const size_t area = (size_t)width * height;
+
+	vector<color> current(area), next(area);
+	vector<double> variance(area), nextVariance(area);
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			size_t i = (size_t)y * width + x;
+			current[i] = frameBuffer.getColor(x, y) / (guides[i].albedo + EPSILON);
+		}
+	}
+
+	// Calls visit(q, distance, kernel weight) for each tap around pixel (x, y).
+	auto forEachTap = [&](int x, int y, int step, auto visit) {
+		for (int j = -2; j <= 2; j++) {
+			const int qy = y + j * step;
+			if (qy < 0 || qy >= height) {
+				continue;
+			}
+			for (int i = -2; i <= 2; i++) {
+				const int qx = x + i * step;
+				if (qx >= 0 && qx < width) {
+					visit((size_t)qy * width + qx, step * std::sqrt(i * i + j * j),
+						KERNEL[i + 2] * KERNEL[j + 2]);
+				}
+			}
+		}
+	};
+
+	parallelFor(height, [&](int y) {
+		for (int x = 0; x < width; ++x) {
+			const size_t p = (size_t)y * width + x;
+			double sum = 0.0, sumSquares = 0.0, totalWeight = 0.0;
+			forEachTap(x, y, 1, [&](size_t q, double distance, double weight) {
+				if (q != p) {
+					weight *= guideWeight(guides[p], guides[q], distance);
+				}
+				double L = luminance(current[q]);
+				sum += weight * L;
+				sumSquares += weight * L * L;
+				totalWeight += weight;
+			});
+			double mean = sum / totalWeight;
+			variance[p] = glm::max(0.0, sumSquares / totalWeight - mean * mean);
+		}
+	}, numThreads);
+
+	for (int pass = 0; pass < passes; pass++) {
+		const int step = 1 << pass;
+		parallelFor(height, [&](int y) {
+			for (int x = 0; x < width; ++x) {
+				const size_t p = (size_t)y * width + x;
+				const double Lp = luminance(current[p]);
+				const double tolerance = colorSigma * std::sqrt(variance[p]) + 1.0E-4;
+				color sum = black;
+				double sumVariance = 0.0, totalWeight = 0.0;
+				forEachTap(x, y, step, [&](size_t q, double distance, double weight) {
+					if (q != p) {
+						weight *= guideWeight(guides[p], guides[q], distance) *
+							std::exp(-std::abs(Lp - luminance(current[q])) / tolerance);
+					}
+					sum += weight * current[q];
+					sumVariance += weight * weight * variance[q];
+					totalWeight += weight;
+				});
+				next[p] = sum / totalWeight;
+				nextVariance[p] = sumVariance / (totalWeight * totalWeight);
+			}
+		}, numThreads);
+		current.swap(next);
+		variance.swap(nextVariance);
+	}
+
+	vector<color> row(width);
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			size_t i = (size_t)y * width + x;
+			row[x] = glm::clamp(current[i] * (guides[i].albedo + EPSILON), 0.0, 1.0);
+		}
+		frameBuffer.setSpan(0, y, width, row.data());
+	}
+}
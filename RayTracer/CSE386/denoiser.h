@@ -0,0 +1,62 @@
+/****************************************************
+ * 2016-2025 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include "utilities.h"
+#include "framebuffer.h"
+#include "iscene.h"
+
+const double DENOISE_ALBEDO_EPSILON = 0.01;	//!< Keeps demodulation finite on black surfaces
+
+/**
+ * @struct	GuideTexel
+ * @brief	What the primary ray through the center of one pixel hit. Guides the
+ * 			denoiser: pixels are only averaged with neighbors on a similar surface.
+ */
+
+struct GuideTexel {
+	dvec3 normal;				//!< Normal at the first hit. (0, 0, 0) ==> nothing hit
+	double depth = FLT_MAX;		//!< HitRecord::t of the first hit
+	color albedo = white;		//!< Material::diffuse, or the texel, at the first hit
+};
+
+/**
+ * @class	Denoiser
+ * @brief	An edge-avoiding a-trous wavelet filter, which cleans up images made with
+ * 			few samples per pixel. Each pass blends every pixel with 5 x 5 neighbors
+ * 			spaced 2^pass pixels apart, weighted by a B-spline kernel and by how alike
+ * 			the two pixels are: in luminance, relative to the estimated noise, and in
+ * 			the normal, depth and albedo of the surfaces they show. A few passes cover a wide footprint at a small cost,
+ * 			without blurring across edges. Colors are divided by the albedo before
+ * 			filtering and multiplied by it afterwards, so textures stay sharp.
+ *
+ * 			The guides are gathered by gatherGuides, one ray per pixel, and are
+ * 			noise-free, unlike the color. Filtering works on the color buffer, so it
+ * 			follows tone mapping when the accumulation buffer is in use.
+ */
+
+class Denoiser {
+public:
+	void gatherGuides(const IScene& theScene, int width, int height);
+	void denoise(FrameBuffer& frameBuffer) const;
+	const GuideTexel& guideAt(int x, int y) const { return guides[(size_t)y * width + x]; }
+
+	int passes = 4;				//!< Number of a-trous passes. Footprint is 4 * (2^passes - 1) + 1
+	double colorSigma = 4.0;	//!< Luminance difference tolerated, in standard deviations
+	double normalPower = 64.0;	//!< Exponent applied to the cosine between normals
+	double depthSigma = 0.02;	//!< Relative depth difference tolerated per pixel of distance
+	double albedoSigma = 0.1;	//!< Albedo difference tolerated
+	int numThreads = defaultThreadCount();	//!< Threads used by gatherGuides and denoise
+protected:
+	double guideWeight(const GuideTexel& p, const GuideTexel& q, double distance) const;
+	vector<GuideTexel> guides;	//!< width x height guides, from the last gatherGuides
+	int width = 0;				//!< Width of the guide buffer
+	int height = 0;				//!< Height of the guide buffer
+};
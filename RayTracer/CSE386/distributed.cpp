@@ -0,0 +1,748 @@
+/****************************************************
+ * 2016-2025 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+// The socket headers come first, since winsock2.h must precede windows.h
+#ifdef WINDOWS
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "Ws2_32.lib")
+#endif
+typedef SOCKET NativeSocket;
+typedef int SocketLength;
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <csignal>
+typedef int NativeSocket;
+typedef socklen_t SocketLength;
+#endif
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "distributed.h"
+
+const uint32_t MAX_MESSAGE_SIZE = 1 << 26;	//!< Longest payload accepted. Longer ==> the peer is confused
+
+/**
+ * @fn	static bool startNetworking()
+ * @brief	Readies the socket library, once per process. On Windows, starts Winsock;
+ * 			elsewhere, ignores SIGPIPE, so that writing to a lost peer fails instead of
+ * 			ending the process.
+ * @return	True iff sockets can be used.
+ */
+
+static bool startNetworking() {
+#ifdef WINDOWS
+	static const bool started = [] {
+		WSADATA data;
+		return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+	}();
+	return started;
+#else
+	static const bool started = [] {
+		std::signal(SIGPIPE, SIG_IGN);
+		return true;
+	}();
+	return started;
+#endif
+}
+
+/**
+ * @fn	static void closeNative(std::intptr_t handle)
+ * @brief	Closes a native socket.
+ * @param	handle	The socket.
+ */
+
+static void closeNative(std::intptr_t handle) {
+#ifdef WINDOWS
+	closesocket((NativeSocket)handle);
+#else
+	::close((NativeSocket)handle);
+#endif
+}
+
+/**
+ * @fn	static std::intptr_t toHandle(NativeSocket s)
+ * @brief	Converts a native socket to the handle kept by TcpSocket.
+ * @param	s	The socket.
+ * @return	The handle. -1 ==> invalid.
+ */
+
+static std::intptr_t toHandle(NativeSocket s) {
+#ifdef WINDOWS
+	return s == INVALID_SOCKET ? -1 : (std::intptr_t)s;
+#else
+	return s < 0 ? -1 : (std::intptr_t)s;
+#endif
+}
+
+/**
+ * @fn	static timeval toTimeval(double seconds)
+ * @brief	Converts a duration to a timeval.
+ * @param	seconds	The duration.
+ * @return	The timeval.
+ */
+
+static timeval toTimeval(double seconds) {
+	seconds = glm::max(seconds, 0.0);
+	timeval tv;
+	tv.tv_sec = (long)seconds;
+	tv.tv_usec = (long)((seconds - (double)tv.tv_sec) * 1.0E6);
+	return tv;
+}
+
+/**
+ * @fn	static void putInt(vector<uint8_t> &payload, int32_t value)
+ * @brief	Appends a 32 bit integer to a payload, little endian.
+ * @param [in,out]	payload	The payload.
+ * @param 		  	value  	The value.
+ */
+
+static void putInt(vector<uint8_t>& payload, int32_t value) {
+	uint32_t bits = (uint32_t)value;
+	for (int i = 0; i < 4; i++) {
+		payload.push_back((uint8_t)(bits >> (8 * i)));
+	}
+}
+
+/**
+ * @fn	static void putDouble(vector<uint8_t> &payload, double value)
+ * @brief	Appends a double precision number to a payload, little endian.
+ * @param [in,out]	payload	The payload.
+ * @param 		  	value  	The value.
+ */
+
+static void putDouble(vector<uint8_t>& payload, double value) {
+	uint64_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	for (int i = 0; i < 8; i++) {
+		payload.push_back((uint8_t)(bits >> (8 * i)));
+	}
+}
+
+/**
+ * @struct	MessageReader
+ * @brief	Reads the values written by putInt and putDouble back out of a
+ * 			payload. Reading past the end yields zeros and clears ok.
+ */
+
+struct MessageReader {
+	const vector<uint8_t>& payload;		//!< The payload
+	size_t position = 0;				//!< Next byte to read
+	bool ok = true;						//!< False ==> a read went past the end
+
+	MessageReader(const vector<uint8_t>& payload) : payload(payload) {}
+
+	uint64_t getBits(int bytes) {
+		if (position + bytes > payload.size()) {
+			ok = false;
+			return 0;
+		}
+		uint64_t bits = 0;
+		for (int i = 0; i < bytes; i++) {
+			bits |= (uint64_t)payload[position++] << (8 * i);
+		}
+		return bits;
+	}
+	int32_t getInt() { return (int32_t)(uint32_t)getBits(4); }
+	double getDouble() {
+		uint64_t bits = getBits(8);
+		double value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+};
+
+TcpSocket::TcpSocket(TcpSocket&& other) noexcept
+	: handle(other.handle) {
+	other.handle = -1;
+}
+
+TcpSocket& TcpSocket::operator=(TcpSocket&& other) noexcept {
+	if (this != &other) {
+		close();
+		handle = other.handle;
+		other.handle = -1;
+	}
+	return *this;
+}
+
+TcpSocket::~TcpSocket() {
+	close();
+}
+
+/**
+ * @fn	void TcpSocket::close()
+ * @brief	Closes the socket, if it is open.
+ */
+
+void TcpSocket::close() {
+	if (handle != -1) {
+		closeNative(handle);
+		handle = -1;
+	}
+}
+
+/**
+ * @fn	TcpSocket TcpSocket::listenOn(int port)
+ * @brief	Opens a socket listening for connections on a port of every interface.
+ * @param	port	The port.
+ * @return	The socket. Not open ==> the port could not be used.
+ */
+
+TcpSocket TcpSocket::listenOn(int port) {
+	TcpSocket result;
+	if (!startNetworking()) {
+		return result;
+	}
+	result.handle = toHandle(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+	if (!result.isOpen()) {
+		return result;
+	}
+	int reuse = 1;
+	setsockopt((NativeSocket)result.handle, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+	sockaddr_in address;
+	std::memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons((uint16_t)port);
+	if (bind((NativeSocket)result.handle, (const sockaddr*)&address, sizeof(address)) != 0 ||
+		::listen((NativeSocket)result.handle, SOMAXCONN) != 0) {
+		result.close();
+	}
+	return result;
+}
+
+/**
+ * @fn	TcpSocket TcpSocket::connectTo(const string &host, int port)
+ * @brief	Connects to a port of a host, given by name or address.
+ * @param	host	The host.
+ * @param	port	The port.
+ * @return	The connection. Not open ==> it could not be made.
+ */
+
+TcpSocket TcpSocket::connectTo(const string& host, int port) {
+	TcpSocket result;
+	if (!startNetworking()) {
+		return result;
+	}
+	addrinfo hints;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* addresses = nullptr;
+	if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) {
+		return result;
+	}
+	for (addrinfo* a = addresses; a != nullptr && !result.isOpen(); a = a->ai_next) {
+		result.handle = toHandle(socket(a->ai_family, a->ai_socktype, a->ai_protocol));
+		if (result.isOpen() && connect((NativeSocket)result.handle, a->ai_addr, (SocketLength)a->ai_addrlen) != 0) {
+			result.close();
+		}
+	}
+	freeaddrinfo(addresses);
+	if (result.isOpen()) {
+		int noDelay = 1;
+		setsockopt((NativeSocket)result.handle, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+	}
+	return result;
+}
+
+/**
+ * @fn	vector<int> TcpSocket::waitForReadable(const vector<const TcpSocket*> &sockets, double seconds)
+ * @brief	Waits until at least one of some sockets has data (or a connection, or has
+ * 			been closed by its peer), or until a timeout.
+ * @param	sockets	The sockets. All must be open.
+ * @param	seconds	The timeout.
+ * @return	The indices of the sockets that can be read without blocking. Empty ==>
+ * 			timed out.
+ */
+
+vector<int> TcpSocket::waitForReadable(const vector<const TcpSocket*>& sockets, double seconds) {
+	fd_set readable;
+	FD_ZERO(&readable);
+	NativeSocket highest = 0;
+	for (const TcpSocket* s : sockets) {
+		FD_SET((NativeSocket)s->handle, &readable);
+		highest = std::max(highest, (NativeSocket)s->handle);
+	}
+	timeval tv = toTimeval(seconds);
+	vector<int> ready;
+	if (select((int)highest + 1, &readable, nullptr, nullptr, &tv) > 0) {
+		for (int i = 0; i < (int)sockets.size(); i++) {
+			if (FD_ISSET((NativeSocket)sockets[i]->handle, &readable)) {
+				ready.push_back(i);
+			}
+		}
+	}
+	return ready;
+}
+
+/**
+ * @fn	TcpSocket TcpSocket::accept(double seconds) const
+ * @brief	Accepts the next connection to a listening socket.
+ * @param	seconds	How long to wait for one.
+ * @return	The connection. Not open ==> none arrived in time.
+ */
+
+TcpSocket TcpSocket::accept(double seconds) const {
+	TcpSocket result;
+	if (!isOpen() || waitForReadable({ this }, seconds).empty()) {
+		return result;
+	}
+	result.handle = toHandle(::accept((NativeSocket)handle, nullptr, nullptr));
+	if (result.isOpen()) {
+		int noDelay = 1;
+		setsockopt((NativeSocket)result.handle, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+	}
+	return result;
+}
+
+/**
+ * @fn	void TcpSocket::setReceiveTimeout(double seconds)
+ * @brief	Limits how long a receive may block, so that a peer that stops halfway
+ * 			through a message cannot hang this end.
+ * @param	seconds	The timeout. 0 ==> wait forever.
+ */
+
+void TcpSocket::setReceiveTimeout(double seconds) {
+#ifdef WINDOWS
+	DWORD ms = (DWORD)(seconds * 1000.0);
+	setsockopt((NativeSocket)handle, SOL_SOCKET, SO_RCVTIMEO, (const char*)&ms, sizeof(ms));
+#else
+	timeval tv = toTimeval(seconds);
+	setsockopt((NativeSocket)handle, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+#endif
+}
+
+/**
+ * @fn	bool TcpSocket::sendAll(const void *data, size_t size)
+ * @brief	Sends every byte of a buffer.
+ * @param	data	The buffer.
+ * @param	size	Its size in bytes.
+ * @return	True iff all were sent. False ==> the connection is lost, and is closed.
+ */
+
+bool TcpSocket::sendAll(const void* data, size_t size) {
+	const char* bytes = (const char*)data;
+	while (size > 0 && isOpen()) {
+		int sent = (int)send((NativeSocket)handle, bytes, (int)std::min(size, (size_t)1 << 20), 0);
+		if (sent <= 0) {
+			close();
+			return false;
+		}
+		bytes += sent;
+		size -= sent;
+	}
+	return isOpen();
+}
+
+/**
+ * @fn	bool TcpSocket::receiveAll(void *data, size_t size)
+ * @brief	Receives exactly size bytes.
+ * @param [out]	data	Where to put them.
+ * @param 	   	size	The number of bytes.
+ * @return	True iff all arrived. False ==> the connection is lost or timed out, and is
+ * 			closed.
+ */
+
+bool TcpSocket::receiveAll(void* data, size_t size) {
+	char* bytes = (char*)data;
+	while (size > 0 && isOpen()) {
+		int received = (int)recv((NativeSocket)handle, bytes, (int)std::min(size, (size_t)1 << 20), 0);
+		if (received <= 0) {
+			close();
+			return false;
+		}
+		bytes += received;
+		size -= received;
+	}
+	return isOpen();
+}
+
+/**
+ * @fn	bool TcpSocket::sendMessage(RenderMessage type, const vector<uint8_t> &payload)
+ * @brief	Sends one message.
+ * @param	type   	The kind of message.
+ * @param	payload	The payload.
+ * @return	True iff it was sent.
+ */
+
+bool TcpSocket::sendMessage(RenderMessage type, const vector<uint8_t>& payload) {
+	vector<uint8_t> message;
+	message.reserve(8 + payload.size());
+	putInt(message, (int32_t)type);
+	putInt(message, (int32_t)payload.size());
+	message.insert(message.end(), payload.begin(), payload.end());
+	return sendAll(message.data(), message.size());
+}
+
+/**
+ * @fn	bool TcpSocket::receiveMessage(RenderMessage &type, vector<uint8_t> &payload)
+ * @brief	Receives one message, blocking until it arrives.
+ * @param [out]	type   	The kind of message.
+ * @param [out]	payload	The payload.
+ * @return	True iff a whole message arrived.
+ */
+
+bool TcpSocket::receiveMessage(RenderMessage& type, vector<uint8_t>& payload) {
+	vector<uint8_t> header(8);
+	if (!receiveAll(header.data(), header.size())) {
+		return false;
+	}
+	MessageReader reader(header);
+	type = (RenderMessage)reader.getInt();
+	uint32_t length = (uint32_t)reader.getInt();
+	if (length > MAX_MESSAGE_SIZE) {
+		close();
+		return false;
+	}
+	payload.resize(length);
+	return length == 0 || receiveAll(payload.data(), length);
+}
+
+/**
+ * @fn	bool RenderCoordinator::listen(int port)
+ * @brief	Starts listening for workers.
+ * @param	port	The port.
+ * @return	True iff the port could be used.
+ */
+
+bool RenderCoordinator::listen(int port) {
+	listener = TcpSocket::listenOn(port);
+	return listener.isOpen();
+}
+
+/**
+ * @fn	int RenderCoordinator::acceptWorkers(int count, double seconds)
+ * @brief	Waits for workers to connect and introduce themselves. Workers speaking a
+ * 			different protocol version are turned away.
+ * @param	count  	The number of workers wanted.
+ * @param	seconds	How long to wait for them all.
+ * @return	The number of workers connected now.
+ */
+
+int RenderCoordinator::acceptWorkers(int count, double seconds) {
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+	for (int accepted = 0; accepted < count; ) {
+		double remaining = std::chrono::duration<double>(deadline - std::chrono::steady_clock::now()).count();
+		if (remaining <= 0.0) {
+			break;
+		}
+		TcpSocket socket = listener.accept(remaining);
+		if (!socket.isOpen()) {
+			continue;
+		}
+		socket.setReceiveTimeout(tileTimeout);
+		RenderMessage type;
+		vector<uint8_t> payload;
+		if (socket.receiveMessage(type, payload) && type == RenderMessage::HELLO &&
+			MessageReader(payload).getInt() == DISTRIBUTED_PROTOCOL_VERSION) {
+			workers.emplace_back();
+			workers.back().socket = std::move(socket);
+			accepted++;
+		}
+	}
+	return workerCount();
+}
+
+/**
+ * @fn	bool RenderCoordinator::assignTile(WorkerConnection &worker, int tile)
+ * @brief	Sends a tile of the current frame to a worker.
+ * @param [in,out]	worker	The worker.
+ * @param 		  	tile  	Index of the tile.
+ * @return	True iff it was sent. False ==> the worker is marked failed.
+ */
+
+bool RenderCoordinator::assignTile(WorkerConnection& worker, int tile) {
+	vector<uint8_t> payload;
+	for (int32_t value : { frameNumber, tile, tiles[tile].x0, tiles[tile].y0, tiles[tile].x1, tiles[tile].y1 }) {
+		putInt(payload, value);
+	}
+	worker.tiles.push_back(std::make_pair(tile, std::chrono::steady_clock::now()));
+	if (!worker.socket.sendMessage(RenderMessage::TILE, payload)) {
+		worker.failed = true;
+	}
+	return !worker.failed;
+}
+
+/**
+ * @fn	void RenderCoordinator::dropFailedWorkers(std::deque<int> &pending)
+ * @brief	Disconnects the workers marked failed, and puts the tiles they held back at
+ * 			the front of the queue.
+ * @param [in,out]	pending	The tiles waiting for a worker.
+ */
+
+void RenderCoordinator::dropFailedWorkers(std::deque<int>& pending) {
+	for (WorkerConnection& worker : workers) {
+		if (worker.failed) {
+			for (const auto& tile : worker.tiles) {
+				pending.push_front(tile.first);
+			}
+			std::cerr << "Dropped a render worker; " << worker.tiles.size() << " tile(s) reassigned" << endl;
+		}
+	}
+	workers.erase(std::remove_if(workers.begin(), workers.end(),
+		[](const WorkerConnection& worker) { return worker.failed; }), workers.end());
+}
+
+/**
+ * @fn	void RenderCoordinator::render(FrameBuffer &frameBuffer, RayTracer &rayTracer, const IScene &theScene, int depth, int N, const vector<double> &state)
+ * @brief	Traces a frame on the workers and assembles it in the framebuffer, in place of
+ * 			RayTracer::raytraceScene. Tiles go first to the workers that return them
+ * 			first. Lost workers' tiles are traced again by others, or by rayTracer once
+ * 			none are left. The frame is finished by rayTracer.finishFrame, so denoising
+ * 			and overlays happen here.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param [in,out]	rayTracer  	Finishes the frame, and traces it if no workers remain.
+ * @param 		  	theScene   	The scene, set up for this frame.
+ * @param 		  	depth	   	The recursion depth.
+ * @param 		  	N		   	Rays per pixel in each direction.
+ * @param 		  	state	   	Whatever the workers' FrameSetup needs to match theScene.
+ */
+
+void RenderCoordinator::render(FrameBuffer& frameBuffer, RayTracer& rayTracer, const IScene& theScene,
+	int depth, int N, const vector<double>& state) {
+	const int width = frameBuffer.getWindowWidth();
+	const int height = frameBuffer.getWindowHeight();
+	frameNumber++;
+	tilesTracedLocally = 0;
+
+	// The leading 2 tells these checkpoints from those of other renderers
+	vector<double> settings = { 2.0, (double)depth, (double)N,
+		(double)frameBuffer.isAccumulationEnabled() };
+	settings.insert(settings.end(), state.begin(), state.end());
+	checkpoint.begin(frameBuffer, RenderCheckpoint::sceneKey(theScene, width, height, settings), nullptr, tileSize);
+	tiles = checkpoint.getTiles();
+
+	std::deque<int> pending;
+	for (int i = 0; i < (int)tiles.size(); i++) {
+		if (!checkpoint.isTileDone(i)) {
+			pending.push_back(i);
+		}
+	}
+	const double weight = N > 1 ? N * N : 1;
+	vector<color> colors;
+	int remaining = (int)pending.size();
+
+	vector<uint8_t> frame;
+	for (int32_t value : { frameNumber, width, height, depth, N, (int)state.size() }) {
+		putInt(frame, value);
+	}
+	for (double value : state) {
+		putDouble(frame, value);
+	}
+	for (WorkerConnection& worker : workers) {
+		worker.tiles.clear();
+		worker.failed = !worker.socket.sendMessage(RenderMessage::FRAME, frame);
+	}
+	dropFailedWorkers(pending);
+
+	while (remaining > 0) {
+		for (WorkerConnection& worker : workers) {
+			while (!worker.failed && (int)worker.tiles.size() < tilesInFlight && !pending.empty()) {
+				int tile = pending.front();
+				pending.pop_front();
+				assignTile(worker, tile);
+			}
+		}
+		dropFailedWorkers(pending);
+
+		if (workers.empty()) {
+			for (int tile : pending) {
+				const RenderTile& t = tiles[tile];
+				rayTracer.raytraceTile(colors, t.x0, t.y0, t.x1, t.y1, theScene, depth, N);
+				storeTile(frameBuffer, t, colors, weight);
+				checkpoint.tileDone(frameBuffer, tile);
+				tilesTracedLocally++;
+				remaining--;
+			}
+			pending.clear();
+			break;
+		}
+
+		vector<const TcpSocket*> sockets;
+		for (const WorkerConnection& worker : workers) {
+			sockets.push_back(&worker.socket);
+		}
+		for (int i : TcpSocket::waitForReadable(sockets, 0.25)) {
+			WorkerConnection& worker = workers[i];
+			RenderMessage type;
+			vector<uint8_t> payload;
+			if (!worker.socket.receiveMessage(type, payload) || type != RenderMessage::RESULT) {
+				worker.failed = true;
+				continue;
+			}
+			MessageReader reader(payload);
+			const int frameOfResult = reader.getInt();
+			const int tile = reader.getInt();
+			auto held = std::find_if(worker.tiles.begin(), worker.tiles.end(),
+				[tile](const std::pair<int, std::chrono::steady_clock::time_point>& t) { return t.first == tile; });
+			if (frameOfResult != frameNumber || held == worker.tiles.end()) {
+				worker.failed = true;
+				continue;
+			}
+			const RenderTile& t = tiles[tile];
+			colors.resize((size_t)(t.x1 - t.x0) * (t.y1 - t.y0));
+			for (color& C : colors) {
+				C.r = reader.getDouble();
+				C.g = reader.getDouble();
+				C.b = reader.getDouble();
+			}
+			if (!reader.ok) {
+				worker.failed = true;
+				continue;
+			}
+			worker.tiles.erase(held);
+			storeTile(frameBuffer, t, colors, weight);
+			checkpoint.tileDone(frameBuffer, tile);
+			remaining--;
+		}
+
+		const auto now = std::chrono::steady_clock::now();
+		for (WorkerConnection& worker : workers) {
+			if (!worker.tiles.empty() &&
+				std::chrono::duration<double>(now - worker.tiles.front().second).count() > tileTimeout) {
+				worker.failed = true;
+			}
+		}
+		dropFailedWorkers(pending);
+	}
+
+	checkpoint.finish();
+	rayTracer.finishFrame(frameBuffer, theScene);
+}
+
+/**
+ * @fn	void RenderCoordinator::shutdown()
+ * @brief	Tells every worker to quit, and disconnects them.
+ */
+
+void RenderCoordinator::shutdown() {
+	for (WorkerConnection& worker : workers) {
+		worker.socket.sendMessage(RenderMessage::QUIT, vector<uint8_t>());
+	}
+	workers.clear();
+	listener.close();
+}
+
+/**
+ * @fn	bool RenderWorker::run(const string &host, int port, RayTracer &rayTracer, IScene &theScene, const FrameSetup &setup)
+ * @brief	Connects to a coordinator, retrying for up to connectTimeout seconds, and
+ * 			traces the tiles it sends until it says to quit.
+ * @param 		  	host	 	The coordinator's host.
+ * @param 		  	port	 	The coordinator's port.
+ * @param [in,out]	rayTracer	Traces the tiles.
+ * @param [in,out]	theScene 	The scene, built the same way as the coordinator's.
+ * @param 		  	setup	 	Applies each frame's state to theScene, and sets its camera.
+ * @return	True iff the coordinator said to quit. False ==> it could not be reached, or
+ * 			was lost.
+ */
+
+bool RenderWorker::run(const string& host, int port, RayTracer& rayTracer, IScene& theScene,
+	const FrameSetup& setup) {
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(connectTimeout);
+	TcpSocket socket = TcpSocket::connectTo(host, port);
+	while (!socket.isOpen() && std::chrono::steady_clock::now() < deadline) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		socket = TcpSocket::connectTo(host, port);
+	}
+	vector<uint8_t> hello;
+	putInt(hello, DISTRIBUTED_PROTOCOL_VERSION);
+	if (!socket.sendMessage(RenderMessage::HELLO, hello)) {
+		return false;
+	}
+
+	int frameNumber = 0, width = 0, height = 0, depth = 0, N = 1;
+	RenderMessage type;
+	vector<uint8_t> payload;
+	while (socket.receiveMessage(type, payload)) {
+		MessageReader reader(payload);
+		if (type == RenderMessage::FRAME) {
+			frameNumber = reader.getInt();
+			width = reader.getInt();
+			height = reader.getInt();
+			depth = reader.getInt();
+			N = reader.getInt();
+			const int count = reader.getInt();
+			if (count < 0 || (size_t)count > payload.size() / 8) {
+				return false;
+			}
+			vector<double> state(count);
+			for (double& value : state) {
+				value = reader.getDouble();
+			}
+			if (!reader.ok) {
+				return false;
+			}
+			setup(state, width, height);
+		} else if (type == RenderMessage::TILE) {
+			const int frameOfTile = reader.getInt();
+			const int tile = reader.getInt();
+			RenderTile t;
+			t.x0 = reader.getInt();
+			t.y0 = reader.getInt();
+			t.x1 = reader.getInt();
+			t.y1 = reader.getInt();
+			if (!reader.ok || frameOfTile != frameNumber || t.x0 < 0 || t.y0 < 0 ||
+				t.x1 > width || t.y1 > height || t.x0 >= t.x1 || t.y0 >= t.y1) {
+				return false;
+			}
+			vector<color> colors;
+			rayTracer.raytraceTile(colors, t.x0, t.y0, t.x1, t.y1, theScene, depth, N);
+
+			vector<uint8_t> result;
+			result.reserve(8 + 24 * colors.size());
+			putInt(result, frameNumber);
+			putInt(result, tile);
+			for (const color& C : colors) {
+				putDouble(result, C.r);
+				putDouble(result, C.g);
+				putDouble(result, C.b);
+			}
+			if (!socket.sendMessage(RenderMessage::RESULT, result)) {
+				return false;
+			}
+		} else {
+			return type == RenderMessage::QUIT;
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	bool launchLocalWorkers(const string &executable, int port, int count)
+ * @brief	Starts worker processes on this machine, in the background. Each runs
+ * 			"executable --worker localhost port".
+ * @param	executable	The program to run, usually argv[0].
+ * @param	port	  	The port the coordinator is listening on.
+ * @param	count	  	The number of workers.
+ * @return	True iff every process could be started.
+ */
+
+bool launchLocalWorkers(const string& executable, int port, int count) {
+	bool launched = true;
+	for (int i = 0; i < count; i++) {
+#ifdef WINDOWS
+		string command = "start \"\" /B \"" + executable + "\" --worker localhost " + std::to_string(port);
+#else
+		string command = "\"" + executable + "\" --worker localhost " + std::to_string(port) + " &";
+#endif
+		launched = std::system(command.c_str()) == 0 && launched;
+	}
+	return launched;
+}
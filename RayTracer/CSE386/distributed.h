@@ -0,0 +1,142 @@
+/****************************************************
+ * 2016-2025 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include "utilities.h"
+#include "framebuffer.h"
+#include "iscene.h"
+#include "raytracer.h"
+
+const int DISTRIBUTED_PROTOCOL_VERSION = 1;	//!< Must be the same in the coordinator and its workers
+const int DISTRIBUTED_DEFAULT_PORT = 38600;	//!< Port the coordinator listens on, unless told otherwise
+const int DISTRIBUTED_TILE_SIZE = 32;		//!< Width and height of the tiles handed to workers
+
+/**
+ * @enum	RenderMessage
+ * @brief	The kinds of message sent between a coordinator and its workers. Every
+ * 			message is an 8 byte header (type and payload length, both 32 bit little
+ * 			endian) followed by the payload.
+ */
+
+enum class RenderMessage : int32_t {
+	HELLO = 1,	//!< Worker to coordinator: protocol version
+	FRAME,		//!< Coordinator to worker: frame number, width, height, depth, N, state
+	TILE,		//!< Coordinator to worker: frame number, tile number, x0, y0, x1, y1
+	RESULT,		//!< Worker to coordinator: frame number, tile number, colors of the tile
+	QUIT		//!< Coordinator to worker: no more frames
+};
+
+/**
+ * @class	TcpSocket
+ * @brief	A TCP connection, or a socket listening for them, that can send and receive
+ * 			whole messages. Wraps Winsock on Windows and BSD sockets elsewhere. Closes
+ * 			itself when destroyed; it can be moved but not copied.
+ */
+
+class TcpSocket {
+public:
+	TcpSocket() = default;
+	TcpSocket(TcpSocket&& other) noexcept;
+	TcpSocket& operator=(TcpSocket&& other) noexcept;
+	TcpSocket(const TcpSocket&) = delete;
+	TcpSocket& operator=(const TcpSocket&) = delete;
+	~TcpSocket();
+	static TcpSocket listenOn(int port);
+	static TcpSocket connectTo(const string& host, int port);
+	static vector<int> waitForReadable(const vector<const TcpSocket*>& sockets, double seconds);
+	TcpSocket accept(double seconds) const;
+	void setReceiveTimeout(double seconds);
+	bool sendMessage(RenderMessage type, const vector<uint8_t>& payload);
+	bool receiveMessage(RenderMessage& type, vector<uint8_t>& payload);
+	bool isOpen() const { return handle != -1; }
+	void close();
+protected:
+	bool sendAll(const void* data, size_t size);
+	bool receiveAll(void* data, size_t size);
+	std::intptr_t handle = -1;	//!< The native socket. -1 ==> none
+};
+
+/**
+ * @struct	WorkerConnection
+ * @brief	The coordinator's end of one worker, and the tiles it is working on.
+ */
+
+struct WorkerConnection {
+	TcpSocket socket;				//!< The connection
+	std::deque<std::pair<int, std::chrono::steady_clock::time_point>> tiles;	//!< Tiles sent, and when
+	bool failed = false;			//!< True ==> to be dropped, and its tiles handed to others
+};
+
+/**
+ * @class	RenderCoordinator
+ * @brief	Divides frames into tiles and farms them out to worker processes, which may
+ * 			be on this machine or others. Each worker builds the same scene itself and
+ * 			is told, with each frame, the state the application passes to render (light
+ * 			positions, say), which it applies before tracing.
+ *
+ * 			Tiles are handed out dynamically: each worker holds at most tilesInFlight
+ * 			at once, and gets another as each one comes back, so faster workers do more
+ * 			of the frame. A worker that disconnects, sends something unexpected, or
+ * 			holds a tile longer than tileTimeout is dropped, and its tiles go to the
+ * 			others. If every worker is lost, the rest of the frame is traced here.
+ * 			With checkpoint.filename set, finished tiles are saved as they arrive, and
+ * 			a restarted coordinator hands out only the tiles still missing.
+ */
+
+class RenderCoordinator {
+public:
+	bool listen(int port = DISTRIBUTED_DEFAULT_PORT);
+	int acceptWorkers(int count, double seconds);
+	void render(FrameBuffer& frameBuffer, RayTracer& rayTracer, const IScene& theScene,
+		int depth, int N, const vector<double>& state);
+	void shutdown();
+	int workerCount() const { return (int)workers.size(); }
+
+	int tileSize = DISTRIBUTED_TILE_SIZE;	//!< Width and height of each tile
+	int tilesInFlight = 2;					//!< Tiles a worker may hold at once. > 1 hides the round trip
+	double tileTimeout = 30.0;				//!< Seconds a worker may hold a tile before it is dropped
+	int tilesTracedLocally = 0;				//!< Tiles of the last frame traced here, after workers were lost
+	RenderCheckpoint checkpoint;			//!< Saves frames in progress, if its filename is set
+protected:
+	bool assignTile(WorkerConnection& worker, int tile);
+	void dropFailedWorkers(std::deque<int>& pending);
+	TcpSocket listener;						//!< Accepts workers
+	vector<WorkerConnection> workers;		//!< The workers still connected
+	vector<RenderTile> tiles;				//!< The tiles of the current frame
+	int frameNumber = 0;					//!< Number of the current frame
+};
+
+/**
+ * @typedef	std::function<void(const vector<double>& state, int width, int height)> FrameSetup
+ * @brief	Applies the state the coordinator sent with a frame to a worker's scene, and
+ * 			sets up its camera for an image of the given size.
+ */
+
+typedef std::function<void(const vector<double>& state, int width, int height)> FrameSetup;
+
+/**
+ * @class	RenderWorker
+ * @brief	Connects to a coordinator and traces the tiles it is sent until it is told to
+ * 			quit.
+ */
+
+class RenderWorker {
+public:
+	bool run(const string& host, int port, RayTracer& rayTracer, IScene& theScene,
+		const FrameSetup& setup);
+
+	double connectTimeout = 10.0;	//!< Seconds to keep trying to reach the coordinator
+};
+
+bool launchLocalWorkers(const string& executable, int port, int count);
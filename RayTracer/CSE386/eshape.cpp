@@ -9,7 +9,266 @@
 
 #include <fstream>
 #include <sstream>
+#include <unordered_map>
 #include "eshape.h"
+
+/**
+ * @fn	unsigned int EShapeData::addVertex(const VertexData &v)
+ * @brief	Appends a vertex to the vertex buffer.
+ * @param	v	The vertex.
+ * @return	The index of the new vertex.
+ */
+
+unsigned int EShapeData::addVertex(const VertexData& v) {
+	vertices.push_back(v);
+	return (unsigned int)vertices.size() - 1;
+}
+
+/**
+ * @fn	void EShapeData::addTriangle(unsigned int a, unsigned int b, unsigned int c)
+ * @brief	Appends a triangle to the index buffer. Vertices are specified in
+ * 			counterclockwise order. The first vertex is the provoking vertex, which
+ * 			supplies the material for the whole triangle.
+ * @param	a	Index of the first vertex.
+ * @param	b	Index of the second vertex.
+ * @param	c	Index of the third vertex.
+ */
+
+void EShapeData::addTriangle(unsigned int a, unsigned int b, unsigned int c) {
+	indices.push_back(a);
+	indices.push_back(b);
+	indices.push_back(c);
+}
+
+/**
+ * @struct	VertexHash
+ * @brief	Hashes and compares vertices bit for bit, so that exact duplicates can be welded.
+ */
+
+struct VertexHash {
+	static size_t combine(size_t h, double d) {
+		return h ^ (std::hash<double>()(d) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+	}
+	size_t operator()(const VertexData& v) const {
+		size_t h = std::hash<int>()(v.materialID);
+		for (int i = 0; i < 4; i++) h = combine(h, v.pos[i]);
+		for (int i = 0; i < 3; i++) h = combine(h, v.normal[i]);
+		for (int i = 0; i < 2; i++) h = combine(h, v.textCoord[i]);
+		return h;
+	}
+	bool operator()(const VertexData& a, const VertexData& b) const {
+		return a.pos == b.pos && a.normal == b.normal && a.textCoord == b.textCoord &&
+			a.worldPos == b.worldPos && a.materialID == b.materialID && a.w == b.w;
+	}
+};
+
+/**
+ * @fn	EShapeData EShapeData::fromTriangleSoup(const vector<VertexData> &soup)
+ * @brief	Builds an indexed mesh from a vector of vertices in which each successive
+ * 			triplet is a triangle. Vertices that are exactly equal are stored once.
+ * @param	soup	The triangles.
+ * @return	The indexed mesh.
+ */
+
+EShapeData EShapeData::fromTriangleSoup(const vector<VertexData>& soup) {
+	EShapeData result;
+	std::unordered_map<VertexData, unsigned int, VertexHash, VertexHash> unique;
+	result.indices.reserve(soup.size());
+	for (const VertexData& v : soup) {
+		auto it = unique.find(v);
+		if (it == unique.end()) {
+			it = unique.emplace(v, result.addVertex(v)).first;
+		}
+		result.indices.push_back(it->second);
+	}
+	return result;
+}
+
+const int VERTEX_CACHE_SIZE = 32;	//!< Size of the FIFO cache modeled when ordering triangles.
+
+/**
+ * @fn	static double vertexCacheScore(int cachePosition, int remainingTriangles)
+ * @brief	Scores how much drawing a triangle that uses a vertex would help the cache.
+ * 			Vertices near the front of the cache score well, as do vertices with few
+ * 			triangles left to draw, so that no vertex is left behind for long.
+ * @param	cachePosition	  	Position in the modeled cache, or -1 if not in it.
+ * @param	remainingTriangles	Number of triangles using the vertex not yet drawn.
+ * @return	The score.
+ */
+
+static double vertexCacheScore(int cachePosition, int remainingTriangles) {
+	if (remainingTriangles == 0) {
+		return -1.0;
+	}
+	double score = 0.0;
+	if (cachePosition >= 0) {
+		if (cachePosition < 3) {	// Used by the last triangle
+			score = 0.75;
+		} else {
+			double t = 1.0 - (cachePosition - 3) / (double)(VERTEX_CACHE_SIZE - 3);
+			score = std::pow(t, 1.5);
+		}
+	}
+	return score + 2.0 / std::sqrt((double)remainingTriangles);
+}
+
+/**
+ * @fn	void EShapeData::optimizeVertexCacheOrder()
+ * @brief	Reorders the triangles so that consecutive triangles share vertices, which keeps
+ * 			the post-transform vertex cache warm (Forsyth's greedy algorithm). The vertices
+ * 			are then renumbered in the order they are first used, so the vertex buffer is
+ * 			read nearly sequentially. Each triangle keeps its winding and provoking vertex.
+ * 			Meant to run once, when the shape is created.
+ */
+
+void EShapeData::optimizeVertexCacheOrder() {
+	const int numTris = numTriangles();
+	const int numVerts = (int)vertices.size();
+	if (numTris == 0) {
+		return;
+	}
+
+	// The triangles using each vertex. The first remaining[v] entries are not drawn yet.
+	vector<int> firstTri(numVerts + 1, 0);
+	for (unsigned int idx : indices) {
+		firstTri[idx + 1]++;
+	}
+	for (int v = 0; v < numVerts; v++) {
+		firstTri[v + 1] += firstTri[v];
+	}
+	vector<int> vertTris(indices.size());
+	vector<int> remaining(numVerts, 0);
+	for (int t = 0; t < numTris; t++) {
+		for (int i = 0; i < 3; i++) {
+			int v = indices[3 * t + i];
+			vertTris[firstTri[v] + remaining[v]++] = t;
+		}
+	}
+
+	vector<int> cachePosition(numVerts, -1);
+	vector<double> vertScore(numVerts);
+	for (int v = 0; v < numVerts; v++) {
+		vertScore[v] = vertexCacheScore(-1, remaining[v]);
+	}
+	vector<double> triScore(numTris);
+	vector<bool> drawn(numTris, false);
+	int best = 0;
+	for (int t = 0; t < numTris; t++) {
+		triScore[t] = vertScore[indices[3 * t]] + vertScore[indices[3 * t + 1]] + vertScore[indices[3 * t + 2]];
+		if (triScore[t] > triScore[best]) {
+			best = t;
+		}
+	}
+
+	vector<unsigned int> newIndices;
+	newIndices.reserve(indices.size());
+	vector<int> cache;
+	vector<int> newCache;
+	int nextUndrawn = 0;
+	while ((int)newIndices.size() < 3 * numTris) {
+		if (best < 0) {		// Nothing in the cache helps; start somewhere new
+			while (drawn[nextUndrawn]) {
+				nextUndrawn++;
+			}
+			best = nextUndrawn;
+		}
+		drawn[best] = true;
+		newCache.clear();
+		for (int i = 0; i < 3; i++) {
+			int v = indices[3 * best + i];
+			newIndices.push_back(v);
+			newCache.push_back(v);
+			int* tris = &vertTris[firstTri[v]];
+			int n = remaining[v]--;
+			for (int j = 0; j < n; j++) {
+				if (tris[j] == best) {
+					std::swap(tris[j], tris[n - 1]);
+					break;
+				}
+			}
+		}
+		for (int v : cache) {
+			if (v != newCache[0] && v != newCache[1] && v != newCache[2]) {
+				newCache.push_back(v);
+			}
+		}
+
+		// Rescore the cached vertices, including any just pushed out, then their triangles
+		for (int i = 0; i < (int)newCache.size(); i++) {
+			int v = newCache[i];
+			cachePosition[v] = i < VERTEX_CACHE_SIZE ? i : -1;
+			vertScore[v] = vertexCacheScore(cachePosition[v], remaining[v]);
+		}
+		best = -1;
+		for (int v : newCache) {
+			for (int j = 0; j < remaining[v]; j++) {
+				int t = vertTris[firstTri[v] + j];
+				triScore[t] = vertScore[indices[3 * t]] + vertScore[indices[3 * t + 1]] + vertScore[indices[3 * t + 2]];
+				if (best < 0 || triScore[t] > triScore[best]) {
+					best = t;
+				}
+			}
+		}
+		if (newCache.size() > VERTEX_CACHE_SIZE) {
+			newCache.resize(VERTEX_CACHE_SIZE);
+		}
+		std::swap(cache, newCache);
+	}
+
+	// Renumber the vertices in order of first use
+	vector<int> newNumber(numVerts, -1);
+	vector<VertexData> newVertices;
+	newVertices.reserve(numVerts);
+	for (unsigned int& idx : newIndices) {
+		if (newNumber[idx] < 0) {
+			newNumber[idx] = (int)newVertices.size();
+			newVertices.push_back(vertices[idx]);
+		}
+		idx = newNumber[idx];
+	}
+	vertices.swap(newVertices);
+	indices.swap(newIndices);
+}
+
+/**
+ * @fn	void EShapeData::computeBoundingSphere()
+ * @brief	Computes a sphere enclosing every vertex, centered on the center of the
+ * 			vertices' bounding box. Must be called again if the vertices change.
+ */
+
+void EShapeData::computeBoundingSphere() {
+	if (vertices.empty()) {
+		boundingCenter = ORIGIN3D;
+		boundingRadius = 0.0;
+		return;
+	}
+	dvec3 lo = vertices[0].pos.xyz();
+	dvec3 hi = lo;
+	for (const VertexData& v : vertices) {
+		lo = glm::min(lo, v.pos.xyz());
+		hi = glm::max(hi, v.pos.xyz());
+	}
+	boundingCenter = (lo + hi) / 2.0;
+	double radiusSquared = 0.0;
+	for (const VertexData& v : vertices) {
+		dvec3 d = v.pos.xyz() - boundingCenter;
+		radiusSquared = std::max(radiusSquared, glm::dot(d, d));
+	}
+	boundingRadius = std::sqrt(radiusSquared);
+}
+
+/**
+ * @fn	static void prepareForRendering(EShapeData &shape)
+ * @brief	The last step in creating a shape: orders it for the vertex cache and
+ * 			computes its bounding sphere.
+ * @param [in,out]	shape	The shape.
+ */
+
+static void prepareForRendering(EShapeData& shape) {
+	shape.optimizeVertexCacheOrder();
+	shape.computeBoundingSphere();
+}
+
  /**
   * @fn	EShapeData EShape::createEDisk(const Material &mat, int slices)
   * @brief	Creates a disk with radius 1, centered on origin and lying at z = 0
@@ -22,16 +281,18 @@ EShapeData EShape::createEDisk(const Material& mat, int slices) {
 	EShapeData result;
 
 	double angleInc = TWO_PI / slices;
+	int materialID = MaterialTable::getID(mat);
+	dvec3 normal(0.0, 0.0, 1.0);
 
+	unsigned int center = result.addVertex(VertexData(dvec4(0.0, 0.0, 0.0, 1.0), normal, materialID, ORIGIN3D));
 	for (int i = 0; i < slices; i++) {
-		double A1 = i * angleInc;
-		double A2 = A1 + angleInc;
-		dvec4 A(0.0, 0.0, 0.0, 1.0);
-		dvec4 B(std::cos(A1), std::sin(A1), 0.0, 1.0);
-		dvec4 C(std::cos(A2), std::sin(A2), 0.0, 1.0);
-		VertexData::addTriVertsAndComputeNormal(result, A, B, C, mat);
+		double A = i * angleInc;
+		result.addVertex(VertexData(dvec4(std::cos(A), std::sin(A), 0.0, 1.0), normal, materialID, ORIGIN3D));
 	}
-
+	for (int i = 0; i < slices; i++) {
+		result.addTriangle(center, 1 + i, 1 + (i + 1) % slices);
+	}
+	prepareForRendering(result);
 	return result;
 }
 
@@ -71,37 +332,29 @@ EShapeData EShape::createECylinder(const Material& mat, int slices) {
 	double topY = 0.5;
 	double bottomY = -topY;
 	double angInc = TWO_PI / slices;
-
+	int materialID = MaterialTable::getID(mat);
+	dvec3 dummyWorldPos(0.0, 0.0, 0.0);
+
+	// One column of vertices per angle. The seam is duplicated, since the
+	// texture coordinates differ there.
+	for (int i = 0; i <= slices; i++) {
+		double ang = i * angInc;
+		double x = glm::cos(ang);
+		double z = glm::sin(ang);
+		dvec3 normal = glm::normalize(dvec3(x, 0, z));
+		double u = map(ang, 0.0, TWO_PI, 0.0, 1.0);
+		data.addVertex(VertexData(dvec4(x, topY, z, 1), normal, materialID, dummyWorldPos, dvec2(u, 1.0)));
+		data.addVertex(VertexData(dvec4(x, bottomY, z, 1), normal, materialID, dummyWorldPos, dvec2(u, 0.0)));
+	}
 	for (int i = 0; i < slices; i++) {
-		double thisAng = i * angInc;
-		double nextAng = thisAng + angInc;
-		double x1 = glm::cos(thisAng);
-		double z1 = glm::sin(thisAng);
-		double x2 = glm::cos(nextAng);
-		double z2 = glm::sin(nextAng);
-		dvec4 thisNormal(x1, 0, z1, 0);
-		dvec4 nextNormal(x2, 0, z2, 0);
-		thisNormal = glm::normalize(thisNormal);
-		nextNormal = glm::normalize(nextNormal);
-
-		dvec2 thisTexCoordBottom(map(thisAng, 0.0, TWO_PI, 0.0, 1.0), 0.0);
-		dvec2 thisTexCoordTop(map(thisAng, 0.0, TWO_PI, 0.0, 1.0), 1.0);
-		dvec2 nextTexCoordBottom(map(nextAng, 0.0, TWO_PI, 0.0, 1.0), 0.0);
-		dvec2 nextTexCoordTop(map(nextAng, 0.0, TWO_PI, 0.0, 1.0), 1.0);
-
-		dvec3 dummyWorldPos(0.0, 0.0, 0.0);
-
-		VertexData c1(dvec4(x1, topY, z1, 1), thisNormal, mat, dummyWorldPos, thisTexCoordTop);
-		VertexData c2(dvec4(x1, bottomY, z1, 1), thisNormal, mat, dummyWorldPos, thisTexCoordBottom);
-		VertexData c3(dvec4(x2, bottomY, z2, 1), nextNormal, mat, dummyWorldPos, nextTexCoordBottom);
-		VertexData c4(dvec4(x2, topY, z2, 1), nextNormal, mat, dummyWorldPos, nextTexCoordTop);
-		data.push_back(c1);
-		data.push_back(c3);
-		data.push_back(c2);
-		data.push_back(c1);
-		data.push_back(c4);
-		data.push_back(c3);
+		unsigned int c1 = 2 * i;			// this top
+		unsigned int c2 = 2 * i + 1;		// this bottom
+		unsigned int c3 = 2 * i + 3;		// next bottom
+		unsigned int c4 = 2 * i + 2;		// next top
+		data.addTriangle(c1, c3, c2);
+		data.addTriangle(c1, c4, c3);
 	}
+	prepareForRendering(data);
 	return data;
 }
 
@@ -138,24 +391,20 @@ EShapeData EShape::createECone(const Material& mat, int slices) {
 
 	double radius = 1.0;
 	double height = 4.0;
+	int materialID = MaterialTable::getID(mat);
 
+	dvec4 tip(0.0, height, 0.0, 1.0);
+	unsigned int tipIndex = result.addVertex(VertexData(tip, glm::normalize(tip.xyz()), materialID, ORIGIN3D));
 	for (int i = 0; i < slices; i++) {
-
-		double A1 = i * INC;
-		double A2 = A1 + INC;
-		dvec4 tip(0.0, height, 0.0, 1.0);
-		dvec4 A(radius * cos(A1), 0.0, radius * sin(A1), 1.0);
-		dvec4 B(radius * cos(A2), 0.0, radius * sin(A2), 1.0);
-
-		dvec3 thisfaceNormal = normalFrom3Points(tip.xyz(), B.xyz(), A.xyz());
-
-		result.push_back(VertexData(tip, glm::normalize(tip), mat));
-
-		result.push_back(VertexData(B, glm::normalize(dvec3(cos(A2), atan(radius / height), sin(A2))), mat));
-
-		result.push_back(VertexData(A, glm::normalize(dvec3(cos(A1), atan(radius / height), sin(A1))), mat));
-
+		double A = i * INC;
+		dvec4 P(radius * cos(A), 0.0, radius * sin(A), 1.0);
+		dvec3 normal = glm::normalize(dvec3(cos(A), atan(radius / height), sin(A)));
+		result.addVertex(VertexData(P, normal, materialID, ORIGIN3D));
 	}
+	for (int i = 0; i < slices; i++) {
+		result.addTriangle(tipIndex, 1 + (i + 1) % slices, 1 + i);
+	}
+	prepareForRendering(result);
 	return result;
 }
 
@@ -172,8 +421,10 @@ EShapeData EShape::createECone(const Material& mat, int slices) {
 
 EShapeData EShape::createETriangle(const Material& mat,
 	const dvec4& A, const dvec4& B, const dvec4& C) {
-	EShapeData result;
-	VertexData::addTriVertsAndComputeNormal(result, A, B, C, mat);
+	vector<VertexData> soup;
+	VertexData::addTriVertsAndComputeNormal(soup, A, B, C, mat);
+	EShapeData result = EShapeData::fromTriangleSoup(soup);
+	result.computeBoundingSphere();
 	return result;
 }
 
@@ -191,6 +442,8 @@ EShapeData EShape::createETriangle(const Material& mat,
 EShapeData EShape::createECheckerBoard(const Material& mat1, const Material& mat2,
 	double WIDTH, double HEIGHT, int DIV) {
 	EShapeData result;
+	int materialID1 = MaterialTable::getID(mat1);
+	int materialID2 = MaterialTable::getID(mat2);
 
 	const double INC = WIDTH / DIV;
 	for (int X = 0; X < DIV; X++) {
@@ -200,24 +453,26 @@ EShapeData EShape::createECheckerBoard(const Material& mat1, const Material& mat
 			dvec4 V1 = V0 + dvec4(0.0, 0.0, INC, 0.0);
 			dvec4 V2 = V0 + dvec4(INC, 0.0, INC, 0.0);
 			dvec4 V3 = V0 + dvec4(INC, 0.0, 0.0, 0.0);
-			const Material& mat = isMat1 ? mat1 : mat2;
-			dvec4 Y(0, 1, 0, 0);
-			result.push_back(VertexData(V0, Y, mat));
-			result.push_back(VertexData(V1, Y, mat));
-			result.push_back(VertexData(V2, Y, mat));
-
-			result.push_back(VertexData(V2, Y, mat));
-			result.push_back(VertexData(V3, Y, mat));
-			result.push_back(VertexData(V0, Y, mat));
+			int materialID = isMat1 ? materialID1 : materialID2;
+			dvec3 Y(0, 1, 0);
+			// Squares do not share vertices, since neighbors differ in material
+			unsigned int i0 = result.addVertex(VertexData(V0, Y, materialID, ORIGIN3D));
+			unsigned int i1 = result.addVertex(VertexData(V1, Y, materialID, ORIGIN3D));
+			unsigned int i2 = result.addVertex(VertexData(V2, Y, materialID, ORIGIN3D));
+			unsigned int i3 = result.addVertex(VertexData(V3, Y, materialID, ORIGIN3D));
+			result.addTriangle(i0, i1, i2);
+			result.addTriangle(i2, i3, i0);
 			isMat1 = !isMat1;
 		}
 	}
+	prepareForRendering(result);
 	return result;
 }
 
 // This code provided by Jack Duval
 EShapeData EShape::createEObj(const string& filename) {
 	EShapeData result;
+	vector<VertexData> soup;
 	std::ifstream in(filename);
 	if (!in.is_open()) {
 		cout << "Error: Cannot open file " << filename << endl;
@@ -268,8 +523,10 @@ EShapeData EShape::createEObj(const string& filename) {
 		dvec4 A = vertices.at(faces.at(i).x - 1);
 		dvec4 B = vertices.at(faces.at(i).y - 1);
 		dvec4 C = vertices.at(faces.at(i).z - 1);
-		VertexData::addTriVertsAndComputeNormal(result, A, B, C, mat);
+		VertexData::addTriVertsAndComputeNormal(soup, A, B, C, mat);
 	}
 
+	result = EShapeData::fromTriangleSoup(soup);
+	prepareForRendering(result);
 	return result;
 }
\ No newline at end of file
@@ -15,14 +15,33 @@
 #include "framebuffer.h"
 #include "light.h"
 
-typedef vector<VertexData> EShapeData;
+/**
+ * @struct	EShapeData
+ * @brief	An indexed triangle mesh. Each unique vertex is stored once, and each
+ * 			successive triplet of indices is a triangle. Shared vertices are therefore
+ * 			transformed and lit only once per draw.
+ */
+
+struct EShapeData {
+	vector<VertexData> vertices;	//!< The unique vertices.
+	vector<unsigned int> indices;	//!< Each successive triplet is a triangle.
+	dvec3 boundingCenter;			//!< Center of a sphere enclosing the vertices, in object coordinates.
+	double boundingRadius = -1.0;	//!< Radius of the bounding sphere. Negative ==> not computed.
+
+	int numTriangles() const { return (int)indices.size() / 3; }
+	unsigned int addVertex(const VertexData& v);
+	void addTriangle(unsigned int a, unsigned int b, unsigned int c);
+	void optimizeVertexCacheOrder();
+	void computeBoundingSphere();
+	static EShapeData fromTriangleSoup(const vector<VertexData>& soup);
+};
 
 /**
  * @struct	EShape
  * @brief	This class contains functions that create explicitly represented shapes.
  * 			This class is used within pipeline applications. The objects returned by
- * 			these routines are vectors of VertexData, where each successive triplet
- * 			is a triangle.
+ * 			these routines are indexed triangle meshes, already ordered for the
+ * 			vertex cache.
  */
 
 struct EShape {
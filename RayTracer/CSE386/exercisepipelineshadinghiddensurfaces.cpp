@@ -60,7 +60,9 @@ static void render() {
 	int width = frameBuffer.getWindowWidth();
 	int height = frameBuffer.getWindowHeight();
 	viewingMatrix = glm::lookAt(glm::dvec3(0, 5, 5), glm::dvec3(0, 0, 0), Y_AXIS);
+	VertexOps::cullingStats = CullingStats();
 	renderObjects();
+	VertexOps::resolveDeferred(frameBuffer, lights, pipeMats);
 	frameBuffer.showAxes(viewingMatrix, projectionMatrix, viewportMatrix,
 						BoundingBoxi(0, width, 0, height));
 	frameBuffer.showColorBuffer();
@@ -101,6 +103,17 @@ void keyboard(unsigned char key, int x, int y) {
 			renderBackFaces = !renderBackFaces;
 			cout << "Toggle renderBackFaces: " << renderBackFaces << endl;
 			break;
+		case 'd': //*****************************
+		case 'D':
+			FragmentOps::deferredShadingEnabled = !FragmentOps::deferredShadingEnabled;
+			cout << "Deferred shading: " << FragmentOps::deferredShadingEnabled << endl;
+			break;
+		case 'S': //*****************************
+		case 's':
+			cout << "Draws submitted: " << VertexOps::cullingStats.submitted
+				<< " culled: " << VertexOps::cullingStats.culled
+				<< " occluded: " << VertexOps::cullingStats.occluded << endl;
+			break;
 		case 'W': //*****************************
 		case 'w':VertexOps::polygonRenderMode = (VertexOps::polygonRenderMode == FILL) ? LINE : FILL;
 			cout << "Render mode: " << VertexOps::polygonRenderMode << endl;
@@ -16,6 +16,34 @@ bool FragmentOps::depthBufferWriteEnabled = true;
 bool FragmentOps::colorBufferWriteEnabled = true;
 bool FragmentOps::textureMappingEnabled = false;
 Image* FragmentOps::textureImage = nullptr;
+bool FragmentOps::deferredShadingEnabled = false;
+GBuffer FragmentOps::gBuffer;
+
+/**
+ * @fn	void GBuffer::resize(int width, int height)
+ * @brief	Resizes the G-buffer, marking every texel empty. Queued triangles are kept.
+ * @param	width 	The width.
+ * @param	height	The height.
+ */
+
+void GBuffer::resize(int width, int height) {
+	this->width = width;
+	this->height = height;
+	texels.assign((size_t)width * height, GBufferTexel());
+}
+
+/**
+ * @fn	void GBuffer::clear()
+ * @brief	Marks every texel empty and drops any queued triangles.
+ */
+
+void GBuffer::clear() {
+	for (GBufferTexel& texel : texels) {
+		texel.materialID = -1;
+	}
+	forwardVerts.clear();
+	translucentVerts.clear();
+}
 
 /**
  * @fn	double FogParams::fogFactor(const dvec3 &fragPos, const dvec3 &eyePos) const
@@ -77,10 +105,36 @@ color FragmentOps::applyBlending(double alpha, const color& srcColor, const colo
 	return weightedAverage(alpha, srcColor, 1.0 - alpha, destColor);
 }
 
+/**
+ * @fn	color FragmentOps::shadeFragment(const vector<LightSourcePtr> &lights,
+ *										const dvec3 &worldPos, const dvec3 &worldNormal,
+ *										const Material &material, const Frame &eyeFrame)
+ * @brief	Computes the lit color of a surface point. Shared by the forward and deferred paths.
+ * @param	lights	   	Vector of lights in scene.
+ * @param	worldPos   	Surface position in world coordinates.
+ * @param	worldNormal	Surface normal in world coordinates.
+ * @param	material   	Surface material.
+ * @param	eyeFrame   	The camera's frame.
+ * @return	The sum of the contributions of all lights that are on.
+ */
+
+color FragmentOps::shadeFragment(const vector<LightSourcePtr>& lights,
+	const dvec3& worldPos, const dvec3& worldNormal,
+	const Material& material, const Frame& eyeFrame) {
+	color C = black;
+	for (const auto& light : lights) {
+		if (light->isOn) {
+			C += light->illuminate(worldPos, worldNormal, material, eyeFrame,
+									false); // Shadowing will come later
+		}
+	}
+	return C;
+}
+
 /**
  * @fn	void FragmentOps::processFragment(FrameBuffer &frameBuffer,
  *											const dvec3 &eyePositionInWorldCoords,
- *											const vector<LightSourcePtr> lights,
+ *											const vector<LightSourcePtr> &lights,
  *											const Fragment &fragment,
  *											const dmat4 &viewingMatrix)
  * @brief	Process the fragment, leaving the results in the framebuffer.
@@ -92,27 +146,21 @@ color FragmentOps::applyBlending(double alpha, const color& srcColor, const colo
  */
 
  void FragmentOps::processFragment(FrameBuffer &frameBuffer, const dvec3 &eyePositionInWorldCoords,
- 										const vector<LightSourcePtr> lights,
+ 										const vector<LightSourcePtr>& lights,
  										const Fragment &fragment,
  										const Frame &eyeFrame) {
 
- //	const dvec3 &eyePos = eyePositionInWorldCoords;
- //
- //	double Z = fragment.windowPos.z;
- //	int X = (int)fragment.windowPos.x;
- //	int Y = (int)fragment.windowPos.y;
- //	DEBUG_PIXEL = (X == xDebug && Y == yDebug);
-
-	//color C = fragment.material.diffuse;
-	//frameBuffer.setColor(X, Y, C);
-	//frameBuffer.setDepth(X, Y, Z);
-
 	 const dvec3& eyePos = eyePositionInWorldCoords;
 
 	 double Z = fragment.windowPos.z;
 	 int X = (int)fragment.windowPos.x;
 	 int Y = (int)fragment.windowPos.y;
-	 DEBUG_PIXEL = (X == xDebug && Y == yDebug);
+	 SET_DEBUG_PIXEL(X, Y);
+
+	 // Hidden surface check
+	 if (!passesDepthTest(frameBuffer, X, Y, Z)) {
+		 return;
+	 }
 
 	 // Final color already lit
 	 color litColor = fragment.color;
@@ -123,13 +171,86 @@ color FragmentOps::applyBlending(double alpha, const color& srcColor, const colo
 	 // Apply alpha blending
 	 color finalColor = applyBlending(fragment.material.alpha, foggedColor, frameBuffer.getColor(X, Y));
 
-	 // Hidden surface check
-	 if (!performDepthTest || Z < frameBuffer.getDepth(X, Y)) {
-		 if (colorBufferWriteEnabled) {
-			 frameBuffer.setColor(X, Y, finalColor);
-		 }
-		 if (depthBufferWriteEnabled) {
-			 frameBuffer.setDepth(X, Y, Z);
-		 }
+	 if (colorBufferWriteEnabled) {
+		 frameBuffer.setColor(X, Y, finalColor);
+	 }
+	 if (depthBufferWriteEnabled) {
+		 frameBuffer.setDepth(X, Y, Z);
 	 }
- }
\ No newline at end of file
+ }
+
+/**
+ * @fn	void FragmentOps::prepareGBuffer(const FrameBuffer &frameBuffer)
+ * @brief	Sizes the G-buffer to match the framebuffer, if deferred shading is enabled.
+ * 			Must be called before rasterizing into the G-buffer.
+ * @param	frameBuffer	The frame buffer.
+ */
+
+void FragmentOps::prepareGBuffer(const FrameBuffer& frameBuffer) {
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	if (deferredShadingEnabled && (gBuffer.width != W || gBuffer.height != H)) {
+		gBuffer.resize(W, H);
+	}
+}
+
+/**
+ * @fn	void FragmentOps::writeGBuffer(FrameBuffer &frameBuffer, int X, int Y, double Z,
+ *										const GBufferTexel &texel)
+ * @brief	Geometry pass of deferred shading. Records the surface attributes of a
+ * 			fragment that has already passed the depth test.
+ * @param [in,out]	frameBuffer	The frame buffer. Only its depth buffer is written.
+ * @param 		  	X		   	Window x coordinate.
+ * @param 		  	Y		   	Window y coordinate.
+ * @param 		  	Z		   	Fragment depth.
+ * @param 		  	texel	   	The surface attributes.
+ */
+
+void FragmentOps::writeGBuffer(FrameBuffer& frameBuffer, int X, int Y, double Z,
+	const GBufferTexel& texel) {
+	if (X < 0 || X >= gBuffer.width || Y < 0 || Y >= gBuffer.height) {
+		return;
+	}
+	if (colorBufferWriteEnabled) {
+		gBuffer.at(X, Y) = texel;
+	}
+	if (depthBufferWriteEnabled) {
+		frameBuffer.setDepth(X, Y, Z);
+	}
+}
+
+/**
+ * @fn	void FragmentOps::shadeGBuffer(FrameBuffer &frameBuffer,
+ *										const dvec3 &eyePositionInWorldCoords,
+ *										const vector<LightSourcePtr> &lights,
+ *										const Frame &eyeFrame)
+ * @brief	Lighting pass of deferred shading. Every visible pixel is lit exactly once
+ * 			and fogged. The texels are marked empty afterwards, ready for the next frame.
+ * @param [in,out]	frameBuffer	                The frame buffer
+ * @param 		  	eyePositionInWorldCoords	The eye position in world coordinates.
+ * @param 		  	lights						Vector of lights in scene.
+ * @param           eyeFrame                    The camera's frame.
+ */
+
+void FragmentOps::shadeGBuffer(FrameBuffer& frameBuffer, const dvec3& eyePositionInWorldCoords,
+	const vector<LightSourcePtr>& lights,
+	const Frame& eyeFrame) {
+	if (gBuffer.width != frameBuffer.getWindowWidth() ||
+		gBuffer.height != frameBuffer.getWindowHeight()) {
+		return;
+	}
+	for (int Y = 0; Y < gBuffer.height; Y++) {
+		for (int X = 0; X < gBuffer.width; X++) {
+			GBufferTexel& texel = gBuffer.at(X, Y);
+			if (texel.materialID < 0) {
+				continue;
+			}
+			SET_DEBUG_PIXEL(X, Y);
+			const Material& material = MaterialTable::getMaterial(texel.materialID);
+			color litColor = shadeFragment(lights, texel.worldPos, texel.worldNormal,
+											material, eyeFrame);
+			frameBuffer.setColor(X, Y, applyFog(litColor, eyePositionInWorldCoords, texel.worldPos));
+			texel.materialID = -1;
+		}
+	}
+}
@@ -10,6 +10,7 @@
 #pragma once
 #include "framebuffer.h"
 #include "light.h"
+#include "vertexdata.h"
 
  /**
   * @enum	fogType
@@ -51,6 +52,37 @@ struct Fragment {
 	color color;		
 };
 
+/**
+ * @struct	GBufferTexel
+ * @brief	The surface attributes saved for one pixel during the geometry pass of
+ * 			deferred shading: just what the lighting pass reads.
+ */
+
+struct GBufferTexel {
+	dvec3 worldNormal;		//!< Interpolated normal vector in world coordinates
+	dvec3 worldPos;			//!< Interpolated position in world coordinates
+	int materialID = -1;	//!< Index into the MaterialTable. -1 ==> nothing visible.
+};
+
+/**
+ * @struct	GBuffer
+ * @brief	Geometry buffer used for deferred shading. Holds the attributes of the
+ * 			nearest opaque surface at each pixel, along with the triangles that must
+ * 			still be drawn with forward shading once the opaque surfaces are lit.
+ */
+
+struct GBuffer {
+	int width = 0;							//!< width of the G-buffer
+	int height = 0;							//!< height of the G-buffer
+	vector<GBufferTexel> texels;			//!< width x height array of texels
+	vector<VertexData> forwardVerts;		//!< Opaque triangles that could not be deferred
+	vector<VertexData> translucentVerts;	//!< Translucent triangles (alpha < 1)
+
+	void resize(int width, int height);
+	void clear();
+	GBufferTexel& at(int x, int y) { return texels[y * width + x]; }
+};
+
 /**
  * @class	FragmentOps
  * @brief	Class to encapsulate the methods related to fragment processing.
@@ -64,11 +96,37 @@ public:
 	static bool textureMappingEnabled;		//!< True ==> use texture mapping. Typically false
 	static FogParams fogParams;			//!< Parameters controlling fog effects.
 	static Image* textureImage;			//!< Image to use for texture mapping.
+	static bool deferredShadingEnabled;	//!< True ==> rasterize to G-buffer, shade in a later pass.
+	static GBuffer gBuffer;				//!< G-buffer used when deferred shading is enabled.
 
 	static void processFragment(FrameBuffer& frameBuffer, const dvec3& eyePositionInWorldCoords,
-		const vector<LightSourcePtr> lights,
+		const vector<LightSourcePtr>& lights,
 		const Fragment& fragment,
 		const Frame& eyeFrame);
+	static color shadeFragment(const vector<LightSourcePtr>& lights,
+		const dvec3& worldPos, const dvec3& worldNormal,
+		const Material& material, const Frame& eyeFrame);
+	static void prepareGBuffer(const FrameBuffer& frameBuffer);
+	static void writeGBuffer(FrameBuffer& frameBuffer, int X, int Y, double Z,
+		const GBufferTexel& texel);
+	static void shadeGBuffer(FrameBuffer& frameBuffer, const dvec3& eyePositionInWorldCoords,
+		const vector<LightSourcePtr>& lights,
+		const Frame& eyeFrame);
+
+	/**
+	 * @fn	static bool passesDepthTest(const FrameBuffer &frameBuffer, int X, int Y, double Z)
+	 * @brief	Early depth test. Lets the rasterizer reject hidden fragments before any
+	 * 			attributes are interpolated or lighting is computed.
+	 * @param	frameBuffer	The frame buffer.
+	 * @param	X		   	Window x coordinate.
+	 * @param	Y		   	Window y coordinate.
+	 * @param	Z		   	Fragment depth.
+	 * @return	True iff the fragment could be visible.
+	 */
+
+	static bool passesDepthTest(const FrameBuffer& frameBuffer, int X, int Y, double Z) {
+		return !performDepthTest || Z < frameBuffer.getDepth(X, Y);
+	}
 protected:
 	static color applyFog(const color& destColor, const dvec3& eyePos, const dvec3& fragPos);
 	static color applyBlending(double alpha, const color& src, const color& dest);
@@ -11,6 +11,50 @@
 #include "utilities.h"
 #include "framebuffer.h"
 
+/**
+ * @fn	static inline uint32_t packPixel(GLubyte r, GLubyte g, GLubyte b)
+ * @brief	Packs a color into the framebuffer's pixel format: R, G, B and A bytes, in that
+ * 			order in memory, whatever the byte order of the machine.
+ * @return	The packed pixel.
+ */
+
+static inline uint32_t packPixel(GLubyte r, GLubyte g, GLubyte b) {
+	GLubyte bytes[BYTES_PER_PIXEL] = { r, g, b, 255 };
+	uint32_t pixel;
+	std::memcpy(&pixel, bytes, BYTES_PER_PIXEL);
+	return pixel;
+}
+
+/**
+ * @fn	static inline uint32_t packColor(const color &C)
+ * @brief	Clamps a color to [0, 1] and packs it.
+ * @return	The packed pixel.
+ */
+
+static inline uint32_t packColor(const color& C) {
+	color clampedColor = glm::clamp(C, 0.0, 1.0);
+	return packPixel((GLubyte)(clampedColor.r * 255),
+					(GLubyte)(clampedColor.g * 255),
+					(GLubyte)(clampedColor.b * 255));
+}
+
+/**
+ * @fn	static inline color unpackPixel(uint32_t pixel)
+ * @brief	Converts a packed pixel back to a color.
+ * @return	The color.
+ */
+
+static inline color unpackPixel(uint32_t pixel) {
+	GLubyte c[BYTES_PER_PIXEL];
+	std::memcpy(c, &pixel, BYTES_PER_PIXEL);
+	return color(c[0] / 255.0, c[1] / 255.0, c[2] / 255.0);
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRAMEBUFFER_USE_SSE2
+#endif
+
  /**
   * @fn	FrameBuffer::FrameBuffer(const int width, const int height)
   * @brief	Constructor
@@ -18,7 +62,9 @@
   * @param	height	The height.
   */
 
-FrameBuffer::FrameBuffer(const int width, const int height) {
+FrameBuffer::FrameBuffer(const int width, const int height)
+	: colorBuffer(nullptr), depthBuffer(nullptr), accumBuffer(nullptr) {
+	setClearColor(black);
 	setFrameBufferSize(width, height);
 }
 
@@ -30,11 +76,12 @@ FrameBuffer::FrameBuffer(const int width, const int height) {
 FrameBuffer::~FrameBuffer() {
 	delete[] colorBuffer;
 	delete[] depthBuffer;
+	delete[] accumBuffer;
 }
 
 /**
  * @fn	void FrameBuffer::setFrameBufferSize(int width, int height)
- * @brief	Sets frame buffer size
+ * @brief	Sets frame buffer size. The new color and depth buffers start out cleared.
  * @param	width 	The width.
  * @param	height	The height.
  * @see https://www.opengl.org/archives/resources/features/KilgardTechniques/oglpitfall/
@@ -46,8 +93,19 @@ void FrameBuffer::setFrameBufferSize(int width, int height) {
 	int area = width * height;
 	delete[] colorBuffer;
 	delete[] depthBuffer;
-	colorBuffer = new GLubyte[area * BYTES_PER_PIXEL];
-	depthBuffer = new double[area];
+	colorBuffer = new uint32_t[area];
+	depthBuffer = new float[area];
+	colorTilesX = (width + COLOR_TILE_SIZE - 1) / COLOR_TILE_SIZE;
+	clearPending.resize(colorTilesX * ((height + COLOR_TILE_SIZE - 1) / COLOR_TILE_SIZE));
+	clearColorBuffer();
+	fineDepth.resize(width, height, DEPTH_BLOCK_SIZE);
+	coarseDepth.resize(width, height, DEPTH_COARSE_SIZE);
+	clearDepthBuffer();
+	if (accumBuffer != nullptr) {
+		delete[] accumBuffer;
+		accumBuffer = new float[area * 4];
+		clearAccumulationBuffer();
+	}
 }
 
 /**
@@ -58,9 +116,9 @@ void FrameBuffer::setFrameBufferSize(int width, int height) {
 
 void FrameBuffer::setClearColor(const color& clear) {
 	clearColor = clear;
-	clearColorUB[0] = (GLubyte)(clear.r * 255.0);
-	clearColorUB[1] = (GLubyte)(clear.g * 255.0);
-	clearColorUB[2] = (GLubyte)(clear.b * 255.0);
+	clearPixel = packPixel((GLubyte)(clear.r * 255.0),
+							(GLubyte)(clear.g * 255.0),
+							(GLubyte)(clear.b * 255.0));
 }
 
 /**
@@ -75,14 +133,142 @@ void FrameBuffer::clearColorAndDepthBuffers() {
 
 /**
  * @fn	void FrameBuffer::clearColorBuffer()
- * @brief	Clears the color buffer
+ * @brief	Clears the color buffer. Nothing is written yet: every tile is marked, and is
+ * 			filled with the clear color the first time it is written or displayed.
  */
 
 void FrameBuffer::clearColorBuffer() {
-	for (int y = 0; y < height; ++y) {		// can be made faster
-		for (int x = 0; x < width; ++x) {
-			std::memcpy(colorBuffer + BYTES_PER_PIXEL * (x + y * width),
-											clearColorUB, BYTES_PER_PIXEL);
+	pendingClearPixel = clearPixel;
+	std::fill(clearPending.begin(), clearPending.end(), true);
+}
+
+/**
+ * @fn	void FrameBuffer::finishClear(int tile) const
+ * @brief	Fills a tile that is waiting to be cleared with the clear color. Safe to call
+ * 			from the thread that owns the tile's pixels.
+ * @param	tile	Index of the tile.
+ */
+
+void FrameBuffer::finishClear(int tile) const {
+	int x0 = (tile % colorTilesX) * COLOR_TILE_SIZE;
+	int y0 = (tile / colorTilesX) * COLOR_TILE_SIZE;
+	int x1 = std::min(x0 + COLOR_TILE_SIZE, width);
+	int y1 = std::min(y0 + COLOR_TILE_SIZE, height);
+	for (int y = y0; y < y1; y++) {
+		std::fill(colorBuffer + y * width + x0, colorBuffer + y * width + x1, pendingClearPixel);
+	}
+	clearPending[tile] = false;
+}
+
+/**
+ * @fn	void FrameBuffer::finishClears() const
+ * @brief	Fills every tile still waiting to be cleared.
+ */
+
+void FrameBuffer::finishClears() const {
+	for (int tile = 0; tile < (int)clearPending.size(); tile++) {
+		if (clearPending[tile]) {
+			finishClear(tile);
+		}
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::prepareRegionForWrite(int x0, int y0, int x1, int y1)
+ * @brief	Called before every pixel in [x0, x1] x [y0, y1] is overwritten. Tiles the region
+ * 			covers completely no longer need clearing; the others are cleared now.
+ * @param	x0	Left column, inside the window.
+ * @param	y0	Bottom row, inside the window.
+ * @param	x1	Right column, inside the window.
+ * @param	y1	Top row, inside the window.
+ */
+
+void FrameBuffer::prepareRegionForWrite(int x0, int y0, int x1, int y1) {
+	for (int ty = y0 / COLOR_TILE_SIZE; ty <= y1 / COLOR_TILE_SIZE; ty++) {
+		for (int tx = x0 / COLOR_TILE_SIZE; tx <= x1 / COLOR_TILE_SIZE; tx++) {
+			int tile = ty * colorTilesX + tx;
+			if (!clearPending[tile]) {
+				continue;
+			}
+			bool covered = x0 <= tx * COLOR_TILE_SIZE && y0 <= ty * COLOR_TILE_SIZE &&
+							x1 >= std::min((tx + 1) * COLOR_TILE_SIZE, width) - 1 &&
+							y1 >= std::min((ty + 1) * COLOR_TILE_SIZE, height) - 1;
+			if (covered) {
+				clearPending[tile] = false;
+			} else {
+				finishClear(tile);
+			}
+		}
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::setSpan(int x, int y, int count, const color *colors)
+ * @brief	Sets count consecutive pixels of a row, starting at (x, y). The span is clipped
+ * 			to the window once, rather than pixel by pixel.
+ * @param	x	  	The x coordinate of the first pixel.
+ * @param	y	  	The y coordinate.
+ * @param	count 	The number of pixels.
+ * @param	colors	The colors of the pixels, from left to right.
+ */
+
+void FrameBuffer::setSpan(int x, int y, int count, const color* colors) {
+	int x0 = std::max(x, 0);
+	int x1 = std::min(x + count, width) - 1;
+	if (y < 0 || y >= height || x0 > x1) {
+		return;
+	}
+	prepareRegionForWrite(x0, y, x1, y);
+	uint32_t* dst = colorBuffer + y * width;
+	for (int i = x0; i <= x1; i++) {
+		dst[i] = packColor(colors[i - x]);
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::fill(const BoundingBoxi &region, const color &C)
+ * @brief	Sets every pixel in a region to one color.
+ * @param	region	The region, in window coordinates. Clipped to the window.
+ * @param	C	  	The color.
+ */
+
+void FrameBuffer::fill(const BoundingBoxi& region, const color& C) {
+	int x0 = std::max(region.lx, 0);
+	int y0 = std::max(region.ly, 0);
+	int x1 = std::min(region.lx + region.width, width) - 1;
+	int y1 = std::min(region.ly + region.height, height) - 1;
+	if (x0 > x1 || y0 > y1) {
+		return;
+	}
+	prepareRegionForWrite(x0, y0, x1, y1);
+	uint32_t pixel = packColor(C);
+	for (int y = y0; y <= y1; y++) {
+		std::fill(colorBuffer + y * width + x0, colorBuffer + y * width + x1 + 1, pixel);
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::writeTile(const BoundingBoxi &region, const color *colors)
+ * @brief	Copies a block of colors, such as a tile rendered into a private buffer, into
+ * 			the color buffer.
+ * @param	region	The region, in window coordinates. Clipped to the window.
+ * @param	colors	region.width * region.height colors, row by row from the bottom.
+ */
+
+void FrameBuffer::writeTile(const BoundingBoxi& region, const color* colors) {
+	int x0 = std::max(region.lx, 0);
+	int y0 = std::max(region.ly, 0);
+	int x1 = std::min(region.lx + region.width, width) - 1;
+	int y1 = std::min(region.ly + region.height, height) - 1;
+	if (x0 > x1 || y0 > y1) {
+		return;
+	}
+	prepareRegionForWrite(x0, y0, x1, y1);
+	for (int y = y0; y <= y1; y++) {
+		const color* src = colors + (y - region.ly) * region.width - region.lx;
+		uint32_t* dst = colorBuffer + y * width;
+		for (int x = x0; x <= x1; x++) {
+			dst[x] = packColor(src[x]);
 		}
 	}
 }
@@ -95,17 +281,20 @@ void FrameBuffer::clearColorBuffer() {
 void FrameBuffer::clearDepthBuffer() {
 	int area = width * height;
 	const int SZ = area;
-	std::fill(depthBuffer, depthBuffer + SZ, 1.0);
+	std::fill(depthBuffer, depthBuffer + SZ, 1.0f);
+	fineDepth.clear(1.0f);
+	coarseDepth.clear(1.0f);
 }
 /**
  * @fn	void FrameBuffer::showColorBuffer() const
- * @brief	Shows the contents of the color buffer to screen.
+ * @brief	Shows the contents of the color buffer to screen. The pixels are copied
+ * 			out before returning, so the next frame can be rendered while this one is
+ * 			still being uploaded.
  */
 
 void FrameBuffer::showColorBuffer() const {
-	glRasterPos2d(-1, -1);
-	glDrawPixels(width, height, GL_RGB, GL_UNSIGNED_BYTE, colorBuffer);
-	glFlush();
+	finishClears();
+	presenter.present(colorBuffer, width, height);
 }
 
 /**
@@ -129,14 +318,11 @@ void FrameBuffer::setColor(int x, int y, const color& rgb) {
 	if (x < 0 || x >= width || y < 0 || y >= height) {
 		return;
 	}
-
-	color clampedColor = glm::clamp(rgb, 0.0, 1.0);
-
-	GLubyte c[] = { (GLubyte)(clampedColor.r * 255),
-					(GLubyte)(clampedColor.g * 255),
-					(GLubyte)(clampedColor.b * 255) };
-
-	std::memcpy(colorBuffer + BYTES_PER_PIXEL * (x + y * width), c, BYTES_PER_PIXEL);
+	int tile = colorTileIndex(x, y);
+	if (clearPending[tile]) {
+		finishClear(tile);
+	}
+	colorBuffer[x + y * width] = packColor(rgb);
 }
 
 /**
@@ -148,24 +334,13 @@ void FrameBuffer::setColor(int x, int y, const color& rgb) {
  */
 
 color FrameBuffer::getColor(int x, int y) const {
-	double red, green, blue;
-
-	if (checkInWindow(x, y)) {
-		GLubyte c[BYTES_PER_PIXEL];
-
-		// Retrieve color values from the color buffer
-		std::memcpy(c, colorBuffer + BYTES_PER_PIXEL * (x + y * width), BYTES_PER_PIXEL);
-
-		// Convert individual color components back to double values
-		red = c[0] / 255.0;
-		green = c[1] / 255.0;
-		blue = c[2] / 255.0;
-	} else {
-		red = clearColorUB[0] / 255.0;
-		green = clearColorUB[1] / 255.0;
-		blue = clearColorUB[2] / 255.0;
+	if (!checkInWindow(x, y)) {
+		return unpackPixel(clearPixel);
 	}
-	return color(red, green, blue);
+	if (clearPending[colorTileIndex(x, y)]) {
+		return unpackPixel(pendingClearPixel);
+	}
+	return unpackPixel(colorBuffer[x + y * width]);
 }
 
 /**
@@ -190,7 +365,15 @@ void FrameBuffer::setDepth(double x, double y, double depth) {
 
 void FrameBuffer::setDepth(int x, int y, double depth) {
 	if (checkInWindow(x, y)) {
-		depthBuffer[y * width + x] = depth;
+		float d = (float)depth;
+		depthBuffer[y * width + x] = d;
+
+		int fine = fineDepth.blockIndex(x, y);
+		fineDepth.minDepth[fine] = std::min(fineDepth.minDepth[fine], d);
+		fineDepth.maxStale[fine] = true;
+		int coarse = coarseDepth.blockIndex(x, y);
+		coarseDepth.minDepth[coarse] = std::min(coarseDepth.minDepth[coarse], d);
+		coarseDepth.maxStale[coarse] = true;
 	}
 }
 
@@ -222,6 +405,325 @@ double FrameBuffer::getDepth(double x, double y) const {
 	return getDepth((int)(x), (int)(y));
 }
 
+/**
+ * @fn	void FrameBuffer::setAccumulationEnabled(bool enabled)
+ * @brief	Allocates or frees the accumulation buffer. A new buffer is cleared.
+ * @param	enabled	True ==> samples may be accumulated.
+ */
+
+void FrameBuffer::setAccumulationEnabled(bool enabled) {
+	if (enabled && accumBuffer == nullptr) {
+		accumBuffer = new float[width * height * 4];
+		clearAccumulationBuffer();
+	} else if (!enabled) {
+		delete[] accumBuffer;
+		accumBuffer = nullptr;
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::clearAccumulationBuffer()
+ * @brief	Discards all accumulated samples, e.g. when the camera moves.
+ */
+
+void FrameBuffer::clearAccumulationBuffer() {
+	if (accumBuffer != nullptr) {
+		std::fill(accumBuffer, accumBuffer + width * height * 4, 0.0f);
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::accumulate(int x, int y, const color &C, double weight)
+ * @brief	Adds a weighted sample to a pixel of the accumulation buffer. The color is not
+ * 			clamped, so it may be brighter than white.
+ * @param	x	  	The x coordinate.
+ * @param	y	  	The y coordinate.
+ * @param	C	  	The sample's color.
+ * @param	weight	The sample's weight.
+ */
+
+void FrameBuffer::accumulate(int x, int y, const color& C, double weight) {
+	if (accumBuffer != nullptr && checkInWindow(x, y)) {
+		float* p = accumBuffer + 4 * (y * width + x);
+		p[0] += (float)(weight * C.r);
+		p[1] += (float)(weight * C.g);
+		p[2] += (float)(weight * C.b);
+		p[3] += (float)weight;
+	}
+}
+
+/**
+ * @fn	color FrameBuffer::getAccumulatedColor(int x, int y) const
+ * @brief	Gets the weighted average of the samples at (x, y), before tone mapping.
+ * @param	x	The x coordinate.
+ * @param	y	The y coordinate.
+ * @return	The average, or black if there are no samples.
+ */
+
+color FrameBuffer::getAccumulatedColor(int x, int y) const {
+	double weight = getAccumulatedWeight(x, y);
+	if (weight <= 0.0) {
+		return black;
+	}
+	const float* p = accumBuffer + 4 * (y * width + x);
+	return color(p[0], p[1], p[2]) / weight;
+}
+
+/**
+ * @fn	double FrameBuffer::getAccumulatedWeight(int x, int y) const
+ * @brief	Gets the total weight of the samples at (x, y).
+ * @param	x	The x coordinate.
+ * @param	y	The y coordinate.
+ * @return	The total weight. 0 if accumulation is disabled.
+ */
+
+double FrameBuffer::getAccumulatedWeight(int x, int y) const {
+	if (accumBuffer == nullptr || !checkInWindow(x, y)) {
+		return 0.0;
+	}
+	return accumBuffer[4 * (y * width + x) + 3];
+}
+
+/**
+ * @fn	void FrameBuffer::setAccumulationBuffer(const float *sums)
+ * @brief	Replaces the whole accumulation buffer, e.g. with one saved earlier from
+ * 			getAccumulationBuffer. Does nothing if accumulation is disabled.
+ * @param	sums	width * height RGBA sums, row by row from the bottom.
+ */
+
+void FrameBuffer::setAccumulationBuffer(const float* sums) {
+	if (accumBuffer != nullptr) {
+		std::copy(sums, sums + width * height * 4, accumBuffer);
+	}
+}
+
+const int GAMMA_TABLE_SIZE = 4096;		//!< Entries in the table used to apply gamma.
+
+/**
+ * @fn	void FrameBuffer::resolveAccumulationBuffer()
+ * @brief	Averages, tone maps, applies gamma to and quantizes every pixel of the
+ * 			accumulation buffer, writing the results into the color buffer. Pixels with
+ * 			no samples are set to the clear color. Rows are resolved in parallel and, if
+ * 			SSE2 is available, the RGBA channels of a pixel are handled together. Gamma
+ * 			is applied with a lookup table instead of pow. Does nothing if accumulation
+ * 			is disabled.
+ */
+
+void FrameBuffer::resolveAccumulationBuffer() {
+	if (accumBuffer == nullptr) {
+		return;
+	}
+	const ToneMapParams params = toneMapParams;
+	const bool linear = params.gamma == 1.0;
+	GLubyte gammaTable[GAMMA_TABLE_SIZE];
+	if (!linear) {
+		for (int i = 0; i < GAMMA_TABLE_SIZE; i++) {
+			double v = std::pow(i / (double)(GAMMA_TABLE_SIZE - 1), 1.0 / params.gamma);
+			gammaTable[i] = (GLubyte)(v * 255.0 + 0.5);
+		}
+	}
+	const float scale = linear ? 255.0f : (float)(GAMMA_TABLE_SIZE - 1);
+	const float round = linear ? 0.0f : 0.5f;		// Match setColor, which truncates
+	const float exposure = (float)params.exposure;
+	const bool reinhard = params.type == ToneMapType::REINHARD;
+
+	// Every pixel is about to be overwritten, so pending clears can be forgotten.
+	std::fill(clearPending.begin(), clearPending.end(), false);
+
+	parallelFor(height, [&](int y) {
+		const float* src = accumBuffer + 4 * y * width;
+		uint32_t* dst = colorBuffer + y * width;
+		for (int x = 0; x < width; x++, src += 4, dst++) {
+			if (!(src[3] > 0.0f)) {
+				*dst = clearPixel;
+				continue;
+			}
+			int q[4];
+#ifdef FRAMEBUFFER_USE_SSE2
+			__m128 c = _mm_mul_ps(_mm_loadu_ps(src), _mm_set1_ps(exposure / src[3]));
+			c = _mm_max_ps(c, _mm_setzero_ps());
+			if (reinhard) {
+				c = _mm_div_ps(c, _mm_add_ps(c, _mm_set1_ps(1.0f)));
+			}
+			c = _mm_min_ps(c, _mm_set1_ps(1.0f));
+			c = _mm_add_ps(_mm_mul_ps(c, _mm_set1_ps(scale)), _mm_set1_ps(round));
+			_mm_storeu_si128((__m128i*)q, _mm_cvttps_epi32(c));
+#else
+			for (int i = 0; i < 3; i++) {
+				float c = std::max(src[i] * (exposure / src[3]), 0.0f);
+				if (reinhard) {
+					c = c / (c + 1.0f);
+				}
+				q[i] = (int)(std::min(c, 1.0f) * scale + round);
+			}
+#endif
+			if (linear) {
+				*dst = packPixel((GLubyte)q[0], (GLubyte)q[1], (GLubyte)q[2]);
+			} else {
+				*dst = packPixel(gammaTable[q[0]], gammaTable[q[1]], gammaTable[q[2]]);
+			}
+		}
+	});
+}
+
+/**
+ * @fn	void DepthLevel::resize(int width, int height, int blockSize)
+ * @brief	Sizes one level of the depth pyramid for a window. Blocks on the right and
+ * 			top edges may be partially outside of the window.
+ * @param	width	 	The width of the window.
+ * @param	height   	The height of the window.
+ * @param	blockSize	Pixels per side of a block.
+ */
+
+void DepthLevel::resize(int width, int height, int blockSize) {
+	this->blockSize = blockSize;
+	blocksX = (width + blockSize - 1) / blockSize;
+	blocksY = (height + blockSize - 1) / blockSize;
+	minDepth.resize(blocksX * blocksY);
+	maxDepth.resize(blocksX * blocksY);
+	maxStale.resize(blocksX * blocksY);
+}
+
+/**
+ * @fn	void DepthLevel::clear(float depth)
+ * @brief	Sets every block's depth range to a single depth.
+ * @param	depth	The depth the depth buffer was cleared to.
+ */
+
+void DepthLevel::clear(float depth) {
+	std::fill(minDepth.begin(), minDepth.end(), depth);
+	std::fill(maxDepth.begin(), maxDepth.end(), depth);
+	std::fill(maxStale.begin(), maxStale.end(), false);
+}
+
+/**
+ * @fn	float FrameBuffer::blockMaxDepth(int block)
+ * @brief	Farthest depth in a fine block, recomputed from the depth buffer if stale.
+ * 			Safe to call from the thread that owns the block's pixels.
+ * @param	block	Index of the fine block.
+ * @return	The farthest depth in the block.
+ */
+
+float FrameBuffer::blockMaxDepth(int block) {
+	if (fineDepth.maxStale[block]) {
+		int x0 = (block % fineDepth.blocksX) * DEPTH_BLOCK_SIZE;
+		int y0 = (block / fineDepth.blocksX) * DEPTH_BLOCK_SIZE;
+		int x1 = std::min(x0 + DEPTH_BLOCK_SIZE, width);
+		int y1 = std::min(y0 + DEPTH_BLOCK_SIZE, height);
+		float farthest = -std::numeric_limits<float>::max();
+		for (int y = y0; y < y1; y++) {
+			const float* row = depthBuffer + y * width;
+			for (int x = x0; x < x1; x++) {
+				farthest = std::max(farthest, row[x]);
+			}
+		}
+		fineDepth.maxDepth[block] = farthest;
+		fineDepth.maxStale[block] = false;
+	}
+	return fineDepth.maxDepth[block];
+}
+
+/**
+ * @fn	float FrameBuffer::coarseMaxDepth(int block)
+ * @brief	Farthest depth in a coarse block, recomputed from the fine blocks if stale.
+ * @param	block	Index of the coarse block.
+ * @return	The farthest depth in the block.
+ */
+
+float FrameBuffer::coarseMaxDepth(int block) {
+	if (coarseDepth.maxStale[block]) {
+		const int PER_SIDE = DEPTH_COARSE_SIZE / DEPTH_BLOCK_SIZE;
+		int bx0 = (block % coarseDepth.blocksX) * PER_SIDE;
+		int by0 = (block / coarseDepth.blocksX) * PER_SIDE;
+		int bx1 = std::min(bx0 + PER_SIDE, fineDepth.blocksX);
+		int by1 = std::min(by0 + PER_SIDE, fineDepth.blocksY);
+		float farthest = -std::numeric_limits<float>::max();
+		for (int by = by0; by < by1; by++) {
+			for (int bx = bx0; bx < bx1; bx++) {
+				farthest = std::max(farthest, blockMaxDepth(by * fineDepth.blocksX + bx));
+			}
+		}
+		coarseDepth.maxDepth[block] = farthest;
+		coarseDepth.maxStale[block] = false;
+	}
+	return coarseDepth.maxDepth[block];
+}
+
+/**
+ * @fn	double FrameBuffer::getFarthestDepth(const BoundingBoxi &region)
+ * @brief	Conservative farthest depth within a region: no pixel of the region has a
+ * 			depth greater than the value returned. Uses the coarse blocks that lie
+ * 			entirely inside the region, and fine blocks elsewhere.
+ * @param	region	The region, in window coordinates. Clipped to the window.
+ * @return	Upper bound on the depths in the region.
+ */
+
+double FrameBuffer::getFarthestDepth(const BoundingBoxi& region) {
+	int x0 = std::max(region.lx, 0);
+	int y0 = std::max(region.ly, 0);
+	int x1 = std::min(region.lx + region.width, width) - 1;
+	int y1 = std::min(region.ly + region.height, height) - 1;
+	float farthest = -std::numeric_limits<float>::max();
+	if (x0 > x1 || y0 > y1) {
+		return farthest;
+	}
+	const int PER_SIDE = DEPTH_COARSE_SIZE / DEPTH_BLOCK_SIZE;
+	for (int by = y0 / DEPTH_BLOCK_SIZE; by <= y1 / DEPTH_BLOCK_SIZE; by++) {
+		for (int bx = x0 / DEPTH_BLOCK_SIZE; bx <= x1 / DEPTH_BLOCK_SIZE; bx++) {
+			int cx = bx / PER_SIDE;
+			int cy = by / PER_SIDE;
+			bool coarseInside = cx * DEPTH_COARSE_SIZE >= x0 && (cx + 1) * DEPTH_COARSE_SIZE - 1 <= x1 &&
+								cy * DEPTH_COARSE_SIZE >= y0 && (cy + 1) * DEPTH_COARSE_SIZE - 1 <= y1;
+			if (coarseInside) {
+				if (bx % PER_SIDE == 0 && by % PER_SIDE == 0) {
+					farthest = std::max(farthest, coarseMaxDepth(cy * coarseDepth.blocksX + cx));
+				}
+			} else {
+				farthest = std::max(farthest, blockMaxDepth(by * fineDepth.blocksX + bx));
+			}
+			if (farthest >= 1.0f) {		// Cleared depth. Nothing there can be hidden.
+				return farthest;
+			}
+		}
+	}
+	return farthest;
+}
+
+/**
+ * @fn	double FrameBuffer::getNearestDepth(const BoundingBoxi &region)
+ * @brief	Conservative nearest depth within a region: no pixel of the region has a
+ * 			depth less than the value returned.
+ * @param	region	The region, in window coordinates. Clipped to the window.
+ * @return	Lower bound on the depths in the region.
+ */
+
+double FrameBuffer::getNearestDepth(const BoundingBoxi& region) {
+	int x0 = std::max(region.lx, 0);
+	int y0 = std::max(region.ly, 0);
+	int x1 = std::min(region.lx + region.width, width) - 1;
+	int y1 = std::min(region.ly + region.height, height) - 1;
+	float nearest = std::numeric_limits<float>::max();
+	for (int by = y0 / DEPTH_BLOCK_SIZE; by <= y1 / DEPTH_BLOCK_SIZE && x0 <= x1; by++) {
+		for (int bx = x0 / DEPTH_BLOCK_SIZE; bx <= x1 / DEPTH_BLOCK_SIZE; bx++) {
+			nearest = std::min(nearest, fineDepth.minDepth[by * fineDepth.blocksX + bx]);
+		}
+	}
+	return nearest;
+}
+
+/**
+ * @fn	bool FrameBuffer::isOccluded(const BoundingBoxi &region, double nearestDepth)
+ * @brief	Determines whether something covering at most the given region, and no nearer
+ * 			than nearestDepth, would fail the depth test at every pixel.
+ * @param	region			The screen area covered, in window coordinates.
+ * @param	nearestDepth	The nearest depth of what is being tested.
+ * @return	True iff it is certainly hidden.
+ */
+
+bool FrameBuffer::isOccluded(const BoundingBoxi& region, double nearestDepth) {
+	return nearestDepth >= getFarthestDepth(region);
+}
+
 /**
  * @fn	bool FrameBuffer::checkInWindow(int x, int y) const
  * @brief	Returns true iff (x, y) is a valid window coordinate.
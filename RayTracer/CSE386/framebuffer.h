@@ -12,18 +12,76 @@
 #include "defs.h"
 #include "ishape.h"
 #include "colorandmaterials.h"
+#include "presenter.h"
 
 #ifndef WINDOWS
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
 #endif
 
-const int BYTES_PER_PIXEL = 3;			//!< RGB requires 3 bytes.
+const int BYTES_PER_PIXEL = 4;			//!< RGBA, padded so that a pixel is one 32-bit word.
+const int COLOR_TILE_SIZE = 64;			//!< Pixels per side of a tile of the color buffer.
+const int DEPTH_BLOCK_SIZE = 8;			//!< Pixels per side of a fine block of the depth pyramid.
+const int DEPTH_COARSE_SIZE = 64;		//!< Pixels per side of a coarse block. A multiple of DEPTH_BLOCK_SIZE.
+
+/**
+ * @enum	ToneMapType
+ * @brief	Operators for mapping high dynamic range colors into [0, 1].
+ */
+
+enum class ToneMapType { CLAMP, REINHARD };
+
+/**
+ * @struct	ToneMapParams
+ * @brief	Controls how the accumulation buffer is resolved into the color buffer.
+ * 			The defaults reproduce setColor exactly.
+ */
+
+struct ToneMapParams {
+	ToneMapType type;	//!< Tone mapping operator
+	double exposure;	//!< Colors are multiplied by this before tone mapping
+	double gamma;		//!< Display gamma. 1 ==> linear.
+	ToneMapParams() {
+		type = ToneMapType::CLAMP;
+		exposure = 1.0;
+		gamma = 1.0;
+	}
+};
+
+/**
+ * @struct	DepthLevel
+ * @brief	One level of the hierarchical depth buffer: the nearest and the farthest depth
+ * 			stored within each square block of pixels. Nearest depths are kept up to date
+ * 			on every write. Farthest depths can only be found by looking at the whole
+ * 			block again, so writes just mark them stale and they are recomputed on demand.
+ */
+
+struct DepthLevel {
+	int blockSize = 1;			//!< Pixels per side of a block
+	int blocksX = 0;			//!< Number of blocks across
+	int blocksY = 0;			//!< Number of blocks down
+	vector<float> minDepth;		//!< Nearest depth in each block
+	vector<float> maxDepth;		//!< Farthest depth in each block, if not stale
+	vector<char> maxStale;		//!< True ==> maxDepth must be recomputed
+
+	void resize(int width, int height, int blockSize);
+	void clear(float depth);
+	int blockIndex(int x, int y) const { return (y / blockSize) * blocksX + x / blockSize; }
+};
 
 /**
  * @struct	FrameBuffer
  * @brief	Represents a framebuffer. Two identically sized 2D arrays. The color
  * 			buffer stores the colors and the depth buffer stores the corresponding
- * 			depth at each pixel.
+ * 			depth at each pixel. Depths are stored as floats. A two level pyramid of
+ * 			per-block nearest and farthest depths is maintained alongside the depth
+ * 			buffer, so that whole regions can be tested for occlusion at once.
+ * 			Optionally, a float RGBA accumulation buffer collects unclamped samples;
+ * 			A holds the total weight at each pixel. It is tone mapped and quantized
+ * 			into the color buffer by resolveAccumulationBuffer, once per frame.
+ * 			Clearing the color buffer is lazy: each COLOR_TILE_SIZE tile is only filled
+ * 			with the clear color when first written, and not at all if it is overwritten
+ * 			completely. Colors are stored as packed RGBA words. Frames are handed to a
+ * 			FramePresenter for display.
  */
 
 struct FrameBuffer {
@@ -34,6 +92,9 @@ struct FrameBuffer {
 	void setColor(int x, int y, const color& C);
 	color getClearColor();
 	color getColor(int x, int y) const;
+	void setSpan(int x, int y, int count, const color* colors);
+	void fill(const BoundingBoxi& region, const color& C);
+	void writeTile(const BoundingBoxi& region, const color* colors);
 
 	void clearColorAndDepthBuffers();
 	void clearColorBuffer();
@@ -46,17 +107,45 @@ struct FrameBuffer {
 	void setDepth(int x, int y, double depth);
 	double getDepth(int x, int y) const;
 	double getDepth(double x, double y) const;
+	double getFarthestDepth(const BoundingBoxi& region);
+	double getNearestDepth(const BoundingBoxi& region);
+	bool isOccluded(const BoundingBoxi& region, double nearestDepth);
 
 	void showAxes(int x, int y, const Ray& ray, double thickness);
 	void showAxes(const dmat4& VM, const dmat4& PM, const dmat4& VPM,
 		const BoundingBoxi& viewport);
 	void setPixel(int x, int y, const color& C, double depth);
+
+	void setAccumulationEnabled(bool enabled);
+	bool isAccumulationEnabled() const { return accumBuffer != nullptr; }
+	void clearAccumulationBuffer();
+	void accumulate(int x, int y, const color& C, double weight = 1.0);
+	color getAccumulatedColor(int x, int y) const;
+	double getAccumulatedWeight(int x, int y) const;
+	const float* getAccumulationBuffer() const { return accumBuffer; }
+	void setAccumulationBuffer(const float* sums);
+	void resolveAccumulationBuffer();
+
+	ToneMapParams toneMapParams;			//!< Used when resolving the accumulation buffer
 protected:
 	bool checkInWindow(int x, int y) const;
+	int colorTileIndex(int x, int y) const { return (y / COLOR_TILE_SIZE) * colorTilesX + x / COLOR_TILE_SIZE; }
+	void finishClear(int tile) const;
+	void finishClears() const;
+	void prepareRegionForWrite(int x0, int y0, int x1, int y1);
+	float blockMaxDepth(int block);
+	float coarseMaxDepth(int block);
 	int width;								//!< width of framebuffer
 	int height;								//!< height of framebuffer
-	GLubyte clearColorUB[BYTES_PER_PIXEL];	//!< Clear color, as unsigned bytes
+	uint32_t clearPixel;					//!< Clear color, packed
+	uint32_t pendingClearPixel;				//!< Clear color at the time of the last clear
 	color clearColor;						//!< Clear color
-	GLubyte* colorBuffer;					//!< 2D array for holding colors
-	double* depthBuffer;					//!< 2D array for holding depths
+	uint32_t* colorBuffer;					//!< 2D array for holding colors, packed
+	int colorTilesX;						//!< Number of color tiles across
+	mutable vector<char> clearPending;		//!< True ==> tile must be cleared before use
+	float* depthBuffer;						//!< 2D array for holding depths
+	float* accumBuffer;						//!< 2D array of RGBA sums. nullptr ==> disabled.
+	DepthLevel fineDepth;					//!< Depth range of each DEPTH_BLOCK_SIZE block
+	DepthLevel coarseDepth;					//!< Depth range of each DEPTH_COARSE_SIZE block
+	mutable FramePresenter presenter;		//!< Uploads finished frames to the window
 };
\ No newline at end of file
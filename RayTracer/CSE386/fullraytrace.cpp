@@ -7,17 +7,21 @@
  * permission is granted.
  ****************************************************/
 
+#include <algorithm>
 #include <ctime>
+#include <fstream>
 #include "defs.h"
 #include "io.h"
 #include "ishape.h"
 #include "framebuffer.h"
 #include "raytracer.h"
+#include "pathtracer.h"
 #include "iscene.h"
 #include "light.h"
 #include "image.h"
 #include "camera.h"
 #include "rasterization.h"
+#include "distributed.h"
 
 Image im1("usflag.ppm");
 Image im2("earth.ppm");
@@ -39,9 +43,11 @@ const int MAXZ = 4;
 double z = MINZ;
 double inc = 0.4;
 bool isAnimated = false;
+bool motionBlur = false;
 int numReflections = 0;
 int antiAliasing = 1;
 bool multiViewOn = false;
+const string IRRADIANCE_CACHE_FILE = "irradiance.cache";
 double spotDirX = -1;
 double spotDirY = 0;
 double spotDirZ = 0;
@@ -53,6 +59,8 @@ dvec3 cameraUp = Y_AXIS;
 
 //double cameraFOV = glm::radians(120.0);
 double cameraFOV = glm::radians(60.0);
+double lensAperture = 0.0;		// Radius of the camera's lens. 0 ==> pinhole
+double focalDistance = glm::distance(cameraPos, cameraFocus);
 
 
 /* ********** Lighhs ********** */
@@ -74,9 +82,14 @@ DirectionalLightPtr dirLight = dynamic_cast<DirectionalLightPtr>(lights[2]);
 
 FrameBuffer frameBuffer(WINDOW_WIDTH, WINDOW_HEIGHT);
 RayTracer rayTrace(black);
+PathTracer pathTracer(black);
+bool pathTracing = false;
+RenderCoordinator coordinator;
 IScene scene;
 
-IPlane* clearPlane = new IPlane(dvec3(0.0, 0.0, MINZ), dvec3(0.0, 0.0, 1.0));
+// Thin pane of glass across the box, swept back and forth along z while the animation runs
+IInstance* clearPlane = new IInstance(new IRectangle(dvec3(0.75, 1.25, 0.0), 6.5, 6.0, 0.05), T(0.0, 0.0, MINZ));
+VisibleIShapePtr clearPlaneObj = nullptr;
 
 
 void buildScene() {
@@ -124,6 +137,11 @@ void buildScene() {
 
 	scene.addTransparentObject(new TransparentIShape(new IRectangle(dvec3(4, 1, -2), 0.5, 7, 25), color(0.25, 0.25, 0.25), 0.2));
 
+	// Added to the scene by showPane while the animation runs
+	Material paneGlass(color(0.15, 0.15, 0.3), color(0.55, 0.55, 0.85), color(1.0, 1.0, 1.0), 128.0);
+	paneGlass.alpha = 0.85;
+	clearPlaneObj = new VisibleIShape(clearPlane, paneGlass);
+
 
 	// Planet struct for iterating the planets
 	struct Planet {
@@ -168,6 +186,113 @@ void buildScene() {
 	lights[0]->isOn = true;
 	lights[1]->isOn = false;
 	lights[2]->isOn = false;
+
+	scene.buildAccelerationStructures();
+}
+
+/**
+ * @fn	void placePane()
+ * @brief	Moves the animated pane to z. With motionBlur, it goes on to where the next
+ * 			frame puts it during the shutter interval.
+ */
+
+void placePane() {
+	clearPlane->setTransform(T(0.0, 0.0, z));
+	if (motionBlur) {
+		clearPlane->setMotion(T(0.0, 0.0, z + inc));
+	}
+}
+
+/**
+ * @fn	void showPane(bool visible)
+ * @brief	Adds the animated pane to the scene, at the current z, or takes it out again.
+ * 			The acceleration structures are rebuilt at the next update.
+ * @param	visible	True ==> the pane is in the scene.
+ */
+
+void showPane(bool visible) {
+	auto it = std::find(scene.opaqueObjs.begin(), scene.opaqueObjs.end(), clearPlaneObj);
+	bool inScene = it != scene.opaqueObjs.end();
+	if (visible && !inScene) {
+		placePane();
+		scene.addOpaqueObject(clearPlaneObj);
+	} else if (!visible && inScene) {
+		scene.opaqueObjs.erase(it);
+	}
+}
+
+/**
+ * @fn	RaytracingCamera* makeCamera(int width, int height)
+ * @brief	The camera for an image of the given size, with its lens as set from the
+ * 			keyboard.
+ * @param	width 	Width of the image.
+ * @param	height	Height of the image.
+ * @return	The camera.
+ */
+
+RaytracingCamera* makeCamera(int width, int height) {
+	RaytracingCamera* camera = new PerspectiveCamera(cameraPos, cameraFocus, cameraUp, cameraFOV, width, height);
+	camera->aperture = lensAperture;
+	camera->focalDistance = focalDistance;
+	camera->motionBlurEnabled = motionBlur;
+	return camera;
+}
+
+/**
+ * @fn	vector<double> sceneState()
+ * @brief	Everything that can be changed from the keyboard or by the animation, and
+ * 			that render workers need to trace the same image.
+ * @return	The state, as read by applySceneState.
+ */
+
+vector<double> sceneState() {
+	vector<double> state = { (double)rayTrace.irradianceCachingEnabled, (double)rayTrace.causticsEnabled,
+		(double)rayTrace.wavefrontEnabled, (double)rayTrace.fastShadingEnabled, spotDirX, spotDirY, spotDirZ,
+		lensAperture, focalDistance, (double)isAnimated, z, (double)motionBlur, inc };
+	for (PositionalLightPtr light : lights) {
+		state.insert(state.end(), { (double)light->isOn, light->pos.x, light->pos.y, light->pos.z });
+	}
+	return state;
+}
+
+/**
+ * @fn	void applySceneState(const vector<double> &state, int width, int height)
+ * @brief	Run by a render worker before each frame. Copies the coordinator's state into
+ * 			this process, and sets up the camera.
+ * @param	state 	The state, from sceneState.
+ * @param	width 	Width of the image.
+ * @param	height	Height of the image.
+ */
+
+void applySceneState(const vector<double>& state, int width, int height) {
+	if (state.size() == 13 + 4 * lights.size()) {
+		rayTrace.irradianceCachingEnabled = state[0] != 0.0;
+		rayTrace.causticsEnabled = state[1] != 0.0;
+		rayTrace.wavefrontEnabled = state[2] != 0.0;
+		rayTrace.fastShadingEnabled = state[3] != 0.0;
+		spotDirX = state[4];
+		spotDirY = state[5];
+		spotDirZ = state[6];
+		spotLight->setDir(spotDirX, spotDirY, spotDirZ);
+		lensAperture = state[7];
+		focalDistance = state[8];
+		isAnimated = state[9] != 0.0;
+		bool moved = state[10] != z || (state[11] != 0.0) != motionBlur || state[12] != inc;
+		z = state[10];
+		motionBlur = state[11] != 0.0;
+		inc = state[12];
+		showPane(isAnimated);
+		if (moved) {
+			placePane();
+			scene.objectMoved(clearPlaneObj);
+		}
+		for (size_t i = 0; i < lights.size(); i++) {
+			lights[i]->isOn = state[13 + 4 * i] != 0.0;
+			lights[i]->pos = dvec3(state[14 + 4 * i], state[15 + 4 * i], state[16 + 4 * i]);
+		}
+	}
+	scene.camera = makeCamera(width, height);
+	scene.updateAccelerationStructures();
 }
 
 void render() {
@@ -177,21 +302,33 @@ void render() {
 	int height = frameBuffer.getWindowHeight();
 	frameBuffer.clearColorBuffer();
 
-	scene.camera = new PerspectiveCamera(cameraPos, cameraFocus, cameraUp, cameraFOV, width, height);
-	rayTrace.raytraceScene(frameBuffer, numReflections, scene, antiAliasing);
+	scene.camera = makeCamera(width, height);
+	scene.updateAccelerationStructures();
+	if (pathTracing) {
+		pathTracer.render(frameBuffer, scene);
+	} else if (coordinator.workerCount() > 0) {
+		coordinator.render(frameBuffer, rayTrace, scene, numReflections, antiAliasing, sceneState());
+	} else {
+		rayTrace.raytraceScene(frameBuffer, numReflections, scene, antiAliasing);
+	}
 
 	frameBuffer.showColorBuffer();
 	int frameEndTime = glutGet(GLUT_ELAPSED_TIME); // Get end time
 	double totalTimeSec = (frameEndTime - frameStartTime) / 1000.0;
 
 	if (isAnimated) {
-		cout << "Transparent plane's z value: " << clearPlane->a.z << endl;
+		cout << "Transparent plane's z value: " << z << endl;
 	}
 	cout << "Render time: " << totalTimeSec << " sec." << endl;
+	if (pathTracing) {
+		cout << "Samples per pixel: " << pathTracer.getSamplesTaken() << endl;
+		glutPostRedisplay();		// Keep refining the image
+	}
 }
 
 void resize(int width, int height) {
 	frameBuffer.setFrameBufferSize(width, height);
+	pathTracer.restart();
 	glutPostRedisplay();
 }
 void incrementClamp(double& v, double delta, double lo, double hi) {
@@ -211,8 +348,13 @@ void timer(int id) {
 		else if (z >= MAXZ) {
 			inc = -inc;
 		}
+		placePane();
+		scene.objectMoved(clearPlaneObj);
+
+		// Samples of the pane where it was must not be blended with new ones
+		pathTracer.restart();
+		frameBuffer.clearAccumulationBuffer();
 	}
-	clearPlane->a = dvec3(0, 0, z);
 	glutTimerFunc(TIME_INTERVAL, timer, 0);
 	glutPostRedisplay();
 }
@@ -266,8 +408,61 @@ void keyboard(unsigned char key, int x, int y) {
 		break;
 	case 'P':
 	case 'p':	isAnimated = !isAnimated;
+		showPane(isAnimated);
 		cout << "Animation: " << (isAnimated ? "on" : "off") << endl;
 		break;
+	case 'G':
+	case 'g':	pathTracing = !pathTracing;
+		frameBuffer.setAccumulationEnabled(pathTracing);
+		cout << "Path tracing: " << (pathTracing ? "on" : "off") << endl;
+		break;
+	case 'W':
+	case 'w':	rayTrace.wavefrontEnabled = !rayTrace.wavefrontEnabled;
+		rayTrace.temporalCacheEnabled = !rayTrace.wavefrontEnabled;
+		cout << "Wavefront tracing: " << (rayTrace.wavefrontEnabled ? "on" : "off") << endl;
+		break;
+	case 'F':
+	case 'f':	rayTrace.fastShadingEnabled = !rayTrace.fastShadingEnabled;
+		cout << "Fast wavefront shading: " << (rayTrace.fastShadingEnabled ? "on" : "off") << endl;
+		break;
+	case 'D':
+	case 'd':	rayTrace.denoisingEnabled = !rayTrace.denoisingEnabled;
+		pathTracer.denoisingEnabled = rayTrace.denoisingEnabled;
+		cout << "Denoising: " << (rayTrace.denoisingEnabled ? "on" : "off") << endl;
+		break;
+	case 'I':
+	case 'i':	rayTrace.irradianceCachingEnabled = !rayTrace.irradianceCachingEnabled;
+		if (rayTrace.irradianceCachingEnabled) {
+			if (rayTrace.irradianceCache.size() == 0 && std::ifstream(IRRADIANCE_CACHE_FILE).good()) {
+				rayTrace.irradianceCache.load(IRRADIANCE_CACHE_FILE, IrradianceCache::sceneKey(scene));
+			}
+		} else {
+			rayTrace.irradianceCache.save(IRRADIANCE_CACHE_FILE, IrradianceCache::sceneKey(scene));
+		}
+		rayTrace.invalidateTemporalCache();
+		cout << "Irradiance caching: " << (rayTrace.irradianceCachingEnabled ? "on" : "off")
+			<< " (" << rayTrace.irradianceCache.size() << " records)" << endl;
+		break;
+	case 'E':
+	case 'e':	incrementClamp(lensAperture, isupper(key) ? 0.05 : -0.05, 0.0, 1.0);
+		cout << "Lens aperture: " << lensAperture << (antiAliasing > 1 ? "" : " (needs anti aliasing, '+')") << endl;
+		break;
+	case 'U':
+	case 'u':	incrementClamp(focalDistance, isupper(key) ? INC : -INC, 1.0, 50.0);
+		cout << "Focal distance: " << focalDistance << endl;
+		break;
+	case 'S':
+	case 's':	motionBlur = !motionBlur;
+		placePane();
+		scene.objectMoved(clearPlaneObj);
+		cout << "Motion blur: " << (motionBlur ? "on" : "off")
+			<< (antiAliasing > 1 || pathTracing ? "" : " (needs anti aliasing, '+')") << endl;
+		break;
+	case 'M':
+	case 'm':	rayTrace.causticsEnabled = !rayTrace.causticsEnabled;
+		rayTrace.invalidateTemporalCache();
+		cout << "Caustics: " << (rayTrace.causticsEnabled ? "on" : "off") << endl;
+		break;
 	case '+':	antiAliasing = 3;
 		cout << "Anti aliasing: " << antiAliasing << endl;
 		break;
@@ -282,16 +477,41 @@ void keyboard(unsigned char key, int x, int y) {
 		cout << "Num reflections: " << numReflections << endl;
 		break;
 	case ESCAPE:
+		coordinator.shutdown();
 		glutLeaveMainLoop();
 		break;
 	default:
 		cout << (int)key << "unmapped key pressed." << endl;
 	}
 
+	// Anything may have changed, so the path traced image starts over
+	pathTracer.restart();
+	frameBuffer.clearAccumulationBuffer();
 	glutPostRedisplay();
 }
 
 int main(int argc, char* argv[]) {
+	// fullraytrace ... --checkpoint file ==> save renders in progress to file, and resume from it
+	for (int i = 1; i + 1 < argc; i++) {
+		if (string(argv[i]) == "--checkpoint") {
+			rayTrace.checkpoint.filename = argv[i + 1];
+			pathTracer.checkpoint.filename = argv[i + 1];
+			coordinator.checkpoint.filename = argv[i + 1];
+			for (int j = i; j + 2 <= argc; j++) {
+				argv[j] = argv[j + 2];
+			}
+			argc -= 2;
+			break;
+		}
+	}
+
+	// fullraytrace --worker host port ==> trace tiles for a coordinator, without a window
+	if (argc == 4 && string(argv[1]) == "--worker") {
+		buildScene();
+		RenderWorker worker;
+		return worker.run(argv[2], std::atoi(argv[3]), rayTrace, scene, applySceneState) ? 0 : 1;
+	}
+
 	graphicsInit(argc, argv, __FILE__);
 
 	glutDisplayFunc(render);
@@ -300,6 +520,22 @@ int main(int argc, char* argv[]) {
 	glutMouseFunc(mouseUtility);
 	glutTimerFunc(TIME_INTERVAL, timer, 0);
 	buildScene();
+	rayTrace.temporalCacheEnabled = true;
+
+	// fullraytrace --workers N [port] ==> start N workers on this machine
+	// fullraytrace --remote-workers N [port] ==> wait for N workers started elsewhere
+	if (argc >= 3 && (string(argv[1]) == "--workers" || string(argv[1]) == "--remote-workers")) {
+		int count = std::atoi(argv[2]);
+		int port = argc >= 4 ? std::atoi(argv[3]) : DISTRIBUTED_DEFAULT_PORT;
+		if (!coordinator.listen(port)) {
+			cout << "Cannot listen on port " << port << endl;
+		} else {
+			if (string(argv[1]) == "--workers") {
+				launchLocalWorkers(argv[0], port, count);
+			}
+			cout << coordinator.acceptWorkers(count, 30.0) << " render workers connected" << endl;
+		}
+	}
 
 	glutMainLoop();
 
@@ -0,0 +1,487 @@
+/****************************************************
+ * 2016-2025 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include "irradiancecache.h"
+#include "pathtracer.h"
+#include "light.h"
+#include "raytracer.h"
+
+/**
+ * @fn	IrradianceOctreeNode::IrradianceOctreeNode(const dvec3 &center, double halfSize)
+ * @brief	Constructs an octree node with no children and no records.
+ * @param	center  	Center of the cube.
+ * @param	halfSize	Half the width of the cube.
+ */
+
+IrradianceOctreeNode::IrradianceOctreeNode(const dvec3& center, double halfSize)
+	: center(center), halfSize(halfSize) {
+	for (int i = 0; i < 8; i++) {
+		children[i] = -1;
+	}
+}
+
+/**
+ * @fn	static int octant(const dvec3 &center, const dvec3 &pt)
+ * @brief	Which octant of a cube a point lies in: bit i set ==> above the center on axis i.
+ * @param	center	Center of the cube.
+ * @param	pt	  	The point.
+ * @return	The octant, 0-7.
+ */
+
+static int octant(const dvec3& center, const dvec3& pt) {
+	return (pt.x >= center.x ? 1 : 0) | (pt.y >= center.y ? 2 : 0) | (pt.z >= center.z ? 4 : 0);
+}
+
+/**
+ * @fn	static double farthestAxis(const dvec3 &center, const dvec3 &pt)
+ * @brief	The distance from a cube's center to a point, along the axis where it is largest.
+ * @param	center	Center of the cube.
+ * @param	pt	  	The point.
+ * @return	The distance.
+ */
+
+static double farthestAxis(const dvec3& center, const dvec3& pt) {
+	dvec3 d = glm::abs(pt - center);
+	return glm::max(d.x, glm::max(d.y, d.z));
+}
+
+/**
+ * @fn	IrradianceCache::IrradianceCache()
+ * @brief	Constructs an empty cache.
+ */
+
+IrradianceCache::IrradianceCache() {
+}
+
+/**
+ * @fn	color IrradianceCache::getIrradiance(const dvec3 &pt, const dvec3 &n, const IScene &theScene)
+ * @brief	Gets the indirect irradiance at a point, interpolated from the cache if
+ * 			possible, and otherwise sampled and added to the cache.
+ * @param	pt			The point.
+ * @param	n			Surface normal at the point.
+ * @param	theScene	The scene.
+ * @return	The irradiance.
+ */
+
+color IrradianceCache::getIrradiance(const dvec3& pt, const dvec3& n, const IScene& theScene) {
+	color irradiance;
+	if (findIrradiance(pt, n, irradiance)) {
+		return irradiance;
+	}
+	IrradianceRecord record = computeRecord(pt, n, theScene);
+	insert(record);
+	return record.irradiance;
+}
+
+/**
+ * @fn	bool IrradianceCache::findIrradiance(const dvec3 &pt, const dvec3 &n, color &irradiance) const
+ * @brief	Interpolates the irradiance at a point from the records that are valid there.
+ * 			Records in front of the point are skipped, since they may see light that the
+ * 			point does not.
+ * @param 		  	pt		  	The point.
+ * @param 		  	n		  	Surface normal at the point.
+ * @param [out]	irradiance	The interpolated irradiance.
+ * @return	True iff some record is valid at the point.
+ */
+
+bool IrradianceCache::findIrradiance(const dvec3& pt, const dvec3& n, color& irradiance) const {
+	std::shared_lock<std::shared_timed_mutex> lock(mutex);
+	if (root < 0) {
+		return false;
+	}
+	color sum = black;
+	double totalWeight = 0.0;
+
+	// A node's own records reach at most halfSize beyond it, and its descendants'
+	// records at most halfSize / 2.
+	int stack[IRRADIANCE_STACK_SIZE];
+	int top = 0;
+	stack[top++] = root;
+	while (top > 0) {
+		const IrradianceOctreeNode& node = nodes[stack[--top]];
+		double offCenter = farthestAxis(node.center, pt);
+		if (offCenter > 2.0 * node.halfSize) {
+			continue;
+		}
+		for (int i : node.records) {
+			const IrradianceRecord& R = records[i];
+			dvec3 offset = pt - R.position;
+			double cosine = glm::dot(n, R.normal);
+			if (cosine <= 0.0 || glm::dot(offset, n + R.normal) < -2.0 * EPSILON) {
+				continue;
+			}
+			double error = glm::length(offset) / R.radius + std::sqrt(glm::max(0.0, 1.0 - cosine));
+			if (error >= accuracy) {
+				continue;
+			}
+			double weight = 1.0 / glm::max(error, 1.0E-6);
+			dvec3 rotation = glm::cross(R.normal, n);
+			for (int c = 0; c < 3; c++) {
+				sum[c] += weight * (R.irradiance[c] + glm::dot(rotation, R.rotationGradient[c]) +
+					glm::dot(offset, R.translationGradient[c]));
+			}
+			totalWeight += weight;
+		}
+		if (offCenter > 1.5 * node.halfSize) {
+			continue;
+		}
+		for (int child : node.children) {
+			if (child >= 0 && top < IRRADIANCE_STACK_SIZE) {
+				stack[top++] = child;
+			}
+		}
+	}
+	if (totalWeight == 0.0) {
+		return false;
+	}
+	irradiance = glm::max(sum / totalWeight, 0.0);
+	return true;
+}
+
+/**
+ * @fn	color IrradianceCache::incomingRadiance(const Ray &ray, const IScene &theScene, double &distance) const
+ * @brief	The direct diffuse light reflected back along a ray by the first opaque
+ * 			surface it hits. Rays that leave the scene bring no light.
+ * @param 		  	ray			The ray.
+ * @param 		  	theScene	The scene.
+ * @param [out]	distance	Distance to the surface. FLT_MAX ==> nothing hit.
+ * @return	The radiance.
+ */
+
+color IrradianceCache::incomingRadiance(const Ray& ray, const IScene& theScene, double& distance) const {
+	OpaqueHitRecord hit;
+	if (theScene.findIntersection(ray, hit) < 0) {
+		distance = FLT_MAX;
+		return black;
+	}
+	distance = hit.t;
+	Material material = hit.material;
+	if (hit.texture != nullptr) {
+		material.diffuse = hit.texture->getPixelUV(hit.u, hit.v);
+	}
+	material.ambient = black;
+	material.specular = black;
+
+	color radiance = black;
+	const Frame& eyeFrame = theScene.camera->getFrame();
+	for (auto& light : theScene.lights) {
+		bool inShadow = light->pointIsInAShadow(hit.interceptPt, hit.normal, theScene, eyeFrame);
+		radiance += light->illuminate(hit.interceptPt, hit.normal, material, eyeFrame, inShadow);
+	}
+	return radiance;
+}
+
+/**
+ * @fn	IrradianceRecord IrradianceCache::computeRecord(const dvec3 &pt, const dvec3 &n, const IScene &theScene) const
+ * @brief	Samples the irradiance at a point with samplesTheta x samplesPhi stratified,
+ * 			cosine-distributed rays, and derives the gradients from the same samples.
+ * 			The record's radius is limited by the gradient, and kept within minSpacing
+ * 			and maxSpacing times the distance to the eye, so that the density of the
+ * 			records on screen stays about the same near and far.
+ * 			The jitter within each stratum depends only on the point, so a record is
+ * 			the same whichever thread computes it.
+ * @param	pt			The point.
+ * @param	n			Surface normal at the point.
+ * @param	theScene	The scene.
+ * @return	The record.
+ */
+
+IrradianceRecord IrradianceCache::computeRecord(const dvec3& pt, const dvec3& n, const IScene& theScene) const {
+	const int M = samplesTheta;
+	const int N = samplesPhi;
+	const Frame frame = Frame::createOrthoNormalBasis(ORIGIN3D, n);
+	const dvec3 origin = pt + EPSILON * n;
+
+	uint64_t key = 0;
+	for (int i = 0; i < 3; i++) {
+		uint64_t bits;
+		std::memcpy(&bits, &pt[i], sizeof(bits));
+		key = CounterRNG::mix(key ^ bits);
+	}
+	CounterRNG rng(key, 0);
+
+	vector<color> L((size_t)M * N);
+	vector<double> dist((size_t)M * N);
+	double inverseDistances = 0.0;
+	for (int j = 0; j < M; j++) {
+		for (int k = 0; k < N; k++) {
+			double sinTheta = std::sqrt((j + rng.next()) / M);
+			double cosTheta = std::sqrt(glm::max(0.0, 1.0 - sinTheta * sinTheta));
+			double phi = TWO_PI * (k + rng.next()) / N;
+			dvec3 dir = sinTheta * std::cos(phi) * frame.u + sinTheta * std::sin(phi) * frame.v +
+				cosTheta * frame.w;
+			size_t s = (size_t)j * N + k;
+			L[s] = incomingRadiance(Ray(origin, dir), theScene, dist[s]);
+			dist[s] = glm::max(dist[s], EPSILON);
+			if (dist[s] < FLT_MAX) {
+				inverseDistances += 1.0 / dist[s];
+			}
+		}
+	}
+	auto at = [&](int j, int k) { return (size_t)j * N + (k + N) % N; };
+
+	IrradianceRecord record;
+	record.position = pt;
+	record.normal = n;
+	record.irradiance = black;
+	for (int c = 0; c < 3; c++) {
+		record.translationGradient[c] = dvec3(0);
+		record.rotationGradient[c] = dvec3(0);
+	}
+	for (const color& sample : L) {
+		record.irradiance += sample;
+	}
+	record.irradiance *= PI / (M * N);
+
+	for (int k = 0; k < N; k++) {
+		double phiCenter = TWO_PI * (k + 0.5) / N;
+		double phiEdge = TWO_PI * k / N;
+		dvec3 u = std::cos(phiCenter) * frame.u + std::sin(phiCenter) * frame.v;
+		dvec3 v = -std::sin(phiCenter) * frame.u + std::cos(phiCenter) * frame.v;
+		dvec3 vEdge = -std::sin(phiEdge) * frame.u + std::cos(phiEdge) * frame.v;
+
+		color rotation = black;		// Change with tilt toward u, from each stratum's tangent
+		color acrossTheta = black;	// Change between strata of adjacent elevations
+		color acrossPhi = black;	// Change between strata of adjacent azimuths
+		for (int j = 0; j < M; j++) {
+			double sinLo = std::sqrt((double)j / M);
+			double sinHi = std::sqrt((j + 1.0) / M);
+			double sinCenter = std::sqrt((j + 0.5) / M);
+			rotation += (sinCenter / std::sqrt(1.0 - sinCenter * sinCenter)) * L[at(j, k)];
+			if (j > 0) {
+				double cosLo2 = 1.0 - sinLo * sinLo;
+				acrossTheta += (sinLo * cosLo2 / glm::min(dist[at(j, k)], dist[at(j - 1, k)])) *
+					(L[at(j, k)] - L[at(j - 1, k)]);
+			}
+			acrossPhi += ((sinHi - sinLo) / glm::min(dist[at(j, k)], dist[at(j, k - 1)])) *
+				(L[at(j, k)] - L[at(j, k - 1)]);
+		}
+		for (int c = 0; c < 3; c++) {
+			record.rotationGradient[c] += (PI / (M * N)) * rotation[c] * v;
+			record.translationGradient[c] += (TWO_PI / N) * acrossTheta[c] * u + acrossPhi[c] * vEdge;
+		}
+	}
+
+	double radius = inverseDistances > 0.0 ? (M * N) / inverseDistances : FLT_MAX;
+	for (int c = 0; c < 3; c++) {
+		double slope = glm::length(record.translationGradient[c]);
+		if (slope > 0.0) {
+			radius = glm::min(radius, record.irradiance[c] / slope);
+		}
+	}
+	double eyeDistance = glm::length(pt - theScene.camera->getFrame().origin);
+	record.radius = glm::clamp(radius, minSpacing * eyeDistance, maxSpacing * eyeDistance);
+	return record;
+}
+
+/**
+ * @fn	void IrradianceCache::insert(const IrradianceRecord &record)
+ * @brief	Adds a record to the cache.
+ * @param	record	The record.
+ */
+
+void IrradianceCache::insert(const IrradianceRecord& record) {
+	std::unique_lock<std::shared_timed_mutex> lock(mutex);
+	records.push_back(record);
+	insertLocked((int)records.size() - 1);
+}
+
+/**
+ * @fn	void IrradianceCache::insertLocked(int record)
+ * @brief	Files a record in the octree, growing the root until it covers the record.
+ * 			The record goes in the smallest node containing its position that is at
+ * 			least as wide as its validity radius. The caller holds the lock.
+ * @param	record	Index of the record.
+ */
+
+void IrradianceCache::insertLocked(int record) {
+	const dvec3 pt = records[record].position;
+	const double reach = glm::max(accuracy * records[record].radius, EPSILON);
+
+	if (root < 0) {
+		nodes.push_back(IrradianceOctreeNode(pt, glm::max(reach, 1.0)));
+		root = 0;
+	}
+	while (farthestAxis(nodes[root].center, pt) > nodes[root].halfSize || nodes[root].halfSize < reach) {
+		const IrradianceOctreeNode old = nodes[root];
+		dvec3 toward(pt.x >= old.center.x ? 1 : -1, pt.y >= old.center.y ? 1 : -1, pt.z >= old.center.z ? 1 : -1);
+		IrradianceOctreeNode bigger(old.center + old.halfSize * toward, 2.0 * old.halfSize);
+		bigger.children[octant(bigger.center, old.center)] = root;
+		nodes.push_back(bigger);
+		root = (int)nodes.size() - 1;
+	}
+
+	int node = root;
+	while (nodes[node].halfSize / 2.0 >= reach) {
+		int oct = octant(nodes[node].center, pt);
+		if (nodes[node].children[oct] < 0) {
+			double quarter = nodes[node].halfSize / 2.0;
+			dvec3 offset((oct & 1) ? quarter : -quarter, (oct & 2) ? quarter : -quarter,
+				(oct & 4) ? quarter : -quarter);
+			nodes.push_back(IrradianceOctreeNode(nodes[node].center + offset, quarter));
+			nodes[node].children[oct] = (int)nodes.size() - 1;
+		}
+		node = nodes[node].children[oct];
+	}
+	nodes[node].records.push_back(record);
+}
+
+/**
+ * @fn	void IrradianceCache::clear()
+ * @brief	Removes every record.
+ */
+
+void IrradianceCache::clear() {
+	std::unique_lock<std::shared_timed_mutex> lock(mutex);
+	records.clear();
+	nodes.clear();
+	root = -1;
+}
+
+/**
+ * @fn	int IrradianceCache::size() const
+ * @brief	Gets the number of records.
+ * @return	The number of records.
+ */
+
+int IrradianceCache::size() const {
+	std::shared_lock<std::shared_timed_mutex> lock(mutex);
+	return (int)records.size();
+}
+
+/**
+ * @fn	uint64_t IrradianceCache::sceneKey(const IScene &theScene, uint64_t sceneID)
+ * @brief	A hash (FNV-1a) of what determines the records: the lights, the number of
+ * 			objects and the bounds of each, and an id the caller may give
+ * 			the scene. The camera is not included, since irradiance does not depend on
+ * 			it. Materials are not included either, so delete the file after changing them.
+ * @param	theScene	The scene.
+ * @param	sceneID 	Anything else that tells scenes apart, or 0.
+ * @return	The key.
+ */
+
+uint64_t IrradianceCache::sceneKey(const IScene& theScene, uint64_t sceneID) {
+	vector<double> values = lightingState(theScene);
+	values.insert(values.end(), { (double)theScene.opaqueObjs.size(), (double)theScene.transparentObjs.size() });
+	auto addBounds = [&](const IShapePtr shape) {
+		AABB box = shape->getBounds();
+		values.insert(values.end(), { box.lo.x, box.lo.y, box.lo.z, box.hi.x, box.hi.y, box.hi.z });
+	};
+	for (const VisibleIShapePtr obj : theScene.opaqueObjs) {
+		addBounds(obj->shape);
+	}
+	for (const TransparentIShapePtr obj : theScene.transparentObjs) {
+		addBounds(obj->shape);
+	}
+
+	uint64_t hash = 14695981039346656037ull;
+	auto add = [&](const void* data, size_t size) {
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; i++) {
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+	};
+	for (double value : values) {
+		add(&value, sizeof(double));
+	}
+	add(&sceneID, sizeof(sceneID));
+	return hash;
+}
+
+/**
+ * @fn	bool IrradianceCache::save(const string &filename, uint64_t key) const
+ * @brief	Writes every record to a text file, one per line, after a header holding key.
+ * @param	filename	Name of the file.
+ * @param	key			Identifies the scene the records belong to. See sceneKey.
+ * @return	True iff the file was written.
+ */
+
+bool IrradianceCache::save(const string& filename, uint64_t key) const {
+	std::shared_lock<std::shared_timed_mutex> lock(mutex);
+	std::ofstream out(filename);
+	if (!out.is_open()) {
+		cout << "Error: Cannot open file " << filename << endl;
+		return false;
+	}
+	out << std::setprecision(17);
+	out << "IRRADIANCE_CACHE 2 " << key << ' ' << records.size() << endl;
+	for (const IrradianceRecord& R : records) {
+		auto write = [&](const dvec3& v) { out << v.x << ' ' << v.y << ' ' << v.z << ' '; };
+		write(R.position);
+		write(R.normal);
+		write(R.irradiance);
+		out << R.radius << ' ';
+		for (int c = 0; c < 3; c++) {
+			write(R.translationGradient[c]);
+			write(R.rotationGradient[c]);
+		}
+		out << '\n';
+	}
+	return out.good();
+}
+
+/**
+ * @fn	bool IrradianceCache::load(const string &filename, uint64_t key)
+ * @brief	Replaces the records with those saved in a file, if it was saved with the
+ * 			same key. The octree is rebuilt with the current accuracy.
+ * @param	filename	Name of the file.
+ * @param	key			Identifies the scene being rendered. See sceneKey.
+ * @return	True iff the file was read. If not, the cache is left empty.
+ */
+
+bool IrradianceCache::load(const string& filename, uint64_t key) {
+	clear();
+	std::ifstream in(filename);
+	if (!in.is_open()) {
+		cout << "Error: Cannot open file " << filename << endl;
+		return false;
+	}
+	string tag;
+	int version = 0;
+	uint64_t savedKey = 0;
+	size_t count = 0;
+	in >> tag >> version;
+	if (tag != "IRRADIANCE_CACHE" || version != 2) {
+		cout << "Error: " << filename << " is not an irradiance cache" << endl;
+		return false;
+	}
+	in >> savedKey >> count;
+	if (in.fail() || savedKey != key) {
+		cout << "Error: " << filename << " was saved for another scene" << endl;
+		return false;
+	}
+
+	vector<IrradianceRecord> loaded(count);
+	for (IrradianceRecord& R : loaded) {
+		auto read = [&](dvec3& v) { in >> v.x >> v.y >> v.z; };
+		read(R.position);
+		read(R.normal);
+		read(R.irradiance);
+		in >> R.radius;
+		for (int c = 0; c < 3; c++) {
+			read(R.translationGradient[c]);
+			read(R.rotationGradient[c]);
+		}
+	}
+	if (in.fail()) {
+		cout << "Error: " << filename << " is truncated" << endl;
+		return false;
+	}
+
+	std::unique_lock<std::shared_timed_mutex> lock(mutex);
+	records = loaded;
+	for (int i = 0; i < (int)records.size(); i++) {
+		insertLocked(i);
+	}
+	return true;
+}
@@ -0,0 +1,91 @@
+/****************************************************
+ * 2016-2025 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include <shared_mutex>
+#include "utilities.h"
+#include "iscene.h"
+
+const int IRRADIANCE_STACK_SIZE = 512;	//!< Size of the octree traversal stack (8 per level)
+
+/**
+ * @struct	IrradianceRecord
+ * @brief	The indirect irradiance arriving at one point, with its gradients, so that
+ * 			it can be extrapolated to nearby points of similar orientation. Each
+ * 			gradient holds one vector per color channel.
+ */
+
+struct IrradianceRecord {
+	dvec3 position;					//!< Where the irradiance was sampled
+	dvec3 normal;					//!< Surface normal there
+	color irradiance;				//!< Indirect irradiance
+	double radius;					//!< Harmonic mean distance to the surfaces seen, clamped
+	dvec3 translationGradient[3];	//!< Change in each channel per unit of motion
+	dvec3 rotationGradient[3];		//!< Change in each channel per radian of rotation of the normal
+};
+
+/**
+ * @struct	IrradianceOctreeNode
+ * @brief	A cube of the irradiance cache's octree. Holds the records centered inside
+ * 			it whose validity radius is between a quarter and a half of its width.
+ */
+
+struct IrradianceOctreeNode {
+	dvec3 center;					//!< Center of the cube
+	double halfSize;				//!< Half the width of the cube
+	int children[8];				//!< Index of each octant's node. -1 ==> none yet
+	vector<int> records;			//!< Indices of the records stored here
+	IrradianceOctreeNode(const dvec3& center, double halfSize);
+};
+
+/**
+ * @class	IrradianceCache
+ * @brief	An irradiance cache (Ward et al.) for one bounce of diffuse indirect light.
+ * 			Irradiance is sampled sparsely, by stratified hemisphere sampling, and is
+ * 			interpolated elsewhere from the records that are close enough. Record i is
+ * 			used at point p with normal n when its weight
+ * 				w = 1 / (|p - p_i| / R_i + sqrt(1 - n . n_i))
+ * 			exceeds 1 / accuracy. Translation and rotation gradients (Ward and Heckbert)
+ * 			let the records extrapolate, so fewer are needed.
+ *
+ * 			The hemisphere rays gather direct diffuse light only, so the result is one
+ * 			bounce. Lookups may run on any number of threads at once; inserting a
+ * 			record locks the cache briefly. Records can be saved to a file and loaded
+ * 			again, so that renders of a static scene reuse them. The file is stamped with
+ * 			sceneKey, and a file made for another scene or lighting is not loaded. Call
+ * 			clear after the scene, lights or accuracy change.
+ */
+
+class IrradianceCache {
+public:
+	IrradianceCache();
+	color getIrradiance(const dvec3& pt, const dvec3& n, const IScene& theScene);
+	bool findIrradiance(const dvec3& pt, const dvec3& n, color& irradiance) const;
+	IrradianceRecord computeRecord(const dvec3& pt, const dvec3& n, const IScene& theScene) const;
+	void insert(const IrradianceRecord& record);
+	void clear();
+	int size() const;
+	bool save(const string& filename, uint64_t key) const;
+	bool load(const string& filename, uint64_t key);
+	static uint64_t sceneKey(const IScene& theScene, uint64_t sceneID = 0);
+
+	double accuracy = 0.3;		//!< Larger ==> records are used farther away (faster, blurrier)
+	double minSpacing = 0.005;	//!< Smallest radius given to a record, per unit of distance from the eye
+	double maxSpacing = 0.2;	//!< Largest radius given to a record, per unit of distance from the eye
+	int samplesTheta = 8;		//!< Strata in elevation. samplesTheta * samplesPhi rays per record
+	int samplesPhi = 24;		//!< Strata in azimuth
+protected:
+	color incomingRadiance(const Ray& ray, const IScene& theScene, double& distance) const;
+	void insertLocked(int record);
+	vector<IrradianceRecord> records;		//!< Every record
+	vector<IrradianceOctreeNode> nodes;		//!< The octree. nodes[root] covers every record
+	int root = -1;							//!< Index of the root. -1 ==> empty
+	mutable std::shared_timed_mutex mutex;	//!< Shared by lookups, exclusive for changes
+};
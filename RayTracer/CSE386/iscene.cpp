@@ -7,6 +7,7 @@
  * permission is granted.
  ****************************************************/
 
+#include <algorithm>
 #include "iscene.h"
 
 /**
@@ -38,3 +39,162 @@ void IScene::addTransparentObject(const TransparentIShapePtr obj) {
 void IScene::addLight(const LightSourcePtr light) {
 	lights.push_back(light);
 }
+
+/**
+ * @fn	template <class Obj> static vector<AABB> boundsOf(const vector<Obj*>& objects)
+ * @brief	Collects the bounds of each object's shape.
+ * @param	objects	The objects.
+ * @return	The bounds, in the same order.
+ */
+
+template <class Obj>
+static vector<AABB> boundsOf(const vector<Obj*>& objects) {
+	vector<AABB> result(objects.size());
+	for (size_t i = 0; i < objects.size(); i++) {
+		result[i] = objects[i]->shape->getBounds();
+	}
+	return result;
+}
+
+/**
+ * @fn	void IScene::buildAccelerationStructures()
+ * @brief	Builds the hierarchies over the objects currently in the scene.
+ */
+
+void IScene::buildAccelerationStructures() {
+	geometryVersion++;
+	opaqueBVH.build(boundsOf(opaqueObjs));
+	transparentBVH.build(boundsOf(transparentObjs));
+}
+
+/**
+ * @fn	void IScene::objectMoved(const VisibleIShapePtr obj)
+ * @brief	Records that the shape of an opaque object has changed.
+ * @param	obj	The object.
+ */
+
+void IScene::objectMoved(const VisibleIShapePtr obj) {
+	geometryVersion++;
+	auto it = std::find(opaqueObjs.begin(), opaqueObjs.end(), obj);
+	if (it != opaqueObjs.end() && opaqueBVH.size() == (int)opaqueObjs.size()) {
+		opaqueBVH.markDirty((int)(it - opaqueObjs.begin()));
+	}
+}
+
+/**
+ * @fn	void IScene::objectMoved(const TransparentIShapePtr obj)
+ * @brief	Records that the shape of a transparent object has changed.
+ * @param	obj	The object.
+ */
+
+void IScene::objectMoved(const TransparentIShapePtr obj) {
+	geometryVersion++;
+	auto it = std::find(transparentObjs.begin(), transparentObjs.end(), obj);
+	if (it != transparentObjs.end() && transparentBVH.size() == (int)transparentObjs.size()) {
+		transparentBVH.markDirty((int)(it - transparentObjs.begin()));
+	}
+}
+
+/**
+ * @fn	void IScene::updateAccelerationStructures()
+ * @brief	Refits the hierarchies around the objects that moved, or rebuilds them if
+ * 			objects were added or removed. Costs nothing if nothing has changed.
+ */
+
+void IScene::updateAccelerationStructures() {
+	if (opaqueBVH.size() != (int)opaqueObjs.size() ||
+		transparentBVH.size() != (int)transparentObjs.size()) {
+		geometryVersion++;
+	}
+	if (opaqueBVH.size() != (int)opaqueObjs.size()) {
+		opaqueBVH.build(boundsOf(opaqueObjs));
+	} else if (opaqueBVH.isDirty()) {
+		opaqueBVH.refit(boundsOf(opaqueObjs));
+	}
+	if (transparentBVH.size() != (int)transparentObjs.size()) {
+		transparentBVH.build(boundsOf(transparentObjs));
+	} else if (transparentBVH.isDirty()) {
+		transparentBVH.refit(boundsOf(transparentObjs));
+	}
+}
+
+/**
+ * @fn	template <class Obj, class Hit> static int findIntersectionLinear(const Ray& ray, const vector<Obj*>& objects, Hit& closest)
+ * @brief	Finds the closest object by testing each one in turn. Only the distance to
+ * 			each object is found; the hit is completed for the closest one alone.
+ * @param 		  	ray	   	The ray.
+ * @param 		  	objects	The objects.
+ * @param [in,out]	closest	The closest hit. t == FLT_MAX ==> no hit.
+ * @return	The index of the object hit, or -1 if there is none.
+ */
+
+template <class Obj, class Hit>
+static int findIntersectionLinear(const Ray& ray, const vector<Obj*>& objects, Hit& closest) {
+	closest.t = FLT_MAX;
+	int closestIndex = -1;
+	int closestPart = 0;
+	for (int i = 0; i < (int)objects.size(); i++) {
+		int part = 0;
+		double t = objects[i]->findClosestT(ray, part);
+		if (t < closest.t) {
+			closest.t = t;
+			closestIndex = i;
+			closestPart = part;
+		}
+	}
+	if (closestIndex >= 0) {
+		objects[closestIndex]->completeHit(ray, closest.t, closestPart, closest);
+	}
+	return closestIndex;
+}
+
+/**
+ * @fn	int IScene::findIntersection(const Ray& ray, OpaqueHitRecord& hit) const
+ * @brief	Finds the closest opaque object along a ray.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The closest hit. t == FLT_MAX ==> no hit.
+ * @return	The index of the object hit in opaqueObjs, or -1 if there is none.
+ */
+
+int IScene::findIntersection(const Ray& ray, OpaqueHitRecord& hit) const {
+	if (opaqueBVH.size() == (int)opaqueObjs.size()) {
+		return opaqueBVH.findIntersection(ray, opaqueObjs, hit);
+	}
+	return findIntersectionLinear(ray, opaqueObjs, hit);
+}
+
+/**
+ * @fn	int IScene::findIntersection(const Ray& ray, TransparentHitRecord& hit) const
+ * @brief	Finds the closest transparent object along a ray.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The closest hit. t == FLT_MAX ==> no hit.
+ * @return	The index of the object hit in transparentObjs, or -1 if there is none.
+ */
+
+int IScene::findIntersection(const Ray& ray, TransparentHitRecord& hit) const {
+	if (transparentBVH.size() == (int)transparentObjs.size()) {
+		return transparentBVH.findIntersection(ray, transparentObjs, hit);
+	}
+	return findIntersectionLinear(ray, transparentObjs, hit);
+}
+
+/**
+ * @fn	bool IScene::findAnyOpaqueIntersection(const Ray& ray, double maxT) const
+ * @brief	Determines if any opaque object lies along a ray closer than maxT.
+ * @param	ray 	The ray.
+ * @param	maxT	Hits at or beyond this distance are ignored.
+ * @return	True iff something was hit.
+ */
+
+bool IScene::findAnyOpaqueIntersection(const Ray& ray, double maxT) const {
+	if (opaqueBVH.size() == (int)opaqueObjs.size()) {
+		return opaqueBVH.findAnyIntersection(ray, opaqueObjs, maxT);
+	}
+	for (const VisibleIShapePtr obj : opaqueObjs) {
+		int part = 0;
+		if (obj->findClosestT(ray, part) < maxT) {
+			return true;
+		}
+	}
+	return false;
+}
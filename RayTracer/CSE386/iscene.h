@@ -16,10 +16,16 @@
 #include "light.h"
 #include "eshape.h"
 #include "ishape.h"
+#include "bvh.h"
 
  /**
   * @struct	IScene
   * @brief	Represents an scene of implicitly represented objects. Used mostly in ray tracing.
+  * 		Once buildAccelerationStructures has been called, rays are intersected
+  * 		through a BVH over the opaque and over the transparent objects. When objects
+  * 		move, report them with objectMoved and call updateAccelerationStructures
+  * 		before the next frame. Objects added after a build are searched linearly
+  * 		until the next update.
   */
 
 struct IScene {
@@ -30,4 +36,16 @@ struct IScene {
 	void addOpaqueObject(const VisibleIShapePtr obj);
 	void addTransparentObject(const TransparentIShapePtr obj);
 	void addLight(const LightSourcePtr light);
+
+	void buildAccelerationStructures();
+	void objectMoved(const VisibleIShapePtr obj);
+	void objectMoved(const TransparentIShapePtr obj);
+	void updateAccelerationStructures();
+	int findIntersection(const Ray& ray, OpaqueHitRecord& hit) const;
+	int findIntersection(const Ray& ray, TransparentHitRecord& hit) const;
+	bool findAnyOpaqueIntersection(const Ray& ray, double maxT) const;
+
+	BVH opaqueBVH;			//!< Hierarchy over opaqueObjs
+	BVH transparentBVH;		//!< Hierarchy over transparentObjs
+	int geometryVersion = 0;	//!< Changes whenever objects are reported moved or the structures are rebuilt
 };
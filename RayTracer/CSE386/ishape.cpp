@@ -32,6 +32,51 @@ void IShape::getTexCoords(const dvec3& pt, double& u, double& v) const {
 	u = v = 0;
 }
 
+/**
+ * @fn	void IShape::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Finds the closest intersection by running both phases.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The hit. t == FLT_MAX ==> none.
+ */
+
+void IShape::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
+	int part = 0;
+	hit.t = findClosestT(ray, part);
+	if (hit.t < FLT_MAX) {
+		completeHit(ray, hit.t, part, hit);
+	}
+}
+
+/**
+ * @fn	double IShape::findClosestT(const Ray &ray, int &part) const
+ * @brief	First phase of intersection: the distance to the closest hit. The default
+ * 			runs findClosestIntersection and discards everything else.
+ * @param 		  	ray 	The ray.
+ * @param [in,out]	part	Shape-specific information for completeHit.
+ * @return	The distance to the closest hit, or FLT_MAX if there is none.
+ */
+
+double IShape::findClosestT(const Ray& ray, int& part) const {
+	HitRecord hit;
+	findClosestIntersection(ray, hit);
+	part = 0;
+	return hit.t;
+}
+
+/**
+ * @fn	void IShape::completeHit(const Ray &ray, double t, int part, HitRecord &hit) const
+ * @brief	Second phase of intersection: fills in the hit found by findClosestT. The
+ * 			default runs findClosestIntersection again.
+ * @param 		  	ray 	The ray.
+ * @param 		  	t   	The distance returned by findClosestT.
+ * @param 		  	part	The part returned by findClosestT.
+ * @param [in,out]	hit 	The hit.
+ */
+
+void IShape::completeHit(const Ray& ray, double /*t*/, int /*part*/, HitRecord& hit) const {
+	findClosestIntersection(ray, hit);
+}
+
 /**
  * @fn	dvec3 IShape::movePointOffSurface(const dvec3 &pt, const dvec3 &n)
  * @brief	Compute point that is slightly off surface.
@@ -45,6 +90,169 @@ dvec3 IShape::movePointOffSurface(const dvec3& pt, const dvec3& n) {
 	return pt;
 }
 
+/**
+ * @fn	AABB IShape::getBounds() const
+ * @brief	Gets the world space bounds of the shape. By default, a shape is assumed to be
+ * 			unbounded, so it is never skipped by a bounds test.
+ * @return	The bounds.
+ */
+
+AABB IShape::getBounds() const {
+	return AABB::infinite();
+}
+
+/**
+ * @fn	bool IShape::findSpans(const Ray& ray, vector<RaySpan>& spans) const
+ * @brief	Finds the intervals of the ray that lie inside the shape, in increasing order,
+ * 			for ICSG. The whole line counts, including behind the origin, although spans
+ * 			that end before t = 0 may be left out. The default is for shapes that do not
+ * 			enclose a volume (disks, triangles, open cylinders).
+ * @param 		  	ray  	The ray.
+ * @param [in,out]	spans	Replaced by the spans.
+ * @return	True iff the shape is a solid. If not, there are no spans.
+ */
+
+bool IShape::findSpans(const Ray& /*ray*/, vector<RaySpan>& spans) const {
+	spans.clear();
+	return false;
+}
+
+/**
+ * @fn	AABB::AABB()
+ * @brief	Constructs an empty box. Expanding it by any point gives a box around just that point.
+ */
+
+AABB::AABB()
+	: lo(DBL_MAX), hi(-DBL_MAX) {
+}
+
+/**
+ * @fn	AABB::AABB(const dvec3& lo, const dvec3& hi)
+ * @brief	Constructs a box from its two extreme corners.
+ * @param	lo	Corner with the smallest coordinates.
+ * @param	hi	Corner with the largest coordinates.
+ */
+
+AABB::AABB(const dvec3& lo, const dvec3& hi)
+	: lo(lo), hi(hi) {
+}
+
+/**
+ * @fn	AABB AABB::infinite()
+ * @brief	The box that contains everything.
+ * @return	The box.
+ */
+
+AABB AABB::infinite() {
+	return AABB(dvec3(-DBL_MAX), dvec3(DBL_MAX));
+}
+
+/**
+ * @fn	void AABB::expand(const dvec3& pt)
+ * @brief	Grows the box just enough to contain a point.
+ * @param	pt	The point.
+ */
+
+void AABB::expand(const dvec3& pt) {
+	lo = glm::min(lo, pt);
+	hi = glm::max(hi, pt);
+}
+
+/**
+ * @fn	void AABB::expand(const AABB& box)
+ * @brief	Grows the box just enough to contain another box.
+ * @param	box	The other box.
+ */
+
+void AABB::expand(const AABB& box) {
+	lo = glm::min(lo, box.lo);
+	hi = glm::max(hi, box.hi);
+}
+
+/**
+ * @fn	bool AABB::isBounded() const
+ * @brief	Determines if the box is finite in every direction.
+ * @return	True iff no side of the box is at infinity.
+ */
+
+bool AABB::isBounded() const {
+	for (int i = 0; i < 3; i++) {
+		if (lo[i] <= -DBL_MAX || hi[i] >= DBL_MAX) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @fn	AABB AABB::transformed(const dmat4& M) const
+ * @brief	Computes the bounds of this box after an affine transformation. The result
+ * 			is built from the transformed center and the absolute value of the linear
+ * 			part applied to the half extents, so it is exact for the eight corners.
+ * @param	M	The transformation.
+ * @return	The bounds of the transformed box.
+ */
+
+AABB AABB::transformed(const dmat4& M) const {
+	if (isEmpty()) {
+		return AABB();
+	}
+	if (!isBounded()) {
+		return infinite();
+	}
+	dvec3 C = (M * dvec4(center(), 1.0)).xyz();
+	dvec3 halfSize = extent() / 2.0;
+	dvec3 R;
+	for (int row = 0; row < 3; row++) {
+		R[row] = glm::abs(M[0][row]) * halfSize.x +
+			glm::abs(M[1][row]) * halfSize.y +
+			glm::abs(M[2][row]) * halfSize.z;
+	}
+	return AABB(C - R, C + R);
+}
+
+/**
+ * @fn	bool AABB::intersects(const Ray& ray, double tMax, double& tNear) const
+ * @brief	Slab test of a ray against the box.
+ * @param 		  	ray  	The ray.
+ * @param 		  	tMax 	Hits farther away than this are ignored.
+ * @param [in,out]	tNear	Where the ray enters the box. 0 if it starts inside.
+ * @return	True iff the ray passes through the box at some t in [0, tMax].
+ */
+
+bool AABB::intersects(const Ray& ray, double tMax, double& tNear) const {
+	double t0 = 0.0;
+	double t1 = tMax;
+	for (int i = 0; i < 3; i++) {
+		double invDir = 1.0 / ray.dir[i];
+		double tLo = (lo[i] - ray.origin[i]) * invDir;
+		double tHi = (hi[i] - ray.origin[i]) * invDir;
+		if (tLo > tHi) {
+			std::swap(tLo, tHi);
+		}
+		t0 = tLo > t0 ? tLo : t0;
+		t1 = tHi < t1 ? tHi : t1;
+		if (t0 > t1) {
+			return false;
+		}
+	}
+	tNear = t0;
+	return true;
+}
+
+/**
+ * @fn	AABB AABB::overlap(const AABB& a, const AABB& b)
+ * @brief	The box common to two boxes. Empty if they do not overlap.
+ * @param	a	One box.
+ * @param	b	The other box.
+ * @return	The overlap.
+ */
+
+AABB AABB::overlap(const AABB& a, const AABB& b) {
+	AABB box(glm::max(a.lo, b.lo), glm::min(a.hi, b.hi));
+	return box.isEmpty() ? AABB() : box;
+}
+
 /**
  * @fn	VisibleIShape::VisibleIShape(IShapePtr shapePtr, const Material &mat)
  * @brief	Represents an visible, implicit shape.
@@ -67,26 +275,43 @@ VisibleIShape::VisibleIShape(IShapePtr shapePtr, const Material& mat, Image* ima
 void VisibleIShape::findClosestIntersection(const Ray& ray, OpaqueHitRecord& hit) const {
 	/* 386 - todo */
 
-	shape->findClosestIntersection(ray, hit);
+	int part = 0;
+	hit.t = findClosestT(ray, part);
 
 	if (hit.t < FLT_MAX) {
-		hit.material = material;
-		if (glm::dot(ray.dir, hit.normal) > 0) {
+		completeHit(ray, hit.t, part, hit);
+	}
+}
 
-			// Reverse the normal vector for correct lighting
-			hit.normal = -hit.normal;
+/**
+ * @fn	void VisibleIShape::completeHit(const Ray &ray, double t, int part, OpaqueHitRecord &hit) const
+ * @brief	Fills in everything about a hit found by findClosestT: the intercept point,
+ * 			the normal (facing the ray), the material and the tex coordinates.
+ * @param 		  	ray 	The ray.
+ * @param 		  	t   	The distance returned by findClosestT.
+ * @param 		  	part	The part returned by findClosestT.
+ * @param [in,out]	hit 	The hit.
+ */
 
-			// Assume the ray is leaving the surface
-			hit.rayStatus = LEAVING;
-		}
-		else {
-			// The ray is entering the surface
-			hit.rayStatus = ENTERING;
-		}
-		hit.texture = texture;
-		if (hit.texture != nullptr) {
-			shape->getTexCoords(hit.interceptPt, hit.u, hit.v);
-		}
+void VisibleIShape::completeHit(const Ray& ray, double t, int part, OpaqueHitRecord& hit) const {
+	shape->completeHit(ray, t, part, hit);
+
+	hit.material = material;
+	if (glm::dot(ray.dir, hit.normal) > 0) {
+
+		// Reverse the normal vector for correct lighting
+		hit.normal = -hit.normal;
+
+		// Assume the ray is leaving the surface
+		hit.rayStatus = LEAVING;
+	}
+	else {
+		// The ray is entering the surface
+		hit.rayStatus = ENTERING;
+	}
+	hit.texture = texture;
+	if (hit.texture != nullptr) {
+		shape->getTexCoords(hit.interceptPt, hit.u, hit.v);
 	}
 }
 
@@ -102,15 +327,22 @@ void VisibleIShape::findIntersection(const Ray& ray, const vector<VisibleIShapeP
 	OpaqueHitRecord& closestSoFar) {
 	/* CSE 386 - todo  */
 	closestSoFar.t = FLT_MAX;
+	VisibleIShapePtr closestSurface = nullptr;
+	int closestPart = 0;
 
 	for (auto& surface : surfaces) {
-		OpaqueHitRecord thisHit;
-		surface->findClosestIntersection(ray, thisHit);
+		int part = 0;
+		double t = surface->findClosestT(ray, part);
 
-		if (thisHit.t < closestSoFar.t) {
-			closestSoFar = thisHit;
+		if (t < closestSoFar.t) {
+			closestSoFar.t = t;
+			closestSurface = surface;
+			closestPart = part;
 		}
 	}
+	if (closestSurface != nullptr) {
+		closestSurface->completeHit(ray, closestSoFar.t, closestPart, closestSoFar);
+	}
 }
 
 /**
@@ -153,6 +385,35 @@ void TransparentIShape::findClosestIntersection(const Ray& ray, TransparentHitRe
 	}
 }
 
+/**
+ * @fn	double TransparentIShape::findClosestT(const Ray &ray, int &part) const
+ * @brief	First phase of intersection. Transparent objects are few, so this simply
+ * 			finds the whole hit.
+ * @param 		  	ray 	The ray.
+ * @param [in,out]	part	Unused by completeHit.
+ * @return	The distance to the closest hit, or FLT_MAX if there is none.
+ */
+
+double TransparentIShape::findClosestT(const Ray& ray, int& part) const {
+	TransparentHitRecord hit;
+	findClosestIntersection(ray, hit);
+	part = 0;
+	return hit.t;
+}
+
+/**
+ * @fn	void TransparentIShape::completeHit(const Ray &ray, double t, int part, TransparentHitRecord &hit) const
+ * @brief	Second phase of intersection: finds the whole hit again.
+ * @param 		  	ray 	The ray.
+ * @param 		  	t   	The distance returned by findClosestT.
+ * @param 		  	part	The part returned by findClosestT.
+ * @param [in,out]	hit 	The hit.
+ */
+
+void TransparentIShape::completeHit(const Ray& ray, double /*t*/, int /*part*/, TransparentHitRecord& hit) const {
+	findClosestIntersection(ray, hit);
+}
+
 /**
  * @fn	HitRecord VisibleIShape::findIntersection(const Ray &ray, const vector<VisibleIShapePtr> &surfaces)
  * @brief	Searches for the first intersection
@@ -204,23 +465,38 @@ IDisk::IDisk(const dvec3& pos, const dvec3& normal, double rad)
 }
 
 /**
- * @fn	void IDisk::findClosestIntersection(const Ray &ray, HitRecord &hit) const
- * @brief	Identifies the nearest intersection
- * @param 		  	ray	The ray.
- * @param [in,out]	hit	The hit.
+ * @fn	double IDisk::findClosestT(const Ray &ray, int &part) const
+ * @brief	Finds the distance to the disk
+ * @param 		  	ray 	The ray.
+ * @param [in,out]	part	Always 0.
+ * @return	The distance to the hit, or FLT_MAX if there is none.
  */
 
-void IDisk::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
+double IDisk::findClosestT(const Ray& ray, int& part) const {
 	/* CSE 386 - todo  */
-	hit.t = FLT_MAX;
 	IPlane plane(center, n);
-	plane.findClosestIntersection(ray, hit);	// HitRecord populated
+	double t = plane.findClosestT(ray, part);
 
-	if (hit.t < FLT_MAX) {
-		if (glm::distance(center, hit.interceptPt) > radius) {	// The intersection is outside the disk
-			hit.t = FLT_MAX;
+	if (t < FLT_MAX) {
+		if (glm::distance(center, ray.getPoint(t)) > radius) {	// The intersection is outside the disk
+			t = FLT_MAX;
 		}
 	}
+	return t;
+}
+
+/**
+ * @fn	void IDisk::completeHit(const Ray &ray, double t, int part, HitRecord &hit) const
+ * @brief	Fills in the hit found by findClosestT
+ * @param 		  	ray 	The ray.
+ * @param 		  	t   	The distance to the hit.
+ * @param 		  	part	The part returned by findClosestT.
+ * @param [in,out]	hit 	The hit.
+ */
+
+void IDisk::completeHit(const Ray& ray, double t, int part, HitRecord& hit) const {
+	IPlane plane(center, n);
+	plane.completeHit(ray, t, part, hit);
 }
 
 /**
@@ -251,6 +527,18 @@ void IDisk::getTexCoords(const dvec3& pt, double& u, double& v) const {
 	//v = 1.0 - v;
 }
 
+/**
+ * @fn	AABB IDisk::getBounds() const
+ * @brief	Gets the bounds of the disk. Along each axis, the disk extends by the radius
+ * 			times the sine of the angle between that axis and the normal.
+ * @return	The bounds.
+ */
+
+AABB IDisk::getBounds() const {
+	dvec3 R = radius * glm::sqrt(glm::max(dvec3(1.0) - n * n, dvec3(0.0)));
+	return AABB(center - R, center + R);
+}
+
 /**
  * @fn	ISphere::ISphere(const dvec3 & position, double radius)
  * @brief	Implicit representation of a 3D sphere.
@@ -279,6 +567,17 @@ void ISphere::getTexCoords(const dvec3& pt, double& u, double& v) const {
 	v = 1.0 - map(el, -PI_2, PI_2, 0.0, 1.0); // Get rid of the "1.0 -" if needing to flip
 }
 
+/**
+ * @fn	AABB ISphere::getBounds() const
+ * @brief	Gets the bounds of the sphere.
+ * @return	The bounds.
+ */
+
+AABB ISphere::getBounds() const {
+	dvec3 R(glm::sqrt(-qParams.J));
+	return AABB(center - R, center + R);
+}
+
 /**
  * @fn	QuadricParameters::QuadricParameters()
  * @brief	Default constructor
@@ -461,19 +760,20 @@ bool IPlane::onFrontSide(const dvec3& point) const {
 }
 
 /**
- * @fn	void IPlane::findClosestIntersection(const Ray &ray, HitRecord &hit) const
- * @brief	Find the HitRecord for this plane and the passed Ray. The t value of
- *          the HitRecord will be MAX_FLT, if there is no intersection. There are
- *          two ways to produce a non-existant intersection:
+ * @fn	double IPlane::findClosestT(const Ray &ray, int &part) const
+ * @brief	Find the distance to this plane along the passed Ray. It will be MAX_FLT,
+ *          if there is no intersection. There are two ways to produce a
+ *          non-existant intersection:
  *              1. The ray is parallel to the plane
  * 				2. The intersection is behind the ray's origin
- * @param 		  	ray	The ray.
- * @param [in,out]	hit	The hit.
+ * @param 		  	ray 	The ray.
+ * @param [in,out]	part	Always 0.
+ * @return	The distance to the hit, or FLT_MAX if there is none.
  */
 
-void IPlane::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
+double IPlane::findClosestT(const Ray& ray, int& part) const {
 	/* CSE 386 - todo  */
-	hit.t = FLT_MAX;
+	part = 0;
 
 	double denom = glm::dot(ray.dir, this->n);
 
@@ -481,15 +781,50 @@ void IPlane::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
 		double t = glm::dot(a - ray.origin, n) / denom;
 
 		if (t > 0.0) {	// Intersection is infront of ray's origin (visible)
-			hit.t = t;
-			//hit.interceptPt = ray.origin + t * ray.dir;
-			hit.interceptPt = ray.getPoint(t);
-			hit.normal = n;
+			return t;
 		}
 	}
+	return FLT_MAX;
+}
 
-	//hit.interceptPt = ORIGIN3D;
-	//hit.normal = Y_AXIS;
+/**
+ * @fn	void IPlane::completeHit(const Ray &ray, double t, int part, HitRecord &hit) const
+ * @brief	Fills in the hit found by findClosestT
+ * @param 		  	ray 	The ray.
+ * @param 		  	t   	The distance to the hit.
+ * @param 		  	part	The part returned by findClosestT.
+ * @param [in,out]	hit 	The hit.
+ */
+
+void IPlane::completeHit(const Ray& ray, double t, int /*part*/, HitRecord& hit) const {
+	hit.t = t;
+	hit.interceptPt = ray.getPoint(t);
+	hit.normal = n;
+}
+
+/**
+ * @fn	bool IPlane::findSpans(const Ray& ray, vector<RaySpan>& spans) const
+ * @brief	Treats the plane as the half space behind it (away from n), which is handy
+ * 			for cutting other solids.
+ * @param 		  	ray  	The ray.
+ * @param [in,out]	spans	Replaced by the span behind the plane, if there is one.
+ * @return	True.
+ */
+
+bool IPlane::findSpans(const Ray& ray, vector<RaySpan>& spans) const {
+	spans.clear();
+	double denom = glm::dot(ray.dir, n);
+	double dist = glm::dot(a - ray.origin, n);
+	if (denom == 0.0) {
+		if (dist > 0.0) {
+			spans.push_back({ -DBL_MAX, DBL_MAX, 0, 0 });
+		}
+	} else if (denom > 0.0) {
+		spans.push_back({ -DBL_MAX, dist / denom, 0, 0 });
+	} else {
+		spans.push_back({ dist / denom, DBL_MAX, 0, 0 });
+	}
+	return true;
 }
 
 /**
@@ -656,6 +991,31 @@ void IQuadricSurface::computeAqBqCq(const Ray& ray, double& Aq, double& Bq, doub
 		I * Ro.z + J;
 }
 
+/**
+ * @fn	int IQuadricSurface::findRoots(const Ray &ray, double roots[2]) const
+ * @brief	Finds the distances to the intersections that appear in front of the
+ * 			viewer, sorted by distance from viewer.
+ * @param 		  	ray  	The ray.
+ * @param [in,out]	roots	The distances.
+ * @return	The number of intersections found.
+ */
+
+int IQuadricSurface::findRoots(const Ray& ray, double roots[2]) const {
+	double Aq, Bq, Cq;
+	computeAqBqCq(ray, Aq, Bq, Cq);
+	double allRoots[2];
+
+	int numRoots = quadratic(Aq, Bq, Cq, allRoots);
+	int numIntersections = 0;
+
+	for (int i = 0; i < numRoots; i++) {
+		if (allRoots[i] > 0) {
+			roots[numIntersections++] = allRoots[i];
+		}
+	}
+	return numIntersections;
+}
+
 /**
  * @fn	int IQuadricSurface::findIntersections(const Ray &ray, HitRecord hits[2]) const
  * @brief	Identifies the intersections that appear in front of the viewer. These
@@ -666,54 +1026,93 @@ void IQuadricSurface::computeAqBqCq(const Ray& ray, double& Aq, double& Bq, doub
  */
 
 int IQuadricSurface::findIntersections(const Ray& ray, HitRecord hits[2]) const {
-	double Aq, Bq, Cq;
-	computeAqBqCq(ray, Aq, Bq, Cq);
 	double roots[2];
+	int numIntersections = findRoots(ray, roots);
 
-	int numRoots = quadratic(Aq, Bq, Cq, roots);
-	int numIntersections = 0;
-
-	for (int i = 0; i < numRoots; i++) {
-		if (roots[i] > 0) {
-			const double& t = roots[i];
-			hits[numIntersections].t = t;
-			hits[numIntersections].interceptPt = ray.origin + t * ray.dir;
-			const dvec3& intercept = hits[numIntersections].interceptPt;
-			hits[numIntersections].normal = normal(intercept);
-			numIntersections++;
-		}
+	for (int i = 0; i < numIntersections; i++) {
+		IQuadricSurface::completeHit(ray, roots[i], i, hits[i]);
 	}
 
 	return numIntersections;
 }
 
 /**
- * @fn	void IQuadricSurface::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @fn	double IQuadricSurface::findClosestT(const Ray &ray, int &part) const
  * @brief	Searches for the nearest intersection
- * @param 		  	ray	The ray.
- * @param [in,out]	hit	The hit.
- */
-
-void IQuadricSurface::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
-	HitRecord hits[2];
-	hit.t = FLT_MAX;
-
-	int numIntercepts = findIntersections(ray, hits);
-	if (numIntercepts == 1 && hits[0].t > 0) {
-		hit.t = hits[0].t;
-		hit.interceptPt = hits[0].interceptPt;
-		hit.normal = normal(hit.interceptPt);
-	} else if (numIntercepts == 2) {
-		if (hits[0].t > 0) {
-			hit.t = hits[0].t;
-			hit.interceptPt = hits[0].interceptPt;
-			hit.normal = normal(hit.interceptPt);
-		} else if (hits[1].t > 0) {
-			hit.t = hits[1].t;
-			hit.interceptPt = hits[1].interceptPt;
-			hit.normal = normal(hit.interceptPt);
+ * @param 		  	ray 	The ray.
+ * @param [in,out]	part	Always 0.
+ * @return	The distance to the hit, or FLT_MAX if there is none.
+ */
+
+double IQuadricSurface::findClosestT(const Ray& ray, int& part) const {
+	double roots[2];
+	part = 0;
+	return findRoots(ray, roots) > 0 ? roots[0] : FLT_MAX;
+}
+
+/**
+ * @fn	void IQuadricSurface::completeHit(const Ray &ray, double t, int part, HitRecord &hit) const
+ * @brief	Fills in the hit found by findClosestT
+ * @param 		  	ray 	The ray.
+ * @param 		  	t   	The distance to the hit.
+ * @param 		  	part	The part returned by findClosestT.
+ * @param [in,out]	hit 	The hit.
+ */
+
+void IQuadricSurface::completeHit(const Ray& ray, double t, int /*part*/, HitRecord& hit) const {
+	hit.t = t;
+	hit.interceptPt = ray.origin + t * ray.dir;
+	hit.normal = normal(hit.interceptPt);
+}
+
+/**
+ * @fn	bool IQuadricSurface::findSpans(const Ray& ray, vector<RaySpan>& spans) const
+ * @brief	The solid is where the quadric's equation is negative, which is the inside of
+ * 			a sphere, ellipsoid, cylinder or cone. Along the ray that is between the two
+ * 			roots when Aq > 0, and outside them when Aq < 0 (e.g., a ray crossing both
+ * 			halves of a cone). Unbounded quadrics give unbounded spans.
+ * @param 		  	ray  	The ray.
+ * @param [in,out]	spans	Replaced by the spans.
+ * @return	True.
+ */
+
+bool IQuadricSurface::findSpans(const Ray& ray, vector<RaySpan>& spans) const {
+	double Aq, Bq, Cq;
+	computeAqBqCq(ray, Aq, Bq, Cq);
+	spans.clear();
+
+	if (Aq == 0.0) {	// e.g., parallel to a cylinder's axis
+		if (Bq == 0.0) {
+			if (Cq < 0.0) {
+				spans.push_back({ -DBL_MAX, DBL_MAX, 0, 0 });
+			}
+		} else if (Bq > 0.0) {
+			spans.push_back({ -DBL_MAX, -Cq / Bq, 0, 0 });
+		} else {
+			spans.push_back({ -Cq / Bq, DBL_MAX, 0, 0 });
 		}
+		return true;
 	}
+
+	// Not quadratic(), which takes a nearly zero discriminant as a single root. That
+	// would lose the spans of rays running almost along a cylinder's axis.
+	double discriminant = Bq * Bq - 4.0 * Aq * Cq;
+	if (discriminant <= 0.0) {
+		if (Aq < 0.0) {
+			spans.push_back({ -DBL_MAX, DBL_MAX, 0, 0 });
+		}
+		return true;
+	}
+	double sqrtDisc = glm::sqrt(discriminant);
+	double root1 = (-Bq - sqrtDisc) / (2.0 * Aq);
+	double root2 = (-Bq + sqrtDisc) / (2.0 * Aq);
+	if (Aq > 0.0) {
+		spans.push_back({ root1, root2, 0, 0 });
+	} else {
+		spans.push_back({ -DBL_MAX, root2, 0, 0 });
+		spans.push_back({ root1, DBL_MAX, 0, 0 });
+	}
+	return true;
 }
 
 /**
@@ -782,25 +1181,6 @@ IConeY::IConeY(const dvec3& pos, double rad, double H)
 	: ICone(pos, rad, H, QuadricParameters::coneYQParams(rad, H)) {
 }
 
-/**
- * @fn	void ICone::findClosestIntersection(const Ray &ray, HitRecord &hit) const
- * @brief	Searches for the nearest intersection
- * @param 		  	ray	The ray.
- * @param [in,out]	hit	The hit.
- */
-
-void IConeY::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
-	static HitRecord hits[2];
-	int numHits = IQuadricSurface::findIntersections(ray, hits);
-
-	if (numHits == 0) {
-		hit.t = FLT_MAX;
-	} else {
-		hit = hits[0];
-	}
-	return;
-}
-
 /**
  * @fn	ICylinderY::ICylinderY(const dvec3 &pos, double rad, double len)
  * @brief	Default constructor
@@ -823,27 +1203,42 @@ ICylinderY::ICylinderY(const dvec3& pos, double rad, double len)
 }
 
 /**
- * @fn	void ICylinderY::findClosestIntersection(const Ray &ray, HitRecord &hit) const
- * @brief	Searches for the nearest intersection
- * @param 		  	ray	The ray.
- * @param [in,out]	hit	The hit.
+ * @fn	double ICylinderY::findClosestT(const Ray &ray, int &part) const
+ * @brief	Searches for the nearest intersection between the ends of the cylinder
+ * @param 		  	ray 	The ray.
+ * @param [in,out]	part	Always 0.
+ * @return	The distance to the hit, or FLT_MAX if there is none.
  */
 
-void ICylinderY::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
-	HitRecord hits[2];
-	int numHits = IQuadricSurface::findIntersections(ray, hits);
+double ICylinderY::findClosestT(const Ray& ray, int& part) const {
+	double roots[2];
+	int numHits = IQuadricSurface::findRoots(ray, roots);
+	part = 0;
 
-	for (HitRecord &Thishit : hits) {
+	for (int i = 0; i < numHits; i++) {
+		double y = ray.origin.y + roots[i] * ray.dir.y;
 
-		if (Thishit.interceptPt.y < center.y + length / 2.0 && 
-			Thishit.interceptPt.y > center.y - length / 2.0) {
+		if (y < center.y + length / 2.0 && 
+			y > center.y - length / 2.0) {
 
-			hit = Thishit;
-			return;
+			return roots[i];
 		}
 	}
 
-	hit.t = FLT_MAX;
+	return FLT_MAX;
+}
+
+/**
+ * @fn	bool ICylinderY::findSpans(const Ray& ray, vector<RaySpan>& spans) const
+ * @brief	An open cylinder is just a tube, not a solid. See IClosedCylinderY.
+ * @param 		  	ray  	The ray.
+ * @param [in,out]	spans	Cleared.
+ * @return	False.
+ */
+
+bool ICylinderY::findSpans(const Ray& /*ray*/, vector<RaySpan>& spans) const {
+	spans.clear();
+	return false;
 }
 
 /**
@@ -865,6 +1260,17 @@ void ICylinderY::getTexCoords(const dvec3& pt, double& u, double& v) const {
 	u = map(angle, 0.0, TWO_PI, 0.0, 1.0);
 }
 
+/**
+ * @fn	AABB ICylinderY::getBounds() const
+ * @brief	Gets the bounds of the cylinder, including its caps if it has them.
+ * @return	The bounds.
+ */
+
+AABB ICylinderY::getBounds() const {
+	dvec3 R(radius, length / 2.0, radius);
+	return AABB(center - R, center + R);
+}
+
 /**
  * @fn	ICylinderY::ICylinderY(const dvec3 &pos, double rad, double len)
  * @brief	Constructor
@@ -878,19 +1284,21 @@ IClosedCylinderY::IClosedCylinderY(const dvec3& pos, double rad, double len)
 }
 
 /**
- * @fn	void IClosedCylinderY::findClosestIntersection(const Ray& ray, HitRecord& hit) const
+ * @fn	double IClosedCylinderY::findClosestT(const Ray& ray, int& part) const
  * @brief	Searches for the nearest intersection
- * @param 		  	ray	The ray.
- * @param [in,out]	hit	The hit.
+ * @param 		  	ray 	The ray.
+ * @param [in,out]	part	0 ==> side, 1 ==> bottom cap, 2 ==> top cap.
+ * @return	The distance to the hit, or FLT_MAX if there is none.
  */
 
-void IClosedCylinderY::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
+double IClosedCylinderY::findClosestT(const Ray& ray, int& part) const {
 
-	hit.t = FLT_MAX;
-	HitRecord sideHit, bottomHit, topHit;
+	int unused;
+	double t = FLT_MAX;
+	part = 0;
 
 	// Check intersection with the side of the cylinder
-	ICylinderY::findClosestIntersection(ray, sideHit);
+	double sideT = ICylinderY::findClosestT(ray, unused);
 
 	// Define disk centers
 	dvec3 bottomCenter = center - dvec3(0.0, length / 2.0, 0.0);
@@ -898,24 +1306,92 @@ void IClosedCylinderY::findClosestIntersection(const Ray& ray, HitRecord& hit) c
 
 	// Bottom cap
 	IDisk bottomDisk(bottomCenter, -Y_AXIS, radius);
-	bottomDisk.findClosestIntersection(ray, bottomHit);
+	double bottomT = bottomDisk.findClosestT(ray, unused);
 
 	// Top cap
 	IDisk topDisk(topCenter, Y_AXIS, radius);
-	topDisk.findClosestIntersection(ray, topHit);
+	double topT = topDisk.findClosestT(ray, unused);
 
 	// Choose closest valid hit
-	if (sideHit.t < hit.t) {
-		hit = sideHit;
+	if (sideT < t) {
+		t = sideT;
+		part = 0;
+	}
+	if (bottomT < t) {
+		t = bottomT;
+		part = 1;
 	}
-	if (bottomHit.t < hit.t) {
-		hit = bottomHit;
+	if (topT < t) {
+		t = topT;
+		part = 2;
 	}
-	if (topHit.t < hit.t) {
-		hit = topHit;
+	return t;
+}
+
+/**
+ * @fn	void IClosedCylinderY::completeHit(const Ray& ray, double t, int part, HitRecord& hit) const
+ * @brief	Fills in the hit found by findClosestT
+ * @param 		  	ray 	The ray.
+ * @param 		  	t   	The distance to the hit.
+ * @param 		  	part	The part returned by findClosestT.
+ * @param [in,out]	hit 	The hit.
+ */
+
+void IClosedCylinderY::completeHit(const Ray& ray, double t, int part, HitRecord& hit) const {
+	if (part == 0) {
+		ICylinderY::completeHit(ray, t, part, hit);
+	} else if (part == 1) {
+		IDisk bottomDisk(center - dvec3(0.0, length / 2.0, 0.0), -Y_AXIS, radius);
+		bottomDisk.completeHit(ray, t, 0, hit);
+	} else {
+		IDisk topDisk(center + dvec3(0.0, length / 2.0, 0.0), Y_AXIS, radius);
+		topDisk.completeHit(ray, t, 0, hit);
 	}
 }
 
+/**
+ * @fn	bool IClosedCylinderY::findSpans(const Ray& ray, vector<RaySpan>& spans) const
+ * @brief	The spans of the infinite cylinder, clipped to the slab between the caps.
+ * @param 		  	ray  	The ray.
+ * @param [in,out]	spans	Replaced by the spans. Parts are as for completeHit.
+ * @return	True.
+ */
+
+bool IClosedCylinderY::findSpans(const Ray& ray, vector<RaySpan>& spans) const {
+	vector<RaySpan> sides;
+	IQuadricSurface::findSpans(ray, sides);
+	spans.clear();
+
+	const double bottom = center.y - length / 2.0;
+	const double top = center.y + length / 2.0;
+	RaySpan slab = { -DBL_MAX, DBL_MAX, 1, 2 };
+	if (ray.dir.y == 0.0) {
+		if (ray.origin.y <= bottom || ray.origin.y >= top) {
+			return true;
+		}
+	} else {
+		double tBottom = (bottom - ray.origin.y) / ray.dir.y;
+		double tTop = (top - ray.origin.y) / ray.dir.y;
+		slab = ray.dir.y > 0.0 ? RaySpan{ tBottom, tTop, 1, 2 } : RaySpan{ tTop, tBottom, 2, 1 };
+	}
+
+	for (const RaySpan& side : sides) {
+		RaySpan span = side;
+		if (slab.tIn > span.tIn) {
+			span.tIn = slab.tIn;
+			span.inPart = slab.inPart;
+		}
+		if (slab.tOut < span.tOut) {
+			span.tOut = slab.tOut;
+			span.outPart = slab.outPart;
+		}
+		if (span.tIn < span.tOut) {
+			spans.push_back(span);
+		}
+	}
+	return true;
+}
+
 /**
  * @fn	IEllipsoid::IEllipsoid(const dvec3 &position, const dvec3 &sz)
  * @brief	Constructs an implicit representation of an ellipsoid.
@@ -927,6 +1403,17 @@ IEllipsoid::IEllipsoid(const dvec3& position, const dvec3& sz)
 	: IQuadricSurface(QuadricParameters::ellipsoidQParams(sz), position) {
 }
 
+/**
+ * @fn	AABB IEllipsoid::getBounds() const
+ * @brief	Gets the bounds of the ellipsoid.
+ * @return	The bounds.
+ */
+
+AABB IEllipsoid::getBounds() const {
+	dvec3 R(1.0 / glm::sqrt(qParams.A), 1.0 / glm::sqrt(qParams.B), 1.0 / glm::sqrt(qParams.C));
+	return AABB(center - R, center + R);
+}
+
 /**
  * @fn	ITriangle::ITriangle(const dvec3 &a, const dvec3 &b, const dvec3 &c)
  * @brief	Creates a triangle with 3 vertices.
@@ -942,15 +1429,16 @@ ITriangle::ITriangle(const dvec3& a, const dvec3& b, const dvec3& c)
 }
 
 /**
- * @fn	void ITriangle::findClosestIntersection(const Ray& ray, HitRecord& hit) const
+ * @fn	double ITriangle::findClosestT(const Ray& ray, int& part) const
  * @brief	Performs ray triangle intersection using the Moller Trumbore algorithm.
- * @param	ray	The ray to test.
- * @param	hit	The hit record.
+ * @param	ray 	The ray to test.
+ * @param	part	Always 0.
+ * @return	The distance to the hit, or FLT_MAX if there is none.
  */
 
-void ITriangle::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
+double ITriangle::findClosestT(const Ray& ray, int& part) const {
 
-	hit.t = FLT_MAX;
+	part = 0;
 
 	dvec3 edge1 = v1 - v0;
 	dvec3 edge2 = v2 - v0;
@@ -959,7 +1447,7 @@ void ITriangle::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
 
 	if (fabs(a) < EPSILON) {
 
-		return;
+		return FLT_MAX;
 	}
 
 	double f = 1.0 / a;
@@ -968,7 +1456,7 @@ void ITriangle::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
 
 	if (u < 0.0 || u > 1.0) {
 
-		return;
+		return FLT_MAX;
 	}
 
 	dvec3 q = glm::cross(s, edge1);
@@ -976,17 +1464,27 @@ void ITriangle::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
 
 	if (v < 0.0 || u + v > 1.0) {
 
-		return;
+		return FLT_MAX;
 	}
 
 	double t = f * glm::dot(edge2, q);
 
-	if (t > EPSILON) {
+	return t > EPSILON ? t : FLT_MAX;
+}
 
-		hit.t = t;
-		hit.interceptPt = ray.getPoint(t);
-		hit.normal = normal;
-	}
+/**
+ * @fn	void ITriangle::completeHit(const Ray& ray, double t, int part, HitRecord& hit) const
+ * @brief	Fills in the hit found by findClosestT.
+ * @param	ray 	The ray.
+ * @param	t   	The distance to the hit.
+ * @param	part	The part returned by findClosestT.
+ * @param	hit 	The hit record.
+ */
+
+void ITriangle::completeHit(const Ray& ray, double t, int /*part*/, HitRecord& hit) const {
+	hit.t = t;
+	hit.interceptPt = ray.getPoint(t);
+	hit.normal = normal;
 }
 
 /**
@@ -1017,6 +1515,20 @@ void ITriangle::getTexCoords(const dvec3& pt, double& u, double& v) const {
 	v = b;
 }
 
+/**
+ * @fn	AABB ITriangle::getBounds() const
+ * @brief	Gets the bounds of the triangle.
+ * @return	The bounds.
+ */
+
+AABB ITriangle::getBounds() const {
+	AABB box;
+	box.expand(v0);
+	box.expand(v1);
+	box.expand(v2);
+	return box;
+}
+
 /**
  * @fn	IBasicSphere::IBasicSphere(const dvec3& c, double r)
  * @brief	Constructor for a non-quadric sphere.
@@ -1029,15 +1541,16 @@ IBasicSphere::IBasicSphere(const dvec3& c, double r)
 }
 
 /**
- * @fn	void IBasicSphere::findClosestIntersection(const Ray& ray, HitRecord& hit) const
- * @brief	Computes the closest intersection of a ray with the sphere.
- * @param	ray	The ray to test.
- * @param	hit The resulting intersection data.
+ * @fn	double IBasicSphere::findClosestT(const Ray& ray, int& part) const
+ * @brief	Computes the distance to the closest intersection of a ray with the sphere.
+ * @param	ray 	The ray to test.
+ * @param	part	Always 0.
+ * @return	The distance to the hit, or FLT_MAX if there is none.
  */
 
-void IBasicSphere::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
+double IBasicSphere::findClosestT(const Ray& ray, int& part) const {
 
-	hit.t = FLT_MAX;
+	part = 0;
 
 	const dvec3& e = ray.origin;
 	const dvec3& d = ray.dir;
@@ -1051,7 +1564,7 @@ void IBasicSphere::findClosestIntersection(const Ray& ray, HitRecord& hit) const
 
 	if (discriminant < 0.0) {
 
-		return;
+		return FLT_MAX;
 	}
 
 	double sqrtDisc = sqrt(discriminant);
@@ -1060,11 +1573,19 @@ void IBasicSphere::findClosestIntersection(const Ray& ray, HitRecord& hit) const
 
 	double t = (t0 > 0.0) ? t0 : ((t1 > 0.0) ? t1 : -1.0);
 
-	if (t < 0.0) {
+	return t < 0.0 ? FLT_MAX : t;
+}
 
-		return;
-	}
+/**
+ * @fn	void IBasicSphere::completeHit(const Ray& ray, double t, int part, HitRecord& hit) const
+ * @brief	Fills in the hit found by findClosestT.
+ * @param	ray 	The ray.
+ * @param	t   	The distance to the hit.
+ * @param	part	The part returned by findClosestT.
+ * @param	hit 	The resulting intersection data.
+ */
 
+void IBasicSphere::completeHit(const Ray& ray, double t, int /*part*/, HitRecord& hit) const {
 	hit.t = t;
 	hit.interceptPt = ray.getPoint(t);
 	hit.normal = glm::normalize(hit.interceptPt - center);
@@ -1088,6 +1609,39 @@ void IBasicSphere::getTexCoords(const dvec3& pt, double& u, double& v) const {
 	v = 1.0 - map(el, -PI_2, PI_2, 0.0, 1.0);
 }
 
+/**
+ * @fn	AABB IBasicSphere::getBounds() const
+ * @brief	Gets the bounds of the sphere.
+ * @return	The bounds.
+ */
+
+AABB IBasicSphere::getBounds() const {
+	dvec3 R(radius);
+	return AABB(center - R, center + R);
+}
+
+/**
+ * @fn	bool IBasicSphere::findSpans(const Ray& ray, vector<RaySpan>& spans) const
+ * @brief	The span between the two intersections, if the ray passes through the sphere.
+ * @param 		  	ray  	The ray.
+ * @param [in,out]	spans	Replaced by the span, if any.
+ * @return	True.
+ */
+
+bool IBasicSphere::findSpans(const Ray& ray, vector<RaySpan>& spans) const {
+	spans.clear();
+	dvec3 ec = ray.origin - center;
+	double B = 2.0 * glm::dot(ray.dir, ec);
+	double C = glm::dot(ec, ec) - radius * radius;
+	double discriminant = B * B - 4.0 * C;
+
+	if (discriminant > 0.0) {
+		double sqrtDisc = sqrt(discriminant);
+		spans.push_back({ (-B - sqrtDisc) / 2.0, (-B + sqrtDisc) / 2.0, 0, 0 });
+	}
+	return true;
+}
+
 /**
  * @fn		IRectangle::IRectangle(const dvec3& center, double width, double height, double depth)
  * @brief	Constructor for an axis-aligned rectangular prism (box).
@@ -1121,19 +1675,22 @@ IRectangle::IRectangle(const dvec3& center, double width, double height, double
 }
 
 /**
- * @fn		void IRectangle::findClosestIntersection(const Ray& ray, HitRecord& hit) const
- * @brief	Computes the closest intersection between a ray and the rectangular prism.
+ * @fn		double IRectangle::findClosestT(const Ray& ray, int& part) const
+ * @brief	Computes the distance to the closest intersection between a ray and the rectangular prism.
  *			Iterates through each of the six bounded faces and determines if the ray intersects
- *			within the finite boundaries of the face. Updates the hit record with the nearest valid hit.
+ *			within the finite boundaries of the face. Keeps the nearest valid hit.
  *
- * @param	ray	The ray to test for intersection with the rectangle.
- * @param	hit	[out] The hit record to store intersection details such as t-value, point of contact, and normal.
+ * @param	ray 	The ray to test for intersection with the rectangle.
+ * @param	part	[out] Index of the face that was hit.
+ * @return	The distance to the hit, or FLT_MAX if there is none.
  */
 
-void IRectangle::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
-	hit.t = FLT_MAX;
+double IRectangle::findClosestT(const Ray& ray, int& part) const {
+	double closestT = FLT_MAX;
+	part = 0;
 
-	for (const auto& face : faces) {
+	for (int i = 0; i < (int)faces.size(); i++) {
+		const Face& face = faces[i];
 
 		double denom = glm::dot(ray.dir, face.normal);
 
@@ -1144,7 +1701,7 @@ void IRectangle::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
 
 		double t = glm::dot(face.center - ray.origin, face.normal) / denom;
 
-		if (t < 0.0 || t >= hit.t) {
+		if (t < 0.0 || t >= closestT) {
 
 			continue;
 		}
@@ -1158,11 +1715,26 @@ void IRectangle::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
 
 		if (fabs(u) <= face.halfU && fabs(v) <= face.halfV) {
 
-			hit.t = t;
-			hit.interceptPt = pt;
-			hit.normal = face.normal;
+			closestT = t;
+			part = i;
 		}
 	}
+	return closestT;
+}
+
+/**
+ * @fn	void IRectangle::completeHit(const Ray& ray, double t, int part, HitRecord& hit) const
+ * @brief	Fills in the hit found by findClosestT.
+ * @param	ray 	The ray.
+ * @param	t   	The distance to the hit.
+ * @param	part	Index of the face that was hit.
+ * @param	hit	[out] The hit record.
+ */
+
+void IRectangle::completeHit(const Ray& ray, double t, int part, HitRecord& hit) const {
+	hit.t = t;
+	hit.interceptPt = ray.getPoint(t);
+	hit.normal = faces[part].normal;
 }
 
 /**
@@ -1198,4 +1770,410 @@ void IRectangle::getTexCoords(const dvec3& pt, double& u,
 	// If none 
 	u = 0.0;
 	v = 0.0;
-}
\ No newline at end of file
+}
+
+/**
+ * @fn	AABB IRectangle::getBounds() const
+ * @brief	Gets the bounds of the box, which is the box itself.
+ * @return	The bounds.
+ */
+
+AABB IRectangle::getBounds() const {
+	dvec3 R(halfWidth, halfHeight, halfDepth);
+	return AABB(center - R, center + R);
+}
+
+/**
+ * @fn	bool IRectangle::findSpans(const Ray& ray, vector<RaySpan>& spans) const
+ * @brief	Slab test of the whole line against the box, keeping track of which face the
+ * 			ray enters and leaves through.
+ * @param 		  	ray  	The ray.
+ * @param [in,out]	spans	Replaced by the span, if any. Parts are indices into faces.
+ * @return	True.
+ */
+
+bool IRectangle::findSpans(const Ray& ray, vector<RaySpan>& spans) const {
+	static const int plusFace[3] = { 2, 4, 0 };		// Indices into faces
+	static const int minusFace[3] = { 3, 5, 1 };
+	const dvec3 R(halfWidth, halfHeight, halfDepth);
+	RaySpan span = { -DBL_MAX, DBL_MAX, 0, 0 };
+	spans.clear();
+
+	for (int i = 0; i < 3; i++) {
+		double lo = center[i] - R[i] - ray.origin[i];
+		double hi = center[i] + R[i] - ray.origin[i];
+		if (ray.dir[i] == 0.0) {
+			if (lo >= 0.0 || hi <= 0.0) {
+				return true;
+			}
+			continue;
+		}
+		double tLo = lo / ray.dir[i];
+		double tHi = hi / ray.dir[i];
+		int loPart = minusFace[i];
+		int hiPart = plusFace[i];
+		if (tLo > tHi) {
+			std::swap(tLo, tHi);
+			std::swap(loPart, hiPart);
+		}
+		if (tLo > span.tIn) {
+			span.tIn = tLo;
+			span.inPart = loPart;
+		}
+		if (tHi < span.tOut) {
+			span.tOut = tHi;
+			span.outPart = hiPart;
+		}
+	}
+	if (span.tIn < span.tOut) {
+		spans.push_back(span);
+	}
+	return true;
+}
+
+/**
+ * @fn	IInstance::IInstance(IShapePtr child, const dmat4& T)
+ * @brief	Constructs an instance of another shape.
+ * @param	child	The shape to instance. It is shared, not copied.
+ * @param	T	 	Object to world transformation. Must be invertible.
+ */
+
+IInstance::IInstance(IShapePtr child, const dmat4& T)
+	: child(child) {
+	setTransform(T);
+}
+
+/**
+ * @fn	void IInstance::setTransform(const dmat4& T)
+ * @brief	Moves the instance, updating the cached inverse and world bounds. The
+ * 			instance stands still until setMotion is called again.
+ * @param	T	Object to world transformation. Must be invertible.
+ */
+
+void IInstance::setTransform(const dmat4& T) {
+	transform = T;
+	endTransform = T;
+	moving = false;
+	inverseTransform = glm::inverse(T);
+	normalMatrix = glm::transpose(dmat3(inverseTransform));
+	bounds = child->getBounds().transformed(T);
+}
+
+/**
+ * @fn	void IInstance::setMotion(const dmat4& T1)
+ * @brief	Sets where the instance is at the end of the shutter interval; it is at
+ * 			the transformation given to setTransform at the start. In between, the two
+ * 			matrices are interpolated linearly, which is exact for translation and
+ * 			scaling, and close for rotations of a few degrees. The bounds grow to hold
+ * 			the instance over the whole interval.
+ * @param	T1	Object to world transformation at the end of the shutter interval. Every
+ * 				transformation between it and the starting one must be invertible.
+ */
+
+void IInstance::setMotion(const dmat4& T1) {
+	endTransform = T1;
+	moving = T1 != transform;
+	bounds = child->getBounds().transformed(transform);
+	bounds.expand(child->getBounds().transformed(T1));
+}
+
+/**
+ * @fn	Ray IInstance::toObjectSpace(const Ray& ray, double& scale, dmat3* normals) const
+ * @brief	Moves a ray into the child's coordinate system, as the instance is at the
+ * 			ray's time. Object space directions are normalized too, so distances along
+ * 			the object space ray are scale times those along the world space ray.
+ * @param 		  	ray	   	The ray, in world coordinates.
+ * @param [out]   	scale  	Length of the object space direction, before normalizing.
+ * @param [out]   	normals	If not null, the matrix that takes object space normals to
+ * 							world space at the ray's time.
+ * @return	The ray in object space.
+ */
+
+Ray IInstance::toObjectSpace(const Ray& ray, double& scale, dmat3* normals) const {
+	const bool moved = moving && ray.time != 0.0;
+	const dmat4 inverse = moved ? glm::inverse(transform + ray.time * (endTransform - transform))
+								: inverseTransform;
+	dvec3 objectOrigin = (inverse * dvec4(ray.origin, 1.0)).xyz();
+	dvec3 objectDir = (inverse * dvec4(ray.dir, 0.0)).xyz();
+	scale = glm::length(objectDir);
+	if (normals != nullptr) {
+		*normals = moved ? glm::transpose(dmat3(inverse)) : normalMatrix;
+	}
+	return Ray(objectOrigin, objectDir, ray.time);
+}
+
+/**
+ * @fn	void IInstance::findClosestIntersection(const Ray& ray, HitRecord& hit) const
+ * @brief	Intersects the ray with the child in its own coordinate system. Ray
+ * 			directions are normalized, so t is rescaled by the length of the object
+ * 			space direction to make it a world space distance again.
+ * @param 		  	ray	The ray, in world coordinates.
+ * @param [in,out]	hit	The hit, in world coordinates.
+ */
+
+void IInstance::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
+	double scale;
+	dmat3 normals;
+	child->findClosestIntersection(toObjectSpace(ray, scale, &normals), hit);
+
+	if (hit.t < FLT_MAX) {
+		hit.t /= scale;
+		hit.interceptPt = ray.getPoint(hit.t);
+		hit.normal = glm::normalize(normals * hit.normal);
+	}
+}
+
+/**
+ * @fn	double IInstance::findClosestT(const Ray& ray, int& part) const
+ * @brief	Finds the distance to the child, in world space.
+ * @param 		  	ray 	The ray, in world coordinates.
+ * @param [in,out]	part	The child's part.
+ * @return	The distance to the hit, or FLT_MAX if there is none.
+ */
+
+double IInstance::findClosestT(const Ray& ray, int& part) const {
+	double scale;
+	double t = child->findClosestT(toObjectSpace(ray, scale), part);
+	return t < FLT_MAX ? t / scale : t;
+}
+
+/**
+ * @fn	void IInstance::completeHit(const Ray& ray, double t, int part, HitRecord& hit) const
+ * @brief	Fills in the hit found by findClosestT, or at either end of a span found by
+ * 			findSpans, by completing the child's hit at the same point in object space.
+ * @param 		  	ray 	The ray, in world coordinates.
+ * @param 		  	t   	The distance to the hit.
+ * @param 		  	part	The part returned by findClosestT.
+ * @param [in,out]	hit 	The hit, in world coordinates.
+ */
+
+void IInstance::completeHit(const Ray& ray, double t, int part, HitRecord& hit) const {
+	double scale;
+	dmat3 normals;
+	Ray objRay = toObjectSpace(ray, scale, &normals);
+	child->completeHit(objRay, t * scale, part, hit);
+	hit.t = t;
+	hit.interceptPt = ray.getPoint(t);
+	hit.normal = glm::normalize(normals * hit.normal);
+}
+
+/**
+ * @fn	bool IInstance::findSpans(const Ray& ray, vector<RaySpan>& spans) const
+ * @brief	Finds the child's spans in object space, and converts their ends back to
+ * 			world space distances.
+ * @param 		  	ray  	The ray, in world coordinates.
+ * @param [in,out]	spans	Replaced by the spans.
+ * @return	True iff the child is a solid.
+ */
+
+bool IInstance::findSpans(const Ray& ray, vector<RaySpan>& spans) const {
+	double scale;
+	bool solid = child->findSpans(toObjectSpace(ray, scale), spans);
+	for (RaySpan& span : spans) {
+		span.tIn = span.tIn <= -DBL_MAX ? span.tIn : span.tIn / scale;
+		span.tOut = span.tOut >= DBL_MAX ? span.tOut : span.tOut / scale;
+	}
+	return solid;
+}
+
+/**
+ * @fn	void IInstance::getTexCoords(const dvec3& pt, double& u, double& v) const
+ * @brief	Gets the child's tex coordinates for a point on the instance. The point
+ * 			carries no time, so a moving instance is taken to be where it starts.
+ * @param 		  	pt	The point, in world coordinates.
+ * @param [in,out]	u 	Tex coordinate u.
+ * @param [in,out]	v 	Tex coordinate v.
+ */
+
+void IInstance::getTexCoords(const dvec3& pt, double& u, double& v) const {
+	child->getTexCoords((inverseTransform * dvec4(pt, 1.0)).xyz(), u, v);
+}
+
+/**
+ * @fn	ICSG::ICSG(CSGOperation op, IShapePtr left, IShapePtr right)
+ * @brief	Combines two solids.
+ * @param	op   	How they are combined.
+ * @param	left 	The first solid. It is shared, not copied.
+ * @param	right	The second solid, which is subtracted from the first by a difference.
+ */
+
+ICSG::ICSG(CSGOperation op, IShapePtr left, IShapePtr right)
+	: op(op), left(left), right(right),
+	leftBounds(left->getBounds()), rightBounds(right->getBounds()) {
+	if (op == CSGOperation::UNION) {
+		bounds = leftBounds;
+		bounds.expand(rightBounds);
+	} else if (op == CSGOperation::INTERSECTION) {
+		bounds = AABB::overlap(leftBounds, rightBounds);
+	} else {
+		bounds = leftBounds;
+	}
+}
+
+/**
+ * @fn	void ICSG::combineSpans(CSGOperation op, const vector<RaySpan>& a, const vector<RaySpan>& b, vector<RaySpan>& result)
+ * @brief	Merges the spans of the two children, walking the ends of both lists in order
+ * 			and keeping track of whether the ray is inside each. A span of the result
+ * 			starts or ends wherever that changes whether it is inside the combination.
+ * 			Where ends coincide, a union takes entries first, so that solids that touch
+ * 			are merged, and the others take exits first, so that no empty spans appear.
+ *
+ * 			The parts of the result tell completeHit which child to finish the hit with,
+ * 			in bit 0, and whether to reverse its normal, in bit 1, which is set for the
+ * 			surfaces of the second child of a difference. The child's own part is in
+ * 			the remaining bits.
+ * @param 		  	op	  	How the spans are combined.
+ * @param 		  	a	  	Spans of the first child, in order.
+ * @param 		  	b	  	Spans of the second child, in order.
+ * @param [in,out]	result	Replaced by the spans of the combination.
+ */
+
+void ICSG::combineSpans(CSGOperation op, const vector<RaySpan>& a, const vector<RaySpan>& b,
+	vector<RaySpan>& result) {
+	result.clear();
+	// Ends of the spans are numbered 2k (tIn of span k) and 2k + 1 (tOut of span k)
+	const size_t endA = 2 * a.size();
+	const size_t endB = 2 * b.size();
+	const int flipB = op == CSGOperation::DIFFERENCE ? 2 : 0;
+	size_t i = 0, j = 0;
+	bool inA = false, inB = false, inside = false;
+	RaySpan span = { 0.0, 0.0, 0, 0 };
+
+	while (i < endA || j < endB) {
+		double tA = i >= endA ? HUGE_VAL : (i % 2 == 0 ? a[i / 2].tIn : a[i / 2].tOut);
+		double tB = j >= endB ? HUGE_VAL : (j % 2 == 0 ? b[j / 2].tIn : b[j / 2].tOut);
+		bool entersA = i % 2 == 0;
+		bool takeA = tA < tB || (tA == tB && (op == CSGOperation::UNION ? entersA : !entersA));
+
+		double t;
+		int part;
+		if (takeA) {
+			t = tA;
+			part = (entersA ? a[i / 2].inPart : a[i / 2].outPart) << 2;
+			inA = entersA;
+			i++;
+		} else {
+			bool entersB = j % 2 == 0;
+			t = tB;
+			part = ((entersB ? b[j / 2].inPart : b[j / 2].outPart) << 2) | flipB | 1;
+			inB = entersB;
+			j++;
+		}
+
+		bool nowInside = op == CSGOperation::UNION ? (inA || inB) :
+			op == CSGOperation::INTERSECTION ? (inA && inB) : (inA && !inB);
+		if (nowInside == inside) {
+			continue;
+		}
+		inside = nowInside;
+		if (inside) {
+			span.tIn = t;
+			span.inPart = part;
+		} else {
+			span.tOut = t;
+			span.outPart = part;
+			if (span.tOut > span.tIn) {
+				result.push_back(span);
+			}
+		}
+	}
+}
+
+/**
+ * @fn	bool ICSG::findSpans(const Ray& ray, vector<RaySpan>& spans) const
+ * @brief	Finds the spans of the children and combines them. A child whose bounds
+ * 			the ray misses has no spans in front of the origin, so it is not intersected,
+ * 			and neither child is when the bounds alone show the result is empty.
+ * @param 		  	ray  	The ray.
+ * @param [in,out]	spans	Replaced by the spans.
+ * @return	True.
+ */
+
+bool ICSG::findSpans(const Ray& ray, vector<RaySpan>& spans) const {
+	double tNear;
+	const bool throughLeft = leftBounds.intersects(ray, DBL_MAX, tNear);
+	const bool throughRight = rightBounds.intersects(ray, DBL_MAX, tNear);
+	spans.clear();
+	if ((op != CSGOperation::UNION && !throughLeft) ||
+		(op == CSGOperation::INTERSECTION && !throughRight)) {
+		return true;
+	}
+
+	vector<RaySpan> a, b;
+	if (throughLeft) {
+		left->findSpans(ray, a);
+	}
+	if (throughRight && (op == CSGOperation::UNION || !a.empty())) {
+		right->findSpans(ray, b);
+	}
+	combineSpans(op, a, b, spans);
+	return true;
+}
+
+/**
+ * @fn	double ICSG::findClosestT(const Ray& ray, int& part) const
+ * @brief	The first end of a span in front of the ray's origin. If the origin is inside
+ * 			the solid, that is where the ray leaves it.
+ * @param 		  	ray 	The ray.
+ * @param [in,out]	part	See combineSpans.
+ * @return	The distance to the hit, or FLT_MAX if there is none.
+ */
+
+double ICSG::findClosestT(const Ray& ray, int& part) const {
+	double tNear;
+	part = 0;
+	if (!bounds.intersects(ray, FLT_MAX, tNear)) {
+		return FLT_MAX;
+	}
+
+	vector<RaySpan> spans;
+	findSpans(ray, spans);
+	for (const RaySpan& span : spans) {
+		if (span.tIn > 0.0) {
+			if (span.tIn < FLT_MAX) {
+				part = span.inPart;
+				return span.tIn;
+			}
+			break;
+		}
+		if (span.tOut > 0.0) {
+			if (span.tOut < FLT_MAX) {
+				part = span.outPart;
+				return span.tOut;
+			}
+			break;
+		}
+	}
+	return FLT_MAX;
+}
+
+/**
+ * @fn	void ICSG::completeHit(const Ray& ray, double t, int part, HitRecord& hit) const
+ * @brief	Has the child whose surface was hit fill in the hit, reversing the normal of
+ * 			the second child of a difference, which faces into the remaining solid.
+ * @param 		  	ray 	The ray.
+ * @param 		  	t   	The distance to the hit.
+ * @param 		  	part	The part returned by findClosestT.
+ * @param [in,out]	hit 	The hit.
+ */
+
+void ICSG::completeHit(const Ray& ray, double t, int part, HitRecord& hit) const {
+	IShapePtr child = (part & 1) == 0 ? left : right;
+	child->completeHit(ray, t, part >> 2, hit);
+	if ((part & 2) != 0) {
+		hit.normal = -hit.normal;
+	}
+}
+
+/**
+ * @fn	void ICSG::getTexCoords(const dvec3& pt, double& u, double& v) const
+ * @brief	Gets tex coordinates from the first child, which usually makes up most of
+ * 			the surface.
+ * @param 		  	pt	The point.
+ * @param [in,out]	u 	Tex coordinate u.
+ * @param [in,out]	v 	Tex coordinate v.
+ */
+
+void ICSG::getTexCoords(const dvec3& pt, double& u, double& v) const {
+	left->getTexCoords(pt, u, v);
+}
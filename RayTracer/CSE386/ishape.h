@@ -21,30 +21,79 @@ typedef TransparentIShape* TransparentIShapePtr;
 
 /**
  * @struct	Ray
- * @brief	Represents a ray.
+ * @brief	Represents a ray. Rays spawned by a ray (reflections, shadow feelers, and
+ * 			so on) are given its time, so that they see moving objects where it did.
  */
 
 struct Ray {
 	dvec3 origin;		//!< starting point for this ray
 	dvec3 dir;			//!< direction for this ray, given it's origin
+	double time;		//!< when this ray is cast, as a fraction of the shutter interval [0, 1)
 
-	Ray(const dvec3& rayOrigin, const dvec3& rayDirection) :
-		origin(rayOrigin), dir(glm::normalize(rayDirection)) {
+	Ray(const dvec3& rayOrigin, const dvec3& rayDirection, double rayTime = 0.0) :
+		origin(rayOrigin), dir(glm::normalize(rayDirection)), time(rayTime) {
 	}
 	dvec3 getPoint(double t) const {
 		return origin + t * dir;
 	}
 };
 
+/**
+ * @struct	AABB
+ * @brief	An axis-aligned bounding box. A default constructed box is empty. Shapes
+ * 			that extend forever, such as planes, are bounded by AABB::infinite().
+ */
+
+struct AABB {
+	dvec3 lo;		//!< corner with the smallest coordinates
+	dvec3 hi;		//!< corner with the largest coordinates
+
+	AABB();
+	AABB(const dvec3& lo, const dvec3& hi);
+	static AABB infinite();
+	void expand(const dvec3& pt);
+	void expand(const AABB& box);
+	bool isEmpty() const { return lo.x > hi.x || lo.y > hi.y || lo.z > hi.z; }
+	bool isBounded() const;
+	dvec3 center() const { return (lo + hi) / 2.0; }
+	dvec3 extent() const { return hi - lo; }
+	AABB transformed(const dmat4& M) const;
+	bool intersects(const Ray& ray, double tMax, double& tNear) const;
+	static AABB overlap(const AABB& a, const AABB& b);
+};
+
+/**
+ * @struct	RaySpan
+ * @brief	An interval of a ray that lies inside a solid. inPart and outPart are the parts
+ * 			(as completeHit understands them) of the surface where the ray enters and
+ * 			leaves. A solid that extends forever along the ray has tIn == -DBL_MAX or
+ * 			tOut == DBL_MAX, and the part at that end means nothing.
+ */
+
+struct RaySpan {
+	double tIn;		//!< Where the ray enters the solid
+	double tOut;	//!< Where the ray leaves the solid
+	int inPart;		//!< Part of the surface at tIn
+	int outPart;	//!< Part of the surface at tOut
+};
+
 /**
  * @struct	IShape
- * @brief	Base class for all implicit shapes.
+ * @brief	Base class for all implicit shapes. Intersection has two phases: findClosestT
+ * 			finds just the distance to the closest hit, plus a small shape-specific part
+ * 			number (e.g., which face was hit), and completeHit fills in the intercept
+ * 			point and normal afterwards, for the one hit that wins. Derived classes
+ * 			override either both phases, or findClosestIntersection.
  */
 
 struct IShape {
 	IShape();
-	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const = 0;
+	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual double findClosestT(const Ray& ray, int& part) const;
+	virtual void completeHit(const Ray& ray, double t, int part, HitRecord& hit) const;
 	virtual void getTexCoords(const dvec3& pt, double& u, double& v) const;
+	virtual AABB getBounds() const;
+	virtual bool findSpans(const Ray& ray, vector<RaySpan>& spans) const;
 	static dvec3 movePointOffSurface(const dvec3& pt, const dvec3& n);
 };
 
@@ -59,6 +108,8 @@ struct VisibleIShape {
 	Image* texture;		//!< Texture associated with this shape, if any.
 	VisibleIShape(IShapePtr shapePtr, const Material& mat, Image* image = nullptr);
 	void findClosestIntersection(const Ray& ray, OpaqueHitRecord& hit) const;
+	double findClosestT(const Ray& ray, int& part) const { return shape->findClosestT(ray, part); }
+	void completeHit(const Ray& ray, double t, int part, OpaqueHitRecord& hit) const;
 	static void findIntersection(const Ray& ray, const vector<VisibleIShapePtr>& surfaces,
 		OpaqueHitRecord& opaqueHitRecord);
 };
@@ -74,6 +125,8 @@ struct TransparentIShape {
 	double alpha;		//!< alpha value of transparent object.
 	TransparentIShape(IShapePtr shapePtr, const color& C, double alpha);
 	void findClosestIntersection(const Ray& ray, TransparentHitRecord& hit) const;
+	double findClosestT(const Ray& ray, int& part) const;
+	void completeHit(const Ray& ray, double t, int part, TransparentHitRecord& hit) const;
 	static void findIntersection(const Ray& ray, const vector<TransparentIShapePtr>& surfaces,
 		TransparentHitRecord& theHit);
 };
@@ -90,7 +143,9 @@ struct IPlane : public IShape {
 	IPlane(const dvec3& point, const dvec3& normal);
 	IPlane(const vector<dvec3>& vertices);
 	IPlane(const dvec3& p1, const dvec3& p2, const dvec3& p3);
-	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual double findClosestT(const Ray& ray, int& part) const override;
+	virtual void completeHit(const Ray& ray, double t, int part, HitRecord& hit) const override;
+	virtual bool findSpans(const Ray& ray, vector<RaySpan>& spans) const override;
 	bool onFrontSide(const dvec3& point) const;
 	void findIntersection(const dvec3& p1, const dvec3& p2, double& t) const;
 	virtual void getTexCoords(const dvec3& pt, double& u, double& v) const override;
@@ -109,8 +164,10 @@ dvec3 normalFrom3Points(const vector<dvec3>& pts);
 struct IDisk : public IShape {
 	IDisk();
 	IDisk(const dvec3& position, const dvec3& n, double rad);
-	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual double findClosestT(const Ray& ray, int& part) const override;
+	virtual void completeHit(const Ray& ray, double t, int part, HitRecord& hit) const override;
 	virtual void getTexCoords(const dvec3& pt, double& u, double& v) const;
+	virtual AABB getBounds() const;
 	dvec3 center;	//!< center point of disk
 	dvec3 n;		//!< normal vector of disk
 	double radius;
@@ -148,8 +205,11 @@ struct IQuadricSurface : public IShape {
 	IQuadricSurface(const vector<double>& params,
 		const dvec3& position);
 	IQuadricSurface(const dvec3& position);
-	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual double findClosestT(const Ray& ray, int& part) const override;
+	virtual void completeHit(const Ray& ray, double t, int part, HitRecord& hit) const override;
+	virtual bool findSpans(const Ray& ray, vector<RaySpan>& spans) const override;
 	int findIntersections(const Ray& ray, HitRecord hits[2]) const;
+	int findRoots(const Ray& ray, double roots[2]) const;
 	dvec3 normal(const dvec3& pt) const;
 	void computeAqBqCq(const Ray& ray, double& Aq, double& Bq, double& Cq) const;
 protected:
@@ -167,6 +227,7 @@ protected:
 struct ISphere : IQuadricSurface {
 	ISphere(const dvec3& position, double radius);
 	virtual void getTexCoords(const dvec3& pt, double& u, double& v) const;
+	virtual AABB getBounds() const;
 };
 
 /**
@@ -196,7 +257,6 @@ struct ICone : public IQuadricSurface {
 
 struct IConeY : public ICone {
 	IConeY(const dvec3& position, double R, double H);
-	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
 };
 
 /**
@@ -207,8 +267,10 @@ struct IConeY : public ICone {
 struct ICylinderY : public ICylinder {
 	ICylinderY();
 	ICylinderY(const dvec3& position, double R, double len);
-	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual double findClosestT(const Ray& ray, int& part) const override;
+	virtual bool findSpans(const Ray& ray, vector<RaySpan>& spans) const override;
 	void getTexCoords(const dvec3& pt, double& u, double& v) const;
+	virtual AABB getBounds() const;
 };
 
 /**
@@ -218,7 +280,9 @@ struct ICylinderY : public ICylinder {
 
 struct IClosedCylinderY : public ICylinderY {
 	IClosedCylinderY(const dvec3& pos, double rad, double len);
-	void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	double findClosestT(const Ray& ray, int& part) const override;
+	void completeHit(const Ray& ray, double t, int part, HitRecord& hit) const override;
+	bool findSpans(const Ray& ray, vector<RaySpan>& spans) const override;
 };
 
 /**
@@ -228,6 +292,7 @@ struct IClosedCylinderY : public ICylinderY {
 
 struct IEllipsoid : public IQuadricSurface {
 	IEllipsoid(const dvec3& position, const dvec3& sz);
+	virtual AABB getBounds() const;
 };
 
 /**
@@ -240,8 +305,10 @@ struct ITriangle : public IShape {
 	dvec3 normal;      //!< Normal to the triangle
 
 	ITriangle(const dvec3& a, const dvec3& b, const dvec3& c);
-	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const override;
+	virtual double findClosestT(const Ray& ray, int& part) const override;
+	virtual void completeHit(const Ray& ray, double t, int part, HitRecord& hit) const override;
 	virtual void getTexCoords(const dvec3& pt, double& u, double& v) const override;
+	virtual AABB getBounds() const override;
 };
 
 /**
@@ -255,8 +322,11 @@ struct IBasicSphere : public IShape {
 
 	IBasicSphere(const dvec3& c, double r);
 
-	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const override;
+	virtual double findClosestT(const Ray& ray, int& part) const override;
+	virtual void completeHit(const Ray& ray, double t, int part, HitRecord& hit) const override;
 	virtual void getTexCoords(const dvec3& pt, double& u, double& v) const override;
+	virtual AABB getBounds() const override;
+	virtual bool findSpans(const Ray& ray, vector<RaySpan>& spans) const override;
 };
 
 /**
@@ -268,8 +338,11 @@ struct IBasicSphere : public IShape {
 
 struct IRectangle : public IShape {
 	IRectangle(const dvec3& center, double width, double height, double depth);
-	void findClosestIntersection(const Ray& ray, HitRecord& hit) const override;
+	double findClosestT(const Ray& ray, int& part) const override;
+	void completeHit(const Ray& ray, double t, int part, HitRecord& hit) const override;
 	void getTexCoords(const dvec3& pt, double& u, double& v) const override;
+	AABB getBounds() const override;
+	bool findSpans(const Ray& ray, vector<RaySpan>& spans) const override;
 
 private:
 	dvec3 center;
@@ -283,4 +356,79 @@ private:
 	};
 
 	std::vector<Face> faces;
-};
\ No newline at end of file
+};
+
+/**
+ * @struct	IInstance
+ * @brief	Places another implicit shape in the scene with an arbitrary affine
+ * 			transformation. Rays are moved into the child's object space and normals
+ * 			are moved back out, so one shape (e.g., an ICylinderY) can be reused in any
+ * 			orientation, and shared by any number of instances. An instance given a
+ * 			second transformation by setMotion moves during the shutter interval, and
+ * 			each ray sees it where it is at the ray's time.
+ */
+
+struct IInstance : public IShape {
+	IInstance(IShapePtr child, const dmat4& T);
+	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const override;
+	virtual double findClosestT(const Ray& ray, int& part) const override;
+	virtual void completeHit(const Ray& ray, double t, int part, HitRecord& hit) const override;
+	virtual void getTexCoords(const dvec3& pt, double& u, double& v) const override;
+	virtual AABB getBounds() const override { return bounds; }
+	virtual bool findSpans(const Ray& ray, vector<RaySpan>& spans) const override;
+	void setTransform(const dmat4& T);
+	void setMotion(const dmat4& T1);
+	IShapePtr getChild() const { return child; }
+	const dmat4& getTransform() const { return transform; }
+	bool isMoving() const { return moving; }
+protected:
+	Ray toObjectSpace(const Ray& ray, double& scale, dmat3* normals = nullptr) const;
+	IShapePtr child;			//!< The shape being instanced. Not owned.
+	dmat4 transform;			//!< Object to world transformation
+	dmat4 inverseTransform;		//!< World to object transformation
+	dmat3 normalMatrix;			//!< Transforms object space normals to world space
+	dmat4 endTransform;			//!< Object to world transformation at the end of the shutter interval
+	bool moving = false;		//!< True ==> endTransform differs from transform
+	AABB bounds;				//!< World space bounds of the child, over the whole shutter interval
+};
+
+/**
+ * @enum	CSGOperation
+ * @brief	How an ICSG combines its two solids.
+ */
+
+enum class CSGOperation {
+	UNION,			//!< Inside either solid
+	INTERSECTION,	//!< Inside both solids
+	DIFFERENCE		//!< Inside the first solid, but not the second
+};
+
+/**
+ * @struct	ICSG
+ * @brief	Constructive solid geometry: the union, intersection or difference of two
+ * 			solids, which may themselves be ICSGs. Each child's spans along the ray are
+ * 			merged by operation, and the surface is wherever a merged span begins or
+ * 			ends. Children are only intersected if the ray passes through their bounds,
+ * 			and not at all when the result is already known to be empty. The children
+ * 			must be solids (see IShape::findSpans); a shape that is not contributes
+ * 			nothing. Bounds are computed when the node is built, so rebuild it after
+ * 			moving a child.
+ */
+
+struct ICSG : public IShape {
+	ICSG(CSGOperation op, IShapePtr left, IShapePtr right);
+	virtual double findClosestT(const Ray& ray, int& part) const override;
+	virtual void completeHit(const Ray& ray, double t, int part, HitRecord& hit) const override;
+	virtual void getTexCoords(const dvec3& pt, double& u, double& v) const override;
+	virtual AABB getBounds() const override { return bounds; }
+	virtual bool findSpans(const Ray& ray, vector<RaySpan>& spans) const override;
+	static void combineSpans(CSGOperation op, const vector<RaySpan>& a, const vector<RaySpan>& b,
+		vector<RaySpan>& result);
+protected:
+	CSGOperation op;		//!< How the children are combined
+	IShapePtr left;			//!< First solid. Not owned.
+	IShapePtr right;		//!< Second solid. Not owned.
+	AABB leftBounds;		//!< Bounds of left
+	AABB rightBounds;		//!< Bounds of right
+	AABB bounds;			//!< Bounds of the result
+};
@@ -10,6 +10,7 @@
 #include "light.h"
 #include "io.h"
 #include "ishape.h"
+#include "iscene.h"
 
  /**
   * @fn	color ambientColor(const color &matAmbient, const color &lightColor)
@@ -155,6 +156,25 @@ dvec3 PositionalLight::actualPosition(const Frame& eyeFrame) const {
 	return isTiedToWorld ? pos : eyeFrame.frameCoordsToGlobalCoords(pos);
 }
 
+/**
+* @fn	bool LightSource::pointIsInAShadow(const dvec3& intercept, const dvec3& normal, const IScene& scene, const Frame& eyeFrame, double time) const
+* @brief	Determines if an intercept point falls in a shadow. By default, the scene's
+*			opaque objects are searched one at a time, at the start of the shutter interval.
+* @param	intercept	the position of the intercept.
+* @param	normal		the normal vector at the intercept point
+* @param	scene		the scene
+* @param	eyeFrame	The coordinate frame of the camera.
+* @param	time		Time of the ray that found the intercept. Not used.
+*/
+
+bool LightSource::pointIsInAShadow(const dvec3& intercept,
+	const dvec3& normal,
+	const IScene& scene,
+	const Frame& eyeFrame,
+	double /*time*/) const {
+	return pointIsInAShadow(intercept, normal, scene.opaqueObjs, eyeFrame);
+}
+
 /**
 * @fn	bool PositionalLight::pointIsInAShadow(const dvec3& intercept, const dvec3& normal, const vector<VisibleIShapePtr>& objects, const Frame& eyeFrame) const
 * @brief	Determines if an intercept point falls in a shadow.
@@ -185,6 +205,29 @@ bool PositionalLight::pointIsInAShadow(const dvec3& intercept,
 	}
 }
 
+/**
+* @fn	bool PositionalLight::pointIsInAShadow(const dvec3& intercept, const dvec3& normal, const IScene& scene, const Frame& eyeFrame, double time) const
+* @brief	Determines if an intercept point falls in a shadow, using the scene's
+*			acceleration structure. Any object between the point and the light will do,
+*			so the search stops at the first one found.
+* @param	intercept	the position of the intercept.
+* @param	normal		the normal vector at the intercept point
+* @param	scene		the scene
+* @param	eyeFrame	The coordinate frame of the camera.
+* @param	time		Time of the ray that found the intercept, given to the shadow feeler.
+*/
+
+bool PositionalLight::pointIsInAShadow(const dvec3& intercept,
+	const dvec3& normal,
+	const IScene& scene,
+	const Frame& eyeFrame,
+	double time) const {
+	Ray shadowFeeler = getShadowFeeler(intercept, normal, eyeFrame);
+	shadowFeeler.time = time;
+	return scene.findAnyOpaqueIntersection(shadowFeeler,
+		glm::distance(this->actualPosition(eyeFrame), intercept));
+}
+
 /**
 * @fn	Ray PositionalLight::getShadowFeeler(const dvec3& interceptWorldCoords, const dvec3& normal, const Frame &eyeFrame) const
 * @brief	Returns the shadow feeler for this light.
@@ -355,4 +398,30 @@ bool DirectionalLight::pointIsInAShadow(const dvec3& intercept,
 	VisibleIShape::findIntersection(shadowFeeler, objects, shadowHit);
 
 	return shadowHit.t != std::numeric_limits<double>::max();
-}
\ No newline at end of file
+}
+
+/**
+* @fn	bool DirectionalLight::pointIsInAShadow(const dvec3& intercept, const dvec3& normal, const IScene& scene, const Frame& eyeFrame, double time) const
+* @brief	Determines if an intercept point falls in a shadow, using the scene's
+*			acceleration structure. Same test as the version taking a list of objects.
+* @param	intercept	the position of the intercept.
+* @param	normal		the normal vector at the intercept point
+* @param	scene		the scene
+* @param	eyeFrame	The coordinate frame of the camera.
+* @param	time		Time of the ray that found the intercept, given to the shadow feeler.
+*/
+
+bool DirectionalLight::pointIsInAShadow(const dvec3& intercept,
+	const dvec3& normal,
+	const IScene& scene,
+	const Frame& eyeFrame,
+	double time) const {
+
+	Ray shadowFeeler = getShadowFeeler(intercept, normal, eyeFrame);
+	shadowFeeler.time = time;
+	OpaqueHitRecord shadowHit;
+
+	scene.findIntersection(shadowFeeler, shadowHit);
+
+	return shadowHit.t != std::numeric_limits<double>::max();
+}
@@ -14,6 +14,8 @@
 #include "hitrecord.h"
 #include "ishape.h"
 
+struct IScene;
+
  /**
   * @struct	LightATParams
   * @brief	A light attenuation parameters.
@@ -73,6 +75,11 @@ struct LightSource {
 		const dvec3& normal,
 		const vector<VisibleIShapePtr>& objects,
 		const Frame& eyeFrame) const = 0;
+	virtual bool pointIsInAShadow(const dvec3& intercept,
+		const dvec3& normal,
+		const IScene& scene,
+		const Frame& eyeFrame,
+		double time = 0.0) const;
 };
 
 /**
@@ -109,6 +116,11 @@ struct PositionalLight : public LightSource {
 		const dvec3& normal, 
 		const vector<VisibleIShapePtr>& objects,
 		const Frame& eyeFrame) const;
+	virtual bool pointIsInAShadow(const dvec3& intercept,
+		const dvec3& normal,
+		const IScene& scene,
+		const Frame& eyeFrame,
+		double time = 0.0) const;
 };
 
 /**
@@ -159,6 +171,12 @@ struct DirectionalLight : public PositionalLight {
 		const vector<VisibleIShapePtr>& objects,
 		const Frame& eyeFrame) const;
 
+	virtual bool pointIsInAShadow(const dvec3& intercept,
+		const dvec3& normal,
+		const IScene& scene,
+		const Frame& eyeFrame,
+		double time = 0.0) const;
+
 	virtual Ray getShadowFeeler(const dvec3& interceptWorldCoords,
 		const dvec3& normal,
 		const Frame& eyeFrame) const;
@@ -0,0 +1,486 @@
+/****************************************************
+ * 2016-2025 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include "pathtracer.h"
+#include "raytracer.h"
+#include "light.h"
+
+/**
+ * @fn	static double average(const color &C)
+ * @brief	The average of the three channels of a color.
+ * @param	C	The color.
+ * @return	The average.
+ */
+
+static double average(const color& C) {
+	return (C.r + C.g + C.b) / 3.0;
+}
+
+/**
+ * @fn	static double diffuseProbability(const Material &mat)
+ * @brief	How often the diffuse lobe of a material is sampled, rather than the specular
+ * 			lobe. Proportional to the average reflectance of each.
+ * @param	mat	The material.
+ * @return	The probability of sampling the diffuse lobe.
+ */
+
+static double diffuseProbability(const Material& mat) {
+	double d = average(mat.diffuse);
+	double s = average(mat.specular);
+	return d + s > 0.0 ? d / (d + s) : 1.0;
+}
+
+/**
+ * @fn	static dvec3 sampleAround(const dvec3 &axis, double cosTheta, double phi)
+ * @brief	Builds the direction at a given angle from an axis.
+ * @param	axis		The axis (unit length).
+ * @param	cosTheta	Cosine of the angle between the axis and the direction.
+ * @param	phi			Angle around the axis.
+ * @return	The direction.
+ */
+
+static dvec3 sampleAround(const dvec3& axis, double cosTheta, double phi) {
+	Frame frame = Frame::createOrthoNormalBasis(ORIGIN3D, axis);
+	double sinTheta = std::sqrt(glm::max(0.0, 1.0 - cosTheta * cosTheta));
+	return glm::normalize(sinTheta * std::cos(phi) * frame.u +
+		sinTheta * std::sin(phi) * frame.v + cosTheta * frame.w);
+}
+
+/**
+ * @fn	static double powerHeuristic(double pdf, double otherPdf)
+ * @brief	Multiple importance sampling weight of a sample drawn with one strategy, when
+ * 			the other could also have produced it.
+ * @param	pdf			Density of the strategy that drew the sample.
+ * @param	otherPdf	Density of the other strategy.
+ * @return	The weight.
+ */
+
+static double powerHeuristic(double pdf, double otherPdf) {
+	return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
+/**
+ * @fn	PathTracer::PathTracer(const color &environment)
+ * @brief	Constructs a path tracer.
+ * @param	environment	Radiance of paths that leave the scene.
+ */
+
+PathTracer::PathTracer(const color& environment)
+	: environment(environment) {
+}
+
+/**
+ * @fn	void PathTracer::render(FrameBuffer &frameBuffer, const IScene &theScene, int samplesPerPixel)
+ * @brief	Traces samplesPerPixel more paths through every pixel, spread over numThreads
+ * 			threads. Without the accumulation buffer, the average of just these samples
+ * 			is written to the color buffer. The result is denoised if denoisingEnabled.
+ * 			When checkpointing, the first call after a restart resumes from a matching
+ * 			checkpoint, and each call saves one if checkpoint.interval has passed.
+ * @param [in,out]	frameBuffer	   	Framebuffer.
+ * @param 		  	theScene	   	The scene.
+ * @param 		  	samplesPerPixel	Number of paths per pixel.
+ */
+
+void PathTracer::render(FrameBuffer& frameBuffer, const IScene& theScene, int samplesPerPixel) {
+	const int width = frameBuffer.getWindowWidth();
+	const int height = frameBuffer.getWindowHeight();
+	const bool accumulating = frameBuffer.isAccumulationEnabled();
+	if (accumulating && checkpoint.isEnabled() && samplesTaken == 0) {
+		const vector<double> settings = { 3.0, (double)maxDepth, (double)rouletteDepth,
+			lightRadius, misEnabled ? 1.0 : 0.0, (double)seed, environment.r, environment.g, environment.b };
+		int samples;
+		if (checkpoint.begin(frameBuffer, RenderCheckpoint::sceneKey(theScene, width, height, settings), &samples)) {
+			samplesTaken = samples;
+		}
+	}
+	const uint64_t firstSample = (uint64_t)samplesTaken;
+	vector<color> image((size_t)width * height);
+
+	parallelFor(height, [&](int y) {
+		for (int x = 0; x < width; ++x) {
+			const uint64_t pixel = (uint64_t)y * width + x;
+			color sum = black;
+			for (int s = 0; s < samplesPerPixel; s++) {
+				CounterRNG rng(seed, (pixel << 32) + firstSample + s);
+				double dx = rng.next() - 0.5;
+				double dy = rng.next() - 0.5;
+				Ray ray = theScene.camera->getRay(x + dx, y + dy);
+				if (theScene.camera->hasLensOrShutter()) {
+					double lensX = rng.next();
+					double lensY = rng.next();
+					ray = theScene.camera->getSampleRay(x + dx, y + dy, dvec2(lensX, lensY), rng.next());
+				}
+				color sample = tracePath(ray, theScene, rng);
+				if (!std::isfinite(sample.r + sample.g + sample.b)) {
+					sample = black;
+				}
+				if (accumulating) {
+					frameBuffer.accumulate(x, y, sample);
+				}
+				sum += sample;
+			}
+			image[pixel] = glm::clamp(sum / (double)samplesPerPixel, 0.0, 1.0);
+		}
+	}, numThreads);
+
+	samplesTaken += samplesPerPixel;
+	if (accumulating) {
+		checkpoint.saveIfDue(frameBuffer, samplesTaken);
+		frameBuffer.resolveAccumulationBuffer();
+	} else {
+		for (int y = 0; y < height; ++y) {
+			frameBuffer.setSpan(0, y, width, &image[(size_t)y * width]);
+		}
+	}
+	if (denoisingEnabled) {
+		denoiser.numThreads = numThreads;
+		denoiser.gatherGuides(theScene, width, height);
+		denoiser.denoise(frameBuffer);
+	}
+}
+
+/**
+ * @fn	color PathTracer::tracePath(const Ray &ray, const IScene &theScene, CounterRNG &rng) const
+ * @brief	Estimates the radiance arriving along a ray with one random path.
+ * @param 		  	ray			The ray.
+ * @param 		  	theScene	The scene.
+ * @param [in,out]	rng			The random numbers for this path.
+ * @return	The estimate. Not clamped.
+ */
+
+color PathTracer::tracePath(const Ray& ray, const IScene& theScene, CounterRNG& rng) const {
+	color radiance = black;
+	color throughput = white;
+	Ray current = ray;
+	double brdfPdf = 0.0;			// Density the last direction was drawn with
+	bool specularBounce = false;	// True ==> the last bounce was a perfect mirror or refraction
+	bool passedAlpha = false;		// True ==> went through a partly transparent surface since the last bounce
+	bool seesLights = false;		// False until the first non-specular bounce
+
+	for (int bounce = 0; bounce < maxDepth; bounce++) {
+		OpaqueHitRecord theHit;
+		TransparentHitRecord transHit;
+		theScene.findIntersection(current, theHit);
+		theScene.findIntersection(current, transHit);
+		double nearest = glm::min(theHit.t, transHit.t);
+
+		color emitted;
+		if (seesLights && findLight(current, nearest, brdfPdf, specularBounce || passedAlpha, theScene, emitted)) {
+			radiance += throughput * emitted;
+			break;
+		}
+		if (nearest == FLT_MAX) {
+			radiance += throughput * environment;
+			break;
+		}
+
+		if (transHit.t < theHit.t) {
+			// Seen through with probability 1 - alpha, as RayTracer blends it
+			if (rng.next() < transHit.alpha) {
+				radiance += throughput * transHit.transColor;
+				break;
+			}
+			current = Ray(transHit.interceptPt + EPSILON * current.dir, current.dir, current.time);
+			continue;
+		}
+
+		Material mat = theHit.material;
+		if (theHit.texture != nullptr) {
+			mat.diffuse = theHit.texture->getPixelUV(theHit.u, theHit.v);
+		}
+		const dvec3& pt = theHit.interceptPt;
+		const dvec3& n = theHit.normal;
+
+		if (mat.isDielectric) {
+			double etai = 1.0, etat = mat.dielectricRefractionIndex;
+			if (theHit.rayStatus == LEAVING) {
+				std::swap(etai, etat);
+			}
+			double kr = fresnel(current.dir, n, etai, etat);
+			dvec3 refracted = glm::refract(current.dir, n, etai / etat);
+			if (rng.next() < kr || refracted == dvec3(0.0)) {
+				current = Ray(pt + EPSILON * n, glm::normalize(glm::reflect(current.dir, n)), current.time);
+			} else {
+				current = Ray(pt - EPSILON * n, glm::normalize(refracted), current.time);
+			}
+			specularBounce = true;
+		} else if (mat.alpha < 1.0 && rng.next() < mat.alpha) {
+			// Passes through, as RayTracer blends what lies behind with weight alpha.
+			// Shadow feelers stop here, so a light found beyond is not weighted by MIS
+			current = Ray(pt - EPSILON * n, current.dir, current.time);
+			passedAlpha = true;
+			continue;
+		} else {
+			dvec3 wo = -current.dir;
+			radiance += throughput * directLight(pt, n, wo, mat, theScene, rng, current.time);
+
+			dvec3 wi;
+			if (!samplePhong(mat, n, wo, rng, wi)) {
+				break;
+			}
+			brdfPdf = phongPdf(mat, n, wo, wi);
+			if (brdfPdf <= 0.0) {
+				break;
+			}
+			throughput *= phongBRDF(mat, n, wo, wi) * glm::dot(n, wi) / brdfPdf;
+			current = Ray(pt + EPSILON * n, wi, current.time);
+			specularBounce = false;
+			passedAlpha = false;
+			seesLights = true;
+		}
+
+		if (bounce + 1 >= rouletteDepth) {
+			double survival = glm::min(glm::max(throughput.r, glm::max(throughput.g, throughput.b)), 0.95);
+			if (rng.next() >= survival) {
+				break;
+			}
+			throughput /= survival;
+		}
+	}
+	return radiance;
+}
+
+/**
+ * @fn	bool PathTracer::lightCone(const PositionalLight &light, const dvec3 &pt, const Frame &eyeFrame, dvec3 &center, double &oneMinusCosMax, color &radiance) const
+ * @brief	Describes a spherical light as seen from a point: the cone of directions it
+ * 			covers, and its radiance. The radiance is chosen so that the light delivers
+ * 			pi * lightColor * attenuation, so that a Lambertian surface reflects what
+ * 			RayTracer's diffuse term gives. A spot light only lights points in its cone.
+ * @param 		  	light		  	The light.
+ * @param 		  	pt			  	The point.
+ * @param 		  	eyeFrame	  	The camera's frame, for lights that move with it.
+ * @param [in,out]	center		  	Center of the light.
+ * @param [in,out]	oneMinusCosMax	1 - cosine of the half angle of the cone.
+ * @param [in,out]	radiance	  	Radiance of the light toward pt.
+ * @return	False iff the light is off or does not light pt.
+ */
+
+bool PathTracer::lightCone(const PositionalLight& light, const dvec3& pt, const Frame& eyeFrame,
+	dvec3& center, double& oneMinusCosMax, color& radiance) const {
+	if (!light.isOn) {
+		return false;
+	}
+	center = light.actualPosition(eyeFrame);
+	double d = glm::distance(center, pt);
+	if (d <= lightRadius) {
+		return false;
+	}
+	const SpotLight* spot = dynamic_cast<const SpotLight*>(&light);
+	if (spot != nullptr && !SpotLight::isInSpotlightCone(spot->pos, spot->spotDir, spot->fov, pt)) {
+		return false;
+	}
+	double sin2Max = (lightRadius * lightRadius) / (d * d);
+	oneMinusCosMax = sin2Max / (1.0 + std::sqrt(1.0 - sin2Max));
+	double attenuation = light.attenuationIsTurnedOn ? light.atParams.factor(d) : 1.0;
+	radiance = light.lightColor * attenuation / (2.0 * oneMinusCosMax);
+	return true;
+}
+
+/**
+ * @fn	color PathTracer::directLight(const dvec3 &pt, const dvec3 &n, const dvec3 &wo, const Material &mat, const IScene &theScene, CounterRNG &rng, double time) const
+ * @brief	Next-event estimation: the light reflected toward wo directly from the lights.
+ * 			Spherical lights are sampled uniformly over the cone they subtend, and the
+ * 			sample is weighted against BRDF sampling, which could also have found it.
+ * 			Directional lights, and point lights if lightRadius is 0, are sampled exactly.
+ * @param 		  	pt			The point.
+ * @param 		  	n			Normal at the point, facing wo.
+ * @param 		  	wo			Direction toward the viewer.
+ * @param 		  	mat			Material at the point.
+ * @param 		  	theScene	The scene.
+ * @param [in,out]	rng			The random numbers for this path.
+ * @param 		  	time		Time of the path, given to the shadow feelers.
+ * @return	The reflected light.
+ */
+
+color PathTracer::directLight(const dvec3& pt, const dvec3& n, const dvec3& wo, const Material& mat,
+	const IScene& theScene, CounterRNG& rng, double time) const {
+	const Frame eyeFrame = theScene.camera->getFrame();
+	const dvec3 origin = pt + EPSILON * n;
+	color total = black;
+
+	for (const LightSourcePtr light : theScene.lights) {
+		if (const DirectionalLight* dir = dynamic_cast<const DirectionalLight*>(light)) {
+			dvec3 l = -dir->dir;
+			double cosine = glm::dot(n, l);
+			if (dir->isOn && cosine > 0.0 && !theScene.findAnyOpaqueIntersection(Ray(origin, l, time), FLT_MAX)) {
+				total += phongBRDF(mat, n, wo, l) * cosine * PI * dir->lightColor;
+			}
+			continue;
+		}
+		const PositionalLight* pos = dynamic_cast<const PositionalLight*>(light);
+		if (pos == nullptr || !pos->isOn) {
+			continue;
+		}
+
+		if (lightRadius <= 0.0) {
+			dvec3 center = pos->actualPosition(eyeFrame);
+			const SpotLight* spot = dynamic_cast<const SpotLight*>(pos);
+			if (spot != nullptr && !SpotLight::isInSpotlightCone(spot->pos, spot->spotDir, spot->fov, pt)) {
+				continue;
+			}
+			double d = glm::distance(center, pt);
+			dvec3 l = (center - pt) / d;
+			double cosine = glm::dot(n, l);
+			if (cosine > 0.0 && !theScene.findAnyOpaqueIntersection(Ray(origin, l, time), d)) {
+				double attenuation = pos->attenuationIsTurnedOn ? pos->atParams.factor(d) : 1.0;
+				total += phongBRDF(mat, n, wo, l) * cosine * PI * attenuation * pos->lightColor;
+			}
+			continue;
+		}
+
+		dvec3 center;
+		double oneMinusCosMax;
+		color radiance;
+		double u1 = rng.next(), u2 = rng.next();
+		if (!lightCone(*pos, pt, eyeFrame, center, oneMinusCosMax, radiance)) {
+			continue;
+		}
+		dvec3 axis = glm::normalize(center - pt);
+		dvec3 l = sampleAround(axis, 1.0 - u1 * oneMinusCosMax, TWO_PI * u2);
+		double cosine = glm::dot(n, l);
+		if (cosine <= 0.0) {
+			continue;
+		}
+
+		// Distance to the near side of the sphere
+		dvec3 toCenter = center - origin;
+		double b = glm::dot(l, toCenter);
+		double disc = b * b - (glm::dot(toCenter, toCenter) - lightRadius * lightRadius);
+		double tLight = b - std::sqrt(glm::max(disc, 0.0));
+		if (theScene.findAnyOpaqueIntersection(Ray(origin, l, time), tLight)) {
+			continue;
+		}
+
+		double lightPdf = 1.0 / (TWO_PI * oneMinusCosMax);
+		double weight = misEnabled ? powerHeuristic(lightPdf, phongPdf(mat, n, wo, l)) : 1.0;
+		total += phongBRDF(mat, n, wo, l) * radiance * (cosine * weight / lightPdf);
+	}
+	return total;
+}
+
+/**
+ * @fn	bool PathTracer::findLight(const Ray &ray, double maxT, double brdfPdf, bool unseenByNEE, const IScene &theScene, color &emitted) const
+ * @brief	Determines if a ray drawn from the BRDF runs into a spherical light before
+ * 			maxT, and if so, how much of its radiance counts. The sample is weighted
+ * 			against next-event estimation, unless that cannot find the light: after a
+ * 			perfect mirror or refraction, or through a surface with alpha < 1, which
+ * 			stops shadow feelers.
+ * @param 		  	ray			  	The ray.
+ * @param 		  	maxT		  	Distance to the nearest surface.
+ * @param 		  	brdfPdf		  	Density the ray's direction was drawn with.
+ * @param 		  	unseenByNEE   	True iff next-event estimation could not have found the light.
+ * @param 		  	theScene	  	The scene.
+ * @param [in,out]	emitted		  	The weighted radiance of the light hit.
+ * @return	True iff a light was hit.
+ */
+
+bool PathTracer::findLight(const Ray& ray, double maxT, double brdfPdf, bool unseenByNEE,
+	const IScene& theScene, color& emitted) const {
+	if (lightRadius <= 0.0) {
+		return false;
+	}
+	const Frame eyeFrame = theScene.camera->getFrame();
+	bool found = false;
+	for (const LightSourcePtr light : theScene.lights) {
+		const PositionalLight* pos = dynamic_cast<const PositionalLight*>(light);
+		if (pos == nullptr || dynamic_cast<const DirectionalLight*>(light) != nullptr) {
+			continue;
+		}
+		dvec3 center;
+		double oneMinusCosMax;
+		color radiance;
+		if (!lightCone(*pos, ray.origin, eyeFrame, center, oneMinusCosMax, radiance)) {
+			continue;
+		}
+		dvec3 toCenter = center - ray.origin;
+		double b = glm::dot(ray.dir, toCenter);
+		double disc = b * b - (glm::dot(toCenter, toCenter) - lightRadius * lightRadius);
+		if (disc < 0.0 || b - std::sqrt(disc) <= 0.0 || b - std::sqrt(disc) >= maxT) {
+			continue;
+		}
+		maxT = b - std::sqrt(disc);
+		found = true;
+
+		double weight = 1.0;
+		if (!unseenByNEE) {
+			double lightPdf = 1.0 / (TWO_PI * oneMinusCosMax);
+			weight = misEnabled ? powerHeuristic(brdfPdf, lightPdf) : 0.0;
+		}
+		emitted = weight * radiance;
+	}
+	return found;
+}
+
+/**
+ * @fn	color PathTracer::phongBRDF(const Material &mat, const dvec3 &n, const dvec3 &wo, const dvec3 &wi)
+ * @brief	The normalized Phong BRDF: diffuse / pi, plus a specular lobe around the
+ * 			mirror direction, scaled by (shininess + 2) / (2 pi) so that it reflects no
+ * 			more than Material::specular.
+ * @param	mat	The material.
+ * @param	n  	The normal.
+ * @param	wo 	Direction toward the viewer.
+ * @param	wi 	Direction toward the light.
+ * @return	The BRDF.
+ */
+
+color PathTracer::phongBRDF(const Material& mat, const dvec3& n, const dvec3& wo, const dvec3& wi) {
+	if (glm::dot(n, wi) <= 0.0 || glm::dot(n, wo) <= 0.0) {
+		return black;
+	}
+	double cosAlpha = glm::max(glm::dot(glm::reflect(-wo, n), wi), 0.0);
+	return mat.diffuse / PI +
+		mat.specular * ((mat.shininess + 2.0) / TWO_PI * std::pow(cosAlpha, mat.shininess));
+}
+
+/**
+ * @fn	double PathTracer::phongPdf(const Material &mat, const dvec3 &n, const dvec3 &wo, const dvec3 &wi)
+ * @brief	Density with which samplePhong draws a direction. Both lobes could have
+ * 			drawn it, so this is their mixture.
+ * @param	mat	The material.
+ * @param	n  	The normal.
+ * @param	wo 	Direction toward the viewer.
+ * @param	wi 	The direction drawn.
+ * @return	The density, per unit solid angle.
+ */
+
+double PathTracer::phongPdf(const Material& mat, const dvec3& n, const dvec3& wo, const dvec3& wi) {
+	double cosine = glm::dot(n, wi);
+	if (cosine <= 0.0) {
+		return 0.0;
+	}
+	double pd = diffuseProbability(mat);
+	double cosAlpha = glm::max(glm::dot(glm::reflect(-wo, n), wi), 0.0);
+	return pd * cosine / PI +
+		(1.0 - pd) * (mat.shininess + 1.0) / TWO_PI * std::pow(cosAlpha, mat.shininess);
+}
+
+/**
+ * @fn	bool PathTracer::samplePhong(const Material &mat, const dvec3 &n, const dvec3 &wo, CounterRNG &rng, dvec3 &wi)
+ * @brief	Draws a direction from the Phong BRDF: cosine weighted about the normal for
+ * 			the diffuse lobe, or cosine-power weighted about the mirror direction for the
+ * 			specular lobe.
+ * @param 		  	mat	The material.
+ * @param 		  	n  	The normal.
+ * @param 		  	wo 	Direction toward the viewer.
+ * @param [in,out]	rng	The random numbers for this path.
+ * @param [in,out]	wi 	The direction drawn.
+ * @return	False iff the direction drawn is below the surface.
+ */
+
+bool PathTracer::samplePhong(const Material& mat, const dvec3& n, const dvec3& wo,
+	CounterRNG& rng, dvec3& wi) {
+	double choice = rng.next(), u1 = rng.next(), u2 = rng.next();
+	if (choice < diffuseProbability(mat)) {
+		wi = sampleAround(n, std::sqrt(1.0 - u1), TWO_PI * u2);
+	} else {
+		dvec3 mirror = glm::normalize(glm::reflect(-wo, n));
+		wi = sampleAround(mirror, std::pow(u1, 1.0 / (mat.shininess + 1.0)), TWO_PI * u2);
+	}
+	return glm::dot(n, wi) > 0.0;
+}
@@ -0,0 +1,122 @@
+/****************************************************
+ * 2016-2025 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include "utilities.h"
+#include "framebuffer.h"
+#include "iscene.h"
+#include "denoiser.h"
+#include "checkpoint.h"
+
+/**
+ * @class	CounterRNG
+ * @brief	A counter-based random number generator. The n-th number of a stream is a
+ * 			hash of the stream's key and n, so it depends only on which stream is used,
+ * 			never on which thread draws it or in what order. Each path gets a stream
+ * 			keyed by its pixel and sample number, so images are reproducible regardless
+ * 			of the number of threads.
+ */
+
+class CounterRNG {
+public:
+	/**
+	 * @fn	CounterRNG(uint64_t seed, uint64_t stream)
+	 * @brief	Constructs the generator for one stream.
+	 * @param	seed  	Seed shared by all the streams of an image.
+	 * @param	stream	Identifies the stream.
+	 */
+
+	CounterRNG(uint64_t seed, uint64_t stream)
+		: key(mix(seed + mix(stream))), counter(0) {
+	}
+
+	/**
+	 * @fn	double next()
+	 * @brief	Returns the next number in the stream.
+	 * @return	A number in [0, 1).
+	 */
+
+	double next() {
+		return (mix(key + counter++ * 0x9E3779B97F4A7C15ull) >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	/**
+	 * @fn	static uint64_t mix(uint64_t z)
+	 * @brief	The SplitMix64 finalizer, which scrambles all 64 bits.
+	 * @param	z	The value to scramble.
+	 * @return	The scrambled value.
+	 */
+
+	static uint64_t mix(uint64_t z) {
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+protected:
+	uint64_t key;		//!< Identifies the stream
+	uint64_t counter;	//!< Number of values drawn so far
+};
+
+/**
+ * @class	PathTracer
+ * @brief	An unbiased Monte Carlo path tracer over the same scenes as RayTracer. At each
+ * 			vertex, direct light is gathered from every light (next-event estimation),
+ * 			and the path continues in a direction drawn from the Phong BRDF: a
+ * 			Lambertian lobe for Material::diffuse and a normalized cosine-power lobe
+ * 			around the mirror direction for Material::specular and shininess. Dielectric
+ * 			materials reflect or refract perfectly, chosen with the Fresnel factor.
+ * 			Positional lights are treated as spheres of radius lightRadius, sized so
+ * 			that they light a surface as RayTracer's point lights do, and paths that run
+ * 			into them are combined with next-event estimation by multiple importance
+ * 			sampling (the power heuristic). Lights are not seen directly by the camera.
+ * 			Paths are ended by Russian roulette after rouletteDepth bounces.
+ *
+ * 			Each call to render adds samplesPerPixel new samples per pixel. If the frame
+ * 			buffer's accumulation buffer is enabled, they are accumulated there, so the
+ * 			image converges over successive calls until restart is called (and the
+ * 			accumulation buffer cleared). With denoisingEnabled, the image is then
+ * 			filtered; the samples themselves are left untouched, so convergence goes on.
+ * 			With checkpoint.filename set, the accumulation buffer and the number of
+ * 			samples in it are saved between calls, and the first call after a restart
+ * 			carries on from a checkpoint of the same view.
+ */
+
+class PathTracer {
+public:
+	PathTracer(const color& environment);
+	void render(FrameBuffer& frameBuffer, const IScene& theScene, int samplesPerPixel = 1);
+	void restart() { samplesTaken = 0; }
+	int getSamplesTaken() const { return samplesTaken; }
+	color tracePath(const Ray& ray, const IScene& theScene, CounterRNG& rng) const;
+
+	color environment;			//!< Radiance of paths that leave the scene
+	int maxDepth = 16;			//!< Longest path followed
+	int rouletteDepth = 3;		//!< Bounces before Russian roulette starts
+	double lightRadius = 0.1;	//!< Radius of positional lights. 0 ==> points (no MIS)
+	bool misEnabled = true;		//!< False ==> lights are reached by next-event estimation only
+	uint64_t seed = 0;			//!< Seed of the random number streams
+	int numThreads = defaultThreadCount();	//!< Threads used by render
+	bool denoisingEnabled = false;	//!< True ==> the image is filtered by denoiser after each render
+	Denoiser denoiser;				//!< Filters the image when denoisingEnabled is set
+	RenderCheckpoint checkpoint;	//!< Saves the accumulation buffer, if its filename is set
+protected:
+	color directLight(const dvec3& pt, const dvec3& n, const dvec3& wo, const Material& mat,
+		const IScene& theScene, CounterRNG& rng, double time) const;
+	bool findLight(const Ray& ray, double maxT, double brdfPdf, bool unseenByNEE,
+		const IScene& theScene, color& emitted) const;
+	bool lightCone(const PositionalLight& light, const dvec3& pt, const Frame& eyeFrame,
+		dvec3& center, double& oneMinusCosMax, color& radiance) const;
+	static color phongBRDF(const Material& mat, const dvec3& n, const dvec3& wo, const dvec3& wi);
+	static double phongPdf(const Material& mat, const dvec3& n, const dvec3& wo, const dvec3& wi);
+	static bool samplePhong(const Material& mat, const dvec3& n, const dvec3& wo,
+		CounterRNG& rng, dvec3& wi);
+	int samplesTaken = 0;		//!< Samples per pixel taken since the last restart
+};
@@ -0,0 +1,336 @@
+/****************************************************
+ * 2016-2025 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include "photonmap.h"
+#include "pathtracer.h"
+#include "raytracer.h"
+
+const int PHOTON_BATCH_SIZE = 1024;	//!< Photons traced by one parallel work item
+
+/**
+ * @struct	PhotonTarget
+ * @brief	A light and the cone of directions, around one dielectric object, that
+ * 			photons from it are shot into.
+ */
+
+struct PhotonTarget {
+	dvec3 origin;						//!< Position of the light
+	dvec3 axis;							//!< Direction toward the object
+	double oneMinusCosMax = 2.0;		//!< 1 - cosine of the cone's half angle. 2 ==> every direction
+	color flux;							//!< Total flux shot into the cone
+	const SpotLight* spot = nullptr;	//!< The light, if it is a spot light
+	int first = 0;						//!< Index of the first photon shot at this target
+	int count = 0;						//!< Number of photons shot at this target
+};
+
+/**
+ * @fn	static double average(const color &C)
+ * @brief	The average of the three channels of a color.
+ * @param	C	The color.
+ * @return	The average.
+ */
+
+static double average(const color& C) {
+	return (C.r + C.g + C.b) / 3.0;
+}
+
+/**
+ * @fn	void PhotonMap::build(const IScene &theScene)
+ * @brief	Shoots numPhotons photons and builds the kd-tree over those stored. Each
+ * 			light and dielectric object pair gets a share of the photons proportional
+ * 			to the flux it sends toward the object. Every photon has its own random
+ * 			number stream, so the map is the same for any number of threads.
+ * @param	theScene	The scene.
+ */
+
+void PhotonMap::build(const IScene& theScene) {
+	photons.clear();
+	const Frame& eyeFrame = theScene.camera->getFrame();
+
+	vector<PhotonTarget> targets;
+	double totalFlux = 0.0;
+	for (const LightSourcePtr light : theScene.lights) {
+		PositionalLightPtr pos = dynamic_cast<PositionalLightPtr>(light);
+		if (pos == nullptr || !pos->isOn || dynamic_cast<DirectionalLightPtr>(light) != nullptr) {
+			continue;
+		}
+		for (const VisibleIShapePtr obj : theScene.opaqueObjs) {
+			AABB box = obj->shape->getBounds();
+			if (!obj->material.isDielectric || !box.isBounded() || box.isEmpty()) {
+				continue;
+			}
+			PhotonTarget target;
+			target.origin = pos->actualPosition(eyeFrame);
+			target.spot = dynamic_cast<const SpotLight*>(pos);
+			double radius = glm::length(box.extent()) / 2.0;
+			double d = glm::distance(target.origin, box.center());
+			if (d > radius) {
+				double sin2Max = (radius * radius) / (d * d);
+				target.oneMinusCosMax = sin2Max / (1.0 + std::sqrt(1.0 - sin2Max));
+				target.axis = (box.center() - target.origin) / d;
+			} else {
+				target.oneMinusCosMax = 2.0;
+				target.axis = Y_AXIS;
+				d = radius;
+			}
+			// Irradiance pi * lightColor at distance d, so that diffuse * irradiance / PI
+			// matches the ray tracer's direct diffuse term there
+			double attenuation = pos->attenuationIsTurnedOn ? pos->atParams.factor(d) : 1.0;
+			target.flux = pos->lightColor * attenuation * PI * d * d * TWO_PI * target.oneMinusCosMax;
+			totalFlux += average(target.flux);
+			targets.push_back(target);
+		}
+	}
+	if (totalFlux <= 0.0) {
+		return;
+	}
+
+	int total = 0;
+	for (PhotonTarget& target : targets) {
+		target.first = total;
+		target.count = glm::max(1, (int)std::round(numPhotons * average(target.flux) / totalFlux));
+		total += target.count;
+	}
+
+	vector<Photon> landed(total);
+	vector<char> stored(total, 0);
+	const int numBatches = (total + PHOTON_BATCH_SIZE - 1) / PHOTON_BATCH_SIZE;
+	parallelFor(numBatches, [&](int batch) {
+		int t = 0;
+		const int end = glm::min(total, (batch + 1) * PHOTON_BATCH_SIZE);
+		for (int i = batch * PHOTON_BATCH_SIZE; i < end; i++) {
+			while (i >= targets[t].first + targets[t].count) {
+				t++;
+			}
+			const PhotonTarget& target = targets[t];
+			CounterRNG rng(seed, (uint64_t)i);
+			double cosTheta = 1.0 - rng.next() * target.oneMinusCosMax;
+			double sinTheta = std::sqrt(glm::max(0.0, 1.0 - cosTheta * cosTheta));
+			double phi = TWO_PI * rng.next();
+			Frame frame = Frame::createOrthoNormalBasis(ORIGIN3D, target.axis);
+			dvec3 dir = sinTheta * std::cos(phi) * frame.u + sinTheta * std::sin(phi) * frame.v +
+				cosTheta * frame.w;
+			if (target.spot != nullptr && !SpotLight::isInSpotlightCone(target.spot->pos,
+				target.spot->spotDir, target.spot->fov, target.origin + dir)) {
+				continue;
+			}
+			stored[i] = tracePhoton(theScene, Ray(target.origin, dir), target.flux / (double)target.count,
+				rng, landed[i]);
+		}
+	}, numThreads);
+
+	for (int i = 0; i < total; i++) {
+		if (stored[i]) {
+			photons.push_back(landed[i]);
+		}
+	}
+	buildTree();
+}
+
+/**
+ * @fn	bool PhotonMap::tracePhoton(const IScene &theScene, Ray ray, const color &power, CounterRNG &rng, Photon &photon) const
+ * @brief	Follows one photon. At a dielectric, it is reflected or refracted, chosen
+ * 			with the Fresnel factor; at any other surface, it stops.
+ * @param 		  	theScene	The scene.
+ * @param 		  	ray			Where the photon starts, and its direction.
+ * @param 		  	power   	The flux it carries.
+ * @param [in,out]	rng			The random numbers for this photon.
+ * @param [out]   	photon  	Where it landed.
+ * @return	True iff the photon landed on a diffuse surface after a reflection or
+ * 			refraction, and should be stored.
+ */
+
+bool PhotonMap::tracePhoton(const IScene& theScene, Ray ray, const color& power, CounterRNG& rng,
+	Photon& photon) const {
+	for (int bounce = 0; bounce <= maxBounces; bounce++) {
+		OpaqueHitRecord hit;
+		if (theScene.findIntersection(ray, hit) < 0) {
+			return false;
+		}
+		if (!hit.material.isDielectric) {
+			if (bounce == 0) {
+				return false;
+			}
+			photon.position = glm::vec3(hit.interceptPt);
+			photon.direction = glm::vec3(ray.dir);
+			photon.power = glm::vec3(power);
+			photon.axis = 0;
+			return true;
+		}
+
+		double etai = 1.0, etat = hit.material.dielectricRefractionIndex;
+		if (hit.rayStatus == LEAVING) {
+			std::swap(etai, etat);
+		}
+		double kr = fresnel(ray.dir, hit.normal, etai, etat);
+		dvec3 refracted = glm::refract(ray.dir, hit.normal, etai / etat);
+		if (rng.next() < kr || refracted == dvec3(0.0)) {
+			ray = Ray(hit.interceptPt + EPSILON * hit.normal, glm::reflect(ray.dir, hit.normal));
+		} else {
+			ray = Ray(hit.interceptPt - EPSILON * hit.normal, refracted);
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	void PhotonMap::buildTree()
+ * @brief	Arranges the photons as a kd-tree. The top levels are split here, until there
+ * 			are enough independent ranges to keep every thread busy, and the ranges are
+ * 			then built in parallel.
+ */
+
+void PhotonMap::buildTree() {
+	vector<std::pair<int, int>> ranges(1, std::make_pair(0, (int)photons.size()));
+	while ((int)ranges.size() < 4 * numThreads) {
+		vector<std::pair<int, int>> next;
+		for (const std::pair<int, int>& range : ranges) {
+			if (range.second - range.first > 1) {
+				int mid = splitRange(range.first, range.second);
+				next.push_back(std::make_pair(range.first, mid));
+				next.push_back(std::make_pair(mid + 1, range.second));
+			}
+		}
+		if (next.empty()) {
+			break;
+		}
+		ranges.swap(next);
+	}
+	parallelFor((int)ranges.size(), [&](int i) {
+		buildRange(ranges[i].first, ranges[i].second);
+	}, numThreads);
+}
+
+/**
+ * @fn	int PhotonMap::splitRange(int lo, int hi)
+ * @brief	Moves the median photon of a range, along the axis where the range is widest,
+ * 			to the middle of the range, with smaller photons before it and larger after.
+ * @param	lo	First photon of the range.
+ * @param	hi	One past the last photon of the range.
+ * @return	The index of the middle photon.
+ */
+
+int PhotonMap::splitRange(int lo, int hi) {
+	glm::vec3 low = photons[lo].position;
+	glm::vec3 high = low;
+	for (int i = lo + 1; i < hi; i++) {
+		low = glm::min(low, photons[i].position);
+		high = glm::max(high, photons[i].position);
+	}
+	glm::vec3 extent = high - low;
+	int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+	int mid = (lo + hi) / 2;
+	std::nth_element(photons.begin() + lo, photons.begin() + mid, photons.begin() + hi,
+		[axis](const Photon& a, const Photon& b) { return a.position[axis] < b.position[axis]; });
+	photons[mid].axis = (uint8_t)axis;
+	return mid;
+}
+
+/**
+ * @fn	void PhotonMap::buildRange(int lo, int hi)
+ * @brief	Arranges a range of photons as a kd-tree.
+ * @param	lo	First photon of the range.
+ * @param	hi	One past the last photon of the range.
+ */
+
+void PhotonMap::buildRange(int lo, int hi) {
+	if (hi - lo <= 1) {
+		return;
+	}
+	int mid = splitRange(lo, hi);
+	buildRange(lo, mid);
+	buildRange(mid + 1, hi);
+}
+
+/**
+ * @fn	void PhotonMap::locate(int lo, int hi, const glm::vec3 &pt, int k, int &found, float &maxDist2, std::pair<float, int> *heap) const
+ * @brief	Finds the k photons nearest a point, within a distance. The nearer side of
+ * 			each split is searched first, so that the search radius shrinks quickly.
+ * @param 		  	lo			First photon of the range to search.
+ * @param 		  	hi			One past the last photon of the range to search.
+ * @param 		  	pt			The point.
+ * @param 		  	k			Number of photons wanted.
+ * @param [in,out]	found   	Number of photons found so far.
+ * @param [in,out]	maxDist2	Squared search radius. Shrinks once k are found.
+ * @param [in,out]	heap		Max-heap of (squared distance, index) of the photons found.
+ */
+
+void PhotonMap::locate(int lo, int hi, const glm::vec3& pt, int k, int& found, float& maxDist2,
+	std::pair<float, int>* heap) const {
+	if (lo >= hi) {
+		return;
+	}
+	const int mid = (lo + hi) / 2;
+	const Photon& photon = photons[mid];
+	if (hi - lo > 1) {
+		float delta = pt[photon.axis] - photon.position[photon.axis];
+		if (delta < 0.0f) {
+			locate(lo, mid, pt, k, found, maxDist2, heap);
+			if (delta * delta < maxDist2) {
+				locate(mid + 1, hi, pt, k, found, maxDist2, heap);
+			}
+		} else {
+			locate(mid + 1, hi, pt, k, found, maxDist2, heap);
+			if (delta * delta < maxDist2) {
+				locate(lo, mid, pt, k, found, maxDist2, heap);
+			}
+		}
+	}
+
+	glm::vec3 offset = photon.position - pt;
+	float dist2 = glm::dot(offset, offset);
+	if (dist2 >= maxDist2) {
+		return;
+	}
+	if (found < k) {
+		heap[found++] = std::make_pair(dist2, mid);
+		std::push_heap(heap, heap + found);
+		if (found == k) {
+			maxDist2 = heap[0].first;
+		}
+	} else {
+		std::pop_heap(heap, heap + k);
+		heap[k - 1] = std::make_pair(dist2, mid);
+		std::push_heap(heap, heap + k);
+		maxDist2 = heap[0].first;
+	}
+}
+
+/**
+ * @fn	color PhotonMap::irradiance(const dvec3 &pt, const dvec3 &n) const
+ * @brief	Estimates the caustic irradiance at a point from the density of the nearest
+ * 			photons. Photons that arrived from behind the surface are ignored. If fewer
+ * 			than numNeighbors are within maxRadius, the whole disc of radius maxRadius is
+ * 			taken as their area.
+ * @param	pt	The point.
+ * @param	n 	Surface normal at the point.
+ * @return	The irradiance.
+ */
+
+color PhotonMap::irradiance(const dvec3& pt, const dvec3& n) const {
+	if (photons.empty()) {
+		return black;
+	}
+	std::pair<float, int> heap[PHOTON_MAX_NEIGHBORS];
+	const int k = glm::clamp(numNeighbors, 1, PHOTON_MAX_NEIGHBORS);
+	int found = 0;
+	float maxDist2 = (float)(maxRadius * maxRadius);
+	locate(0, (int)photons.size(), glm::vec3(pt), k, found, maxDist2, heap);
+
+	color flux = black;
+	for (int i = 0; i < found; i++) {
+		const Photon& photon = photons[heap[i].second];
+		if (glm::dot(dvec3(photon.direction), n) < 0.0) {
+			flux += color(photon.power);
+		}
+	}
+	double radius2 = found == k ? glm::max((double)heap[0].first, 1.0E-8) : maxRadius * maxRadius;
+	return flux / (PI * radius2);
+}
@@ -0,0 +1,75 @@
+/****************************************************
+ * 2016-2025 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include "utilities.h"
+#include "iscene.h"
+#include "light.h"
+
+class CounterRNG;
+
+const int PHOTON_MAX_NEIGHBORS = 256;	//!< Largest number of photons gathered by one estimate
+
+/**
+ * @struct	Photon
+ * @brief	A packet of light that came to rest on a diffuse surface. Kept in single
+ * 			precision, so that more of them fit in the cache during searches.
+ */
+
+struct Photon {
+	glm::vec3 position;		//!< Where it landed
+	glm::vec3 direction;	//!< Direction it was traveling
+	glm::vec3 power;		//!< Flux it carries
+	uint8_t axis;			//!< Axis the kd-tree splits along at this photon
+};
+
+/**
+ * @class	PhotonMap
+ * @brief	A caustic photon map. Photons are shot from the positional lights and spot
+ * 			lights toward each dielectric object, followed through any number of
+ * 			reflections and refractions, and stored where they first land on a diffuse
+ * 			surface after at least one. Photons that reach a diffuse surface directly are
+ * 			not stored, since the ray tracer's direct lighting already accounts for them.
+ *
+ * 			The photons are kept in one array, arranged as an implicit kd-tree: the
+ * 			photon in the middle of a range splits it, and the halves on either side are
+ * 			its subtrees. Photon paths are traced in parallel, and independent subtrees
+ * 			are built in parallel. Irradiance is estimated from the numNeighbors nearest
+ * 			photons, within maxRadius.
+ *
+ * 			The scene's lights do not fall off with distance, so the photons aimed at an
+ * 			object carry the flux that gives the same irradiance at that object's
+ * 			distance from the light as the ray tracer does.
+ */
+
+class PhotonMap {
+public:
+	void build(const IScene& theScene);
+	color irradiance(const dvec3& pt, const dvec3& n) const;
+	int size() const { return (int)photons.size(); }
+	void clear() { photons.clear(); }
+
+	int numPhotons = 200000;	//!< Photons emitted per build, shared among the lights and objects
+	int numNeighbors = 64;		//!< Photons used by each estimate. At most PHOTON_MAX_NEIGHBORS
+	double maxRadius = 0.5;		//!< Farthest a photon may be from the point estimated
+	int maxBounces = 10;		//!< Most reflections and refractions followed
+	uint64_t seed = 0;			//!< Seed of the random number streams
+	int numThreads = defaultThreadCount();	//!< Threads used by build
+protected:
+	bool tracePhoton(const IScene& theScene, Ray ray, const color& power, CounterRNG& rng,
+		Photon& photon) const;
+	void buildTree();
+	int splitRange(int lo, int hi);
+	void buildRange(int lo, int hi);
+	void locate(int lo, int hi, const glm::vec3& pt, int k, int& found, float& maxDist2,
+		std::pair<float, int>* heap) const;
+	vector<Photon> photons;		//!< The photons, as an implicit kd-tree
+};
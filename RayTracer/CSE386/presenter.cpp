@@ -0,0 +1,110 @@
+/****************************************************
+ * 2016-2025 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <cstddef>
+#include <cstring>
+#include "defs.h"
+#include "presenter.h"
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+// Buffer object entry points are not part of OpenGL 1.1, so they are looked up at
+// run time rather than linked against.
+
+#define PIXEL_UNPACK_BUFFER	0x88EC
+#define STREAM_DRAW			0x88E0
+#define WRITE_ONLY			0x88B9
+
+typedef void (APIENTRY* GenBuffersProc)(GLsizei n, GLuint* buffers);
+typedef void (APIENTRY* BindBufferProc)(GLenum target, GLuint buffer);
+typedef void (APIENTRY* BufferDataProc)(GLenum target, ptrdiff_t size, const void* data, GLenum usage);
+typedef void* (APIENTRY* MapBufferProc)(GLenum target, GLenum access);
+typedef GLboolean (APIENTRY* UnmapBufferProc)(GLenum target);
+
+static GenBuffersProc genBuffers = nullptr;
+static BindBufferProc bindBuffer = nullptr;
+static BufferDataProc bufferData = nullptr;
+static MapBufferProc mapBuffer = nullptr;
+static UnmapBufferProc unmapBuffer = nullptr;
+
+bool FramePresenter::pixelBuffersEnabled = true;
+
+/**
+ * @fn	FramePresenter::FramePresenter()
+ * @brief	Constructs the presenter. No OpenGL calls are made until the first frame is
+ * 			presented, since there may not be a context yet.
+ */
+
+FramePresenter::FramePresenter() {
+	initialized = false;
+	supported = false;
+	nextBuffer = 0;
+	for (int i = 0; i < NUM_PIXEL_BUFFERS; i++) {
+		pixelBuffers[i] = 0;
+	}
+}
+
+/**
+ * @fn	bool FramePresenter::initialize()
+ * @brief	Looks up the buffer object entry points and creates the ring of buffers.
+ * @return	True iff pixel buffer objects can be used.
+ */
+
+bool FramePresenter::initialize() {
+	initialized = true;
+	genBuffers = (GenBuffersProc)glutGetProcAddress("glGenBuffers");
+	bindBuffer = (BindBufferProc)glutGetProcAddress("glBindBuffer");
+	bufferData = (BufferDataProc)glutGetProcAddress("glBufferData");
+	mapBuffer = (MapBufferProc)glutGetProcAddress("glMapBuffer");
+	unmapBuffer = (UnmapBufferProc)glutGetProcAddress("glUnmapBuffer");
+	if (genBuffers == nullptr || bindBuffer == nullptr || bufferData == nullptr ||
+		mapBuffer == nullptr || unmapBuffer == nullptr) {
+		return false;
+	}
+	genBuffers(NUM_PIXEL_BUFFERS, pixelBuffers);
+	return pixelBuffers[0] != 0;
+}
+
+/**
+ * @fn	void FramePresenter::present(const uint32_t* pixels, int width, int height)
+ * @brief	Draws a frame of packed RGBA pixels to the window and swaps buffers. The
+ * 			pixels are copied before returning, so the caller may overwrite them at once.
+ * @param	pixels	width x height packed RGBA pixels, bottom row first.
+ * @param	width 	The width of the frame.
+ * @param	height	The height of the frame.
+ */
+
+void FramePresenter::present(const uint32_t* pixels, int width, int height) {
+	if (!initialized) {
+		supported = initialize();
+	}
+	glRasterPos2d(-1, -1);
+	if (supported && pixelBuffersEnabled) {
+		ptrdiff_t size = (ptrdiff_t)width * height * sizeof(uint32_t);
+		bindBuffer(PIXEL_UNPACK_BUFFER, pixelBuffers[nextBuffer]);
+		// Orphan the previous contents, so mapping never waits for an upload in flight.
+		bufferData(PIXEL_UNPACK_BUFFER, size, nullptr, STREAM_DRAW);
+		void* dest = mapBuffer(PIXEL_UNPACK_BUFFER, WRITE_ONLY);
+		if (dest != nullptr) {
+			std::memcpy(dest, pixels, size);
+			unmapBuffer(PIXEL_UNPACK_BUFFER);
+			glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, (const void*)0);
+		} else {
+			bindBuffer(PIXEL_UNPACK_BUFFER, 0);
+			glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		}
+		bindBuffer(PIXEL_UNPACK_BUFFER, 0);
+		nextBuffer = (nextBuffer + 1) % NUM_PIXEL_BUFFERS;
+	} else {
+		glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	}
+	glutSwapBuffers();
+}
@@ -0,0 +1,39 @@
+/****************************************************
+ * 2016-2025 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include "defs.h"
+
+const int NUM_PIXEL_BUFFERS = 3;		//!< Frames that may be in flight between the CPU and the display.
+
+/**
+ * @class	FramePresenter
+ * @brief	Copies finished frames to the screen. Each frame is written into the next
+ * 			of a ring of streaming pixel buffer objects and drawn from there, so the
+ * 			upload to the display proceeds asynchronously and the application can start
+ * 			writing the next frame into its FrameBuffer as soon as present returns. The
+ * 			window is double buffered, so the previous frame stays on screen until the
+ * 			new one is complete. Falls back to drawing straight from client memory if
+ * 			pixel buffer objects are unavailable.
+ */
+
+class FramePresenter {
+public:
+	FramePresenter();
+	void present(const uint32_t* pixels, int width, int height);
+
+	static bool pixelBuffersEnabled;	//!< True ==> upload through pixel buffer objects, if supported.
+protected:
+	bool initialize();
+	bool initialized;							//!< True ==> initialize has been called
+	bool supported;								//!< True ==> pixel buffer objects are available
+	int nextBuffer;								//!< Index of the buffer to fill next
+	GLuint pixelBuffers[NUM_PIXEL_BUFFERS];		//!< Ring of pixel unpack buffers
+};
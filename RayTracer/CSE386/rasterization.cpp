@@ -8,8 +8,15 @@
  ****************************************************/
 
 #include <cmath>
+#include <cstdint>
+#include <algorithm>
 #include "rasterization.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RASTER_USE_SSE2
+#endif
+
  /**
  * @fn	template <class T> T barycentricWeighting(double w1, double w2, double w3,
  *													const T &i1, const T &i2, const T &i3)
@@ -268,7 +275,7 @@ static void drawVerticalLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
 
 		// Interpolate vertex attributes using alpha, beta, and gamma weights
 		double oneMinusW = 1.0 - weight;
-		fragment.material = weightedAverage(oneMinusW, v0.material, weight, v1.material);
+		fragment.material = weightedAverage(oneMinusW, v0.getMaterial(), weight, v1.getMaterial());
 		double z = weightedAverage(oneMinusW, v0.pos.z, weight, v1.pos.z);
 		fragment.worldNormal = weightedAverage(oneMinusW, v0.normal, weight, v1.normal);
 		fragment.worldPos = weightedAverage(oneMinusW, v0.worldPos, weight, v1.worldPos);
@@ -308,7 +315,7 @@ static void drawHorizontalLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
 		Fragment fragment;
 
 		// Interpolate vertex attributes using alpha, beta, and gamma weights
-		fragment.material = weightedAverage(1.0 - weight, v0.material, weight, v1.material);
+		fragment.material = weightedAverage(1.0 - weight, v0.getMaterial(), weight, v1.getMaterial());
 		double z = weightedAverage(1 - weight, v0.pos.z, weight, v1.pos.z);
 		fragment.worldNormal = weightedAverage(1.0 - weight, v0.normal, weight, v1.normal);
 		fragment.worldPos = weightedAverage(1.0 - weight, v0.worldPos, weight, v1.worldPos);
@@ -353,7 +360,7 @@ static void midPointLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
 			Fragment fragment;
 
 			// Interpolate vertex attributes using alpha, beta, and gamma weights
-			fragment.material = weightedAverage(1.0 - weight, v0.material, weight, v1.material);
+			fragment.material = weightedAverage(1.0 - weight, v0.getMaterial(), weight, v1.getMaterial());
 			double z = weightedAverage(1 - weight, v0.pos.z, weight, v1.pos.z);
 			fragment.worldNormal = weightedAverage(1.0 - weight, v0.normal, weight, v1.normal);
 			fragment.worldPos = weightedAverage(1.0 - weight, v0.worldPos, weight, v1.worldPos);
@@ -385,7 +392,7 @@ static void midPointLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
 			Fragment fragment;
 
 			// Interpolate vertex attributes using alpha, beta, and gamma weights
-			fragment.material = weightedAverage(1.0 - weight, v0.material, weight, v1.material);
+			fragment.material = weightedAverage(1.0 - weight, v0.getMaterial(), weight, v1.getMaterial());
 			double z = weightedAverage(1 - weight, v0.pos.z, weight, v1.pos.z);
 			fragment.worldNormal = weightedAverage(1.0 - weight, v0.normal, weight, v1.normal);
 			fragment.worldPos = weightedAverage(1.0 - weight, v0.worldPos, weight, v1.worldPos);
@@ -417,7 +424,7 @@ static void midPointLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
 			Fragment fragment;
 
 			// Interpolate vertex attributes using alpha, beta, and gamma weights
-			fragment.material = weightedAverage(1.0 - weight, v0.material, weight, v1.material);
+			fragment.material = weightedAverage(1.0 - weight, v0.getMaterial(), weight, v1.getMaterial());
 			double z = weightedAverage(1 - weight, v0.pos.z, weight, v1.pos.z);
 			fragment.worldNormal = weightedAverage(1.0 - weight, v0.normal, weight, v1.normal);
 			fragment.worldPos = weightedAverage(1.0 - weight, v0.worldPos, weight, v1.worldPos);
@@ -449,7 +456,7 @@ static void midPointLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
 			Fragment fragment;
 
 			// Interpolate vertex attributes using alpha, beta, and gamma weights
-			fragment.material = weightedAverage(1.0 - weight, v0.material, weight, v1.material);
+			fragment.material = weightedAverage(1.0 - weight, v0.getMaterial(), weight, v1.getMaterial());
 			double z = weightedAverage(1 - weight, v0.pos.z, weight, v1.pos.z);
 			fragment.worldNormal = weightedAverage(1.0 - weight, v0.normal, weight, v1.normal);
 			fragment.worldPos = weightedAverage(1.0 - weight, v0.worldPos, weight, v1.worldPos);
@@ -569,61 +576,341 @@ void drawManyWireFrameTriangles(FrameBuffer& frameBuffer,
 }
 
 /**
- * @fn	static inline double f01(const VertexData &v0, const VertexData &v1, const VertexData &v2, double x, double y)
- * @brief	Computes f01. Implicit equation for the line between v0 and v1.
+ * @struct	EdgeFunction
+ * @brief	Fixed-point implicit equation for one edge of a triangle, E(x, y) = A*x + B*y + C.
+ * 			Vertex positions are snapped to 1/2^SUBPIXEL_BITS of a pixel, so the edge
+ * 			functions of a triangle are exact and their sum is constant (twice the area).
+ * 			E is oriented to be positive inside the triangle. threshold is 0 or 1 and
+ * 			encodes the tie-breaking rule for pixels exactly on the edge.
  * @see		*** page in textbook.
- * @param	v0	v0.
- * @param	v1	v1.
- * @param	v2	v2.
- * @param	x 	x coordinate.
- * @param	y 	y coordinate.
- * @return	f01.
  */
 
-static inline double f01(const VertexData& v0, const VertexData& v1, const VertexData& v2,
-	double x, double y) {
-	return (v0.pos.y - v1.pos.y) * x + (v1.pos.x - v0.pos.x) * y +
-		(v0.pos.x * v1.pos.y) - (v1.pos.x * v0.pos.y);
+struct EdgeFunction {
+	int64_t A, B, C;	//!< Coefficients, in fixed-point units.
+	int64_t stepX;		//!< Change in E when moving one pixel in +x.
+	int64_t stepY;		//!< Change in E when moving one pixel in +y.
+	int threshold;		//!< A pixel is on the inside iff E >= threshold.
+
+	/**
+	 * @fn	void setup(int64_t xa, int64_t ya, int64_t xb, int64_t yb)
+	 * @brief	Computes the equation of the line from a to b (fixed-point coordinates).
+	 */
+
+	void setup(int64_t xa, int64_t ya, int64_t xb, int64_t yb) {
+		A = ya - yb;
+		B = xb - xa;
+		C = xa * yb - xb * ya;
+	}
+	int64_t operator()(int64_t x, int64_t y) const { return A * x + B * y + C; }
+};
+
+const int SUBPIXEL_BITS = 4;			//!< Fractional bits of snapped vertex positions.
+const int SUBPIXEL_ONE = 1 << SUBPIXEL_BITS;
+const int RASTER_BLOCK_SIZE = 8;		//!< Width and height of the pixel blocks.
+
+int rasterThreadCount = defaultThreadCount();
+bool hierarchicalDepthTestEnabled = true;
+
+/**
+ * @brief	Margin subtracted from depths computed for whole regions before they are tested
+ * 			against the depth pyramid, so that rounding never rejects a visible fragment.
+ */
+
+const double DEPTH_EPSILON = 1.0E-9;
+
+/**
+ * @fn	static inline int64_t toFixed(double v)
+ * @brief	Snaps a window coordinate to the subpixel grid.
+ * @param	v	Window coordinate.
+ * @return	The fixed-point coordinate.
+ */
 
+static inline int64_t toFixed(double v) {
+	return (int64_t)std::llround(v * SUBPIXEL_ONE);
 }
 
 /**
- * @fn	static inline double f12(const VertexData &v0, const VertexData &v1, const VertexData &v2,
- *									double x, double y)
- * @brief	Computes f12. Implicit equation for the line between v1 and v2.
- * @see		*** page in textbook.
- * @param	v0	v0.
- * @param	v1	v1.
- * @param	v2	v2.
- * @param	x 	x coordinate.
- * @param	y 	y coordinate.
- * @return	f12.
+ * @fn	static int rowCoverageMask(const EdgeFunction edges[3], const int64_t rowValues[3],
+ *									const bool crosses[3], int count, bool narrow)
+ * @brief	Computes which of the next count (<= 8) pixels in a row are inside the triangle.
+ * 			Only the edges that cross the block need to be tested. When narrow is true,
+ * 			those are evaluated four pixels at a time in 32 bits with SSE2, if available.
+ * @param	edges	 	The three edge functions.
+ * @param	rowValues	The values of the edge functions at the first pixel.
+ * @param	crosses  	Which edges cross the current block.
+ * @param	count	 	Number of pixels to test.
+ * @param	narrow	 	True iff the crossing edges are known to fit in 32 bits.
+ * @return	Bit k is set iff the k'th pixel is covered.
  */
 
-static inline double f12(const VertexData& v0, const VertexData& v1, const VertexData& v2,
-	double x, double y) {
-	return (v1.pos.y - v2.pos.y) * x + (v2.pos.x - v1.pos.x) * y +
-		(v1.pos.x * v2.pos.y) - (v2.pos.x * v1.pos.y);
+static int rowCoverageMask(const EdgeFunction edges[3], const int64_t rowValues[3],
+	const bool crosses[3], int count, bool narrow) {
+	int mask = (1 << count) - 1;
+	for (int i = 0; i < 3; i++) {
+		if (!crosses[i]) {
+			continue;
+		}
+		int inside = 0;
+#ifdef RASTER_USE_SSE2
+		if (narrow) {
+			int32_t step = (int32_t)edges[i].stepX;
+			__m128i threshold = _mm_set1_epi32(edges[i].threshold - 1);
+			__m128i v = _mm_add_epi32(_mm_set1_epi32((int32_t)rowValues[i]),
+									_mm_set_epi32(3 * step, 2 * step, step, 0));
+			inside = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, threshold)));
+			v = _mm_add_epi32(v, _mm_set1_epi32(4 * step));
+			inside |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, threshold))) << 4;
+			mask &= inside;
+			continue;
+		}
+#endif
+		int64_t value = rowValues[i];
+		for (int k = 0; k < count; k++) {
+			if (value >= edges[i].threshold) {
+				inside |= 1 << k;
+			}
+			value += edges[i].stepX;
+		}
+		mask &= inside;
+	}
+	return mask;
+}
+
+/**
+ * @fn	static inline void drawTrianglePixel(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+ *											const vector<LightSourcePtr> &lights,
+ *											const VertexData &v0, const VertexData &v1,
+ *											const VertexData &v2, const Frame &eyeFrame,
+ *											int x, int y, double alpha, double beta,
+ *											double gamma)
+ * @brief	Produces the fragment for one covered pixel of a filled triangle.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	eyePos	   	Eye position.
+ * @param 		  	lights	   	Vector of lights in scene.
+ * @param 		  	v0		   	v0.
+ * @param 		  	v1		   	v1.
+ * @param 		  	v2		   	v2.
+ * @param 		  	eyeFrame   	The camera's frame.
+ * @param 		  	x		   	Window x coordinate.
+ * @param 		  	y		   	Window y coordinate.
+ * @param 		  	alpha	   	Barycentric weight of v0.
+ * @param 		  	beta	   	Barycentric weight of v1.
+ * @param 		  	gamma	   	Barycentric weight of v2.
+ */
 
+static inline void drawTrianglePixel(FrameBuffer& frameBuffer, const dvec3& eyePos,
+	const vector<LightSourcePtr>& lights,
+	const VertexData& v0, const VertexData& v1, const VertexData& v2,
+	const Frame& eyeFrame, int x, int y,
+	double alpha, double beta, double gamma) {
+
+	// Early depth test: reject hidden fragments before interpolating
+	// attributes or computing lighting.
+	double z = barycentricWeighting(alpha, beta, gamma, v0.pos.z, v1.pos.z, v2.pos.z);
+	if (!FragmentOps::passesDepthTest(frameBuffer, x, y, z)) {
+		return;
+	}
+
+	if (FragmentOps::deferredShadingEnabled) {
+		GBufferTexel texel;
+		texel.worldNormal = barycentricWeighting(alpha, beta, gamma, v0.normal, v1.normal, v2.normal);
+		texel.worldPos = barycentricWeighting(alpha, beta, gamma, v0.worldPos, v1.worldPos, v2.worldPos);
+		texel.materialID = v0.materialID;
+		FragmentOps::writeGBuffer(frameBuffer, x, y, z, texel);
+		return;
+	}
+
+	// Create and fill fragment. Most triangles have a single material, which
+	// needs no interpolation.
+	Fragment fragment;
+	if (v0.materialID == v1.materialID && v0.materialID == v2.materialID) {
+		fragment.material = v0.getMaterial();
+	} else {
+		fragment.material = barycentricWeighting(alpha, beta, gamma,
+			v0.getMaterial(), v1.getMaterial(), v2.getMaterial());
+	}
+	fragment.worldNormal = barycentricWeighting(alpha, beta, gamma, v0.normal, v1.normal, v2.normal);
+	fragment.worldPos = barycentricWeighting(alpha, beta, gamma, v0.worldPos, v1.worldPos, v2.worldPos);
+	fragment.textCoord = barycentricWeighting(alpha, beta, gamma, v0.textCoord, v1.textCoord, v2.textCoord);
+	fragment.windowPos = dvec3(x, y, z);
+
+	// Compute lighting at the fragment
+	fragment.color = FragmentOps::shadeFragment(lights, fragment.worldPos,
+								fragment.worldNormal, fragment.material, eyeFrame);
+
+	// Process the fully shaded fragment (fog, blend, depth test)
+	FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
 }
 
 /**
- * @fn	static inline double f20(const VertexData &v0, const VertexData &v1, const VertexData &v2,
- *									double x, double y)
- * @brief	Computes f20. Implicit equation for the line between v2 and v0.
- * @see		*** page in textbook.
- * @param	v0	v0.
- * @param	v1	v1.
- * @param	v2	v2.
- * @param	x 	x coordinate.
- * @param	y 	y coordinate.
- * @return	f02.
+ * @fn	static void rasterizeTriangle(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+ *									const vector<LightSourcePtr> &lights,
+ *									const VertexData &v0, const VertexData &v1, const VertexData &v2,
+ *									const Frame &eyeFrame, const BoundingBoxi &scissor)
+ * @brief	Half-space rasterizer: the bounding box is walked in 8x8 blocks, which are
+ * 			rejected or accepted as a whole when possible. Edge functions are stepped
+ * 			incrementally in fixed point. Pixels exactly on an edge are drawn iff the
+ * 			point (-1, -1) is on the inside of that edge, so triangles sharing an edge
+ * 			never both draw a pixel. Only pixels inside the scissor rectangle are touched.
+ * 			Blocks in which the nearest point of the triangle is behind everything already
+ * 			drawn are skipped using the depth pyramid.
+ * @param [in,out]	frameBuffer  	Framebuffer.
+ * @param 		  	eyePos		 	Eye position.
+ * @param 		  	lights		 	Vector of lights in scene.
+ * @param 		  	v0			 	v0.
+ * @param 		  	v1			 	v1.
+ * @param 		  	v2			 	v2.
+ * @param 		  	eyeFrame        The camera's frame.
+ * @param 		  	scissor		 	The pixels that may be drawn.
+ */
+
+static void rasterizeTriangle(FrameBuffer& frameBuffer, const dvec3& eyePos,
+	const vector<LightSourcePtr>& lights,
+	const VertexData& v0, const VertexData& v1, const VertexData& v2,
+	const Frame& eyeFrame, const BoundingBoxi& scissor) {
+
+	// Snap the vertices to the subpixel grid
+	int64_t x0 = toFixed(v0.pos.x), y0 = toFixed(v0.pos.y);
+	int64_t x1 = toFixed(v1.pos.x), y1 = toFixed(v1.pos.y);
+	int64_t x2 = toFixed(v2.pos.x), y2 = toFixed(v2.pos.y);
+
+	// Triangle bounding box, limited to the scissor rectangle
+	int xMin = std::max(scissor.lx, (int)(std::min(x0, std::min(x1, x2)) >> SUBPIXEL_BITS));
+	int yMin = std::max(scissor.ly, (int)(std::min(y0, std::min(y1, y2)) >> SUBPIXEL_BITS));
+	int xMax = std::min(scissor.lx + scissor.width - 1,
+						(int)((std::max(x0, std::max(x1, x2)) + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS));
+	int yMax = std::min(scissor.ly + scissor.height - 1,
+						(int)((std::max(y0, std::max(y1, y2)) + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS));
+	if (xMin > xMax || yMin > yMax) {
+		return;
+	}
+
+	// Edge functions, opposite v0, v1 and v2 respectively.
+	EdgeFunction edges[3];
+	edges[0].setup(x1, y1, x2, y2);
+	edges[1].setup(x2, y2, x0, y0);
+	edges[2].setup(x0, y0, x1, y1);
+
+	int64_t area = edges[0](x0, y0);
+	if (area == 0) {
+		return;
+	}
+	for (EdgeFunction& e : edges) {
+		if (area < 0) {
+			e.A = -e.A;
+			e.B = -e.B;
+			e.C = -e.C;
+		}
+		e.stepX = e.A * SUBPIXEL_ONE;
+		e.stepY = e.B * SUBPIXEL_ONE;
+		e.threshold = e(-SUBPIXEL_ONE, -SUBPIXEL_ONE) > 0 ? 0 : 1;
+	}
+	const double invArea = 1.0 / (double)std::abs(area);
+
+	// Depth is an affine function of window position. Find its change per pixel.
+	const bool testBlockDepth = hierarchicalDepthTestEnabled && FragmentOps::performDepthTest;
+	const double zMin = min(v0.pos.z, v1.pos.z, v2.pos.z) - DEPTH_EPSILON;
+	const double dzdx = (edges[0].stepX * v0.pos.z + edges[1].stepX * v1.pos.z + edges[2].stepX * v2.pos.z) * invArea;
+	const double dzdy = (edges[0].stepY * v0.pos.z + edges[1].stepY * v1.pos.z + edges[2].stepY * v2.pos.z) * invArea;
+
+	// An edge that crosses a block is small in magnitude everywhere in the block, so it
+	// fits in 32 bits unless the edge is extremely steep.
+	const int64_t NARROW_LIMIT = (int64_t)1 << 26;
+	bool narrow = true;
+	for (const EdgeFunction& e : edges) {
+		narrow = narrow && std::abs(e.stepX) < NARROW_LIMIT && std::abs(e.stepY) < NARROW_LIMIT;
+	}
+
+	const int BLOCK = RASTER_BLOCK_SIZE;
+	for (int by = yMin & ~(BLOCK - 1); by <= yMax; by += BLOCK) {
+		int yStart = std::max(by, yMin);
+		int yEnd = std::min(by + BLOCK - 1, yMax);
+		for (int bx = xMin & ~(BLOCK - 1); bx <= xMax; bx += BLOCK) {
+			int xStart = std::max(bx, xMin);
+			int xEnd = std::min(bx + BLOCK - 1, xMax);
+
+			// Classify the block against each edge using the extremes over its corners.
+			int64_t base[3];
+			bool crosses[3];
+			bool rejected = false;
+			for (int i = 0; i < 3 && !rejected; i++) {
+				const EdgeFunction& e = edges[i];
+				base[i] = e((int64_t)xStart << SUBPIXEL_BITS, (int64_t)yStart << SUBPIXEL_BITS);
+				int64_t dx = e.stepX * (xEnd - xStart);
+				int64_t dy = e.stepY * (yEnd - yStart);
+				int64_t lo = base[i] + std::min<int64_t>(0, dx) + std::min<int64_t>(0, dy);
+				int64_t hi = base[i] + std::max<int64_t>(0, dx) + std::max<int64_t>(0, dy);
+				rejected = hi < e.threshold;
+				crosses[i] = lo < e.threshold;
+			}
+			if (rejected) {
+				continue;
+			}
+
+			const int count = xEnd - xStart + 1;
+			if (testBlockDepth) {
+				double z = (base[0] * v0.pos.z + base[1] * v1.pos.z + base[2] * v2.pos.z) * invArea;
+				double nearest = z + std::min(0.0, dzdx * (xEnd - xStart)) + std::min(0.0, dzdy * (yEnd - yStart));
+				nearest = std::max(nearest - DEPTH_EPSILON, zMin);
+				if (frameBuffer.isOccluded(BoundingBoxi(xStart, count, yStart, yEnd - yStart + 1), nearest)) {
+					continue;
+				}
+			}
+			const bool fullyCovered = !crosses[0] && !crosses[1] && !crosses[2];
+			int64_t row[3] = { base[0], base[1], base[2] };
+			for (int y = yStart; y <= yEnd; y++) {
+				int mask = fullyCovered ? (1 << count) - 1 : rowCoverageMask(edges, row, crosses, count, narrow);
+				if (mask != 0) {
+					int64_t w[3] = { row[0], row[1], row[2] };
+					for (int k = 0; k < count; k++) {
+						if (mask & (1 << k)) {
+							double alpha = w[0] * invArea;
+							double beta = w[1] * invArea;
+							double gamma = w[2] * invArea;
+							drawTrianglePixel(frameBuffer, eyePos, lights, v0, v1, v2, eyeFrame,
+												xStart + k, y, alpha, beta, gamma);
+						}
+						w[0] += edges[0].stepX;
+						w[1] += edges[1].stepX;
+						w[2] += edges[2].stepX;
+					}
+				}
+				row[0] += edges[0].stepY;
+				row[1] += edges[1].stepY;
+				row[2] += edges[2].stepY;
+			}
+		}
+	}
+}
+
+/**
+ * @fn	static bool deferTriangle(const VertexData &v0, const VertexData &v1, const VertexData &v2)
+ * @brief	In deferred mode, translucent triangles and triangles whose vertices do not share
+ * 			a material are set aside, to be drawn with forward shading after the lighting pass.
+ * @param 		  	v0			v0.
+ * @param 		  	v1			v1.
+ * @param 		  	v2			v2.
+ * @return	True iff the triangle was set aside.
  */
 
-static inline double f20(const VertexData& v0, const VertexData& v1, const VertexData& v2,
-	double x, double y) {
-	return (v2.pos.y - v0.pos.y) * x + (v0.pos.x - v2.pos.x) * y +
-		(v2.pos.x * v0.pos.y) - (v0.pos.x * v2.pos.y);
+static bool deferTriangle(const VertexData& v0, const VertexData& v1, const VertexData& v2) {
+	if (!FragmentOps::deferredShadingEnabled) {
+		return false;
+	}
+	GBuffer& gBuffer = FragmentOps::gBuffer;
+	if (v0.getMaterial().alpha < 1.0 || v1.getMaterial().alpha < 1.0 || v2.getMaterial().alpha < 1.0) {
+		gBuffer.translucentVerts.push_back(v0);
+		gBuffer.translucentVerts.push_back(v1);
+		gBuffer.translucentVerts.push_back(v2);
+		return true;
+	}
+	if (v0.materialID != v1.materialID || v0.materialID != v2.materialID) {
+		gBuffer.forwardVerts.push_back(v0);
+		gBuffer.forwardVerts.push_back(v1);
+		gBuffer.forwardVerts.push_back(v2);
+		return true;
+	}
+	return false;
 }
 
 /**
@@ -645,65 +932,21 @@ void drawFilledTriangle(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights,
 	const VertexData& v0, const VertexData& v1, const VertexData& v2,
 	const Frame& eyeFrame) {
-
-	// Triangle bounding box
-	double xMin = glm::floor(min(v0.pos.x, v1.pos.x, v2.pos.x));
-	double xMax = glm::ceil(max(v0.pos.x, v1.pos.x, v2.pos.x));
-	double yMin = glm::floor(min(v0.pos.y, v1.pos.y, v2.pos.y));
-	double yMax = glm::ceil(max(v0.pos.y, v1.pos.y, v2.pos.y));
-
-	// Precompute edge functions at triangle corners
-	double fAlpha = f12(v0, v1, v2, v0.pos.x, v0.pos.y);
-	double fBeta = f20(v0, v1, v2, v1.pos.x, v1.pos.y);
-	double fGamma = f01(v0, v1, v2, v2.pos.x, v2.pos.y);
-
-	for (double y = yMin; y <= yMax; y++) {
-		for (double x = xMin; x <= xMax; x++) {
-			// Compute barycentric weights
-			double alpha = f12(v0, v1, v2, x, y) / fAlpha;
-			double beta = f20(v0, v1, v2, x, y) / fBeta;
-			double gamma = f01(v0, v1, v2, x, y) / fGamma;
-
-			// If inside triangle (with edge rules)
-			if (alpha >= 0 && beta >= 0 && gamma >= 0) {
-				if ((alpha > 0 || fAlpha * f12(v0, v1, v2, -1, -1) > 0) &&
-					(beta > 0 || fBeta * f20(v0, v1, v2, -1, -1) > 0) &&
-					(gamma > 0 || fGamma * f01(v0, v1, v2, -1, -1) > 0)) {
-
-					// Create and fill fragment
-					Fragment fragment;
-					fragment.material = barycentricWeighting(alpha, beta, gamma, v0.material, v1.material, v2.material);
-					fragment.worldNormal = barycentricWeighting(alpha, beta, gamma, v0.normal, v1.normal, v2.normal);
-					fragment.worldPos = barycentricWeighting(alpha, beta, gamma, v0.worldPos, v1.worldPos, v2.worldPos);
-					fragment.textCoord = barycentricWeighting(alpha, beta, gamma, v0.textCoord, v1.textCoord, v2.textCoord);
-					double z = barycentricWeighting(alpha, beta, gamma, v0.pos.z, v1.pos.z, v2.pos.z);
-					fragment.windowPos = dvec3(x, y, z);
-
-					// Compute lighting at the fragment
-					fragment.color = black;
-					for (const auto& light : lights) {
-						if (light->isOn) {
-							fragment.color += light->illuminate(
-								fragment.worldPos,
-								fragment.worldNormal,
-								fragment.material,
-								eyeFrame,
-								false // Shadowing will come later
-							);
-						}
-					}
-
-					// Process the fully shaded fragment (fog, blend, depth test)
-					FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
-				}
-			}
-		}
+	if (!deferTriangle(v0, v1, v2)) {
+		FragmentOps::prepareGBuffer(frameBuffer);
+		BoundingBoxi window(0, frameBuffer.getWindowWidth(), 0, frameBuffer.getWindowHeight());
+		rasterizeTriangle(frameBuffer, eyePos, lights, v0, v1, v2, eyeFrame, window);
 	}
 }
 
 /**
  * @fn	void drawManyFilledTriangles(FrameBuffer &frameBuffer, const dvec3 &eyePos, const vector<LightSourcePtr> &lights, const vector<VertexData> &vertices, const dmat4 &viewingMatrix)
- * @brief	Draw many filled triangles,
+ * @brief	Draw many filled triangles. The window is divided into RASTER_TILE_SIZE square
+ * 			tiles and each triangle is binned into the tiles its bounding box touches. The
+ * 			tiles are then rasterized in parallel. A tile's pixels are only ever touched by
+ * 			the thread drawing that tile, and within a tile the triangles are drawn in the
+ * 			order given, so the result is the same as drawing them one after the other.
+ * 			Triangles hidden behind what was drawn by earlier calls are dropped while binning.
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
@@ -714,10 +957,61 @@ void drawFilledTriangle(FrameBuffer& frameBuffer, const dvec3& eyePos,
 void drawManyFilledTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights, const vector<VertexData>& vertices,
 	const Frame& eyeFrame) {
-	for (int i = 0; i < (int)vertices.size() - 2; i += 3) {
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	const int TILE = RASTER_TILE_SIZE;
+	const int tilesX = (W + TILE - 1) / TILE;
+	const int tilesY = (H + TILE - 1) / TILE;
+
+	FragmentOps::prepareGBuffer(frameBuffer);
+
+	// Bin the triangles. Deferred-shading bookkeeping happens here, on one thread.
+	// The bins are reused from call to call.
+	static thread_local vector<vector<int>> binStorage;
+	vector<vector<int>>& bins = binStorage;		// The workers must see this thread's bins
+	if ((int)bins.size() < tilesX * tilesY) {
+		bins.resize(tilesX * tilesY);
+	}
+	for (vector<int>& bin : bins) {
+		bin.clear();
+	}
+	const bool testDepth = hierarchicalDepthTestEnabled && FragmentOps::performDepthTest;
+	for (int i = 0; i + 2 < (int)vertices.size(); i += 3) {
 		const VertexData& Vi = vertices[i];
 		const VertexData& Vi1 = vertices[i + 1];
 		const VertexData& Vi2 = vertices[i + 2];
-		drawFilledTriangle(frameBuffer, eyePos, lights, Vi, Vi1, Vi2, eyeFrame);
+		if (deferTriangle(Vi, Vi1, Vi2)) {
+			continue;
+		}
+		int left = (int)glm::floor(min(Vi.pos.x, Vi1.pos.x, Vi2.pos.x));
+		int bottom = (int)glm::floor(min(Vi.pos.y, Vi1.pos.y, Vi2.pos.y));
+		int right = (int)glm::ceil(max(Vi.pos.x, Vi1.pos.x, Vi2.pos.x));
+		int top = (int)glm::ceil(max(Vi.pos.y, Vi1.pos.y, Vi2.pos.y));
+		if (testDepth) {
+			double nearest = min(Vi.pos.z, Vi1.pos.z, Vi2.pos.z) - DEPTH_EPSILON;
+			if (frameBuffer.isOccluded(BoundingBoxi(left, right - left + 1, bottom, top - bottom + 1), nearest)) {
+				continue;
+			}
+		}
+		int xMin = std::max(0, left / TILE);
+		int yMin = std::max(0, bottom / TILE);
+		int xMax = std::min(tilesX - 1, right / TILE);
+		int yMax = std::min(tilesY - 1, top / TILE);
+		for (int ty = yMin; ty <= yMax; ty++) {
+			for (int tx = xMin; tx <= xMax; tx++) {
+				bins[ty * tilesX + tx].push_back(i);
+			}
+		}
 	}
+
+	parallelFor(tilesX * tilesY, [&](int tile) {
+		int tx = tile % tilesX;
+		int ty = tile / tilesX;
+		BoundingBoxi scissor(tx * TILE, std::min(TILE, W - tx * TILE),
+							ty * TILE, std::min(TILE, H - ty * TILE));
+		for (int i : bins[tile]) {
+			rasterizeTriangle(frameBuffer, eyePos, lights,
+				vertices[i], vertices[i + 1], vertices[i + 2], eyeFrame, scissor);
+		}
+	}, rasterThreadCount);
 }
@@ -13,12 +13,20 @@
 #include "fragmentops.h"
 #include "vertexdata.h"
 
+const int RASTER_TILE_SIZE = 64;	//!< Width and height of the screen tiles. A multiple of 8.
+extern int rasterThreadCount;		//!< Threads used to rasterize filled triangles. 1 ==> serial.
+extern bool hierarchicalDepthTestEnabled;	//!< True ==> reject hidden objects, triangles and blocks early.
+
+// Each thread must own whole coarse blocks of the depth pyramid, and whole color tiles.
+static_assert(RASTER_TILE_SIZE % DEPTH_COARSE_SIZE == 0, "Tiles must be made of coarse depth blocks");
+static_assert(RASTER_TILE_SIZE % COLOR_TILE_SIZE == 0, "Tiles must be made of color tiles");
+
 void drawAxisOnWindow(FrameBuffer& frameBuffer);
 void drawWirePolygon(FrameBuffer& frameBuffer, const vector<dvec3>& pts, const color& rgb);
 void drawLine(FrameBuffer& frameBuffer, int x1, int y1, int x2, int y2, const color& C);
 void drawLine(FrameBuffer& frameBuffer, const dvec2& pt1, const dvec2& pt2, const color& C);
 void drawLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
-	vector<LightSourcePtr>& lights,
+	const vector<LightSourcePtr>& lights,
 	const VertexData& v0, const VertexData& v1,
 	const Frame& eyeFrame);
 void drawManyLines(FrameBuffer& frameBuffer, const dvec3& eyePos,
@@ -29,7 +37,7 @@ void drawWireFrameTriangle(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const VertexData& v0, const VertexData& v1, const VertexData& v2,
 	const Frame& eyeFrame);
 void drawFilledTriangle(FrameBuffer& frameBuffer, const dvec3& eyePos,
-	vector<LightSourcePtr>& lights, const VertexData& v0,
+	const vector<LightSourcePtr>& lights, const VertexData& v0,
 	const VertexData& v1, const VertexData& v2,
 	const Frame& eyeFrame);
 void drawManyWireFrameTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
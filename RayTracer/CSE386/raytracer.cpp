@@ -7,10 +7,41 @@
  * permission is granted.
  ****************************************************/
 
+#include <algorithm>
 #include "raytracer.h"
 #include "ishape.h"
 #include "io.h"
 
+/**
+ * @fn	vector<double> lightingState(const IScene &theScene)
+ * @brief	Collects everything about the scene's lights that affects shading, so that
+ * 			two frames can be compared.
+ * @param	theScene	The scene.
+ * @return	The state of the lights.
+ */
+
+vector<double> lightingState(const IScene& theScene) {
+	vector<double> state;
+	auto add = [&](const dvec3& v) { state.insert(state.end(), { v.x, v.y, v.z }); };
+	for (const LightSourcePtr light : theScene.lights) {
+		state.push_back(light->isOn);
+		add(light->lightColor);
+		if (PositionalLightPtr pos = dynamic_cast<PositionalLightPtr>(light)) {
+			add(pos->pos);
+			state.insert(state.end(), { (double)pos->attenuationIsTurnedOn, (double)pos->isTiedToWorld,
+				pos->atParams.constant, pos->atParams.linear, pos->atParams.quadratic });
+		}
+		if (SpotLightPtr spot = dynamic_cast<SpotLightPtr>(light)) {
+			add(spot->spotDir);
+			state.push_back(spot->fov);
+		}
+		if (DirectionalLightPtr dir = dynamic_cast<DirectionalLightPtr>(light)) {
+			add(dir->dir);
+		}
+	}
+	return state;
+}
+
  /**
   * @fn	RayTracer::RayTracer(const color &defa)
   * @brief	Constructs a raytracers.
@@ -23,7 +54,16 @@ RayTracer::RayTracer(const color& defa)
 
 /**
  * @fn	void RayTracer::raytraceScene(FrameBuffer &frameBuffer, int depth, const IScene &theScene) const
- * @brief	Raytrace scene
+ * @brief	Raytrace scene. Each row is traced into a local buffer and written to the
+ * 			framebuffer in one span. If the framebuffer's accumulation buffer is enabled,
+ * 			every sample is added to it unclamped instead, and the buffer is resolved
+ * 			into the color buffer once at the end. Samples keep accumulating from call
+ * 			to call until the caller clears the accumulation buffer, which allows
+ * 			progressive rendering. Overlays are drawn afterwards, by drawOverlays.
+ * 			With wavefrontEnabled (and N == 1), the image is traced in tiles instead.
+ * 			If checkpoint is enabled, it is traced tile by tile with checkpoints, and
+ * 			the temporal cache is not used.
+ * 			The frame is prepared by beginFrame and finished by finishFrame.
  * @param [in,out]	frameBuffer	Framebuffer.
  * @param 		  	depth	   	The current depth of recursion.
  * @param 		  	theScene   	The scene.
@@ -33,54 +73,552 @@ void RayTracer::raytraceScene(FrameBuffer& frameBuffer, int depth,
 	const IScene& theScene, int N) {
 
 	color defaultColor = frameBuffer.getClearColor();
+	const bool accumulating = frameBuffer.isAccumulationEnabled();
+	const int width = frameBuffer.getWindowWidth();
+	vector<color> row(width);
 
-	this->initialRecursionDepth = depth;
+	beginFrame(theScene, depth);
 
-	for (int y = 0; y < frameBuffer.getWindowHeight(); ++y) {
-		for (int x = 0; x < frameBuffer.getWindowWidth(); ++x) {
-			DEBUG_PIXEL = (x == xDebug && y == yDebug);
-			if (DEBUG_PIXEL) {
-				cout << "";
+	const bool caching = temporalCacheEnabled && N == 1 && !checkpoint.isEnabled();
+	CacheReuse reuse = caching ? beginCachedFrame(frameBuffer, depth, theScene) : CacheReuse::NONE;
+
+	if (checkpoint.isEnabled()) {
+		traceCheckpointedTiles(frameBuffer, theScene, depth, N);
+	} else if (wavefrontEnabled && N == 1 && !caching) {
+		for (int y0 = 0; y0 < frameBuffer.getWindowHeight(); y0 += WAVEFRONT_TILE_SIZE) {
+			for (int x0 = 0; x0 < width; x0 += WAVEFRONT_TILE_SIZE) {
+				traceWavefrontTile(frameBuffer, x0, y0, theScene, depth);
 			}
-			/* CSE 386 - todo  */
-			Ray ray = theScene.camera->getRay(x, y);
+		}
+	} else {
+		for (int y = 0; y < frameBuffer.getWindowHeight(); ++y) {
+			for (int x = 0; x < width; ++x) {
+				SET_DEBUG_PIXEL(x, y);
+				if (DEBUG_PIXEL) {
+					cout << "";		// A place for a breakpoint. Compiled out of release builds.
+				}
+				/* CSE 386 - todo  */
+
+				// Check N, if more than 1 do it the new way, otherwise do it the normal way
+				if (N > 1) {
 
-			// Check N, if more than 1 do it the new way, otherwise do it the normal way
-			if (N > 1) {
+					vector<Ray> rays = theScene.camera->getRaysAA(x, y, N);
 
-				vector<Ray> rays = theScene.camera->getRaysAA(x, y, N);
+					color colorForPixel = black;
 
-				color colorForPixel = black;
+					for (auto& ray : rays) {
 
-				for (auto& ray : rays) {
+						color sample = traceIndividualRay(ray, theScene, depth);
+						if (accumulating) {
+							frameBuffer.accumulate(x, y, sample);
+						}
+						colorForPixel += sample;
+					}
 
-					colorForPixel += traceIndividualRay(ray, theScene, depth);
-					frameBuffer.showAxes(x, y, ray, 0.25);
+					row[x] = colorForPixel / (double)rays.size();
+				}
+				else {
+
+					Ray ray = theScene.camera->getRay(x, y);
+					row[x] = caching ? traceCachedPixel(x, y, ray, theScene, depth, reuse)
+									 : traceIndividualRay(ray, theScene, depth);
+					if (accumulating) {
+						frameBuffer.accumulate(x, y, row[x]);
+					}
 				}
 
-				colorForPixel /= rays.size();
-				frameBuffer.setColor(x, y, colorForPixel);
+				//OpaqueHitRecord hit;
+				//VisibleIShape::findIntersection(ray, theScene.opaqueObjs, hit);
+				//double val = hit.t;
 			}
-			else {
+			if (!accumulating) {
+				frameBuffer.setSpan(0, y, width, row.data());
+			}
+		}
+	}
+
+	finishFrame(frameBuffer, theScene);
+
+	//frameBuffer.showColorBuffer();
+}
+
+/**
+ * @fn	void RayTracer::beginFrame(const IScene &theScene, int depth)
+ * @brief	Prepares to trace a frame. With irradianceCachingEnabled, the irradiance
+ * 			cache is cleared if the lights or geometry changed since the last frame that
+ * 			used it. The first frame keeps whatever it holds, so that a cache loaded from
+ * 			disk is used; load has already checked that it was saved for this scene. With causticsEnabled, the photon map is rebuilt if it is empty
+ * 			or the lights or geometry changed since it was built.
+ * @param	theScene	The scene.
+ * @param	depth   	The recursion depth.
+ */
+
+void RayTracer::beginFrame(const IScene& theScene, int depth) {
+	this->initialRecursionDepth = depth;
+
+	if (irradianceCachingEnabled) {
+		vector<double> lighting = lightingState(theScene);
+		if (irradianceGeometryVersion >= 0 && (lighting != irradianceLighting ||
+			theScene.geometryVersion != irradianceGeometryVersion)) {
+			irradianceCache.clear();
+		}
+		irradianceLighting = lighting;
+		irradianceGeometryVersion = theScene.geometryVersion;
+	}
+
+	if (causticsEnabled) {
+		vector<double> lighting = lightingState(theScene);
+		if (photonMap.size() == 0 || lighting != photonLighting ||
+			theScene.geometryVersion != photonGeometryVersion) {
+			photonMap.build(theScene);
+		}
+		photonLighting = lighting;
+		photonGeometryVersion = theScene.geometryVersion;
+	}
+}
+
+/**
+ * @fn	void RayTracer::finishFrame(FrameBuffer &frameBuffer, const IScene &theScene)
+ * @brief	Resolves the accumulation buffer, if it is enabled, filters the image with
+ * 			denoiser if denoisingEnabled is set, and draws the overlays.
+ * @param [in,out]	frameBuffer	Framebuffer, holding the traced frame.
+ * @param 		  	theScene   	The scene.
+ */
+
+void RayTracer::finishFrame(FrameBuffer& frameBuffer, const IScene& theScene) {
+	frameBuffer.resolveAccumulationBuffer();
+	if (denoisingEnabled) {
+		denoiser.gatherGuides(theScene, frameBuffer.getWindowWidth(), frameBuffer.getWindowHeight());
+		denoiser.denoise(frameBuffer);
+	}
+	drawOverlays(frameBuffer, theScene);
+}
+
+/**
+ * @fn	void RayTracer::raytraceTile(vector<color> &colors, int x0, int y0, int x1, int y1, const IScene &theScene, int depth, int N)
+ * @brief	Traces the pixels of one rectangle of the image, without a framebuffer, so
+ * 			that the image can be divided among processes. The frame is prepared by
+ * 			beginFrame, as by raytraceScene. The temporal cache is not used.
+ * @param [out]	colors  	The colors of the rectangle, row by row, from the bottom.
+ * @param 	   	x0			Left column.
+ * @param 	   	y0			Bottom row.
+ * @param 	   	x1			One past the right column.
+ * @param 	   	y1			One past the top row.
+ * @param 	   	theScene	The scene.
+ * @param 	   	depth   	The recursion depth.
+ * @param 	   	N			Rays per pixel in each direction.
+ */
+
+void RayTracer::raytraceTile(vector<color>& colors, int x0, int y0, int x1, int y1,
+	const IScene& theScene, int depth, int N) {
+	beginFrame(theScene, depth);
+
+	if (wavefrontEnabled && N == 1) {
+		vector<Ray> rays;
+		rays.reserve((size_t)(x1 - x0) * (y1 - y0));
+		for (int y = y0; y < y1; ++y) {
+			for (int x = x0; x < x1; ++x) {
+				rays.push_back(theScene.camera->getRay(x, y));
+			}
+		}
+		traceWavefront(rays, theScene, depth, colors);
+		return;
+	}
+
+	colors.clear();
+	colors.reserve((size_t)(x1 - x0) * (y1 - y0));
+	for (int y = y0; y < y1; ++y) {
+		for (int x = x0; x < x1; ++x) {
+			vector<Ray> rays = N > 1 ? theScene.camera->getRaysAA(x, y, N)
+									 : vector<Ray>(1, theScene.camera->getRay(x, y));
+			color colorForPixel = black;
+			for (const Ray& ray : rays) {
+				colorForPixel += traceIndividualRay(ray, theScene, depth);
+			}
+			colors.push_back(colorForPixel / (double)rays.size());
+		}
+	}
+}
+
+/**
+ * @fn	void RayTracer::traceCheckpointedTiles(FrameBuffer &frameBuffer, const IScene &theScene, int depth, int N)
+ * @brief	Traces the image tile by tile, skipping the tiles restored from a checkpoint of
+ * 			the same frame, and saving checkpoints along the way. The checkpoint is
+ * 			deleted once every tile is done.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	theScene   	The scene.
+ * @param 		  	depth	   	The recursion depth.
+ * @param 		  	N		   	Rays per pixel in each direction.
+ */
 
-				Ray ray = theScene.camera->getRay(x, y);
-				color colorForPixel = traceIndividualRay(ray, theScene, depth);
-				frameBuffer.setColor(x, y, colorForPixel);
+void RayTracer::traceCheckpointedTiles(FrameBuffer& frameBuffer, const IScene& theScene, int depth, int N) {
+	// The leading 1 tells these checkpoints from those of other renderers
+	uint64_t key = RenderCheckpoint::sceneKey(theScene, frameBuffer.getWindowWidth(),
+		frameBuffer.getWindowHeight(), { 1.0, (double)depth, (double)N, (double)irradianceCachingEnabled,
+		(double)causticsEnabled, (double)frameBuffer.isAccumulationEnabled(),
+		(double)(wavefrontEnabled && fastShadingEnabled) });
+	checkpoint.begin(frameBuffer, key);
+
+	const vector<RenderTile>& tiles = checkpoint.getTiles();
+	vector<color> colors;
+	for (int i = 0; i < (int)tiles.size(); i++) {
+		if (!checkpoint.isTileDone(i)) {
+			const RenderTile& tile = tiles[i];
+			raytraceTile(colors, tile.x0, tile.y0, tile.x1, tile.y1, theScene, depth, N);
+			storeTile(frameBuffer, tile, colors, N > 1 ? N * N : 1);
+			checkpoint.tileDone(frameBuffer, i);
+		}
+	}
+	checkpoint.finish();
+}
+
+/**
+ * @fn	void RayTracer::traceWavefrontTile(FrameBuffer &frameBuffer, int x0, int y0, const IScene &theScene, int depth) const
+ * @brief	Traces one tile of the image as a wavefront, and writes it to the framebuffer.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	x0		   	Left column of the tile.
+ * @param 		  	y0		   	Bottom row of the tile.
+ * @param 		  	theScene   	The scene.
+ * @param 		  	depth	   	The recursion depth.
+ */
+
+void RayTracer::traceWavefrontTile(FrameBuffer& frameBuffer, int x0, int y0,
+	const IScene& theScene, int depth) const {
+	const int x1 = std::min(x0 + WAVEFRONT_TILE_SIZE, frameBuffer.getWindowWidth());
+	const int y1 = std::min(y0 + WAVEFRONT_TILE_SIZE, frameBuffer.getWindowHeight());
+	const int tileWidth = x1 - x0;
+
+	vector<Ray> rays;
+	rays.reserve((size_t)tileWidth * (y1 - y0));
+	for (int y = y0; y < y1; ++y) {
+		for (int x = x0; x < x1; ++x) {
+			rays.push_back(theScene.camera->getRay(x, y));
+		}
+	}
+
+	vector<color> colors;
+	traceWavefront(rays, theScene, depth, colors);
+
+	for (int y = y0; y < y1; ++y) {
+		const color* row = &colors[(size_t)(y - y0) * tileWidth];
+		if (frameBuffer.isAccumulationEnabled()) {
+			for (int x = x0; x < x1; ++x) {
+				frameBuffer.accumulate(x, y, row[x - x0]);
 			}
+		} else {
+			frameBuffer.setSpan(x0, y, tileWidth, row);
+		}
+	}
+}
 
-			frameBuffer.showAxes(x, y, ray, 0.25);	// Displays R/x, G/y, B/z axes
+/**
+ * @fn	void RayTracer::traceWavefront(const vector<Ray> &primaryRays, const IScene &theScene, int depth, vector<color> &colors) const
+ * @brief	Traces a batch of rays breadth-first. Each pass intersects every ray in the
+ * 			current wave, lights all the opaque surfaces they hit with one call to
+ * 			shadeBatch, then shades each ray, and collects the secondary rays they spawn into
+ * 			the next wave, which is sorted before it is traced. Every ray's node is kept,
+ * 			and once no rays remain the colors are combined from the leaves up. Gives
+ * 			exactly the same colors as traceIndividualRay, unless fastShadingEnabled.
+ * @param 		  	primaryRays	The rays to trace.
+ * @param 		  	theScene   	The scene.
+ * @param 		  	depth	   	The recursion depth.
+ * @param [in,out]	colors	   	On return, the color seen along each primary ray.
+ */
+
+void RayTracer::traceWavefront(const vector<Ray>& primaryRays, const IScene& theScene, int depth,
+	vector<color>& colors) const {
+	vector<RayTreeNode> nodes(primaryRays.size());
+	vector<int> parents(primaryRays.size(), -1);
+
+	vector<WavefrontRay> wave, nextWave;
+	wave.reserve(primaryRays.size());
+	for (size_t i = 0; i < primaryRays.size(); i++) {
+		wave.push_back(WavefrontRay(primaryRays[i], depth, (int)i));
+	}
 
-			//OpaqueHitRecord hit;
-			//VisibleIShape::findIntersection(ray, theScene.opaqueObjs, hit);
-			//double val = hit.t;
+	// Primary rays are already coherent, in scanline order. Sort the rest.
+	vector<OpaqueHitRecord> hits;
+	vector<TransparentHitRecord> transHits;
+	vector<int> batchIndices;
+	ShadingBatch batch;
+	while (!wave.empty()) {
+		// Intersect the whole wave, and light the opaque surfaces it hit together
+		hits.assign(wave.size(), OpaqueHitRecord());
+		transHits.assign(wave.size(), TransparentHitRecord());
+		batchIndices.assign(wave.size(), -1);
+		batch.clear();
+		vector<int> objectMaterials(theScene.opaqueObjs.size(), -1);
+		for (size_t k = 0; k < wave.size(); k++) {
+			const int object = theScene.findIntersection(wave[k].ray, hits[k]);
+			theScene.findIntersection(wave[k].ray, transHits[k]);
+			if (hits[k].t < transHits[k].t && hits[k].t != FLT_MAX) {
+				// Hits on the same object usually share a material, unless it is textured
+				const Material mat = surfaceMaterial(hits[k]);
+				int& materialID = objectMaterials[object];
+				if (materialID < 0 || batch.materials[materialID] != mat) {
+					materialID = batch.addMaterial(mat);
+				}
+				batchIndices[k] = batch.addHit(hits[k].interceptPt, hits[k].normal, materialID, wave[k].ray.time);
+			}
 		}
+		shadeBatch(batch, theScene, fastShadingEnabled);
+
+		for (size_t k = 0; k < wave.size(); k++) {
+			const WavefrontRay& w = wave[k];
+			color directLight = batchIndices[k] >= 0 ? batch.getColor(batchIndices[k]) : black;
+			nodes[w.node] = shadeSurface(w.ray, theScene, w.level, hits[k], transHits[k],
+				batchIndices[k] >= 0 ? &directLight : nullptr);
+
+			for (int i = 0; i < nodes[w.node].numSecondary; i++) {
+				const RayTreeNode& node = nodes[w.node];
+				Ray secondaryRay(node.origins[i], node.dirs[i], w.ray.time);
+				nextWave.push_back(WavefrontRay(secondaryRay, node.levels[i], (int)nodes.size()));
+				nodes.push_back(RayTreeNode());
+				parents.push_back(2 * w.node + i);
+			}
+		}
+		wave.swap(nextWave);
+		nextWave.clear();
+		sortWavefront(wave);
 	}
 
-	//frameBuffer.showColorBuffer();
+	// Children always come after their parents, so one backward pass resolves them.
+	vector<color> secondary(2 * nodes.size(), black);
+	for (int n = (int)nodes.size() - 1; n >= (int)primaryRays.size(); n--) {
+		secondary[parents[n]] = nodes[n].resolve(secondary[2 * n], secondary[2 * n + 1]);
+	}
+	colors.resize(primaryRays.size());
+	for (size_t n = 0; n < primaryRays.size(); n++) {
+		colors[n] = nodes[n].resolve(secondary[2 * n], secondary[2 * n + 1]);
+	}
+}
+
+/**
+ * @fn	static uint64_t spreadBits(uint64_t v)
+ * @brief	Spreads the low WAVEFRONT_ORIGIN_BITS bits of v out to every third bit, for
+ * 			interleaving into a Morton code.
+ * @param	v	The value.
+ * @return	The spread bits.
+ */
+
+static uint64_t spreadBits(uint64_t v) {
+	uint64_t result = 0;
+	for (int b = 0; b < WAVEFRONT_ORIGIN_BITS; b++) {
+		result |= ((v >> b) & 1) << (3 * b);
+	}
+	return result;
 }
 
 /**
- * @fn	static double fresnel(const dvec3& i, const dvec3& n, const double& etai, const double& etat)
+ * @fn	void RayTracer::sortWavefront(vector<WavefrontRay> &wave)
+ * @brief	Orders a wave of rays so that similar rays are traced together. Rays are
+ * 			binned first by the octant of their direction, and then by the cell of a
+ * 			grid over the wave's bounds that holds their origin, cells being visited
+ * 			in Morton order. Ties keep their original order.
+ * @param [in,out]	wave	The rays.
+ */
+
+void RayTracer::sortWavefront(vector<WavefrontRay>& wave) {
+	AABB box;
+	for (const WavefrontRay& w : wave) {
+		box.expand(w.ray.origin);
+	}
+	const double cells = (double)(1 << WAVEFRONT_ORIGIN_BITS);
+	const dvec3 extent = glm::max(box.extent(), dvec3(EPSILON));
+	for (WavefrontRay& w : wave) {
+		uint64_t octant = (w.ray.dir.x < 0 ? 1 : 0) | (w.ray.dir.y < 0 ? 2 : 0) | (w.ray.dir.z < 0 ? 4 : 0);
+		dvec3 cell = glm::clamp((w.ray.origin - box.lo) / extent * cells, 0.0, cells - 1.0);
+		w.key = (octant << (3 * WAVEFRONT_ORIGIN_BITS)) |
+			(spreadBits((uint64_t)cell.x) << 2) | (spreadBits((uint64_t)cell.y) << 1) | spreadBits((uint64_t)cell.z);
+	}
+	std::stable_sort(wave.begin(), wave.end(),
+		[](const WavefrontRay& a, const WavefrontRay& b) { return a.key < b.key; });
+}
+
+/**
+ * @fn	static bool sameView(const RaytracingCamera &a, const RaytracingCamera &b)
+ * @brief	Determines if two cameras generate the same rays. Rays vary linearly across
+ * 			the image, so comparing the corners is enough.
+ * @param	a	A camera.
+ * @param	b	Another camera.
+ * @return	True iff the cameras are interchangeable.
+ */
+
+static bool sameView(const RaytracingCamera& a, const RaytracingCamera& b) {
+	if (a.getNX() != b.getNX() || a.getNY() != b.getNY()) {
+		return false;
+	}
+	const double xs[] = { 0, a.getNX() - 1.0 };
+	const double ys[] = { 0, a.getNY() - 1.0 };
+	for (double x : xs) {
+		for (double y : ys) {
+			Ray rayA = a.getRay(x, y);
+			Ray rayB = b.getRay(x, y);
+			if (rayA.origin != rayB.origin || rayA.dir != rayB.dir) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * @fn	void RayTracer::invalidateTemporalCache()
+ * @brief	Forces the next frame to be traced from scratch.
+ */
+
+void RayTracer::invalidateTemporalCache() {
+	primaryHits.clear();
+	previousHits.clear();
+	cachedCamera.reset();
+	previousCamera.reset();
+}
+
+/**
+ * @fn	CacheReuse RayTracer::beginCachedFrame(const FrameBuffer &frameBuffer, int depth, const IScene &theScene)
+ * @brief	Compares this frame with the one in the cache, and records this frame's
+ * 			camera, lights and geometry for next time.
+ * @param	frameBuffer	Framebuffer.
+ * @param	depth	   	The recursion depth.
+ * @param	theScene   	The scene.
+ * @return	How much of the cached frame can be reused.
+ */
+
+CacheReuse RayTracer::beginCachedFrame(const FrameBuffer& frameBuffer, int depth, const IScene& theScene) {
+	const size_t numPixels = (size_t)frameBuffer.getWindowWidth() * frameBuffer.getWindowHeight();
+	vector<double> lighting = lightingState(theScene);
+	CacheReuse reuse = CacheReuse::NONE;
+
+	if (cachedCamera != nullptr && primaryHits.size() == numPixels &&
+		cachedGeometryVersion == theScene.geometryVersion && cachedDepth == depth) {
+		if (sameView(*cachedCamera, *theScene.camera)) {
+			reuse = lighting == cachedLighting ? CacheReuse::SHADING : CacheReuse::VISIBILITY;
+		} else if (reprojectionEnabled && lighting == cachedLighting) {
+			reuse = CacheReuse::REPROJECTION;
+			primaryHits.swap(previousHits);
+			previousCamera = std::move(cachedCamera);
+		}
+	}
+	if (reuse != CacheReuse::REPROJECTION) {
+		previousHits.clear();
+		previousCamera.reset();
+	}
+
+	primaryHits.resize(numPixels);
+	cachedCamera.reset(theScene.camera->clone());
+	cachedLighting = lighting;
+	cachedGeometryVersion = theScene.geometryVersion;
+	cachedDepth = depth;
+	cacheStats = TemporalCacheStats();
+	return reuse;
+}
+
+/**
+ * @fn	color RayTracer::traceCachedPixel(int x, int y, const Ray &ray, const IScene &theScene, int depth, CacheReuse reuse)
+ * @brief	Produces one pixel, reusing as much of the cached frame as allowed, and
+ * 			stores what was hit for the next frame.
+ * @param	x			The x coordinate.
+ * @param	y			The y coordinate.
+ * @param	ray			The primary ray through the pixel.
+ * @param	theScene	The scene.
+ * @param	depth		The recursion depth.
+ * @param	reuse   	What may be reused, from beginCachedFrame.
+ * @return	The color of the pixel.
+ */
+
+color RayTracer::traceCachedPixel(int x, int y, const Ray& ray, const IScene& theScene, int depth,
+	CacheReuse reuse) {
+	const int width = theScene.camera->getNX();
+	PrimaryHit& cached = primaryHits[y * width + x];
+	OpaqueHitRecord theHit;
+	TransparentHitRecord transHit;
+
+	if (reuse == CacheReuse::SHADING) {
+		cacheStats.reused++;
+		return cached.shade;
+	}
+
+	if (reuse == CacheReuse::VISIBILITY) {
+		if (cached.opaqueIndex >= 0) {
+			const VisibleIShapePtr obj = theScene.opaqueObjs[cached.opaqueIndex];
+			theHit.t = cached.t;
+			theHit.interceptPt = cached.interceptPt;
+			theHit.normal = cached.normal;
+			theHit.material = obj->material;
+			theHit.texture = obj->texture;
+			theHit.u = cached.u;
+			theHit.v = cached.v;
+			theHit.rayStatus = cached.rayStatus;
+		}
+		if (cached.transparentIndex >= 0) {
+			const TransparentIShapePtr obj = theScene.transparentObjs[cached.transparentIndex];
+			transHit.t = cached.transparentT;
+			transHit.interceptPt = cached.transparentPt;
+			transHit.transColor = obj->c;
+			transHit.alpha = obj->alpha;
+		}
+		cacheStats.reshaded++;
+		cached.shade = shadeHit(ray, theScene, depth, theHit, transHit);
+		return cached.shade;
+	}
+
+	PrimaryHit fresh;
+	fresh.opaqueIndex = theScene.findIntersection(ray, theHit);
+	fresh.transparentIndex = theScene.findIntersection(ray, transHit);
+	fresh.t = theHit.t;
+	fresh.interceptPt = theHit.interceptPt;
+	fresh.normal = theHit.normal;
+	fresh.u = theHit.u;
+	fresh.v = theHit.v;
+	fresh.rayStatus = theHit.rayStatus;
+	fresh.transparentT = transHit.t;
+	fresh.transparentPt = transHit.interceptPt;
+
+	dvec2 previousPixel;
+	if (reuse == CacheReuse::REPROJECTION && fresh.opaqueIndex >= 0 && theHit.t < transHit.t &&
+		previousCamera->projectToPixel(theHit.interceptPt, previousPixel) &&
+		inRangeExclusive(previousPixel.x, -0.5, previousCamera->getNX() - 0.5) &&
+		inRangeExclusive(previousPixel.y, -0.5, previousCamera->getNY() - 0.5)) {
+		int px = (int)std::round(previousPixel.x);
+		int py = (int)std::round(previousPixel.y);
+		const PrimaryHit& old = previousHits[py * width + px];
+		if (old.opaqueIndex == fresh.opaqueIndex && old.t < old.transparentT &&
+			glm::distance(old.interceptPt, fresh.interceptPt) <= REPROJECTION_TOLERANCE * theHit.t) {
+			fresh.shade = old.shade;
+			cacheStats.reprojected++;
+			cached = fresh;
+			return cached.shade;
+		}
+	}
+
+	cacheStats.traced++;
+	fresh.shade = shadeHit(ray, theScene, depth, theHit, transHit);
+	cached = fresh;
+	return cached.shade;
+}
+
+/**
+ * @fn	void RayTracer::drawOverlays(FrameBuffer &frameBuffer, const IScene &theScene) const
+ * @brief	Draws the debugging overlays over a finished image: the R/x, G/y, B/z axes,
+ * 			if showAxes is set. Kept out of the tracing loop so that it costs nothing
+ * 			when turned off.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	theScene   	The scene.
+ */
+
+void RayTracer::drawOverlays(FrameBuffer& frameBuffer, const IScene& theScene) const {
+	if (!showAxes) {
+		return;
+	}
+	for (int y = 0; y < frameBuffer.getWindowHeight(); ++y) {
+		for (int x = 0; x < frameBuffer.getWindowWidth(); ++x) {
+			frameBuffer.showAxes(x, y, theScene.camera->getRay(x, y), 0.25);
+		}
+	}
+}
+
+/**
+ * @fn	double fresnel(const dvec3& i, const dvec3& n, const double& etai, const double& etat)
  *
  * @brief	Compute Fresnel equation
  *
@@ -97,7 +635,7 @@ void RayTracer::raytraceScene(FrameBuffer& frameBuffer, int depth,
  * 			https://www.cs.cornell.edu/courses/cs4620/2012fa/lectures/36raytracing.pdf
  */
 
-static double fresnel(const dvec3& i, const dvec3& n, const double& etai, const double& etat)
+double fresnel(const dvec3& i, const dvec3& n, const double& etai, const double& etat)
 {
 	// Percentage of light that is reflected
 	// Percentage of light that is refracted is equal to 1-kr
@@ -146,9 +684,81 @@ color RayTracer::traceIndividualRay(const Ray& ray, const IScene& theScene, int
 	TransparentHitRecord transHit;	// Check for transparent objects
 
 	// Check ray for intersection against all the shapes to find the closest 
-	VisibleIShape::findIntersection(ray, theScene.opaqueObjs, theHit);
-	TransparentIShape::findIntersection(ray, theScene.transparentObjs, transHit);
+	theScene.findIntersection(ray, theHit);
+	theScene.findIntersection(ray, transHit);
 
+	return shadeHit(ray, theScene, recursionLevel, theHit, transHit);
+}
+
+/**
+ * @fn	color RayTracer::shadeHit(const Ray &ray, const IScene &theScene, int recursionLevel,
+ *									OpaqueHitRecord theHit, const TransparentHitRecord &transHit) const
+ * @brief	Computes the color seen along a ray, given the closest opaque and transparent
+ * 			objects it hits. Secondary rays are traced depth-first, right away.
+ * @param	ray			  	The ray.
+ * @param	theScene	  	The scene.
+ * @param	recursionLevel	The recursion level.
+ * @param	theHit		  	The closest opaque hit. t == FLT_MAX ==> none.
+ * @param	transHit	  	The closest transparent hit. t == FLT_MAX ==> none.
+ * @return	The color to be displayed as a result of this ray.
+ */
+
+color RayTracer::shadeHit(const Ray& ray, const IScene& theScene, int recursionLevel,
+	OpaqueHitRecord theHit, const TransparentHitRecord& transHit) const {
+
+	RayTreeNode node = shadeSurface(ray, theScene, recursionLevel, theHit, transHit);
+
+	color secondary[2] = { black, black };
+	for (int i = 0; i < node.numSecondary; i++) {
+		Ray secondaryRay(node.origins[i], node.dirs[i], ray.time);
+		secondary[i] = traceIndividualRay(secondaryRay, theScene, node.levels[i]);
+	}
+	return node.resolve(secondary[0], secondary[1]);
+}
+
+/**
+ * @fn	Material RayTracer::surfaceMaterial(const OpaqueHitRecord &theHit)
+ * @brief	The material lit at an opaque hit: the object's material, with its ambient
+ * 			and diffuse colors taken from the texture, if it has one.
+ * @param	theHit	The hit.
+ * @return	The material.
+ */
+
+Material RayTracer::surfaceMaterial(const OpaqueHitRecord& theHit) {
+	Material mat = theHit.material;
+
+	if (theHit.texture != nullptr) {
+
+		color texel = theHit.texture->getPixelUV(theHit.u, theHit.v);
+
+		mat.ambient = 0.15 * texel;
+		mat.diffuse = texel;
+	}
+	return mat;
+}
+
+/**
+ * @fn	RayTreeNode RayTracer::shadeSurface(const Ray &ray, const IScene &theScene, int recursionLevel,
+ *											OpaqueHitRecord theHit, const TransparentHitRecord &transHit,
+ *											const color *directLight) const
+ * @brief	Computes the light reflected directly along a ray, given the closest opaque
+ * 			and transparent objects it hits, and determines the reflected and refracted
+ * 			rays it spawns. Shadow feelers are traced from here; secondary rays are
+ * 			left to the caller.
+ * @param	ray			  	The ray.
+ * @param	theScene	  	The scene.
+ * @param	recursionLevel	The recursion level.
+ * @param	theHit		  	The closest opaque hit. t == FLT_MAX ==> none.
+ * @param	transHit	  	The closest transparent hit. t == FLT_MAX ==> none.
+ * @param	directLight   	If not null, the light the opaque hit reflects directly
+ * 							toward the ray's origin, already worked out by shadeBatch.
+ * @return	The node of the ray tree for this ray.
+ */
+
+RayTreeNode RayTracer::shadeSurface(const Ray& ray, const IScene& theScene, int recursionLevel,
+	OpaqueHitRecord theHit, const TransparentHitRecord& transHit, const color* directLight) const {
+
+	RayTreeNode node;
 
 	// Check which hit was first
 	bool hitOpaque = (theHit.t < transHit.t);
@@ -159,25 +769,35 @@ color RayTracer::traceIndividualRay(const Ray& ray, const IScene& theScene, int
 
 		color totalColor = black;	// Could be initialized to hit.material.emissive
 
-		if (theHit.texture != nullptr) {
+		theHit.material = surfaceMaterial(theHit);
 
-			color texel = theHit.texture->getPixelUV(theHit.u, theHit.v);
+		if (directLight != nullptr) {
+			totalColor = *directLight;
+		} else {
+			for (auto& light : theScene.lights) {
 
-			theHit.material.ambient = 0.15 * texel;
-			theHit.material.diffuse = texel;
-		}
+				bool inShadow = light->pointIsInAShadow(theHit.interceptPt, theHit.normal,
+					theScene, theScene.camera->getFrame(), ray.time);
 
-		for (auto& light : theScene.lights) {
+				color c = light->illuminate(theHit.interceptPt, theHit.normal,
+					theHit.material, theScene.camera->getFrame(), inShadow);
 
-			bool inShadow = light->pointIsInAShadow(theHit.interceptPt, theHit.normal,
-				theScene.opaqueObjs, theScene.camera->getFrame());
+				totalColor += c;
+			}
+		}
 
-			color c = light->illuminate(theHit.interceptPt, theHit.normal,
-				theHit.material, theScene.camera->getFrame(), inShadow);
+		if (irradianceCachingEnabled && !theHit.material.isDielectric) {
+			color irradiance = irradianceCache.getIrradiance(theHit.interceptPt, theHit.normal, theScene);
+			totalColor += theHit.material.diffuse * irradiance / PI;
+		}
 
-			totalColor += c;
+		if (causticsEnabled && !theHit.material.isDielectric) {
+			color irradiance = photonMap.irradiance(theHit.interceptPt, theHit.normal);
+			totalColor += theHit.material.diffuse * irradiance / PI;
 		}
 
+		node.base = totalColor;
+
 		if (recursionLevel > 0) {
 
 			// ********** Reflection and Refraction **************** 
@@ -197,7 +817,14 @@ color RayTracer::traceIndividualRay(const Ray& ray, const IScene& theScene, int
 				}
 
 				// Calculate the percentage of reflected light
-				double kr = fresnel(ray.dir, theHit.normal, etat, etai);
+				double kr = fresnel(ray.dir, theHit.normal, etai, etat);
+
+				// A zero refraction vector means total internal reflection, which fresnel
+				// can miss by a rounding error at the critical angle
+				dvec3 refracted = glm::refract(ray.dir, theHit.normal, etai / etat);
+				if (refracted == dvec3(0.0)) {
+					kr = 1.0;
+				}
 
 				// Calculate the percentage of refracted (transmitted light) to reflected light
 				double kt = (1.0 - kr);
@@ -207,20 +834,24 @@ color RayTracer::traceIndividualRay(const Ray& ray, const IScene& theScene, int
 
 				// Create reflection ray
 				// Avoid "surface acne"
-				Ray reflectRay(theHit.interceptPt + EPSILON * theHit.normal, reflection);
-
-				totalColor += kr * traceIndividualRay(reflectRay, theScene, recursionLevel - 1);
+				node.origins[0] = theHit.interceptPt + EPSILON * theHit.normal;
+				node.dirs[0] = reflection;
+				node.weights[0] = kr;
+				node.levels[0] = recursionLevel - 1;
+				node.numSecondary = 1;
 
 				// Check that this is not a case of total reflection
 				if (kr < 1.0) {
 
-					dvec3 refraction = glm::normalize(glm::refract(ray.dir, theHit.normal, etat / etai));
+					dvec3 refraction = glm::normalize(refracted);
 
 					// Create the refracted ray
 					// Avoid "surface acne"
-					Ray refractRay = Ray(theHit.interceptPt + EPSILON * -theHit.normal, refraction);
-
-					totalColor += kt * traceIndividualRay(refractRay, theScene, recursionLevel - 1);
+					node.origins[1] = theHit.interceptPt + EPSILON * -theHit.normal;
+					node.dirs[1] = refraction;
+					node.weights[1] = kt;
+					node.levels[1] = recursionLevel - 1;
+					node.numSecondary = 2;
 				}
 			}
 			else {
@@ -233,48 +864,72 @@ color RayTracer::traceIndividualRay(const Ray& ray, const IScene& theScene, int
 
 				// Create reflection ray
 				// Avoid "surface acne"
-				Ray reflectionRay(theHit.interceptPt + EPSILON * theHit.normal, reflection);
-
-				// Trace the reflection ray
-				totalColor += 1.0 / (2.0 * initialRecursionDepth) * traceIndividualRay(reflectionRay, theScene, recursionLevel - 1);
+				node.origins[0] = theHit.interceptPt + EPSILON * theHit.normal;
+				node.dirs[0] = reflection;
+				node.weights[0] = 1.0 / (2.0 * initialRecursionDepth);
+				node.levels[0] = recursionLevel - 1;
+				node.numSecondary = 1;
 
 				if (theHit.material.alpha < 1.0) {
 
-					// Create a ray that is refracted through the material
-					dvec3 refractionDir = ray.dir;
-
-					// Create the refracted ray
-					Ray refractRay(theHit.interceptPt - EPSILON * theHit.normal, refractionDir);
-
-					// Trace the refracted ray
-					color refractColor = traceIndividualRay(refractRay, theScene, recursionLevel);
-
-					// Blend with the illuminated color
-					totalColor = (1.0 - theHit.material.alpha) * totalColor + theHit.material.alpha * refractColor;
+					// Create a ray that is refracted through the material, and
+					// blend what it sees with the illuminated color
+					node.origins[1] = theHit.interceptPt - EPSILON * theHit.normal;
+					node.dirs[1] = ray.dir;
+					node.scale = 1.0 - theHit.material.alpha;
+					node.weights[1] = theHit.material.alpha;
+					node.levels[1] = recursionLevel;
+					node.numSecondary = 2;
 				}
 			}
 		}
-
-		return glm::clamp(totalColor, 0.0, 1.0);
+		else if (theHit.material.alpha < 1.0 && !theHit.material.isDielectric) {
+
+			// No reflections are left, but seeing through the material costs no depth,
+			// so blend what is behind it with the illuminated color
+			node.base = (1.0 - theHit.material.alpha) * totalColor;
+			node.origins[0] = theHit.interceptPt - EPSILON * theHit.normal;
+			node.dirs[0] = ray.dir;
+			node.weights[0] = theHit.material.alpha;
+			node.levels[0] = recursionLevel;
+			node.numSecondary = 1;
+		}
 	}
 	else if (transHit.t < FLT_MAX) {
 
-		// Check if we are hitting a transparent object first
-		if (!hitOpaque && transHit.t < FLT_MAX) {
-
-			dvec3 offsetPt = transHit.interceptPt + EPSILON * ray.dir;
-			Ray refractedRay(offsetPt, ray.dir);
+		// We are hitting a transparent object first. Blend it with what is behind it.
+		node.base = black;
+		node.origins[0] = transHit.interceptPt + EPSILON * ray.dir;
+		node.dirs[0] = ray.dir;
+		node.weights[0] = 1.0 - transHit.alpha;
+		node.levels[0] = recursionLevel - 1;
+		node.numSecondary = 1;
+		node.post = transHit.alpha * transHit.transColor;
+	}
+	else {
 
-			color bgColor = traceIndividualRay(refractedRay, theScene, recursionLevel - 1);
-			color fgColor = transHit.transColor;
+		node.base = defaultColor;
+		node.clampResult = false;
+	}
+	return node;
+}
 
-			color blended = (1.0 - transHit.alpha) * bgColor + transHit.alpha * fgColor;
+/**
+ * @fn	color RayTreeNode::resolve(const color &first, const color &second) const
+ * @brief	Combines the direct light with what the secondary rays see.
+ * @param	first 	Color seen along the first secondary ray. Ignored if there is none.
+ * @param	second	Color seen along the second secondary ray. Ignored if there is none.
+ * @return	The color seen along the ray.
+ */
 
-			return glm::clamp(blended, 0.0, 1.0);
-		}
+color RayTreeNode::resolve(const color& first, const color& second) const {
+	color result = base;
+	if (numSecondary > 0) {
+		result = scale * (result + weights[0] * first);
 	}
-	else {
-
-		return defaultColor;
+	if (numSecondary > 1) {
+		result += weights[1] * second;
 	}
+	result += post;
+	return clampResult ? glm::clamp(result, 0.0, 1.0) : result;
 }
@@ -13,22 +13,173 @@
 #include "framebuffer.h"
 #include "camera.h"
 #include "iscene.h"
+#include "denoiser.h"
+#include "irradiancecache.h"
+#include "photonmap.h"
+#include "checkpoint.h"
+#include "shadingbatch.h"
+
+const double REPROJECTION_TOLERANCE = 0.01;	//!< Largest reprojection error, as a fraction of the distance
+const int WAVEFRONT_TILE_SIZE = 32;			//!< Width and height of the tiles traced as one wavefront
+const int WAVEFRONT_ORIGIN_BITS = 10;		//!< Bits per axis used to bin secondary ray origins
+
+double fresnel(const dvec3& i, const dvec3& n, const double& etai, const double& etat);
+vector<double> lightingState(const IScene& theScene);
+
+/**
+ * @struct	RayTreeNode
+ * @brief	The color seen along one ray, before the rays it spawns are traced. The
+ * 			final color is clamp(scale * (base + weights[0] * secondary[0]) +
+ * 			weights[1] * secondary[1] + post), where secondary[i] is the color seen
+ * 			along the i-th secondary ray. Lets secondary rays be traced depth-first or
+ * 			in breadth-first batches with identical results.
+ */
+
+struct RayTreeNode {
+	color base = black;				//!< Light reflected directly toward the ray's origin
+	double scale = 1.0;				//!< Factor applied to base and the first secondary ray
+	double weights[2] = { 0, 0 };	//!< Weight of each secondary ray
+	color post = black;				//!< Added last, unscaled
+	bool clampResult = true;		//!< False ==> the color is used as is (background)
+	int numSecondary = 0;			//!< Number of secondary rays (0-2)
+	dvec3 origins[2];				//!< Origin of each secondary ray
+	dvec3 dirs[2];					//!< Direction of each secondary ray
+	int levels[2] = { 0, 0 };		//!< Recursion level of each secondary ray
+	color resolve(const color& first, const color& second) const;
+};
+
+/**
+ * @struct	WavefrontRay
+ * @brief	A ray waiting to be traced as part of a wavefront.
+ */
+
+struct WavefrontRay {
+	Ray ray;						//!< The ray
+	int level;						//!< Its recursion level
+	int node;						//!< Index of the RayTreeNode it will fill in
+	uint64_t key;					//!< Sort key: direction octant, then origin cell
+	WavefrontRay(const Ray& ray, int level, int node)
+		: ray(ray), level(level), node(node), key(0) {}
+};
+
+/**
+ * @struct	PrimaryHit
+ * @brief	What the primary ray through one pixel hit, and the color it produced. Kept
+ * 			from one frame to the next, so that visibility, and sometimes shading, can
+ * 			be reused.
+ */
+
+struct PrimaryHit {
+	int opaqueIndex = -1;			//!< Index into IScene::opaqueObjs. -1 ==> nothing hit
+	int transparentIndex = -1;		//!< Index into IScene::transparentObjs. -1 ==> nothing hit
+	double t = FLT_MAX;				//!< Distance to the opaque hit
+	double transparentT = FLT_MAX;	//!< Distance to the transparent hit
+	dvec3 interceptPt;				//!< Opaque hit point
+	dvec3 normal;					//!< Normal at the opaque hit point
+	dvec3 transparentPt;			//!< Transparent hit point
+	double u = 0, v = 0;			//!< Tex coordinates at the opaque hit point
+	RAY_STATUS rayStatus = ENTERING;	//!< Whether the ray entered or left the opaque object
+	color shade;					//!< The pixel's color
+};
+
+/**
+ * @enum	CacheReuse
+ * @brief	How much of the previous frame a new frame can reuse. SHADING: nothing changed.
+ * 			VISIBILITY: only the lights changed. REPROJECTION: only the camera moved.
+ */
+
+enum class CacheReuse { NONE, REPROJECTION, VISIBILITY, SHADING };
+
+/**
+ * @struct	TemporalCacheStats
+ * @brief	Counts of how each pixel of the last frame was produced.
+ */
+
+struct TemporalCacheStats {
+	int reused = 0;			//!< Color copied from the previous frame
+	int reshaded = 0;		//!< Previous primary hit shaded again
+	int reprojected = 0;	//!< Color copied from where the hit point was last frame
+	int traced = 0;			//!< Traced from scratch
+};
 
  /**
   * @struct	RayTracer
-  * @brief	Encapsulates the functionality of a ray tracer.
+  * @brief	Encapsulates the functionality of a ray tracer. Optionally keeps the primary
+  * 		hits of the last frame. If only the lights change, the next frame reuses
+  * 		them and just shades again; if nothing changes, it reuses the colors too.
+  * 		With reprojectionEnabled, frames taken from a moved camera reuse the color
+  * 		of every pixel whose hit point was visible last frame, and trace the rest.
+  * 		Lights, camera and the scene's geometryVersion are compared automatically.
+  * 		Call invalidateTemporalCache after changing materials or textures.
+  * 		With wavefrontEnabled, each tile of pixels is traced breadth-first: all the
+  * 		primary rays, then all the secondary rays they spawn, sorted so that rays
+  * 		leaving from nearby points in similar directions are traced together, and
+  * 		the surfaces each wave hits are lit as one batch by shadeBatch.
+  * 		With denoisingEnabled, each frame is filtered before overlays are drawn.
+  * 		With irradianceCachingEnabled, diffuse surfaces also reflect indirect light,
+  * 		interpolated from irradianceCache. The cache is cleared when the lights or
+  * 		geometry change, but is kept (and can be saved) while the scene is static.
+  * 		With causticsEnabled, diffuse surfaces also reflect the light that reached
+  * 		them through dielectrics, estimated from photonMap. The map is rebuilt
+  * 		before a frame whenever the lights or geometry changed.
+  * 		With checkpoint.filename set, frames are traced tile by tile, and finished
+  * 		tiles are saved as they go, so that an interrupted render can be resumed.
   */
 
 struct RayTracer {
 
 	color defaultColor;			//!< the color to use if no intersection is present.
+	bool showAxes = true;		//!< True ==> the axes are drawn over the image.
+	bool temporalCacheEnabled = false;	//!< True ==> reuse the last frame's primary hits. N == 1 only.
+	bool reprojectionEnabled = false;	//!< True ==> also reuse colors across camera motion (approximate).
+	bool wavefrontEnabled = false;		//!< True ==> trace tiles breadth-first. N == 1, without the cache.
+	bool fastShadingEnabled = false;	//!< True ==> wavefronts use fastPow for highlights (not exact).
+	bool denoisingEnabled = false;		//!< True ==> run denoiser over each finished frame.
+	Denoiser denoiser;					//!< Filters frames when denoisingEnabled is set
+	bool irradianceCachingEnabled = false;	//!< True ==> add one bounce of diffuse indirect light.
+	mutable IrradianceCache irradianceCache;	//!< Indirect irradiance, when irradianceCachingEnabled is set
+	bool causticsEnabled = false;		//!< True ==> add light focused through dielectrics.
+	PhotonMap photonMap;				//!< Caustic photons, when causticsEnabled is set
+	RenderCheckpoint checkpoint;		//!< Saves frames in progress, if its filename is set
+	TemporalCacheStats cacheStats;		//!< How the pixels of the last frame were produced.
 	RayTracer(const color& defaultColor);
 	void raytraceScene(FrameBuffer& frameBuffer, int depth,
 		const IScene& theScene, int N = 1);
+	void raytraceTile(vector<color>& colors, int x0, int y0, int x1, int y1,
+		const IScene& theScene, int depth, int N = 1);
+	void finishFrame(FrameBuffer& frameBuffer, const IScene& theScene);
+	void drawOverlays(FrameBuffer& frameBuffer, const IScene& theScene) const;
+	void invalidateTemporalCache();
 
 
 protected:
 
+	void beginFrame(const IScene& theScene, int depth);
 	color traceIndividualRay(const Ray& ray, const IScene& theScene, int recursionLevel) const;
+	color shadeHit(const Ray& ray, const IScene& theScene, int recursionLevel,
+		OpaqueHitRecord theHit, const TransparentHitRecord& transHit) const;
+	RayTreeNode shadeSurface(const Ray& ray, const IScene& theScene, int recursionLevel,
+		OpaqueHitRecord theHit, const TransparentHitRecord& transHit,
+		const color* directLight = nullptr) const;
+	static Material surfaceMaterial(const OpaqueHitRecord& theHit);
+	void traceCheckpointedTiles(FrameBuffer& frameBuffer, const IScene& theScene, int depth, int N);
+	void traceWavefrontTile(FrameBuffer& frameBuffer, int x0, int y0, const IScene& theScene, int depth) const;
+	void traceWavefront(const vector<Ray>& primaryRays, const IScene& theScene, int depth,
+		vector<color>& colors) const;
+	static void sortWavefront(vector<WavefrontRay>& wave);
+	CacheReuse beginCachedFrame(const FrameBuffer& frameBuffer, int depth, const IScene& theScene);
+	color traceCachedPixel(int x, int y, const Ray& ray, const IScene& theScene, int depth,
+		CacheReuse reuse);
 	int initialRecursionDepth = 0; //!< Depth of the recursion trees for each pixel
+	vector<PrimaryHit> primaryHits;				//!< This frame's primary hits
+	vector<PrimaryHit> previousHits;			//!< Last frame's primary hits, while reprojecting
+	std::unique_ptr<RaytracingCamera> cachedCamera;	//!< Copy of the camera that produced primaryHits
+	std::unique_ptr<RaytracingCamera> previousCamera;	//!< Copy of the camera that produced previousHits
+	vector<double> cachedLighting;				//!< State of the lights that produced primaryHits
+	int cachedGeometryVersion = -1;				//!< IScene::geometryVersion that produced primaryHits
+	int cachedDepth = -1;						//!< Recursion depth that produced primaryHits
+	vector<double> irradianceLighting;			//!< State of the lights that produced irradianceCache
+	int irradianceGeometryVersion = -1;			//!< IScene::geometryVersion that produced irradianceCache
+	vector<double> photonLighting;				//!< State of the lights that produced photonMap
+	int photonGeometryVersion = -1;				//!< IScene::geometryVersion that produced photonMap
 };
\ No newline at end of file
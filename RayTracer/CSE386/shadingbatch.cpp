@@ -0,0 +1,441 @@
+/****************************************************
+ * 2016-2025 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <typeinfo>
+#include "shadingbatch.h"
+#include "iscene.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SHADING_USE_SSE2
+#endif
+
+/**
+ * @fn	int ShadingBatch::addMaterial(const Material &mat)
+ * @brief	Adds a material that hits can refer to.
+ * @param	mat	The material.
+ * @return	Its index in materials.
+ */
+
+int ShadingBatch::addMaterial(const Material& mat) {
+	materials.push_back(mat);
+	return (int)materials.size() - 1;
+}
+
+/**
+ * @fn	int ShadingBatch::addHit(const dvec3 &pt, const dvec3 &n, int materialID, double time)
+ * @brief	Adds a surface point to be lit.
+ * @param	pt		  	The point, in world coordinates.
+ * @param	n		  	The unit normal there.
+ * @param	materialID	Index into materials of the surface's material.
+ * @param	time	  	Time of the ray that hit the surface.
+ * @return	The index of the hit.
+ */
+
+int ShadingBatch::addHit(const dvec3& pt, const dvec3& n, int materialID, double time) {
+	px.push_back(pt.x);
+	py.push_back(pt.y);
+	pz.push_back(pt.z);
+	nx.push_back(n.x);
+	ny.push_back(n.y);
+	nz.push_back(n.z);
+	materialIDs.push_back(materialID);
+	times.push_back(time);
+	return size() - 1;
+}
+
+/**
+ * @fn	void ShadingBatch::clear()
+ * @brief	Removes all the hits and materials, keeping the memory for the next batch.
+ */
+
+void ShadingBatch::clear() {
+	px.clear();
+	py.clear();
+	pz.clear();
+	nx.clear();
+	ny.clear();
+	nz.clear();
+	materialIDs.clear();
+	times.clear();
+	materials.clear();
+	r.clear();
+	g.clear();
+	b.clear();
+}
+
+const double SQRT2 = 1.4142135623730951;	//!< Mantissas above this are halved before taking logs
+const double LOG2_C1 = 2.0 / 0.6931471805599453;	//!< Coefficients of log2(m) in powers of (m - 1) / (m + 1)
+const double LOG2_C3 = LOG2_C1 / 3.0;
+const double LOG2_C5 = LOG2_C1 / 5.0;
+const double LOG2_C7 = LOG2_C1 / 7.0;
+const double EXP2_C[7] = { 1.0, 6.9314718055994531e-1, 2.4022650695910071e-1,
+	5.5504108664821580e-2, 9.6181291076284772e-3, 1.3333558146428443e-3, 1.5403530393381609e-4 };	//!< Taylor series of 2^f
+
+/**
+ * @fn	double fastPow(double x, double y)
+ * @brief	Approximates x^y, for x >= 0, as 2^(y * log2(x)), with short polynomials for
+ * 			log2 and 2^x instead of the library's. The relative error is about 1e-7 * y,
+ * 			which is invisible in an 8-bit image for any reasonable shininess.
+ * @param	x	The base. Values <= 0 give 0 (1 if y is 0).
+ * @param	y	The exponent.
+ * @return	About x^y.
+ */
+
+double fastPow(double x, double y) {
+	if (y == 0.0) {
+		return 1.0;
+	}
+	if (!(x > DBL_MIN)) {
+		return 0.0;
+	}
+	// log2(x) = e + log2(m), with m in [sqrt(1/2), sqrt(2)]
+	uint64_t bits;
+	std::memcpy(&bits, &x, sizeof(bits));
+	double e = (double)(int)(bits >> 52) - 1023.0;
+	bits = (bits & 0x000FFFFFFFFFFFFFull) | 0x3FF0000000000000ull;
+	double m;
+	std::memcpy(&m, &bits, sizeof(m));
+	if (m > SQRT2) {
+		m *= 0.5;
+		e += 1.0;
+	}
+	double s = (m - 1.0) / (m + 1.0);
+	double s2 = s * s;
+	double z = y * (e + s * (LOG2_C1 + s2 * (LOG2_C3 + s2 * (LOG2_C5 + s2 * LOG2_C7))));
+
+	// 2^z = 2^i * 2^f, with i an integer and f in [-1/2, 1/2]
+	z = glm::clamp(z, -1022.0, 1023.0);
+	double i = std::nearbyint(z);
+	double f = z - i;
+	double p = EXP2_C[0] + f * (EXP2_C[1] + f * (EXP2_C[2] + f * (EXP2_C[3] +
+		f * (EXP2_C[4] + f * (EXP2_C[5] + f * EXP2_C[6])))));
+	bits = (uint64_t)((int)i + 1023) << 52;
+	double scale;
+	std::memcpy(&scale, &bits, sizeof(scale));
+	return p * scale;
+}
+
+#ifdef SHADING_USE_SSE2
+
+/**
+ * @struct	Lanes
+ * @brief	The values of one field for Lanes::COUNT neighboring hits: a pair of doubles
+ * 			in an SSE2 register.
+ */
+
+struct Lanes {
+	static const int COUNT = 2;
+	__m128d v;
+	Lanes() : v(_mm_setzero_pd()) {}
+	Lanes(__m128d v) : v(v) {}
+	Lanes(double d) : v(_mm_set1_pd(d)) {}
+	static Lanes load(const double* p) { return _mm_loadu_pd(p); }
+	void store(double* p) const { _mm_storeu_pd(p, v); }
+};
+
+inline Lanes operator +(Lanes a, Lanes b) { return _mm_add_pd(a.v, b.v); }
+inline Lanes operator -(Lanes a, Lanes b) { return _mm_sub_pd(a.v, b.v); }
+inline Lanes operator *(Lanes a, Lanes b) { return _mm_mul_pd(a.v, b.v); }
+inline Lanes operator /(Lanes a, Lanes b) { return _mm_div_pd(a.v, b.v); }
+inline Lanes operator -(Lanes a) { return _mm_xor_pd(a.v, _mm_set1_pd(-0.0)); }
+inline Lanes laneSqrt(Lanes a) { return _mm_sqrt_pd(a.v); }
+inline Lanes laneMax(Lanes a, Lanes b) { return _mm_max_pd(a.v, b.v); }
+inline Lanes laneMin(Lanes a, Lanes b) { return _mm_min_pd(a.v, b.v); }
+inline Lanes laneGreater(Lanes a, Lanes b) { return _mm_cmpgt_pd(a.v, b.v); }
+inline Lanes laneSelect(Lanes mask, Lanes a, Lanes b) {
+	return _mm_or_pd(_mm_and_pd(mask.v, a.v), _mm_andnot_pd(mask.v, b.v));
+}
+
+/**
+ * @fn	static Lanes lanePow(Lanes x, Lanes y, bool fast)
+ * @brief	x^y in each lane: with std::pow, one lane at a time, or with fastPow's
+ * 			approximation, both lanes at once.
+ * @param	x   	The bases.
+ * @param	y   	The exponents.
+ * @param	fast	True ==> approximate.
+ * @return	The powers.
+ */
+
+static Lanes lanePow(Lanes x, Lanes y, bool fast) {
+	if (!fast) {
+		double xs[2], ys[2];
+		x.store(xs);
+		y.store(ys);
+		return _mm_set_pd(std::pow(xs[1], ys[1]), std::pow(xs[0], ys[0]));
+	}
+	const __m128i bits = _mm_castpd_si128(x.v);
+	const __m128i exponents = _mm_shuffle_epi32(_mm_srli_epi64(bits, 52), _MM_SHUFFLE(3, 1, 2, 0));
+	Lanes e = Lanes(_mm_cvtepi32_pd(exponents)) - Lanes(1023.0);
+	Lanes m = _mm_castsi128_pd(_mm_or_si128(
+		_mm_and_si128(bits, _mm_set1_epi64x(0x000FFFFFFFFFFFFFll)), _mm_set1_epi64x(0x3FF0000000000000ll)));
+	Lanes big = laneGreater(m, Lanes(SQRT2));
+	m = laneSelect(big, m * Lanes(0.5), m);
+	e = e + laneSelect(big, Lanes(1.0), Lanes(0.0));
+	Lanes s = (m - Lanes(1.0)) / (m + Lanes(1.0));
+	Lanes s2 = s * s;
+	Lanes z = y * (e + s * (Lanes(LOG2_C1) + s2 * (Lanes(LOG2_C3) + s2 * (Lanes(LOG2_C5) + s2 * Lanes(LOG2_C7)))));
+
+	z = laneMin(laneMax(z, Lanes(-1022.0)), Lanes(1023.0));
+	const __m128i i = _mm_cvtpd_epi32(z.v);
+	Lanes f = z - Lanes(_mm_cvtepi32_pd(i));
+	Lanes p = Lanes(EXP2_C[0]) + f * (Lanes(EXP2_C[1]) + f * (Lanes(EXP2_C[2]) + f * (Lanes(EXP2_C[3]) +
+		f * (Lanes(EXP2_C[4]) + f * (Lanes(EXP2_C[5]) + f * Lanes(EXP2_C[6]))))));
+	const __m128i biased = _mm_unpacklo_epi32(_mm_add_epi32(i, _mm_set1_epi32(1023)), _mm_setzero_si128());
+	Lanes result = p * Lanes(_mm_castsi128_pd(_mm_slli_epi64(biased, 52)));
+
+	result = laneSelect(laneGreater(x, Lanes(DBL_MIN)), result, Lanes(0.0));
+	return laneSelect(_mm_cmpeq_pd(y.v, _mm_setzero_pd()), Lanes(1.0), result);
+}
+
+#else
+
+/**
+ * @struct	Lanes
+ * @brief	The value of one field for one hit, where SSE2 is not available.
+ */
+
+struct Lanes {
+	static const int COUNT = 1;
+	double v;
+	Lanes() : v(0.0) {}
+	Lanes(double v) : v(v) {}
+	static Lanes load(const double* p) { return *p; }
+	void store(double* p) const { *p = v; }
+};
+
+inline Lanes operator +(Lanes a, Lanes b) { return a.v + b.v; }
+inline Lanes operator -(Lanes a, Lanes b) { return a.v - b.v; }
+inline Lanes operator *(Lanes a, Lanes b) { return a.v * b.v; }
+inline Lanes operator /(Lanes a, Lanes b) { return a.v / b.v; }
+inline Lanes operator -(Lanes a) { return -a.v; }
+inline Lanes laneSqrt(Lanes a) { return std::sqrt(a.v); }
+inline Lanes laneMax(Lanes a, Lanes b) { return a.v > b.v ? a.v : b.v; }
+inline Lanes laneMin(Lanes a, Lanes b) { return a.v < b.v ? a.v : b.v; }
+inline Lanes laneGreater(Lanes a, Lanes b) { return a.v > b.v ? 1.0 : 0.0; }
+inline Lanes laneSelect(Lanes mask, Lanes a, Lanes b) { return mask.v != 0.0 ? a : b; }
+
+static Lanes lanePow(Lanes x, Lanes y, bool fast) {
+	return fast ? fastPow(x.v, y.v) : std::pow(x.v, y.v);
+}
+
+#endif
+
+/**
+ * @enum	BatchLightType
+ * @brief	How shadeBatch lights a batch with a light. OTHER: one hit at a time, through
+ * 			LightSource::illuminate.
+ */
+
+enum class BatchLightType { POSITIONAL, SPOT, DIRECTIONAL, OTHER };
+
+/**
+ * @struct	BatchLight
+ * @brief	What shadeBatch needs to know about a light, worked out once per batch.
+ */
+
+struct BatchLight {
+	BatchLightType type;
+	const LightSource* light;	//!< The light
+	dvec3 pos;					//!< Actual position, or direction toward a directional light
+	color lightColor;			//!< Its color
+	double constant = 1.0, linear = 0.0, quadratic = 0.0;	//!< Attenuation, or 1, 0, 0 for none
+	dvec3 spotPos;				//!< Apex of a spotlight's cone
+	dvec3 spotDir;				//!< Axis of a spotlight's cone
+	double spotCutOffCos = 0.0;	//!< Cosine of half a spotlight's field of view
+	vector<double> lit;			//!< 1 ==> the hit is not in the light's shadow
+};
+
+/**
+ * @fn	void shadeBatch(ShadingBatch &batch, const IScene &theScene, bool fastPowEnabled)
+ * @brief	Lights every hit in a batch with all of the scene's lights, seen from the
+ * 			camera, as if by adding up LightSource::illuminate over the lights, shadows
+ * 			included. The hits are processed Lanes::COUNT at a time (two with SSE2),
+ * 			with the lights in the inner loop so that each hit's data is loaded once.
+ * 			Unless fastPowEnabled, the results are exactly those of illuminate.
+ * 			Shadow feelers are still traced one at a time.
+ * @param [in,out]	batch		  	The hits. On return, r, g and b hold their colors.
+ * @param 		  	theScene	  	The scene.
+ * @param 		  	fastPowEnabled	True ==> specular highlights use fastPow.
+ */
+
+void shadeBatch(ShadingBatch& batch, const IScene& theScene, bool fastPowEnabled) {
+	const int count = batch.size();
+	batch.r.assign(count, 0.0);
+	batch.g.assign(count, 0.0);
+	batch.b.assign(count, 0.0);
+	if (count == 0) {
+		return;
+	}
+	const Frame& eyeFrame = theScene.camera->getFrame();
+	const size_t padded = (count + Lanes::COUNT - 1) / Lanes::COUNT * Lanes::COUNT;
+
+	vector<BatchLight> lights;
+	for (const LightSourcePtr light : theScene.lights) {
+		if (!light->isOn) {
+			continue;
+		}
+		BatchLight L;
+		L.light = light;
+		L.lightColor = light->lightColor;
+		const std::type_info& type = typeid(*light);
+		if (type == typeid(DirectionalLight)) {
+			L.type = BatchLightType::DIRECTIONAL;
+			L.pos = glm::normalize(-static_cast<const DirectionalLight*>(light)->dir);
+		} else if (type == typeid(PositionalLight) || type == typeid(SpotLight)) {
+			const PositionalLight* positional = static_cast<const PositionalLight*>(light);
+			L.type = type == typeid(SpotLight) ? BatchLightType::SPOT : BatchLightType::POSITIONAL;
+			L.pos = positional->actualPosition(eyeFrame);
+			if (positional->attenuationIsTurnedOn) {
+				L.constant = positional->atParams.constant;
+				L.linear = positional->atParams.linear;
+				L.quadratic = positional->atParams.quadratic;
+			}
+			if (L.type == BatchLightType::SPOT) {
+				const SpotLight* spot = static_cast<const SpotLight*>(light);
+				L.spotPos = spot->pos;
+				L.spotDir = spot->spotDir;
+				L.spotCutOffCos = glm::cos(spot->fov / 2.0);
+			}
+		} else {
+			L.type = BatchLightType::OTHER;
+		}
+		L.lit.assign(padded, 1.0);
+		for (int i = 0; i < count; i++) {
+			dvec3 pt(batch.px[i], batch.py[i], batch.pz[i]);
+			dvec3 n(batch.nx[i], batch.ny[i], batch.nz[i]);
+			L.lit[i] = light->pointIsInAShadow(pt, n, theScene, eyeFrame, batch.times[i]) ? 0.0 : 1.0;
+		}
+		lights.push_back(L);
+	}
+
+	// Pad the hits to whole sets of lanes with copies of the last one
+	vector<double>* fields[] = { &batch.px, &batch.py, &batch.pz, &batch.nx, &batch.ny, &batch.nz };
+	for (vector<double>* field : fields) {
+		field->resize(padded, field->back());
+	}
+
+	const Lanes zero(0.0), one(1.0), two(2.0);
+	for (size_t i = 0; i < padded; i += Lanes::COUNT) {
+		Lanes p[3], n[3], ambient[3], diffuse[3], specular[3];
+		double values[10][Lanes::COUNT];
+		for (int k = 0; k < Lanes::COUNT; k++) {
+			const Material& mat = batch.materials[batch.materialIDs[std::min(i + k, (size_t)count - 1)]];
+			for (int c = 0; c < 3; c++) {
+				values[c][k] = mat.ambient[c];
+				values[3 + c][k] = mat.diffuse[c];
+				values[6 + c][k] = mat.specular[c];
+			}
+			values[9][k] = mat.shininess;
+		}
+		for (int c = 0; c < 3; c++) {
+			p[c] = Lanes::load(&(*fields[c])[i]);
+			n[c] = Lanes::load(&(*fields[3 + c])[i]);
+			ambient[c] = Lanes::load(values[c]);
+			diffuse[c] = Lanes::load(values[3 + c]);
+			specular[c] = Lanes::load(values[6 + c]);
+		}
+		const Lanes shininess = Lanes::load(values[9]);
+
+		// v = normalize(eye - p)
+		Lanes v[3] = { Lanes(eyeFrame.origin.x) - p[0], Lanes(eyeFrame.origin.y) - p[1], Lanes(eyeFrame.origin.z) - p[2] };
+		const Lanes vInverse = one / laneSqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+		for (Lanes& vc : v) {
+			vc = vc * vInverse;
+		}
+
+		Lanes total[3] = { zero, zero, zero };
+		for (const BatchLight& L : lights) {
+			if (L.type == BatchLightType::OTHER) {
+				for (int k = 0; k < Lanes::COUNT && i + k < (size_t)count; k++) {
+					const int hit = (int)i + k;
+					color c = L.light->illuminate(dvec3(batch.px[hit], batch.py[hit], batch.pz[hit]),
+						dvec3(batch.nx[hit], batch.ny[hit], batch.nz[hit]),
+						batch.materials[batch.materialIDs[hit]], eyeFrame, L.lit[hit] == 0.0);
+					double lanes[3][Lanes::COUNT];
+					for (int c3 = 0; c3 < 3; c3++) {
+						total[c3].store(lanes[c3]);
+						lanes[c3][k] += c[c3];
+						total[c3] = Lanes::load(lanes[c3]);
+					}
+				}
+				continue;
+			}
+
+			// l: unit vector toward the light; distance: how far it is
+			Lanes l[3], distance = zero;
+			if (L.type == BatchLightType::DIRECTIONAL) {
+				l[0] = L.pos.x;
+				l[1] = L.pos.y;
+				l[2] = L.pos.z;
+			} else {
+				l[0] = Lanes(L.pos.x) - p[0];
+				l[1] = Lanes(L.pos.y) - p[1];
+				l[2] = Lanes(L.pos.z) - p[2];
+				distance = laneSqrt(l[0] * l[0] + l[1] * l[1] + l[2] * l[2]);
+				const Lanes lInverse = one / distance;
+				for (Lanes& lc : l) {
+					lc = lc * lInverse;
+				}
+			}
+
+			// r = reflect(-l, n)
+			const Lanes lDotN = l[0] * n[0] + l[1] * n[1] + l[2] * n[2];
+			const Lanes nDotMinusL = -lDotN;
+			Lanes r[3];
+			for (int c = 0; c < 3; c++) {
+				r[c] = -l[c] - n[c] * nDotMinusL * two;
+			}
+			const Lanes rDotV = r[0] * v[0] + r[1] * v[1] + r[2] * v[2];
+			const Lanes diffuseFactor = laneMax(lDotN, zero);
+			const Lanes specularFactor = lanePow(laneMax(rDotV, zero), shininess, fastPowEnabled);
+			const Lanes attenuation = one / (Lanes(L.constant) + Lanes(L.linear) * distance +
+				Lanes(L.quadratic) * distance * distance);
+
+			const Lanes lit = laneGreater(Lanes::load(&L.lit[i]), zero);
+			Lanes inCone = laneGreater(one, zero);
+			if (L.type == BatchLightType::SPOT) {
+				Lanes w[3] = { p[0] - Lanes(L.spotPos.x), p[1] - Lanes(L.spotPos.y), p[2] - Lanes(L.spotPos.z) };
+				const Lanes wInverse = one / laneSqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+				const Lanes spotCos = w[0] * wInverse * Lanes(L.spotDir.x) +
+					w[1] * wInverse * Lanes(L.spotDir.y) + w[2] * wInverse * Lanes(L.spotDir.z);
+				inCone = laneGreater(spotCos, Lanes(L.spotCutOffCos));
+			}
+
+			for (int c = 0; c < 3; c++) {
+				const Lanes lightColor(L.lightColor[c]);
+				const Lanes ambientTerm = ambient[c] * lightColor;
+				const Lanes diffuseTerm = diffuseFactor * diffuse[c] * lightColor;
+				const Lanes specularTerm = lightColor * specular[c] * specularFactor;
+				Lanes sum = L.type == BatchLightType::DIRECTIONAL ?
+					ambientTerm + diffuseTerm + specularTerm :
+					ambientTerm + attenuation * (diffuseTerm + specularTerm);
+				sum = laneSelect(lit, laneMin(sum, one), ambientTerm);
+				total[c] = total[c] + laneSelect(inCone, sum, zero);
+			}
+		}
+
+		double lanes[3][Lanes::COUNT];
+		for (int c = 0; c < 3; c++) {
+			total[c].store(lanes[c]);
+		}
+		for (int k = 0; k < Lanes::COUNT && i + k < (size_t)count; k++) {
+			batch.r[i + k] = lanes[0][k];
+			batch.g[i + k] = lanes[1][k];
+			batch.b[i + k] = lanes[2][k];
+		}
+	}
+	for (vector<double>* field : fields) {
+		field->resize(count);
+	}
+}
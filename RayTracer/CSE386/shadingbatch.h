@@ -0,0 +1,42 @@
+/****************************************************
+ * 2016-2025 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include "utilities.h"
+#include "light.h"
+
+struct IScene;
+
+/**
+ * @struct	ShadingBatch
+ * @brief	Surface points to be lit together by shadeBatch. Stored as a structure of
+ * 			arrays, so that the kernel can load the same field of neighboring hits at
+ * 			once. Each hit refers to one of the batch's own materials by index, so
+ * 			that textured hits can have a material of their own without registering
+ * 			it anywhere.
+ */
+
+struct ShadingBatch {
+	vector<double> px, py, pz;		//!< Hit points, in world coordinates
+	vector<double> nx, ny, nz;		//!< Unit normals at the hit points
+	vector<int> materialIDs;		//!< Index into materials of each hit's material
+	vector<double> times;			//!< Time of the ray that made each hit, for its shadow feelers
+	vector<Material> materials;		//!< The materials the hits refer to
+	vector<double> r, g, b;			//!< Light reflected toward the eye. Filled in by shadeBatch
+
+	int addMaterial(const Material& mat);
+	int addHit(const dvec3& pt, const dvec3& n, int materialID, double time = 0.0);
+	color getColor(int hit) const { return color(r[hit], g[hit], b[hit]); }
+	int size() const { return (int)px.size(); }
+	void clear();
+};
+
+double fastPow(double x, double y);
+void shadeBatch(ShadingBatch& batch, const IScene& theScene, bool fastPowEnabled = false);
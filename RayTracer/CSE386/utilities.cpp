@@ -11,6 +11,11 @@
 #include <istream>
 #include <iomanip>
 #include <cstdlib>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
 
 #include "defs.h"
 #include "framebuffer.h"
@@ -1035,7 +1040,140 @@ string extractBaseFilename(const string& str) {
 	return str.substr(pos + 1);
 }
 
-bool DEBUG_PIXEL = false;
+/**
+ * @fn	int defaultThreadCount()
+ * @brief	The number of worker threads to use for parallel work.
+ * @return	The number of hardware threads, or 1 if that is unknown.
+ */
+
+int defaultThreadCount() {
+	unsigned int N = std::thread::hardware_concurrency();
+	return N == 0 ? 1 : (int)N;
+}
+
+/**
+ * @class	WorkerPool
+ * @brief	Threads that run the work items of parallelFor. Threads are started the first
+ * 			time they are needed and then wait for more work, so that steady-state calls to
+ * 			parallelFor neither create threads nor allocate.
+ */
+
+class WorkerPool {
+public:
+	bool run(int count, void (*body)(const void*, int), const void* context, int numThreads);
+protected:
+	void workerLoop();
+	void work();
+
+	std::mutex mutex;
+	std::condition_variable wake;		//!< Signalled when a new job is posted
+	std::condition_variable done;		//!< Signalled when the last helper leaves a job
+	vector<std::thread> threads;
+	bool busy = false;					//!< True while a job is running
+	unsigned long long generation = 0;	//!< Incremented for every job
+	int slotsLeft = 0;					//!< Number of helpers that may still join the job
+	int active = 0;						//!< Number of helpers working on the job
+
+	void (*body)(const void*, int) = nullptr;
+	const void* context = nullptr;
+	int count = 0;
+	std::atomic<int> next{ 0 };			//!< Next work item to hand out
+};
+
+/**
+ * @fn	void WorkerPool::work()
+ * @brief	Runs work items of the current job until there are none left.
+ */
+
+void WorkerPool::work() {
+	for (int i = next++; i < count; i = next++) {
+		body(context, i);
+	}
+}
+
+/**
+ * @fn	void WorkerPool::workerLoop()
+ * @brief	Body of a pool thread: waits for a job with a free slot, helps with it, repeats.
+ */
+
+void WorkerPool::workerLoop() {
+	unsigned long long seen = 0;
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;) {
+		wake.wait(lock, [&]() { return generation != seen && slotsLeft > 0; });
+		seen = generation;
+		slotsLeft--;
+		active++;
+		lock.unlock();
+		work();
+		lock.lock();
+		if (--active == 0) {
+			done.notify_all();
+		}
+	}
+}
+
+/**
+ * @fn	bool WorkerPool::run(int count, void (*body)(const void*, int), const void* context,
+ *							int numThreads)
+ * @brief	Runs a job using the calling thread plus up to numThreads - 1 pool threads.
+ * @return	False, without doing anything, if the pool is already running a job.
+ */
+
+bool WorkerPool::run(int count, void (*body)(const void*, int), const void* context,
+	int numThreads) {
+	std::unique_lock<std::mutex> lock(mutex);
+	if (busy) {
+		return false;
+	}
+	busy = true;
+	while ((int)threads.size() < numThreads - 1) {
+		threads.push_back(std::thread(&WorkerPool::workerLoop, this));
+	}
+	this->body = body;
+	this->context = context;
+	this->count = count;
+	next = 0;
+	slotsLeft = numThreads - 1;
+	generation++;
+	lock.unlock();
+	wake.notify_all();
+
+	work();
+
+	lock.lock();
+	slotsLeft = 0;
+	done.wait(lock, [&]() { return active == 0; });
+	busy = false;
+	return true;
+}
+
+/**
+ * @fn	void parallelForImpl(int count, void (*body)(const void *context, int i),
+ *							const void *context, int numThreads)
+ * @brief	Type-erased implementation of parallelFor.
+ * @param	count	  	The number of work items.
+ * @param	body	  	Calls the work for item i.
+ * @param	context   	Passed to body.
+ * @param	numThreads	The number of threads to use.
+ */
+
+void parallelForImpl(int count, void (*body)(const void* context, int i),
+	const void* context, int numThreads) {
+	// Never destroyed: its threads wait for work for the life of the program.
+	static WorkerPool* pool = new WorkerPool();
+
+	numThreads = std::min(numThreads, count);
+	if (numThreads <= 1 || !pool->run(count, body, context, numThreads)) {
+		for (int i = 0; i < count; i++) {
+			body(context, i);
+		}
+	}
+}
+
+#ifndef NDEBUG
+thread_local bool DEBUG_PIXEL = false;
+#endif
 int xDebug = -1, yDebug = -1;
 
 void mouseUtility(int b, int s, int x, int y) {
@@ -1067,7 +1205,7 @@ void graphicsInit(int argc, char* argv[], const std::string& windowName, int wid
 #endif
 #ifndef CONSOLE_ONLY
 	glutInit(&argc, argv);
-	glutInitDisplayMode(GLUT_RGB | GLUT_SINGLE);
+	glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE);
 	glutInitWindowSize(width, height);
 	std::string title = username + std::string(" -- ") + extractBaseFilename(windowName);
 	glutCreateWindow(title.c_str());
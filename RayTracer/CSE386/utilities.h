@@ -15,7 +15,15 @@
 #include <string>
 #include "defs.h"
 
-extern bool DEBUG_PIXEL;
+// DEBUG_PIXEL is true while the pixel clicked on with the mouse is being computed.
+// It is compiled out of release builds, where it is always false.
+#ifndef NDEBUG
+extern thread_local bool DEBUG_PIXEL;
+#define SET_DEBUG_PIXEL(x, y) (DEBUG_PIXEL = ((x) == xDebug && (y) == yDebug))
+#else
+const bool DEBUG_PIXEL = false;
+#define SET_DEBUG_PIXEL(x, y) ((void)0)
+#endif
 extern int xDebug, yDebug;
 void mouseUtility(int, int, int, int);
 void keyboardUtility(unsigned char key, int x, int y);
@@ -78,6 +86,29 @@ void computeAzimuthAndElevationFromXYZ(const dvec3& pt,
 
 string extractBaseFilename(const string& str);
 
+int defaultThreadCount();
+void parallelForImpl(int count, void (*body)(const void* context, int i),
+	const void* context, int numThreads);
+
+/**
+ * @fn	template <class Body> void parallelFor(int count, const Body &body, int numThreads)
+ * @brief	Calls body(i) for i in [0, count), spread over numThreads threads. Work items
+ * 			are handed out one at a time, so uneven items balance themselves. Returns when
+ * 			every item is done. Runs on the calling thread if numThreads <= 1, or if called
+ * 			while another parallelFor is running.
+ * @tparam	Body	Callable taking an int.
+ * @param	count	  	The number of work items.
+ * @param	body	  	The work to do for one item.
+ * @param	numThreads	The number of threads to use.
+ */
+
+template <class Body>
+void parallelFor(int count, const Body& body, int numThreads = defaultThreadCount()) {
+	parallelForImpl(count,
+		[](const void* context, int i) { (*static_cast<const Body*>(context))(i); },
+		&body, numThreads);
+}
+
 // 2D versions
 dmat3 T(double dx, double dy);
 dmat3 S(double sx, double sy);
@@ -20,12 +20,18 @@ struct VertexData {
 	dvec4 pos;			//!< Processed coordinate.
 	dvec3 normal;		//!< transformed normal vector.
 	dvec3 worldPos;		//!< Saved world position, for lighting calculations.
-	Material material;	//!< This vertex's material.
+	int materialID;		//!< This vertex's material, as a MaterialTable ID.
 	dvec2 textCoord;	//!< Texture coordinate.
 	double w;			//!< Perspective correct interpolation factor.
 
+	VertexData() : materialID(-1), w(1.0) { }
+
+	VertexData(const dvec4& pos, const dvec3& norm,
+		int materialID, const dvec3& worldPos, const dvec2& textCoord = dvec2(0.0, 0.0));
+
 	VertexData(const dvec4& pos, const dvec3& norm,
-		const Material& mat, const dvec3& worldPos, const dvec2& textCoord = dvec2(0.0, 0.0));
+		const Material& mat, const dvec3& worldPos, const dvec2& textCoord = dvec2(0.0, 0.0))
+		: VertexData(pos, norm, MaterialTable::getID(mat), worldPos, textCoord) { }
 
 	VertexData(const dvec4& pos)
 		: VertexData(pos, dvec4(0, 0, 1, 0), bronze, ORIGIN3D) { }
@@ -33,6 +39,8 @@ struct VertexData {
 	VertexData(const dvec4& pos, const dvec3& norm, const Material& mat, const dvec2& textCoord = dvec2(0.0, 0.0))
 		: VertexData(pos, norm, mat, ORIGIN3D, textCoord) {	}
 
+	const Material& getMaterial() const { return MaterialTable::getMaterial(materialID); }
+
 	static VertexData genInterpolatedVertex(const VertexData& vd1, const VertexData& vd2, const double t);
 
 	static void addTriVertsAndComputeNormal(vector<VertexData>& verts,
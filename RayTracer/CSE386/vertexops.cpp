@@ -11,6 +11,8 @@
 #include "vertexops.h"
 
 Render_Mode VertexOps::polygonRenderMode = FILL;
+bool VertexOps::cullingEnabled = true;
+CullingStats VertexOps::cullingStats;
 
  // Planes describing the normalized device coordinates view volume - 2x2x2 cube
 
@@ -22,93 +24,6 @@ vector<IPlane> VertexOps::allButNearNDCPlanes{ IPlane(dvec3(1, 0, 0), dvec3(-1,
 	//												IPlane(dvec3(0, 0, -1), dvec3(0, 0, 1))
 };
 
-/**
- * @fn	vector<VertexData> triangulate(const vector<VertexData> &poly)
- * @brief	Triangulates the given polygon
- * @param	poly	The polygon to be decomposed into individual triangles.
- * @return	A vector of triangles, which comprise the original polygon.
- */
-
-vector<VertexData> triangulate(const vector<VertexData>& poly) {
-	vector<VertexData> triangles;
-
-	for (unsigned int i = 1; i < poly.size() - 1; i++) {
-		triangles.push_back(poly[0]);
-		triangles.push_back(poly[i]);
-		triangles.push_back(poly[i + 1]);
-	}
-
-	return triangles;
-}
-
-/**
- * @fn	vector<VertexData> VertexOps::clipAgainstPlane(vector<VertexData> &verts, const IPlane &plane)
- * @brief	Clips a polygon against a single plane
- * @param [in,out]	verts	The array of vertices.
- * @param 		  	plane	The plane that will do the clipping.
- * @return	The polygon that exludes the portions outside the given plane.
- */
-
-vector<VertexData> VertexOps::clipAgainstPlane(vector<VertexData>& verts, const IPlane& plane) {
-	vector<VertexData> output;
-
-	if (verts.size() > 2) {
-		verts.push_back(verts[0]);
-
-		for (unsigned int i = 1; i < verts.size(); i++) {
-			bool v0In = plane.onFrontSide(verts[i - 1].pos.xyz());
-			bool v1In = plane.onFrontSide(verts[i].pos.xyz());
-
-			if (v0In && v1In) {
-				output.push_back(verts[i]);
-			} else if (v0In || v1In) {
-				double t;
-				plane.findIntersection(verts[i - 1].pos.xyz(), verts[i].pos.xyz(), t);
-				
-				output.push_back(VertexData::genInterpolatedVertex(verts[i - 1], verts[i], t));
-
-				if (!v0In && v1In) {
-					output.push_back(verts[i]);
-				}
-			}
-		}
-	}
-	return output;
-}
-
-/**
- * @fn	vector<VertexData> VertexOps::clipPolygon(const vector<VertexData> &clipCoords)
- * @brief	Clip polygon against the normalized view volumn - 2x2x2 cube.
- * @param	clipCoords	The array of triangles.
- * @param	planes		Planes to clip against
- * @return	The array of triangles, after performing clipping.
- */
-
-vector<VertexData> VertexOps::clipPolygon(const vector<VertexData>& clipCoords,
-	const vector<IPlane>& planes) {
-	vector<VertexData> ndcCoords;
-
-	if (clipCoords.size() > 2) {
-		for (unsigned int i = 0; i < clipCoords.size() - 2; i += 3) {
-			vector<VertexData> polygon;
-			polygon.push_back(clipCoords[i]);
-			polygon.push_back(clipCoords[i + 1]);
-			polygon.push_back(clipCoords[i + 2]);
-
-			for (const IPlane& plane : planes) {
-				polygon = clipAgainstPlane(polygon, plane);
-			}
-			if (polygon.size() > 3) {
-				polygon = triangulate(polygon);
-			}
-			for (const VertexData& v : polygon) {
-				ndcCoords.push_back(v);
-			}
-		}
-	}
-	return ndcCoords;
-}
-
 /**
  * @fn	vector<VertexData> VertexOps::clipLineSegments(const vector<VertexData> &clipCoords)
  * @brief	Clip line segments against normalized view volume.
@@ -156,39 +71,6 @@ vector<VertexData> VertexOps::clipLineSegments(const vector<VertexData>& clipCoo
 	return ndcCoords;
 }
 
-/**
-* @fn	vector<VertexData> VertexOps::processBackwardFacingTriangles(const vector<VertexData> &triangleVerts,
-*																	 bool renderBackfaces)
-* @brief	Removes the backward facing triangles
-* @param	triangleVerts	The vector of triangle vertices.
-* @return	Vector of triangle vertices, without those facing backward.
-*/
-
-vector<VertexData> VertexOps::processBackwardFacingTriangles(const vector<VertexData>& triangleVerts, bool renderBackfaces) {
-	vector<VertexData> triangles;
-
-	for (int i = 0; i < (int)triangleVerts.size() - 2; i += 3) {
-		dvec3 n = normalFrom3Points(triangleVerts[i].pos.xyz(),
-			triangleVerts[i + 1].pos.xyz(),
-			triangleVerts[i + 2].pos.xyz());
-		if (n.z >= 0.0) {
-			triangles.push_back(triangleVerts[i]);
-			triangles.push_back(triangleVerts[i + 1]);
-			triangles.push_back(triangleVerts[i + 2]);
-		} else if (renderBackfaces) {
-			triangles.push_back(triangleVerts[i]);
-			triangles.back().normal *= -1;
-
-			triangles.push_back(triangleVerts[i + 1]);
-			triangles.back().normal *= -1;
-
-			triangles.push_back(triangleVerts[i + 2]);
-			triangles.back().normal *= -1;
-		}
-	}
-	return triangles;
-}
-
 /**
  * @fn	vector<VertexData> VertexOps::transformVerticesToWorldCoordinates(const dmat4 &modelMatrix,
  *																			const vector<VertexData> &vertices)
@@ -208,10 +90,9 @@ vector<VertexData> VertexOps::transformVerticesToWorldCoordinates(const dmat4& m
 	vector<VertexData> transformedVertices;
 	for (unsigned int i = 0; i < vertices.size(); i++) {
 		const VertexData& v = vertices[i];
-		dvec3 X = G * v.normal;
 		dvec3 n = glm::normalize(G * v.normal);
 		dvec4 worldPos = modelMatrix * v.pos;
-		VertexData vt(worldPos, n, v.material, worldPos.xyz());
+		VertexData vt(worldPos, n, v.materialID, worldPos.xyz(), v.textCoord);
 		transformedVertices.push_back(vt);
 	}
 	return transformedVertices;
@@ -230,77 +111,312 @@ vector<VertexData> VertexOps::transformVertices(const dmat4& TM, const vector<Ve
 	vector<VertexData> transformedVertices;
 
 	for (const VertexData& v : vertices) {
-		VertexData vt(TM * v.pos, v.normal, v.material);
 		// Save the world position separately for use in per pixel lighting calculations
-		vt.worldPos = v.worldPos;
+		VertexData vt(TM * v.pos, v.normal, v.materialID, v.worldPos, v.textCoord);
 
 		transformedVertices.push_back(vt);
 	}
 	return transformedVertices;
 }
 
-double computeNearPlane(const dmat4& PM) {
-	double alpha = PM[2][2];
-	double beta = PM[3][2];
-	double gamma = PM[2][3];
-	double omega = PM[3][3];
-	double nearf = -(omega + beta) / (alpha + gamma);
-	return nearf;
+/**
+ * @brief	The planes bounding the view volume, in clip coordinates. A point (x, y, z, w)
+ * 			is on the inside of plane i iff dot(CLIP_PLANES[i], (x, y, z, w)) >= 0.
+ * 			The side planes are pushed out to a guard band: the rasterizer limits itself to
+ * 			the window anyway, so they only need to keep coordinates in range. This saves
+ * 			clipping most triangles that straddle the window edge, and keeps clipped edges
+ * 			from landing exactly on the first row and column of pixels.
+ */
+
+const double GUARD_BAND = 2.0;
+static const dvec4 CLIP_PLANES[] = {
+	dvec4(0, 0, 1, 1),				// near:	z >= -w
+	dvec4(1, 0, 0, GUARD_BAND),		// left:	x >= -GUARD_BAND * w
+	dvec4(-1, 0, 0, GUARD_BAND),	// right:	x <= GUARD_BAND * w
+	dvec4(0, 1, 0, GUARD_BAND),		// bottom:	y >= -GUARD_BAND * w
+	dvec4(0, -1, 0, GUARD_BAND),	// top:		y <= GUARD_BAND * w
+	dvec4(0, 0, -1, 1),				// far:		z <= w
+};
+const int NUM_CLIP_PLANES = 6;
+
+/**
+ * @brief	The planes of the view volume itself, in clip coordinates, in the same form
+ * 			as CLIP_PLANES. Used to cull whole objects.
+ */
+
+static const dvec4 FRUSTUM_PLANES[] = {
+	dvec4(0, 0, 1, 1),
+	dvec4(1, 0, 0, 1),
+	dvec4(-1, 0, 0, 1),
+	dvec4(0, 1, 0, 1),
+	dvec4(0, -1, 0, 1),
+	dvec4(0, 0, -1, 1),
+};
+const int MAX_CLIPPED_VERTICES = 3 + NUM_CLIP_PLANES;	//!< Each plane adds at most one vertex.
+
+/**
+ * @fn	static inline int outcode(const dvec4 &clipPos)
+ * @brief	Computes which clip planes a point is outside of.
+ * @param	clipPos	The point, in clip coordinates.
+ * @return	Bit i is set iff the point is outside of CLIP_PLANES[i].
+ */
+
+static inline int outcode(const dvec4& clipPos) {
+	int code = 0;
+	for (int i = 0; i < NUM_CLIP_PLANES; i++) {
+		if (glm::dot(CLIP_PLANES[i], clipPos) < 0.0) {
+			code |= 1 << i;
+		}
+	}
+	return code;
 }
 
 /**
- * @fn	void VertexOps::processTriangleVertices(FrameBuffer &frameBuffer, const dvec3 &eyePos,
- *												const vector<LightSourcePtr> &lights,
- *												const vector<VertexData> &objectCoords)
- * @brief	Transforms the triangle vertices through pipeline:
- *					object -> world -> eye -> clip/ndc -> window.
- * @param [in,out]	frameBuffer 	Buffer for frame data.
- * @param 		  	eyePos			The eye position.
- * @param 		  	lights			The lights.
- * @param 		  	objectCoords	The object coordinates.
+ * @fn	static int clipAgainstPlane(const VertexData *in, int n, VertexData *out,
+ *									const dvec4 &plane)
+ * @brief	Clips a convex polygon against a single plane, in clip coordinates. Attributes
+ * 			are interpolated linearly in clip space, which is perspective correct.
+ * @param 		  	in   	The vertices of the polygon.
+ * @param 		  	n	 	The number of vertices.
+ * @param [out]	  	out  	Receives the clipped polygon. Room for n + 1 vertices.
+ * @param 		  	plane	The plane that will do the clipping.
+ * @return	The number of vertices in the clipped polygon.
  */
 
-void VertexOps::processTriangleVertices(FrameBuffer& frameBuffer, const dvec3& eyePos,
-	const vector<LightSourcePtr>& lights,
-	const vector<VertexData>& objectCoords,
+static int clipAgainstPlane(const VertexData* in, int n, VertexData* out, const dvec4& plane) {
+	int m = 0;
+	for (int i = 0; i < n; i++) {
+		const VertexData& a = in[i];
+		const VertexData& b = in[(i + 1) % n];
+		double da = glm::dot(plane, a.pos);
+		double db = glm::dot(plane, b.pos);
+		if (da >= 0.0) {
+			out[m++] = a;
+		}
+		if ((da >= 0.0) != (db >= 0.0)) {
+			double t = da / (da - db);
+			VertexData& v = out[m++];
+			v.pos = a.pos + t * (b.pos - a.pos);
+			v.normal = glm::normalize(a.normal + t * (b.normal - a.normal));
+			v.worldPos = a.worldPos + t * (b.worldPos - a.worldPos);
+			v.textCoord = a.textCoord + t * (b.textCoord - a.textCoord);
+			v.materialID = a.materialID;
+			v.w = v.pos.w;
+		}
+	}
+	return m;
+}
+
+/**
+ * @fn	void VertexOps::transformVerticesToClipCoordinates(const vector<VertexData> &objectCoords,
+ *												int first, int last,
+ *												const dmat4 &modelingMatrix,
+ *												const PipelineMatrices &pipeMats,
+ *												VertexData *clipCoords, int *outcodes)
+ * @brief	Fills the post-transform vertex cache: transforms the vertices in [first, last)
+ * 			to clip coordinates, keeping their world positions and normals for lighting,
+ * 			and computes their outcodes. Each unique vertex of a mesh is transformed once
+ * 			per draw, no matter how many triangles share it.
+ * @param 		  	objectCoords	The vertices, in object coordinates.
+ * @param 		  	first			Index of the first vertex to process.
+ * @param 		  	last			One past the index of the last vertex to process.
+ * @param 		  	modelingMatrix	The transformation applied to the object
+ * @param 		  	pipeMats    	The pipeline matrices
+ * @param [out]	  	clipCoords		Receives the transformed vertices, at the same indices.
+ * @param [out]	  	outcodes		Receives the outcodes, at the same indices.
+ */
+
+void VertexOps::transformVerticesToClipCoordinates(
+	const vector<VertexData>& objectCoords, int first, int last,
 	const dmat4& modelingMatrix,
 	const PipelineMatrices& pipeMats,
-	bool renderBackfaces) {
-	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
-	const dmat4& projectionMatrix = pipeMats.projectionMatrix;
+	VertexData* clipCoords, int* outcodes) {
+	const dmat4 worldToClip = pipeMats.projectionMatrix * pipeMats.viewingMatrix;
+
+	// 3 x 3 matrix for transforming normal vectors to world coordinates
+	const dmat3 G = glm::transpose(glm::inverse(dmat3(modelingMatrix)));
+
+	for (int i = first; i < last; i++) {
+		const VertexData& v = objectCoords[i];
+		VertexData& c = clipCoords[i];
+		dvec4 worldPos = modelingMatrix * v.pos;
+		c.pos = worldToClip * worldPos;
+		c.normal = glm::normalize(G * v.normal);
+		c.worldPos = worldPos.xyz();
+		c.textCoord = v.textCoord;
+		c.materialID = v.materialID;
+		c.w = c.pos.w;	// Save w for perspective correct interpolation
+		outcodes[i] = outcode(c.pos);
+	}
+}
+
+/**
+ * @fn	void VertexOps::transformTrianglesToWindowCoordinates(const VertexData *clipCoords,
+ *												const int *outcodes,
+ *												const vector<unsigned int> &indices,
+ *												int first, int last,
+ *												const PipelineMatrices &pipeMats,
+ *												bool renderBackfaces,
+ *												vector<VertexData> &windowCoords)
+ * @brief	Assembles triangles from the post-transform vertex cache and takes them the rest
+ *			of the way through the pipeline: clip -> ndc -> window. Each triangle is clipped
+ *			in clip coordinates using stack arrays, and backfaces are handled after the
+ *			perspective division. Nothing is allocated except for growth of windowCoords.
+ *			Triangles are handled independently, so any range may be processed separately.
+ * @param 		  	clipCoords		The transformed vertices.
+ * @param 		  	outcodes		The outcodes of the transformed vertices.
+ * @param 		  	indices			Each successive triplet is a triangle.
+ * @param 		  	first			Index of the first triangle to process.
+ * @param 		  	last			One past the index of the last triangle to process.
+ * @param 		  	pipeMats    	The pipeline matrices
+ * @param 		  	renderBackfaces	True if backfaces are to be rendered
+ * @param [in,out]	windowCoords	The visible triangles are appended here, in window coordinates.
+ */
+
+void VertexOps::transformTrianglesToWindowCoordinates(
+	const VertexData* clipCoords, const int* outcodes,
+	const vector<unsigned int>& indices, int first, int last,
+	const PipelineMatrices& pipeMats,
+	bool renderBackfaces,
+	vector<VertexData>& windowCoords) {
 	const dmat4& viewportMatrix = pipeMats.viewportMatrix;
 
-	vector<VertexData> worldCoords = transformVerticesToWorldCoordinates(modelingMatrix, objectCoords);
-	vector<VertexData> eyeCoords = transformVertices(viewingMatrix, worldCoords);
+	VertexData polygonA[MAX_CLIPPED_VERTICES];
+	VertexData polygonB[MAX_CLIPPED_VERTICES];
 
-	double nearZ = computeNearPlane(projectionMatrix);
-	vector <IPlane> nearPlane = { IPlane(dvec4(0.0, 0.0, nearZ, 1.0), -Z_AXIS) };
-	vector<VertexData> eyeCoordsClippedOnNearPlane = clipPolygon(eyeCoords, nearPlane);
+	for (int tri = first; tri < last; tri++) {
+		const unsigned int* idx = &indices[3 * tri];
+		int outsideAll = outcodes[idx[0]] & outcodes[idx[1]] & outcodes[idx[2]];
+		int outsideAny = outcodes[idx[0]] | outcodes[idx[1]] | outcodes[idx[2]];
+		if (outsideAll != 0) {		// Entirely outside one of the planes
+			continue;
+		}
+		for (int i = 0; i < 3; i++) {
+			polygonA[i] = clipCoords[idx[i]];
+		}
 
-	vector<VertexData> projCoords = transformVertices(projectionMatrix, eyeCoordsClippedOnNearPlane);
-	vector<VertexData> clipCoords;
+		VertexData* polygon = polygonA;
+		int n = 3;
+		if (outsideAny != 0) {
+			VertexData* clipped = polygonB;
+			for (int p = 0; p < NUM_CLIP_PLANES && n >= 3; p++) {
+				if (outsideAny & (1 << p)) {
+					n = clipAgainstPlane(polygon, n, clipped, CLIP_PLANES[p]);
+					std::swap(polygon, clipped);
+				}
+			}
+			if (n < 3) {
+				continue;
+			}
+		}
+
+		// Perspective division. The near plane guarantees w > 0.
+		for (int i = 0; i < n; i++) {
+			polygon[i].pos /= polygon[i].pos.w;
+		}
 
-	for (VertexData v : projCoords) {		// Perspective division
+		// Backfaces are those wound clockwise on the screen.
+		double twiceArea = 0.0;
+		for (int i = 0; i < n; i++) {
+			const dvec4& a = polygon[i].pos;
+			const dvec4& b = polygon[(i + 1) % n].pos;
+			twiceArea += a.x * b.y - b.x * a.y;
+		}
+		if (!(twiceArea > 0.0)) {
+			if (!renderBackfaces) {
+				continue;
+			}
+			for (int i = 0; i < n; i++) {
+				polygon[i].normal = -polygon[i].normal;
+			}
+		}
 
-		v.w = v.pos.w; // Save w for perspective correct interpolation during clipping process
+		for (int i = 0; i < n; i++) {
+			polygon[i].pos = viewportMatrix * polygon[i].pos;
+		}
 
-		if (v.pos.w >= 0) {
-			v.pos /= v.pos.w;
-		} else {							// should not happen
-			v.pos.x /= -v.pos.w;
-			v.pos.y /= -v.pos.w;
-			v.pos.z = -std::abs(v.pos.z / -v.pos.w);
-			v.pos.w = 1.0;
+		// Triangulate as a fan
+		for (int i = 1; i + 1 < n; i++) {
+			windowCoords.push_back(polygon[0]);
+			windowCoords.push_back(polygon[i]);
+			windowCoords.push_back(polygon[i + 1]);
 		}
-		clipCoords.push_back(v);
 	}
+}
 
-	clipCoords = processBackwardFacingTriangles(clipCoords, renderBackfaces);
+/**
+ * @fn	void VertexOps::processTriangleVertices(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+ *												const vector<LightSourcePtr> &lights,
+ *												const EShapeData &shape)
+ * @brief	Transforms the triangles of an indexed mesh through pipeline and draws them.
+ * 			The unique vertices are transformed first, into a post-transform vertex cache
+ * 			that the triangles then index into. Large meshes are split into chunks that
+ * 			are processed in parallel; the triangle chunks are joined back together in
+ * 			their original order. The buffers are reused from call to call, so no
+ * 			allocation happens once they have grown large enough.
+ * @param [in,out]	frameBuffer 	Buffer for frame data.
+ * @param 		  	eyePos			The eye position.
+ * @param 		  	lights			The lights.
+ * @param 		  	shape			The mesh, in object coordinates.
+ */
 
-	vector<VertexData> ndcCoords = clipPolygon(clipCoords, allButNearNDCPlanes);
-	vector<VertexData> windowCoords = transformVertices(viewportMatrix, ndcCoords);
+void VertexOps::processTriangleVertices(FrameBuffer& frameBuffer, const dvec3& eyePos,
+	const vector<LightSourcePtr>& lights,
+	const EShapeData& shape,
+	const dmat4& modelingMatrix,
+	const PipelineMatrices& pipeMats,
+	bool renderBackfaces) {
+	static thread_local vector<VertexData> clipCoordStorage;
+	static thread_local vector<int> outcodeStorage;
+	static thread_local vector<VertexData> windowCoordStorage;
+	static thread_local vector<vector<VertexData>> chunkStorage;
+	vector<VertexData>& clipCoords = clipCoordStorage;		// The workers must see this thread's buffers
+	vector<int>& outcodes = outcodeStorage;
+	vector<VertexData>& windowCoords = windowCoordStorage;
+	vector<vector<VertexData>>& chunkCoords = chunkStorage;
+
+	const int MIN_VERTICES_PER_CHUNK = 512;
+	const int MIN_TRIANGLES_PER_CHUNK = 256;
+	const int numVertices = (int)shape.vertices.size();
+	const int numTriangles = shape.numTriangles();
+
+	if ((int)clipCoords.size() < numVertices) {
+		clipCoords.resize(numVertices);
+		outcodes.resize(numVertices);
+	}
+	int numChunks = std::min(rasterThreadCount, numVertices / MIN_VERTICES_PER_CHUNK);
+	if (numChunks <= 1) {
+		transformVerticesToClipCoordinates(shape.vertices, 0, numVertices, modelingMatrix,
+											pipeMats, clipCoords.data(), outcodes.data());
+	} else {
+		parallelFor(numChunks, [&](int c) {
+			transformVerticesToClipCoordinates(shape.vertices,
+				numVertices * c / numChunks, numVertices * (c + 1) / numChunks,
+				modelingMatrix, pipeMats, clipCoords.data(), outcodes.data());
+		}, numChunks);
+	}
 
-	Frame eyeFrame = Frame::createOrthoNormalBasis(viewingMatrix);
+	windowCoords.clear();
+	numChunks = std::min(rasterThreadCount, numTriangles / MIN_TRIANGLES_PER_CHUNK);
+	if (numChunks <= 1) {
+		transformTrianglesToWindowCoordinates(clipCoords.data(), outcodes.data(), shape.indices,
+												0, numTriangles, pipeMats, renderBackfaces, windowCoords);
+	} else {
+		if ((int)chunkCoords.size() < numChunks) {
+			chunkCoords.resize(numChunks);
+		}
+		parallelFor(numChunks, [&](int c) {
+			chunkCoords[c].clear();
+			transformTrianglesToWindowCoordinates(clipCoords.data(), outcodes.data(), shape.indices,
+				numTriangles * c / numChunks, numTriangles * (c + 1) / numChunks,
+				pipeMats, renderBackfaces, chunkCoords[c]);
+		}, numChunks);
+		for (int c = 0; c < numChunks; c++) {
+			windowCoords.insert(windowCoords.end(), chunkCoords[c].begin(), chunkCoords[c].end());
+		}
+	}
+
+	Frame eyeFrame = Frame::createOrthoNormalBasis(pipeMats.viewingMatrix);
 
 	// Determine the rendering mode for the trangle
 	if (VertexOps::polygonRenderMode == FILL) {
@@ -355,29 +471,160 @@ void VertexOps::processLineSegments(FrameBuffer& frameBuffer, const dvec3& eyePo
 }
 
 /**
- * @fn	void VertexOps::render(FrameBuffer &frameBuffer, const vector<VertexData> &verts,
+ * @fn	void VertexOps::render(FrameBuffer &frameBuffer, const EShapeData &shape,
  *								const vector<LightSourcePtr> &lights, const dmat4 &TM)
  * @brief	Renders this object
  * @param [in,out]	frameBuffer	Buffer for frame data.
- * @param 		  	verts	   	The vertices.
+ * @param 		  	shape	   	The indexed mesh.
  * @param 		  	lights	   	The lights.
  * @param           modelingMatrix  The transformation applied to the object
  * @param 		  	pipeMats    The pipeline matrices
  * @param           renderBackfaces True if backfaces are to be rendered
  */
 
-void VertexOps::render(FrameBuffer& frameBuffer, const vector<VertexData>& verts,
+void VertexOps::render(FrameBuffer& frameBuffer, const EShapeData& shape,
 	const vector<LightSourcePtr>& lights,
 	const dmat4& modelingMatrix,
 	const PipelineMatrices& pipeMats,
 	bool renderBackfaces) {
 	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
 
+	cullingStats.submitted++;
+	if (cullingEnabled && isOutsideViewVolume(shape, modelingMatrix, pipeMats)) {
+		cullingStats.culled++;
+		return;
+	}
+	if (hierarchicalDepthTestEnabled && FragmentOps::performDepthTest &&
+		isOccluded(frameBuffer, shape, modelingMatrix, pipeMats)) {
+		cullingStats.occluded++;
+		return;
+	}
+
 	dvec3 eyePos = glm::inverse(viewingMatrix)[3].xyz();
-	VertexOps::processTriangleVertices(frameBuffer, eyePos, lights, verts,
+	VertexOps::processTriangleVertices(frameBuffer, eyePos, lights, shape,
 		modelingMatrix, pipeMats, renderBackfaces);
 }
 
+/**
+ * @fn	bool VertexOps::isOutsideViewVolume(const EShapeData &shape,
+ *											const dmat4 &modelingMatrix,
+ *											const PipelineMatrices &pipeMats)
+ * @brief	Conservatively tests whether a whole object is invisible. The shape's bounding
+ * 			sphere is moved into world coordinates and tested against the six planes of
+ * 			the view volume, also expressed in world coordinates. Costs a few dozen
+ * 			multiplies, no matter how many vertices the shape has.
+ * @param	shape		  	The shape. Never culled if its bounding sphere was not computed.
+ * @param	modelingMatrix	The transformation applied to the object.
+ * @param	pipeMats	  	The pipeline matrices.
+ * @return	True iff the bounding sphere lies entirely outside one of the planes.
+ */
+
+bool VertexOps::isOutsideViewVolume(const EShapeData& shape,
+	const dmat4& modelingMatrix,
+	const PipelineMatrices& pipeMats) {
+	if (shape.boundingRadius < 0.0) {
+		return false;
+	}
+	dvec3 center = (modelingMatrix * dvec4(shape.boundingCenter, 1.0)).xyz();
+
+	// Non-uniform scales stretch the sphere by at most the longest axis.
+	double scale = std::max(glm::length(dvec3(modelingMatrix[0])),
+						std::max(glm::length(dvec3(modelingMatrix[1])),
+								glm::length(dvec3(modelingMatrix[2]))));
+	double radius = shape.boundingRadius * scale;
+
+	// A plane p in clip coordinates is transpose(worldToClip) * p in world coordinates.
+	const dmat4 clipToWorldPlanes = glm::transpose(pipeMats.projectionMatrix * pipeMats.viewingMatrix);
+	for (const dvec4& clipPlane : FRUSTUM_PLANES) {
+		dvec4 plane = clipToWorldPlanes * clipPlane;
+		double length = glm::length(dvec3(plane));
+		if (glm::dot(dvec3(plane), center) + plane.w < -radius * length) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	bool VertexOps::isOccluded(FrameBuffer &frameBuffer, const EShapeData &shape,
+ *									const dmat4 &modelingMatrix,
+ *									const PipelineMatrices &pipeMats)
+ * @brief	Conservatively tests whether a whole object is hidden behind what has already
+ * 			been drawn. The cube enclosing the shape's bounding sphere is projected to the
+ * 			window, and its screen rectangle and nearest depth are tested against the
+ * 			depth pyramid.
+ * @param [in,out]	frameBuffer   	The frame buffer.
+ * @param 		  	shape		  	The shape. Never occluded if its bounding sphere was not computed.
+ * @param 		  	modelingMatrix	The transformation applied to the object.
+ * @param 		  	pipeMats	  	The pipeline matrices.
+ * @return	True iff every fragment of the object would fail the depth test.
+ */
+
+bool VertexOps::isOccluded(FrameBuffer& frameBuffer, const EShapeData& shape,
+	const dmat4& modelingMatrix,
+	const PipelineMatrices& pipeMats) {
+	if (shape.boundingRadius < 0.0) {
+		return false;
+	}
+	dvec3 center = (modelingMatrix * dvec4(shape.boundingCenter, 1.0)).xyz();
+	double scale = std::max(glm::length(dvec3(modelingMatrix[0])),
+						std::max(glm::length(dvec3(modelingMatrix[1])),
+								glm::length(dvec3(modelingMatrix[2]))));
+	double radius = shape.boundingRadius * scale;
+
+	const dmat4 worldToClip = pipeMats.projectionMatrix * pipeMats.viewingMatrix;
+	dvec3 lo(std::numeric_limits<double>::max());
+	dvec3 hi(-std::numeric_limits<double>::max());
+	for (int i = 0; i < 8; i++) {
+		dvec3 corner = center + radius * dvec3(i & 1 ? 1 : -1, i & 2 ? 1 : -1, i & 4 ? 1 : -1);
+		dvec4 clip = worldToClip * dvec4(corner, 1.0);
+		if (glm::dot(CLIP_PLANES[0], clip) <= 0.0) {	// Crosses the near plane
+			return false;
+		}
+		dvec3 window = (pipeMats.viewportMatrix * (clip / clip.w)).xyz();
+		lo = glm::min(lo, window);
+		hi = glm::max(hi, window);
+	}
+	int left = (int)glm::floor(lo.x);
+	int bottom = (int)glm::floor(lo.y);
+	BoundingBoxi region(left, (int)glm::ceil(hi.x) - left + 1, bottom, (int)glm::ceil(hi.y) - bottom + 1);
+	return frameBuffer.isOccluded(region, lo.z);
+}
+
+/**
+ * @fn	void VertexOps::resolveDeferred(FrameBuffer &frameBuffer,
+ *										const vector<LightSourcePtr> &lights,
+ *										const PipelineMatrices &pipeMats)
+ * @brief	Completes a frame rendered with deferred shading. The G-buffer is lit, then the
+ * 			triangles that were set aside are drawn with forward shading: first the opaque
+ * 			ones, then the translucent ones, so they blend over the finished opaque surfaces.
+ * 			Does nothing if deferred shading is not enabled.
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @param 		  	lights	   	The lights.
+ * @param 		  	pipeMats    The pipeline matrices
+ */
+
+void VertexOps::resolveDeferred(FrameBuffer& frameBuffer,
+	const vector<LightSourcePtr>& lights,
+	const PipelineMatrices& pipeMats) {
+	if (!FragmentOps::deferredShadingEnabled) {
+		return;
+	}
+	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
+	dvec3 eyePos = glm::inverse(viewingMatrix)[3].xyz();
+	Frame eyeFrame = Frame::createOrthoNormalBasis(viewingMatrix);
+
+	FragmentOps::shadeGBuffer(frameBuffer, eyePos, lights, eyeFrame);
+
+	GBuffer& gBuffer = FragmentOps::gBuffer;
+	FragmentOps::deferredShadingEnabled = false;
+	drawManyFilledTriangles(frameBuffer, eyePos, lights, gBuffer.forwardVerts, eyeFrame);
+	drawManyFilledTriangles(frameBuffer, eyePos, lights, gBuffer.translucentVerts, eyeFrame);
+	FragmentOps::deferredShadingEnabled = true;
+	gBuffer.forwardVerts.clear();
+	gBuffer.translucentVerts.clear();
+}
+
 /**
  * @fn	void VertexOps::getViewportTransformation()
  * @brief	Sets viewport transformation based on the current viewport settings.
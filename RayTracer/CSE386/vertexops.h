@@ -13,6 +13,7 @@
 #include "framebuffer.h"
 #include "light.h"
 #include "vertexdata.h"
+#include "eshape.h"
 #include "iscene.h"
 #include "rasterization.h"
 
@@ -27,6 +28,18 @@ struct PipelineMatrices {
 	dmat4 viewportMatrix;
 };
 
+/**
+ * @struct	CullingStats
+ * @brief	Counts of the draws submitted to VertexOps::render, and of those rejected by
+ * 			the bounding sphere test before any vertex was transformed.
+ */
+
+struct CullingStats {
+	int submitted = 0;	//!< Number of calls to render
+	int culled = 0;		//!< Number of those that were entirely outside the view volume
+	int occluded = 0;	//!< Number of those hidden behind what was already drawn
+};
+
 /**
  * @enum	Render_Mode
  *
@@ -46,7 +59,7 @@ public:
 
 	static void processTriangleVertices(FrameBuffer& frameBuffer, const dvec3& eyePos,
 		const vector<LightSourcePtr>& lights,
-		const vector<VertexData>& objectCoords,
+		const EShapeData& shape,
 		const dmat4& modelingMatrix,
 		const PipelineMatrices& pipeMats,
 		bool renderBackfaces);
@@ -55,25 +68,43 @@ public:
 		const vector<VertexData>& objectCoords,
 		const dmat4& modelingMatrix,
 		const PipelineMatrices& pipeMats);
-	static void render(FrameBuffer& frameBuffer, const vector<VertexData>& verts,
+	static void render(FrameBuffer& frameBuffer, const EShapeData& shape,
 		const vector<LightSourcePtr>& lights,
 		const dmat4& modelingMatrix,
 		const PipelineMatrices& pipeMats,
 		bool renderBackfaces
 	);
+	static void resolveDeferred(FrameBuffer& frameBuffer,
+		const vector<LightSourcePtr>& lights,
+		const PipelineMatrices& pipeMats);
 	static dmat4 getViewportTransformation(int left, int width, int bottom, int height);
 
+	static bool isOutsideViewVolume(const EShapeData& shape,
+		const dmat4& modelingMatrix,
+		const PipelineMatrices& pipeMats);
+	static bool isOccluded(FrameBuffer& frameBuffer, const EShapeData& shape,
+		const dmat4& modelingMatrix,
+		const PipelineMatrices& pipeMats);
+
 	static Render_Mode polygonRenderMode;
+	static bool cullingEnabled;			//!< True ==> skip draws whose bounding sphere is not visible.
+	static CullingStats cullingStats;	//!< Accumulates until reset by the application.
 
 protected:
-	static vector<VertexData> clipAgainstPlane(vector<VertexData>& verts, const IPlane& plane);
-	static vector<VertexData> clipPolygon(const vector<VertexData>& clipCoords,
-		const vector<IPlane>& planes);
 	static vector<VertexData> clipLineSegments(const vector<VertexData>& clipCoords,
 		const vector<IPlane>& planes);
-	static vector<VertexData> processBackwardFacingTriangles(const vector<VertexData>& triangleVerts,
-		bool renderBackfaces);
 	static vector<VertexData> transformVerticesToWorldCoordinates(const dmat4& modelMatrix,
 		const vector<VertexData>& vertices);
 	static vector<VertexData> transformVertices(const dmat4& TM, const vector<VertexData>& vertices);
+	static void transformVerticesToClipCoordinates(const vector<VertexData>& objectCoords,
+		int first, int last,
+		const dmat4& modelingMatrix,
+		const PipelineMatrices& pipeMats,
+		VertexData* clipCoords, int* outcodes);
+	static void transformTrianglesToWindowCoordinates(const VertexData* clipCoords,
+		const int* outcodes,
+		const vector<unsigned int>& indices, int first, int last,
+		const PipelineMatrices& pipeMats,
+		bool renderBackfaces,
+		vector<VertexData>& windowCoords);
 };
@@ -13,21 +13,21 @@
 
  /**
   * @fn	VertexData::VertexData(const dvec4 &P, const dvec4 &norm,
-								 const Material &mat, const dvec3 &WP)
+								 int materialID, const dvec3 &WP)
   * @brief	Constructor
   * @param	P			Current coordinate.
   * @param	norm		Normal vector
-  * @param	mat			Material
+  * @param	materialID	MaterialTable ID of the material
   * @param	WP			World position.
   * @param	textCoord	Texture coordinate		
   */
 
 VertexData::VertexData(const dvec4& P,
 	const dvec3& norm,
-	const Material& mat,
+	int materialID,
 	const dvec3& WP,
 	const dvec2& textCoord)
-	: pos(P), normal(glm::normalize(norm)), material(mat), worldPos(WP), textCoord(textCoord), w(1.0)
+	: pos(P), normal(glm::normalize(norm)), worldPos(WP), materialID(materialID), textCoord(textCoord), w(1.0)
 {
 }
 
@@ -64,6 +64,9 @@ VertexData VertexData::genInterpolatedVertex(const VertexData& vd1, const Vertex
 	// Normalize the weighted sum
 	I = (1.0 / denom) * I;
 
+	// The position itself is interpolated linearly
+	I.pos = ndcPos;
+
 	// Update the new VertexData's w to the perspective-correct value
 	I.w = 1.0 / denom;
 
@@ -103,34 +106,34 @@ void VertexData::addTriVertsAndComputeNormal(vector<VertexData>& verts,
 {
 	dvec3 n = normalFrom3Points(V1.xyz(), V2.xyz(), V3.xyz());
 	dvec4 nHomogenous(n.x, n.y, n.z, 0);
-	verts.push_back(VertexData(V1, nHomogenous, mat, t1));
-	verts.push_back(VertexData(V2, nHomogenous, mat, t2));
-	verts.push_back(VertexData(V3, nHomogenous, mat, t3));
+	int materialID = MaterialTable::getID(mat);
+	verts.push_back(VertexData(V1, nHomogenous, materialID, ORIGIN3D, t1));
+	verts.push_back(VertexData(V2, nHomogenous, materialID, ORIGIN3D, t2));
+	verts.push_back(VertexData(V3, nHomogenous, materialID, ORIGIN3D, t3));
 }
 
 /**
  * @fn	VertexData operator* (double scalar, const VertexData &data)
- * @brief	Multiplication operator for VertexData objects
+ * @brief	Multiplication operator for VertexData objects. The material is not scaled.
  *  * @param	scalar   	The scalar multiplier.
  * @param	data	Vertex data to scale.
  * @return	The scaled Vertex data.
  */
 VertexData operator * (double scalar, const VertexData& data) {
-	VertexData result(scalar * data.pos, scalar * data.normal, scalar * data.material, scalar * data.worldPos, scalar * data.textCoord);
+	VertexData result(scalar * data.pos, scalar * data.normal, data.materialID, scalar * data.worldPos, scalar * data.textCoord);
 	return result;
 }
 
 
 /**
  * @fn	VertexData VertexData::operator+ (const VertexData &other) const
- * @brief	Addition operator for VertexData objects
+ * @brief	Addition operator for VertexData objects. Keeps the material of this object.
  * @param	other	The 2nd VertexData object.
  * @return	The raw summation of the two VertexData objects
  */
 
 VertexData VertexData::operator + (const VertexData& other) const {
 	VertexData result(*this);
-	result.material += other.material;
 	result.normal += other.normal;
 	result.pos += other.pos;
 	result.worldPos += other.worldPos;